@@ -0,0 +1,173 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+#include "Reachability.h"
+
+/*
+ * What an RTM tx does when it aborts. XBEGIN returns ~0 when the tx starts and the
+ * abort status otherwise, so the code after it branches on the status; the status is
+ * followed out of begin wrappers through their return values to the first equality
+ * compare with ~0 that a branch tests. From the abort side of that branch:
+ * - if XBEGIN (or the call leading to it) can be reached again, the tx is retried;
+ *   one retry costs the abort itself (-primebort-abort-lat) and the path back, and
+ *   the innermost loop holding both bounds the retries by its trip count. A loop
+ *   without a bound is flagged: under attack, or on a capacity abort that keeps
+ *   happening, it spins, possibly forever if it doesn't check the status either.
+ * - if the entry of a lock tx in the same function can be reached, that lock is the
+ *   fallback, costed as the path to it (without going round the retry loop) plus
+ *   the lock tx's own longest txLat.
+ * - otherwise the tx gives up (returns the failure, asserts, ...).
+ * The worst case of a retry storm is every attempt running the whole tx and aborting
+ * at its end: retries * (txLat + retry latency), then the fallback.
+ */
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+static cl::opt<bool> AbortReport("primebort-abort-report",
+		cl::desc("Print the retry and fallback paths taken after RTM aborts"),
+		cl::init(false));
+
+// abort and rollback, until the handler runs
+static cl::opt<unsigned> AbortLat("primebort-abort-lat",
+		cl::desc("Cycles an RTM abort takes before the abort handler runs"),
+		cl::init(150));
+
+namespace {
+
+// whether V is computed from the status within a few steps
+bool dependsOn(const Value* V, const Value* status, const unsigned depth) {
+	if (V == status) return true;
+	const Instruction* I = dyn_cast<Instruction>(V);
+	if (!I || depth == 0 || isa<PHINode>(I) || isa<CallBase>(I)) return false;
+	return any_of(I->operands(),
+			[&](const Use& U) {return dependsOn(U, status, depth - 1);});
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+void PrimeBortDetectorPass::analyzeAbort(TxInfo& info) {
+	info.abort = AbortInfo();
+	if (!isRTMTx(info)) return;
+
+	// the status, out of wrappers, to the branch on it
+	const SmallVectorImpl<Instruction*>& chain = info.entryChain;
+	Instruction* retryAt = chain.back();
+	BasicBlock* abortBB = NULL;
+	for (unsigned i = chain.size()-1; !abortBB; ) {
+		Instruction* next = NULL;
+		for (User* U : retryAt->users()) {
+			ICmpInst::Predicate P;
+			if (!match(U, m_ICmp(P, m_Specific(retryAt), m_AllOnes())) ||
+					!ICmpInst::isEquality(P)) {
+				if (isa<ReturnInst>(U) && i > 0) next = chain[i-1];
+				continue;
+			}
+			for (User* CU : U->users()) {
+				BranchInst* BI = dyn_cast<BranchInst>(CU);
+				if (!BI || !BI->isConditional()) continue;
+				info.abort.check = BI;
+				abortBB = BI->getSuccessor((P == ICmpInst::ICMP_EQ) ? 1 : 0);
+				break;
+			}
+			if (abortBB) break;
+		}
+		if (abortBB || !next) break;
+		retryAt = next;
+		--i;
+	}
+	if (!abortBB) {
+		LLVM_DEBUG(dbgs() << "No status check found for " << *info.entry << '\n');
+		return;
+	}
+
+	Function& F = *abortBB->getParent();
+	SmallPtrSet<const BasicBlock*, 1> stops;
+	BlockReachability reach(F, stops);
+	const BitVector& fromAbort = reach.reachableFrom(abortBB);
+	auto reachable = [&](const Instruction* I) {
+		return fromAbort.test(reach.getNumber(I->getParent()));
+	};
+	Instruction* start = abortBB->getFirstNonPHIOrDbg();
+
+	if (reachable(retryAt)) {
+		info.abort.retried = true;
+		auto retp = estimatePathLat(start, retryAt, 0, newCacheTag(), true, true, true);
+		info.abort.retryLat = AbortLat + retp.first;
+
+		ScalarEvolution& SE = getSE(F);
+		LoopInfo& LI = getLI(F);
+		Loop* L = LI.getLoopFor(abortBB);
+		while (L && !L->contains(retryAt->getParent())) L = L->getParentLoop();
+		if (L) {
+			info.abort.maxRetries = SE.getSmallConstantMaxTripCount(L);
+			SmallVector<BasicBlock*, 4> exiting;
+			L->getExitingBlocks(exiting);
+			for (BasicBlock* BB : exiting) {
+				const BranchInst* BI = dyn_cast<BranchInst>(BB->getTerminator());
+				if (BI && BI != info.abort.check && BI->isConditional() &&
+						dependsOn(BI->getCondition(), retryAt, 4)) {
+					info.abort.exitsOnStatus = true;
+				}
+			}
+		}
+	}
+
+	// the first lock tx the abort path can get to
+	for (const TxInfo& other : S->foundTx) {
+		if (isRTMTx(other) || other.ancestor != &F || !reachable(other.entry)) continue;
+		info.abort.fallback = other.entry;
+		auto retp = estimatePathLat(start, other.entry, 0, newCacheTag(), true, false, true);
+		info.abort.fallbackLat = AbortLat + retp.first + maxTxLat(other);
+		break;
+	}
+
+	LLVM_DEBUG(dbgs() << "Abort path of " << *info.entry << ": retry " <<
+			info.abort.retried << " (max " << info.abort.maxRetries << ", " <<
+			info.abort.retryLat << " each), fallback " << info.abort.fallbackLat << '\n');
+}
+
+void PrimeBortDetectorPass::printAbortReport(raw_ostream& OS) {
+	if (!AbortReport) return;
+
+	OS << "PrimeBort RTM abort paths (" << AbortLat << " cycles per abort)\n=====\n";
+	for (unsigned t = 0; t < S->foundTx.size(); ++t) {
+		const TxInfo& info = S->foundTx[t];
+		if (!isRTMTx(info)) continue;
+		const AbortInfo& A = info.abort;
+		const bool unbounded = A.retried && !A.maxRetries;
+		OS << ((unbounded) ? "! " : "  ") << "tx " << t << ": ";
+		printLoc(OS, info.entry);
+		OS << "\ttxLat " << maxTxLat(info) << '\n';
+		if (!A.check) {
+			OS << "\tstatus not checked\n";
+			continue;
+		}
+
+		OS << "\tretry: ";
+		if (!A.retried) {
+			OS << "no";
+		} else if (unbounded) {
+			OS << "UNBOUNDED, " << A.retryLat << " cycles per abort" <<
+				((A.exitsOnStatus) ? ", leaves on some abort codes" : ", never leaves");
+		} else {
+			OS << "at most " << A.maxRetries << " times, " << A.retryLat <<
+				" cycles per abort, storm " << A.maxRetries * (maxTxLat(info) + A.retryLat);
+		}
+		OS << "\n\tfallback: ";
+		if (A.fallback) {
+			printLoc(OS, A.fallback);
+			OS << ", " << A.fallbackLat << " cycles to the end of its section";
+		} else {
+			OS << "none, gives up";
+		}
+		OS << '\n';
+	}
+	OS << "=====\n";
+}
+
+} // namespace llvm
@@ -0,0 +1,124 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+
+/*
+ * Exports the estimates for later passes and tools, as !primebort.lat metadata
+ * (-primebort-annotate) and as the new-PM PrimeBortAnalysis result. Both carry:
+ *   on the terminator of each block of a function a tx runs code in
+ *     !{!"block", i64 shortest, i64 longest}      the block alone, callees included
+ *   on each such function
+ *     !{!"func", i64 shortest, i64 longest}       entry to any return
+ *   on each tx entry call
+ *     !{!"tx", i32 id, i64 txLat, i64 rtLat, i64 read bytes, i64 write bytes}
+ *   on each of its exit calls
+ *     !{!"tx.exit", i32 id, i64 txLat, i64 rtLat}
+ * with txLat the longest over the exits and rtLat the shortest on the entry. Tx ids
+ * are the same as in the runtime's descriptors. An exit shared by several txs
+ * keeps the last one.
+ */
+
+using namespace llvm;
+
+static cl::opt<bool> Annotate("primebort-annotate",
+		cl::desc("Attach !primebort.lat latency metadata to blocks, functions and txs"),
+		cl::init(false));
+
+namespace llvm {
+
+AnalysisKey PrimeBortAnalysis::Key;
+
+PrimeBortAnalysis::Result PrimeBortAnalysis::run(Module& M, ModuleAnalysisManager& AM) {
+	FunctionAnalysisManager& FAM =
+		AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+	PrimeBortDetectorPass P;
+	P.LIGetter = [&FAM](Function& F) -> LoopInfo& {return FAM.getResult<LoopAnalysis>(F);};
+	P.SEGetter = [&FAM](Function& F) -> ScalarEvolution& {
+		return FAM.getResult<ScalarEvolutionAnalysis>(F);
+	};
+	P.runImpl(M, true);
+
+	Result R;
+	P.exportLatencies(R.txs, R.blockLat, R.funcLat);
+	return R;
+}
+
+void PrimeBortDetectorPass::exportLatencies(SmallVectorImpl<TxInfo>& txs,
+		BlockLatMap& blockLat, FuncLatMap& funcLat) {
+	txs.append(S->foundTx.begin(), S->foundTx.end());
+
+	// the functions a tx runs code in: each ancestor, the wrappers the boundaries
+	// are called through, and everything scanned below them
+	SmallVector<Function*, 16> funcs;
+	SmallPtrSet<Function*, 16> seen;
+	auto add = [&](Function* F) {
+		if (F && !F->isDeclaration() && seen.insert(F).second) funcs.push_back(F);
+	};
+	for (const TxInfo& info : S->foundTx) {
+		add(info.ancestor);
+		for (Instruction* CI : info.entryChain) add(CI->getFunction());
+		for (const auto& chain : info.exitChains)
+			for (Instruction* CI : chain) add(CI->getFunction());
+	}
+	for (auto& P : S->funcProps) add(P.first);
+
+	for (Function* F : funcs) {
+		for (BasicBlock& BB : *F)
+			blockLat[&BB] = std::make_pair(estimateBlockLat(&BB, false),
+					estimateBlockLat(&BB, true));
+		funcLat[F] = estimateFuncLat(F);
+	}
+}
+
+std::pair<size_t, size_t> PrimeBortDetectorPass::estimateFuncLat(Function* F) {
+	Instruction* start = F->getEntryBlock().getFirstNonPHIOrDbg();
+	return std::make_pair(
+			estimatePathLat(start, NULL, 0, newCacheTag(), false, true, false).first,
+			estimatePathLat(start, NULL, 0, newCacheTag(), true, true, false).first);
+}
+
+bool PrimeBortDetectorPass::annotateIR(Module& M) {
+	if (!Annotate || S->foundTx.empty()) return false;
+
+	SmallVector<TxInfo, 0> txs;
+	BlockLatMap blockLat;
+	FuncLatMap funcLat;
+	exportLatencies(txs, blockLat, funcLat);
+
+	LLVMContext& C = M.getContext();
+	const unsigned kind = C.getMDKindID("primebort.lat");
+	auto num = [&C](Type* T, const uint64_t v) -> Metadata* {
+		return ConstantAsMetadata::get(ConstantInt::get(T, v));
+	};
+	Type* I32 = Type::getInt32Ty(C);
+	Type* I64 = Type::getInt64Ty(C);
+
+	for (auto& B : blockLat) {
+		const_cast<BasicBlock*>(B.first)->getTerminator()->setMetadata(kind, MDNode::get(C,
+				{MDString::get(C, "block"), num(I64, B.second.first), num(I64, B.second.second)}));
+	}
+	for (auto& F : funcLat) {
+		const_cast<Function*>(F.first)->setMetadata(kind, MDNode::get(C,
+				{MDString::get(C, "func"), num(I64, F.second.first), num(I64, F.second.second)}));
+	}
+	for (unsigned i = 0; i < txs.size(); ++i) {
+		const TxInfo& info = txs[i];
+		info.entry->setMetadata(kind, MDNode::get(C,
+				{MDString::get(C, "tx"), num(I32, i), num(I64, maxTxLat(info)),
+				num(I64, minRtLat(info)), num(I64, info.props.readBytes),
+				num(I64, info.props.writeBytes)}));
+		for (unsigned j = 0; j < info.exits.size(); ++j) {
+			info.exits[j]->setMetadata(kind, MDNode::get(C,
+					{MDString::get(C, "tx.exit"), num(I32, i), num(I64, info.txLat[j]),
+					num(I64, info.rtLat[j])}));
+		}
+	}
+	LLVM_DEBUG(dbgs() << "Annotated " << blockLat.size() << " blocks, " << funcLat.size() <<
+			" functions, " << txs.size() << " txs\n");
+	return true;
+}
+
+} // namespace llvm
@@ -0,0 +1,207 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+
+/*
+ * Tx boundary recognition. A boundary is either a call to a known lock/unlock (or
+ * RTM begin/end) function, or a spin lock written out in IR:
+ * - acquire: an acquiring cmpxchg from one constant (unlocked) to another (locked), or
+ *   a test-and-set (acquiring xchg tested against 0), whose failure edge leads back to
+ *   it without going through the success edge;
+ *   the boundary is the first instruction of the success block, where the lock is held
+ * - release: an atomic store with release ordering to a lock some acquire takes,
+ *   matched by the global, or the object type and offset, it is reached through; a
+ *   lock reached any other way only matches the same pointer in the same function
+ * Calls to lock functions with bodies (__gthread_*, or anything given with
+ * -primebort-lock-funcs) are boundaries as they are; their bodies aren't searched.
+ * Everything is found in one pass over the module's instructions.
+ */
+
+using namespace llvm;
+
+static cl::list<std::string> LockFuncs("primebort-lock-funcs",
+		cl::desc("Additional functions that take a lock (begin a tx)"),
+		cl::CommaSeparated);
+static cl::list<std::string> UnlockFuncs("primebort-unlock-funcs",
+		cl::desc("Additional functions that release a lock (end a tx)"),
+		cl::CommaSeparated);
+static cl::opt<bool> MatchSpinLocks("primebort-match-spinlocks",
+		cl::desc("Recognize spin locks built from atomics as tx boundaries"),
+		cl::init(true));
+
+static const char* const builtinLockFuncs[] = {
+	"llvm.x86.xbegin",
+	"pthread_mutex_lock", "pthread_rwlock_rdlock", "pthread_rwlock_wrlock",
+	"pthread_spin_lock",
+	"mtx_lock", "mtx_timedlock", // C11
+	"__gthread_mutex_lock", "__gthread_recursive_mutex_lock", // std::mutex, inlined
+};
+static const char* const builtinUnlockFuncs[] = {
+	"llvm.x86.xend",
+	"pthread_mutex_unlock", "pthread_rwlock_unlock",
+	"pthread_spin_unlock",
+	"mtx_unlock",
+	"__gthread_mutex_unlock", "__gthread_recursive_mutex_unlock",
+};
+
+namespace {
+
+// identifies a lock across functions: the global it is in, or else the type of the
+// object it is reached through, and its offset; if neither is known, only the pointer
+// itself does (the type of a pointer says nothing, with opaque pointers)
+typedef std::pair<const void*, int64_t> LockKey;
+
+LockKey getLockKey(const Value* V, const DataLayout& DL) {
+	V = V->stripPointerCasts();
+	APInt off(DL.getIndexTypeSizeInBits(V->getType()), 0);
+	const Value* base = V->stripAndAccumulateConstantOffsets(DL, off, true);
+	if (isa<GlobalValue>(base)) return LockKey(base, off.getSExtValue());
+	if (const GEPOperator* GEP = dyn_cast<GEPOperator>(V))
+		return LockKey(GEP->getSourceElementType(), off.getSExtValue());
+	return LockKey(base, off.getSExtValue());
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+Instruction* PrimeBortDetectorPass::matchSpinAcquire(Instruction& I, const Value*& lock) {
+	BasicBlock* okBB = NULL;
+	BasicBlock* failBB = NULL;
+	auto takeBranch = [&](User* U, const bool okOnTrue) {
+		BranchInst* BR = dyn_cast<BranchInst>(U);
+		if (!BR || !BR->isConditional() || okBB) return;
+		okBB = BR->getSuccessor((okOnTrue) ? 0 : 1);
+		failBB = BR->getSuccessor((okOnTrue) ? 1 : 0);
+	};
+
+	if (AtomicCmpXchgInst* CX = dyn_cast<AtomicCmpXchgInst>(&I)) {
+		if (!isAcquireOrStronger(CX->getSuccessOrdering())) return NULL;
+		// a CAS loop updating a value (counters, list heads) retries just the same
+		const Constant* unlocked = dyn_cast<Constant>(CX->getCompareOperand());
+		const Constant* locked = dyn_cast<Constant>(CX->getNewValOperand());
+		if (!unlocked || !locked || unlocked == locked) return NULL;
+		// branch on the success flag
+		for (User* U : CX->users()) {
+			ExtractValueInst* EV = dyn_cast<ExtractValueInst>(U);
+			if (!EV || EV->getNumIndices() != 1 || *EV->idx_begin() != 1) continue;
+			for (User* B : EV->users()) takeBranch(B, true);
+		}
+		lock = CX->getPointerOperand();
+	} else if (AtomicRMWInst* RMW = dyn_cast<AtomicRMWInst>(&I)) {
+		if (RMW->getOperation() != AtomicRMWInst::Xchg ||
+				!isAcquireOrStronger(RMW->getOrdering())) return NULL;
+		// branch on whether the old value was clear
+		for (User* U : RMW->users()) {
+			if (ICmpInst* C = dyn_cast<ICmpInst>(U)) {
+				Constant* Z = dyn_cast<Constant>(C->getOperand(1));
+				if (!C->isEquality() || !Z || !Z->isNullValue()) continue;
+				for (User* B : C->users())
+					takeBranch(B, C->getPredicate() == CmpInst::ICMP_EQ);
+			} else if (isa<TruncInst>(U) && U->getType()->isIntegerTy(1)) {
+				for (User* B : U->users()) takeBranch(B, false); // atomic_flag
+			}
+		}
+		lock = RMW->getPointerOperand();
+	}
+	if (!okBB) return NULL;
+
+	// a lock retries until it succeeds; anything else is a trylock or a counter
+	BasicBlock* BB = I.getParent();
+	if (okBB == BB) return NULL;
+	SmallPtrSet<BasicBlock*, 1> notHeld;
+	notHeld.insert(okBB);
+	if (!isPotentiallyReachable(failBB, BB, &notHeld)) return NULL;
+	return okBB->getFirstNonPHIOrDbg();
+}
+
+Instruction* PrimeBortDetectorPass::findSpinAcquire(Instruction* held) {
+	if (!S->boundaryLocks.count(held)) return NULL;
+	// the atomic branches straight to the block the lock is held in, which may begin
+	// with a store; a release store has no such atomic
+	for (BasicBlock* BB : predecessors(held->getParent())) {
+		for (Instruction& I : *BB) {
+			const Value* lock = NULL;
+			if ((isa<AtomicCmpXchgInst>(I) || isa<AtomicRMWInst>(I)) &&
+					matchSpinAcquire(I, lock) == held) {
+				return &I;
+			}
+		}
+	}
+	return NULL;
+}
+
+void PrimeBortDetectorPass::populateLeafSets(Module& M,
+		SmallVectorImpl<Instruction*>& begin, SmallVectorImpl<Instruction*>& commit) {
+	DenseSet<const Function*> lockFns, unlockFns;
+	auto addFunc = [&](StringRef name, DenseSet<const Function*>& set) {
+		if (Function* F = M.getFunction(name)) {
+			set.insert(F);
+			S->txBoundaryFuncs.insert(F);
+		}
+	};
+	for (const char* name : builtinLockFuncs) addFunc(name, lockFns);
+	for (const char* name : builtinUnlockFuncs) addFunc(name, unlockFns);
+	for (const std::string& name : LockFuncs) addFunc(name, lockFns);
+	for (const std::string& name : UnlockFuncs) addFunc(name, unlockFns);
+
+	// releases can't be told from other stores until every acquire has been seen
+	const DataLayout& DL = M.getDataLayout();
+	DenseSet<LockKey> acquired;
+	SmallVector<StoreInst*, 8> releases;
+	auto allIn = [](const TargetSet* TS, const DenseSet<const Function*>& set) {
+		return TS && TS->precise && !TS->funcs.empty() &&
+			all_of(TS->funcs, [&set](const Function* F) {return set.count(F) != 0;});
+	};
+
+	S->funcOrder.clear();
+	for (Function& F : M) {
+		S->funcOrder.try_emplace(&F, S->funcOrder.size());
+		if (S->txBoundaryFuncs.count(&F)) continue;
+		for (Instruction& I : instructions(F)) {
+			if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+				if (Function* callee = CI->getCalledFunction()) {
+					if (lockFns.count(callee)) begin.push_back(CI);
+					else if (unlockFns.count(callee)) commit.push_back(CI);
+				} else if (!CI->isInlineAsm()) {
+					const TargetSet* TS = getIndirectTargets(*CI);
+					if (allIn(TS, lockFns)) begin.push_back(CI);
+					else if (allIn(TS, unlockFns)) commit.push_back(CI);
+				}
+			} else if (MatchSpinLocks) {
+				const Value* lock = NULL;
+				if (Instruction* held = matchSpinAcquire(I, lock)) {
+					if (S->boundaryLocks.try_emplace(held, lock).second) begin.push_back(held);
+					acquired.insert(getLockKey(lock, DL));
+				} else if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+					if (SI->isAtomic() && isReleaseOrStronger(SI->getOrdering()))
+						releases.push_back(SI);
+				}
+			}
+		}
+	}
+
+	for (StoreInst* SI : releases) {
+		if (!acquired.count(getLockKey(SI->getPointerOperand(), DL))) continue;
+		S->boundaryLocks[SI] = SI->getPointerOperand();
+		commit.push_back(SI);
+	}
+
+	// a lock call can be the first instruction with a spin lock held: it is one leaf,
+	// a call like any other, and the spin lock's section isn't looked at
+	SmallPtrSet<Instruction*, 16> seen;
+	erase_if(begin, [&](Instruction* I) {
+		if (seen.insert(I).second) return false;
+		S->boundaryLocks.erase(I);
+		return true;
+	});
+	LLVM_DEBUG(dbgs() << "Found " << begin.size() << " tx begin and " << commit.size() <<
+			" tx commit sites, " << S->boundaryLocks.size() << " of them spin locks\n");
+}
+
+} // namespace llvm
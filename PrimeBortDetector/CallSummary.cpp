@@ -0,0 +1,153 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+
+/*
+ * Callee latency summaries. A call to a function with a body costs the longest/
+ * shortest path from its entry to a return, which doesn't depend on the caller, so
+ * it is computed once per function and mode and reused by every later estimate.
+ * Template instantiations and other copies of the same code share one summary: functions
+ * are bucketed by the MergeFunctions structural hash and confirmed equal with
+ * FunctionComparator, and the first function seen of each class (its leader) is the
+ * one that gets costed. The block cache then only ever holds the leader's blocks.
+ *
+ * Calls with constant integer arguments (or arguments forwarded from a caller that
+ * got constants) are costed in that context instead, up to -primebort-context-depth
+ * calls deep: the constants are substituted into the SCEVs of the callee's loop exit
+ * counts and library call sizes, so a helper looping n times is costed for the n it
+ * is called with. These summaries are keyed by the constants as well.
+ */
+
+using namespace llvm;
+
+static cl::opt<bool> DedupFunctions("primebort-dedup-functions",
+		cl::desc("Share latency summaries between structurally identical functions"),
+		cl::init(true));
+
+static cl::opt<unsigned> ContextDepth("primebort-context-depth",
+		cl::desc("Cost callees with the constant arguments of their call site, "
+			"through at most this many nested calls (0 disables)"),
+		cl::init(2));
+
+// trip counts from context constants beyond this are treated as unknown
+#define MAX_CONTEXT_TRIP_COUNT (1u << 20)
+
+namespace llvm {
+
+Function* PrimeBortDetectorPass::getSummaryLeader(Function* F) {
+	if (!DedupFunctions) return F;
+	auto l_it = S->summaryLeader.find(F);
+	if (l_it != S->summaryLeader.end()) return l_it->second;
+
+	SmallVectorImpl<Function*>& bucket = S->summaryBuckets[FunctionComparator::functionHash(*F)];
+	Function* leader = F;
+	for (Function* L : bucket) {
+		if (FunctionComparator(F, L, &S->globalNumbers).compare() == 0) {
+			leader = L;
+			break;
+		}
+	}
+	if (leader == F) bucket.push_back(F);
+	else LLVM_DEBUG(dbgs() << "Summary of " << F->getName() << " shared with " <<
+			leader->getName() << "\n");
+	S->summaryLeader[F] = leader;
+	return leader;
+}
+
+size_t PrimeBortDetectorPass::estimateCallLat(CallBase& CB, Function* F,
+		const size_t prev_lat, const unsigned topLevelTag, const bool longest,
+		const bool handleLoops) {
+	// the function the outermost walk is in can be recursed into as well
+	if (S->summaryStack.empty()) {
+		S->summaryStack.emplace_back(getSummaryLeader(CB.getFunction()), false);
+		const size_t lat = estimateCallLat(CB, F, prev_lat, topLevelTag, longest, handleLoops);
+		S->summaryStack.pop_back();
+		return lat;
+	}
+	Function* L = getSummaryLeader(F);
+
+	// a recursive call costs nothing, which leaves the summary of every function on
+	// the cycle short, the one recursed into included: don't keep any of them
+	auto onStack = find_if(S->summaryStack,
+			[L](const std::pair<Function*, bool>& E) {return E.first == L;});
+	if (onStack != S->summaryStack.end()) {
+		for (; onStack != S->summaryStack.end(); ++onStack) onStack->second = true;
+		return 0;
+	}
+
+	// constant arguments, directly or forwarded from the context we are in
+	CallContext ctx = {L, (S->curContext) ? S->curContext->depth + 1 : 1, {}};
+	if (ctx.depth <= ContextDepth) {
+		for (unsigned n = 0; n < CB.arg_size() && n < L->arg_size(); ++n) {
+			Value* A = CB.getArgOperand(n);
+			if (!A->getType()->isIntegerTy()) continue;
+			ConstantInt* C = dyn_cast<ConstantInt>(A);
+			const Argument* FA = dyn_cast<Argument>(A);
+			if (!C && FA && S->curContext && S->curContext->F == FA->getParent()) {
+				for (const auto& B : S->curContext->args)
+					if (B.first == FA->getArgNo()) C = B.second;
+			}
+			if (C) ctx.args.emplace_back(n, C);
+		}
+	}
+
+	const unsigned mode = (unsigned) longest | (unsigned) handleLoops << 1;
+	const auto key = std::make_pair(L, mode);
+	const auto c_key = std::make_pair(key, ctx.args);
+	if (ctx.args.empty()) {
+		auto s_it = S->funcSummaries.find(key);
+		if (s_it != S->funcSummaries.end()) return s_it->second;
+	} else {
+		auto s_it = S->contextSummaries.find(c_key);
+		if (s_it != S->contextSummaries.end()) return s_it->second;
+	}
+
+	// callee blocks are cached per context, so a contextual walk gets its own tag;
+	// the walk isn't confined to the loop the call is in
+	const CallContext* outerContext = S->curContext;
+	const SmallPtrSetImpl<const BasicBlock*>* outerLoop = S->walkLoop;
+	S->curContext = (ctx.args.empty()) ? NULL : &ctx;
+	S->walkLoop = NULL;
+	S->summaryStack.emplace_back(L, false);
+	auto retp = estimatePathLat(L->getEntryBlock().getFirstNonPHIOrDbg(),
+			NULL, prev_lat, (ctx.args.empty()) ? topLevelTag : newCacheTag(),
+			longest, handleLoops, false);
+	const bool cutShort = S->summaryStack.pop_back_val().second;
+	S->curContext = outerContext;
+	S->walkLoop = outerLoop;
+
+	// nor summaries truncated by the search limit
+	if (!cutShort && prev_lat + retp.first < MAX_SEARCH_DIST) {
+		if (ctx.args.empty()) S->funcSummaries[key] = retp.first;
+		else S->contextSummaries[c_key] = retp.first;
+	}
+	LLVM_DEBUG(if (!ctx.args.empty()) dbgs() << "Call to " << L->getName() << " with " <<
+			ctx.args.size() << " constant args: " << retp.first << "\n");
+	return retp.first;
+}
+
+bool PrimeBortDetectorPass::bindContext(ScalarEvolution& SE, const Function* F,
+		ValueToSCEVMapTy& bindings) {
+	if (!S->curContext || S->curContext->F != F) return false;
+	for (const auto& B : S->curContext->args)
+		bindings[F->getArg(B.first)] = SE.getConstant(B.second);
+	return true;
+}
+
+unsigned PrimeBortDetectorPass::getContextTripCount(ScalarEvolution& SE,
+		const Loop* L, BasicBlock* BB) {
+	ValueToSCEVMapTy bindings;
+	if (!bindContext(SE, BB->getParent(), bindings)) return 0;
+	const SCEV* EC = SE.getExitCount(L, BB);
+	if (isa<SCEVCouldNotCompute>(EC)) return 0;
+	EC = SCEVParameterRewriter::rewrite(EC, SE, bindings);
+	const SCEVConstant* C = dyn_cast<SCEVConstant>(EC);
+	if (!C) return 0;
+	// the exit count is taken branches, one fewer than the trips through the header
+	if (C->getAPInt().isNegative()) return 1;
+	const uint64_t trips = C->getAPInt().getLimitedValue(MAX_CONTEXT_TRIP_COUNT) + 1;
+	return (trips > MAX_CONTEXT_TRIP_COUNT) ? 0 : (unsigned) trips;
+}
+
+} // namespace llvm
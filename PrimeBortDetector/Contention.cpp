@@ -0,0 +1,200 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+#include <algorithm>
+
+/*
+ * Cache line contention between txs. The latency model assumes every line a tx writes
+ * is already in its core's L1D, which is wrong for lines other txs write too: lock
+ * words, shared counters and fields that only happen to share a line with them move
+ * between cores, each time costing a cross-core transfer. The region scan notes the
+ * writes to memory other threads can reach: stores to globals, and atomics on fields
+ * of objects reached through a pointer, named by the struct type. Where an object
+ * starts within a line is only known down to its alignment, so it is split into
+ * pieces of its alignment (up to a line), the largest known to lie in one line. A
+ * piece written inside more than one tx is contended: a piece of a global always,
+ * one of an object only if the txs reach it through the same pointer, as the same
+ * type and offset in two txs is as likely two instances (per-object locks) as one,
+ * and only where two txs write the same field. A tx is charged -primebort-transfer-lat
+ * once for each contended piece it writes: the line comes over on the first write and
+ * stays for the rest of the tx, however many times it is written.
+ * The report lists the contended lines with the writes to them, and marks those where
+ * no field is written by two txs: false sharing, which padding would fix.
+ */
+
+using namespace llvm;
+
+namespace llvm {
+
+cl::opt<bool> PrimeBortContention("primebort-contention",
+		cl::desc("Charge writes to cache lines shared by several txs a cross-core "
+			"transfer, and report those lines"),
+		cl::init(false));
+
+} // namespace llvm
+
+// same-socket core to core; across sockets it is several times this
+static cl::opt<unsigned> TransferLat("primebort-transfer-lat",
+		cl::desc("Cycles to move a contended cache line between cores"),
+		cl::init(70));
+
+#define CACHE_LINE_SIZE 64
+
+namespace {
+
+void printObject(raw_ostream& OS, const PointerUnion<const GlobalVariable*, StructType*> O) {
+	if (const GlobalVariable* GV = O.dyn_cast<const GlobalVariable*>()) {
+		OS << '@' << GV->getName();
+		return;
+	}
+	StructType* ST = O.get<StructType*>();
+	if (ST->hasName()) OS << '%' << ST->getName();
+	else OS << *ST;
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+bool PrimeBortDetectorPass::getSharedLoc(const Instruction& I, SharedLoc& loc) {
+	const Value* P;
+	bool atomic = true;
+	if (const StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+		P = SI->getPointerOperand();
+		atomic = SI->isAtomic();
+	} else if (const AtomicRMWInst* RMW = dyn_cast<AtomicRMWInst>(&I)) {
+		P = RMW->getPointerOperand();
+	} else if (const AtomicCmpXchgInst* CX = dyn_cast<AtomicCmpXchgInst>(&I)) {
+		P = CX->getPointerOperand();
+	} else {
+		return false;
+	}
+
+	// down to the object through constant offsets, noting its type
+	const DataLayout& DL = I.getModule()->getDataLayout();
+	APInt off(DL.getIndexTypeSizeInBits(P->getType()), 0);
+	Type* T = NULL;
+	P = P->stripPointerCasts();
+	while (const GEPOperator* GEP = dyn_cast<GEPOperator>(P)) {
+		if (!GEP->accumulateConstantOffset(DL, off)) return false;
+		T = GEP->getSourceElementType();
+		P = GEP->getPointerOperand()->stripPointerCasts();
+	}
+	if (off.isNegative()) return false;
+	// a global's alignment is what the module gives it, or what codegen will
+	Align align = P->getPointerAlignment(DL);
+
+	if (const GlobalVariable* GV = dyn_cast<GlobalVariable>(P)) {
+		if (GV->isThreadLocal() || GV->isConstant()) return false;
+		loc = SharedLoc{SharedObject(GV), GV, off.getZExtValue(),
+			std::min<uint64_t>(align.value(), CACHE_LINE_SIZE)};
+		return true;
+	}
+	// anywhere else only atomics: plain stores through pointers mostly go to memory
+	// the tx owns, and would pair up by type alone
+	StructType* ST = dyn_cast_or_null<StructType>(T);
+	if (!atomic || !ST) return false;
+	if (isa<AllocaInst>(P) && !PointerMayBeCaptured(P, true, true)) return false;
+	// an object is at least as aligned as its type
+	align = std::max(align, DL.getABITypeAlign(ST));
+	loc = SharedLoc{SharedObject(ST), P, off.getZExtValue(),
+		std::min<uint64_t>(align.value(), CACHE_LINE_SIZE)};
+	return true;
+}
+
+void PrimeBortDetectorPass::findContention() {
+	if (!PrimeBortContention) return;
+
+	// by the pointer the object is reached through and the piece of it
+	MapVector<std::pair<const Value*, uint64_t>, ContendedLine> lines;
+	for (unsigned t = 0; t < S->foundTx.size(); ++t) {
+		for (Instruction* I : S->foundTx[t].props.sharedWrites) {
+			SharedLoc loc;
+			getSharedLoc(*I, loc);
+			const uint64_t chunk = loc.offset / loc.chunkSize;
+			ContendedLine& CL = lines[std::make_pair(loc.base, chunk)];
+			CL.object = loc.object;
+			CL.begin = chunk * loc.chunkSize;
+			CL.size = loc.chunkSize;
+			CL.writes.emplace_back(t, I);
+		}
+	}
+
+	for (auto& E : lines) {
+		ContendedLine& CL = E.second;
+		const unsigned t = CL.writes.front().first;
+		if (all_of(CL.writes,
+					[t](const std::pair<unsigned, Instruction*>& W) {return W.first == t;})) {
+			continue;
+		}
+		// true sharing if some field is written by two txs
+		DenseMap<uint64_t, unsigned> firstTx;
+		CL.trueSharing = false;
+		for (const auto& W : CL.writes) {
+			SharedLoc loc;
+			getSharedLoc(*W.second, loc);
+			auto emplit = firstTx.try_emplace(loc.offset, W.first);
+			if (!emplit.second && emplit.first->second != W.first) CL.trueSharing = true;
+		}
+		// in an object only the same field counts: where it starts is up to its allocator
+		if (!CL.trueSharing && CL.object.is<StructType*>()) continue;
+		for (const auto& W : CL.writes) S->contendedWrites.insert(W.second);
+		S->contendedLines.push_back(std::move(CL));
+	}
+	LLVM_DEBUG(dbgs() << S->contendedLines.size() << " contended cache lines, " <<
+			S->contendedWrites.size() << " writes to them\n");
+}
+
+size_t PrimeBortDetectorPass::getContentionLat(const RegionProps& props) const {
+	DenseSet<std::pair<const Value*, uint64_t> > lines;
+	for (Instruction* I : props.sharedWrites) {
+		if (!S->contendedWrites.count(I)) continue;
+		SharedLoc loc;
+		getSharedLoc(*I, loc);
+		lines.insert(std::make_pair(loc.base, loc.offset / loc.chunkSize));
+	}
+	return lines.size() * TransferLat;
+}
+
+void PrimeBortDetectorPass::printContentionReport(raw_ostream& OS) {
+	if (!PrimeBortContention) return;
+
+	// most txs first
+	auto numTx = [](const ContendedLine& CL) {
+		SmallVector<unsigned, 4> txs;
+		for (const auto& W : CL.writes) txs.push_back(W.first);
+		std::sort(txs.begin(), txs.end());
+		return std::unique(txs.begin(), txs.end()) - txs.begin();
+	};
+	SmallVector<const ContendedLine*, 16> lines;
+	for (const ContendedLine& CL : S->contendedLines) lines.push_back(&CL);
+	std::stable_sort(lines.begin(), lines.end(),
+		[&numTx](const ContendedLine* A, const ContendedLine* B) {
+			return numTx(*A) > numTx(*B);
+		});
+
+	OS << "PrimeBort contended cache lines (+" << TransferLat << " cycles per line and tx)\n"
+		"=====\n";
+	for (const ContendedLine* CL : lines) {
+		printObject(OS, CL->object);
+		if (CL->size == CACHE_LINE_SIZE) OS << " line " << CL->begin / CACHE_LINE_SIZE;
+		else OS << " bytes " << CL->begin << '-' << CL->begin + CL->size - 1;
+		OS << ": " << numTx(*CL) << " txs, " <<
+			((CL->trueSharing) ? "shared" : "false sharing") << '\n';
+		for (const auto& W : CL->writes) {
+			SharedLoc loc;
+			getSharedLoc(*W.second, loc);
+			OS << "\ttx " << W.first << "\t+" << loc.offset << '\t' <<
+				W.second->getOpcodeName() << '\t';
+			printLoc(OS, W.second);
+			OS << '\n';
+		}
+	}
+	OS << "=====\n";
+}
+
+} // namespace llvm
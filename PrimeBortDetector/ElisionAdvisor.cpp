@@ -0,0 +1,111 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include <algorithm>
+
+/*
+ * Lock elision advisor. Uses the latency estimates and region scan of each
+ * lock-bounded tx to decide whether its critical section could run as a hardware
+ * transaction (HLE, or an RTM fast path with the lock as fallback).
+ * A section is a candidate if it is short, makes no syscalls or I/O
+ * (which always abort), and its footprint fits in the L1D, which bounds the RTM
+ * write set (reads can spill further, but not by much in practice).
+ * Candidates are ranked shortest first; the rest are ranked longest first
+ * with the reasons they were rejected.
+ */
+
+using namespace llvm;
+
+static cl::opt<bool> ElisionReport("primebort-elision-report",
+		cl::desc("Print a ranked report of lock critical sections suitable for lock elision"),
+		cl::init(false));
+static cl::opt<unsigned> ElisionMaxLat("primebort-elision-max-lat",
+		cl::desc("Longest txLat (cycles) of a lock elision candidate"),
+		cl::init(10000));
+static cl::opt<unsigned> ElisionMaxRead("primebort-elision-max-read",
+		cl::desc("Largest read set (bytes) of a lock elision candidate"),
+		cl::init(32768));
+static cl::opt<unsigned> ElisionMaxWrite("primebort-elision-max-write",
+		cl::desc("Largest write set (bytes) of a lock elision candidate"),
+		cl::init(4096));
+
+namespace {
+
+struct ElisionEntry {
+	const PrimeBortDetectorPass::TxInfo* info;
+	size_t txLat; // longest over all exits
+	size_t rtLat; // shortest over all exits
+	std::string why; // reasons it was rejected, or caveats for candidates
+};
+
+void printEntry(raw_ostream& OS, const unsigned rank, const ElisionEntry& E) {
+	const PrimeBortDetectorPass::RegionProps& P = E.info->props;
+	OS << "  #" << rank << "\ttxLat " << E.txLat << "\trtLat " << E.rtLat <<
+		"\trd " << P.readBytes << "B\twr " << P.writeBytes << "B\t";
+	PrimeBortDetectorPass::printLoc(OS, E.info->entry);
+	if (!E.why.empty()) OS << "\n\t" << E.why;
+	OS << '\n';
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+void PrimeBortDetectorPass::printElisionReport(raw_ostream& OS) {
+	if (!ElisionReport) return;
+
+	SmallVector<ElisionEntry, 8> good, bad;
+	for (const TxInfo& info : S->foundTx) {
+		// RTM regions are already transactional
+		if (isRTMTx(info)) continue;
+
+		ElisionEntry E = {&info, maxTxLat(info), minRtLat(info), ""};
+
+		// hard reasons reject the section; soft ones are caveats
+		SmallVector<std::string, 4> hard, soft;
+		const RegionProps& P = info.props;
+		if (E.txLat > ElisionMaxLat) hard.push_back("too long");
+		if (P.writeBytes > ElisionMaxWrite) hard.push_back("write set too large");
+		if (P.readBytes > ElisionMaxRead) hard.push_back("read set too large");
+		if (P.flags & (RF_IO | RF_SYSCALL)) {
+			std::string names = "syscall/I/O:";
+			for (Function* F : P.externCalls) {
+				if (classifyExternCall(F->getName()) & (RF_IO | RF_SYSCALL))
+					names += " " + F->getName().str();
+			}
+			hard.push_back(names);
+		}
+		if (P.flags & RF_BLOCKING) hard.push_back("may block");
+		if (P.flags & RF_ALLOC) soft.push_back("calls the allocator");
+		if (P.flags & RF_LOCK) soft.push_back("takes other locks");
+		if (P.flags & RF_INDIRECT) soft.push_back("indirect calls not checked");
+		if (P.flags & RF_ASM) soft.push_back("inline asm not checked");
+		if (P.flags & RF_EXTERN) soft.push_back("external calls without a cost model");
+
+		if (hard.empty()) {
+			E.why = join(soft, ", ");
+			good.push_back(E);
+		} else {
+			hard.append(soft.begin(), soft.end());
+			E.why = join(hard, ", ");
+			bad.push_back(E);
+		}
+	}
+
+	std::stable_sort(good.begin(), good.end(),
+		[](const ElisionEntry& A, const ElisionEntry& B) {
+			if (A.txLat != B.txLat) return A.txLat < B.txLat;
+			return A.info->props.writeBytes < B.info->props.writeBytes;
+		});
+	std::stable_sort(bad.begin(), bad.end(),
+		[](const ElisionEntry& A, const ElisionEntry& B) {return A.txLat > B.txLat;});
+
+	OS << "PrimeBort lock elision report\n=====\n";
+	OS << "Elision candidates (" << good.size() << "):\n";
+	for (unsigned i = 0; i < good.size(); ++i) printEntry(OS, i+1, good[i]);
+	OS << "Not elidable (" << bad.size() << "):\n";
+	for (unsigned i = 0; i < bad.size(); ++i) printEntry(OS, i+1, bad[i]);
+	OS << "=====\n";
+}
+
+} // namespace llvm
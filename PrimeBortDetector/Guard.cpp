@@ -0,0 +1,136 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/IntrinsicsX86.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+
+/*
+ * Prime+Abort mitigation guard. An RTM tx that takes much longer than the way back
+ * to its start (txLat >> rtLat), or that is started again after it aborts, is what
+ * a Prime+Abort attack needs to time its victim, so those get a guard around their
+ * XBEGIN. The guard is split between inline IR and the runtime:
+ *
+ *   pre:    ++guard.attempts; if (guard.backoff) goto slow; else goto xbegin
+ *   slow:   status = __primebort_guard_slow(desc); if (status) goto join
+ *   xbegin: status = XBEGIN; if (status == ~0) goto join
+ *   abort:  __primebort_guard_abort(desc, status)
+ *   join:   ... (all uses of the XBEGIN status use the phi instead)
+ *
+ * so the fast path is a TLS increment, a TLS load and a branch; test/guard_bench.c
+ * measures it against the unguarded code in alternating rounds, since a single run
+ * under contention swings by more than that either way. The runtime keeps a
+ * per-thread abort rate; an abort storm sets an exponential pause backoff, and long
+ * storms make the slow path skip XBEGIN and report an explicit abort (with no retry
+ * bit), which sends the program down its own lock fallback.
+ * Lock-based txs can't abort, so only RTM txs are guarded.
+ */
+
+using namespace llvm;
+
+static cl::opt<unsigned> GuardRatio("primebort-guard-ratio",
+		cl::desc("Guard RTM txs whose txLat is at least this many times their rtLat"),
+		cl::init(8));
+
+namespace llvm {
+
+cl::opt<bool> PrimeBortGuard("primebort-guard",
+		cl::desc("Insert the Prime+Abort guard at suspicious RTM tx entries (link with the PrimeBort runtime)"),
+		cl::init(false));
+
+bool PrimeBortDetectorPass::needsGuard(const TxInfo& info) {
+	if (!isRTMTx(info)) return false;
+	if (maxTxLat(info) >= GuardRatio * std::max(minRtLat(info), (size_t) 1)) {
+		LLVM_DEBUG(dbgs() << "Guarding " << *info.entry << ": txLat >> rtLat\n");
+		return true;
+	}
+	// a loop that merely contains the tx is not a retry loop: the abort side of
+	// the status check has to lead back to XBEGIN, see analyzeAbort
+	if (info.abort.retried) {
+		LLVM_DEBUG(dbgs() << "Guarding " << *info.entry << ": retry loop\n");
+		return true;
+	}
+	return false;
+}
+
+void PrimeBortDetectorPass::insertGuard(CallInst* X, Constant* desc) {
+	Module& M = *X->getModule();
+	LLVMContext& C = M.getContext();
+	IntegerType* I32 = Type::getInt32Ty(C);
+	Type* VoidTy = Type::getVoidTy(C);
+
+	// must match struct primebort_guard in the runtime
+	StructType* GuardTy = StructType::getTypeByName(C, "primebort.guard");
+	if (!GuardTy) GuardTy = StructType::create(C, {I32, I32, I32, I32}, "primebort.guard");
+	GlobalVariable* state = M.getGlobalVariable("__primebort_guard");
+	if (!state) {
+		state = new GlobalVariable(M, GuardTy, false, GlobalValue::ExternalLinkage, nullptr,
+				"__primebort_guard", nullptr, GlobalValue::InitialExecTLSModel);
+	}
+	FunctionCallee slowFn = M.getOrInsertFunction("__primebort_guard_slow",
+			I32, desc->getType());
+	FunctionCallee abortFn = M.getOrInsertFunction("__primebort_guard_abort",
+			VoidTy, desc->getType(), I32);
+
+	// pre -> xbegin -> join, then add the slow and abort paths around them
+	BasicBlock* pre = X->getParent();
+	Function* F = pre->getParent();
+	BasicBlock* xbegin = pre->splitBasicBlock(X, "primebort.xbegin");
+	BasicBlock* join = xbegin->splitBasicBlock(X->getNextNode(), "primebort.join");
+	BasicBlock* slow = BasicBlock::Create(C, "primebort.slow", F, xbegin);
+	BasicBlock* abort = BasicBlock::Create(C, "primebort.abort", F, join);
+	MDBuilder MDB(C);
+
+	IRBuilder<> B(&join->front());
+	PHINode* status = B.CreatePHI(I32, 3, "primebort.status");
+	X->replaceAllUsesWith(status);
+
+	pre->getTerminator()->eraseFromParent();
+	B.SetInsertPoint(pre);
+	Value* attempts = B.CreateStructGEP(GuardTy, state, 0);
+	B.CreateStore(B.CreateAdd(B.CreateLoad(I32, attempts), ConstantInt::get(I32, 1)), attempts);
+	Value* backoff = B.CreateLoad(I32, B.CreateStructGEP(GuardTy, state, 3));
+	B.CreateCondBr(B.CreateICmpNE(backoff, ConstantInt::get(I32, 0)), slow, xbegin,
+			MDB.createBranchWeights(1, 1000));
+
+	B.SetInsertPoint(slow);
+	Value* forced = B.CreateCall(slowFn, {desc});
+	B.CreateCondBr(B.CreateICmpEQ(forced, ConstantInt::get(I32, 0)), xbegin, join);
+
+	xbegin->getTerminator()->eraseFromParent();
+	B.SetInsertPoint(xbegin);
+	B.CreateCondBr(B.CreateICmpEQ(X, ConstantInt::get(I32, ~0U)), join, abort,
+			MDB.createBranchWeights(1000, 1));
+
+	B.SetInsertPoint(abort);
+	B.CreateCall(abortFn, {desc, X});
+	B.CreateBr(join);
+
+	status->addIncoming(forced, slow);
+	status->addIncoming(X, xbegin);
+	status->addIncoming(X, abort);
+}
+
+bool PrimeBortDetectorPass::guardTx(Module& M) {
+	if (!PrimeBortGuard) return false;
+
+	// decide before inserting any guard, on the code the analysis looked at
+	SmallVector<unsigned, 4> toGuard;
+	for (unsigned i = 0; i < S->foundTx.size(); ++i)
+		if (needsGuard(S->foundTx[i])) toGuard.push_back(i);
+
+	// wrappers share one XBEGIN between several txs, guard it once
+	SmallPtrSet<CallInst*, 4> guarded;
+	for (unsigned i : toGuard) {
+		CallInst* X = cast<CallInst>(S->foundTx[i].entryChain.back());
+		if (!guarded.insert(X).second) continue;
+		getTxDescTable(M);
+		insertGuard(X, getTxDesc(i));
+	}
+
+	return !guarded.empty();
+}
+
+} // namespace llvm
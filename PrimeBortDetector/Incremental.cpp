@@ -0,0 +1,192 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+
+/*
+ * Incremental runs, for a module that stays loaded while its functions are edited
+ * (tools/primebort-server). With keepState, a run's state outlives it, and before the
+ * bodies of some functions are replaced, invalidate() drops what depends on them: the
+ * summaries and region properties of those functions and everything that calls them,
+ * directly or through a resolved indirect call, and the txs whose ancestor is one of
+ * them or is called by one (the shortest path back climbs into callers). The next run
+ * matches the boundaries again, which is a walk over the caller graph, and takes the
+ * properties and estimates of every tx with the same entry, exits and chains from the
+ * last run; only the others are scanned and estimated, with the summaries that are left.
+ * Summaries depend on which functions are boundaries, so they are all dropped if that
+ * changed outside the invalidated functions; the estimates of the kept txs include the
+ * contention charge, so they are dropped if the contended writes changed.
+ */
+
+using namespace llvm;
+
+namespace llvm {
+
+void PrimeBortDetectorPass::invalidate(const SmallPtrSetImpl<Function*>& changed) {
+	if (!S) return;
+
+	// functions calling each function through an indirect call resolved so far
+	DenseMap<const Function*, SmallVector<Function*, 4> > indirectCallers;
+	for (const auto& E : S->callTargets) {
+		for (Function* T : E.second->funcs)
+			indirectCallers[T].push_back(const_cast<Function*>(E.first->getFunction()));
+	}
+	auto forCallers = [&](Function* F, function_ref<void(Function*)> fn) {
+		for (User* U : F->users()) {
+			if (CallBase* CB = dyn_cast<CallBase>(U)) fn(CB->getFunction());
+		}
+		for (Function* C : indirectCallers.lookup(F)) fn(C);
+	};
+
+	// the changed functions and everything that calls them
+	SmallVector<Function*, 16> work(changed.begin(), changed.end());
+	while (!work.empty()) {
+		Function* F = work.pop_back_val();
+		if (S->invalidated.insert(F).second) forCallers(F, [&](Function* C) {work.push_back(C);});
+	}
+	auto isStale = [&](const Function* F) {return S->invalidated.count(F) != 0;};
+	auto inChanged = [&](const Instruction* I) {
+		return changed.count(const_cast<Function*>(I->getFunction())) != 0;
+	};
+
+	// summaries, by leader; the changed functions are bucketed again by their new bodies
+	unsigned dropped = 0;
+	for (auto it = S->funcSummaries.begin(), end = S->funcSummaries.end(); it != end; ) {
+		auto cur = it++;
+		if (!isStale(cur->first.first)) continue;
+		S->funcSummaries.erase(cur);
+		++dropped;
+	}
+	for (auto it = S->contextSummaries.begin(); it != S->contextSummaries.end(); ) {
+		if (isStale(it->first.first.first)) it = S->contextSummaries.erase(it);
+		else ++it;
+	}
+	for (auto it = S->summaryLeader.begin(), end = S->summaryLeader.end(); it != end; ) {
+		auto cur = it++;
+		if (changed.count(cur->first) || changed.count(cur->second)) S->summaryLeader.erase(cur);
+	}
+	for (auto& B : S->summaryBuckets)
+		erase_if(B.second, [&](Function* F) {return changed.count(F) != 0;});
+	for (auto it = S->funcProps.begin(), end = S->funcProps.end(); it != end; ) {
+		auto cur = it++;
+		if (isStale(cur->first)) S->funcProps.erase(cur);
+	}
+	S->BBLatCache.clear();
+
+	// indirect calls: targets are resolved again for the calls in the new bodies, and
+	// the bounds cached with a target set are dropped if a target is stale
+	for (auto it = S->callTargets.begin(), end = S->callTargets.end(); it != end; ) {
+		auto cur = it++;
+		if (inChanged(cur->first)) S->callTargets.erase(cur);
+	}
+	for (auto it = S->targetSets.begin(), end = S->targetSets.end(); it != end; ) {
+		auto cur = it++;
+		TargetSet* TS = cur->second;
+		if (any_of(TS->funcs, isStale)) std::fill(TS->hasLat, TS->hasLat + 4, false);
+		// sets of callee values are keyed by their call
+		if (cur->first.second == UINT64_MAX &&
+				changed.count(const_cast<Function*>(
+					static_cast<const CallBase*>(cur->first.first)->getFunction()))) {
+			S->targetSets.erase(cur);
+		}
+	}
+	S->typeTestsScanned = false;
+	S->indirectCallers.clear();
+	S->indirectCallersFound = false;
+
+	// instructions of the old bodies, about to be deleted
+	for (auto it = S->unknownOps.begin(); it != S->unknownOps.end(); ) {
+		auto cur = it++;
+		if (inChanged(cur->second.second)) S->unknownOps.erase(cur);
+	}
+	for (auto it = S->contendedWrites.begin(), end = S->contendedWrites.end(); it != end; ) {
+		auto cur = it++;
+		if (isStale((*cur)->getFunction())) S->contendedWrites.erase(cur);
+	}
+	S->contendedLines.clear();
+	S->machineLat.clear();
+
+	// txs in stale functions, or returning into them
+	DenseMap<Function*, bool> callsBack;
+	std::function<bool(Function*)> reachesStale = [&](Function* F) {
+		auto emplit = callsBack.try_emplace(F, isStale(F));
+		if (!emplit.second || emplit.first->second) return emplit.first->second;
+		bool found = false;
+		forCallers(F, [&](Function* C) {found = found || reachesStale(C);});
+		return callsBack[F] = found;
+	};
+	const unsigned before = S->foundTx.size();
+	erase_if(S->foundTx, [&](const TxInfo& info) {return reachesStale(info.ancestor);});
+	LLVM_DEBUG(dbgs() << "Invalidated " << changed.size() << " functions, " <<
+			S->invalidated.size() << " with their callers: " << dropped << " summaries, " <<
+			before - S->foundTx.size() << " of " << before << " txs\n");
+}
+
+void PrimeBortDetectorPass::beginRerun() {
+	S->rerun = true;
+	S->keptTx.clear();
+	for (TxInfo& info : S->foundTx) S->keptTx.try_emplace(info.entry, std::move(info));
+	S->foundTx.clear();
+	S->candidateMap.clear();
+	S->txBeginCallees.clear();
+	S->txCommitCallees.clear();
+	S->txEntries.clear();
+	S->boundaryLocks.clear();
+	S->keptBoundaryFuncs = std::move(S->txBoundaryFuncs);
+	S->txBoundaryFuncs.clear();
+	S->keptContendedWrites = std::move(S->contendedWrites);
+	S->contendedWrites.clear();
+	S->contendedLines.clear();
+}
+
+bool PrimeBortDetectorPass::reuseTx(TxInfo& info) {
+	auto k_it = S->keptTx.find(info.entry);
+	if (k_it == S->keptTx.end()) return false;
+	const TxInfo& K = k_it->second;
+	if (K.ancestor != info.ancestor || K.exits != info.exits ||
+			K.entryChain != info.entryChain || K.exitChains != info.exitChains) {
+		return false;
+	}
+	info.props = K.props;
+	info.txLat = K.txLat;
+	info.rtLat = K.rtLat;
+	return true;
+}
+
+void PrimeBortDetectorPass::dropSummaries() {
+	S->funcSummaries.clear();
+	S->contextSummaries.clear();
+	for (auto& E : S->targetSets) std::fill(E.second->hasLat, E.second->hasLat + 4, false);
+	S->BBLatCache.clear();
+}
+
+void PrimeBortDetectorPass::checkKeptBoundaries() {
+	bool same = S->keptBoundaryFuncs.size() == S->txBoundaryFuncs.size() &&
+		all_of(S->txBoundaryFuncs,
+			[&](const Function* F) {return S->keptBoundaryFuncs.count(F) != 0;});
+	if (same) return;
+	LLVM_DEBUG(dbgs() << "Boundary functions changed, summaries dropped\n");
+	dropSummaries();
+	S->funcProps.clear();
+	S->keptTx.clear();
+}
+
+void PrimeBortDetectorPass::checkKeptContention() {
+	bool same = true;
+	for (const Instruction* I : S->contendedWrites) {
+		if (!S->invalidated.count(I->getFunction()))
+			same &= S->keptContendedWrites.count(I) != 0;
+	}
+	for (const Instruction* I : S->keptContendedWrites) same &= S->contendedWrites.count(I) != 0;
+	S->rerun = false;
+	S->invalidated.clear();
+	S->keptTx.clear();
+	S->keptContendedWrites.clear();
+	if (same) return;
+	LLVM_DEBUG(dbgs() << "Contention changed, estimates dropped\n");
+	for (TxInfo& info : S->foundTx) {
+		info.txLat.clear();
+		info.rtLat.clear();
+	}
+}
+
+} // namespace llvm
@@ -0,0 +1,176 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortIndex.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#define DEBUG_TYPE "primebort"
+#include <cstring>
+#include <vector>
+
+/*
+ * Binary index of a run's results, for answering questions across many binaries with
+ * tools/primebort-query: which functions run inside sections longer than some bound,
+ * which locks are held around calls to malloc, ... One file per module, in the layout
+ * of PrimeBortIndex.h, which the tool maps and reads in place. Each tx has what the
+ * JSON results have (ancestor, entry, chains, latencies and footprint), plus its lock
+ * and every function called inside it; each function called inside a tx has its own
+ * latency, its flags and the txs it runs in.
+ */
+
+using namespace llvm;
+
+static cl::opt<std::string> IndexFile("primebort-index",
+		cl::desc("Write the found txs and the functions run inside them to this binary "
+			"index, for tools/primebort-query"),
+		cl::value_desc("file"), cl::init(""));
+
+namespace {
+
+class IndexBuilder {
+	StringMap<uint32_t> offsets;
+	std::string strings;
+
+	public:
+	std::vector<uint32_t> refs;
+
+	uint32_t str(StringRef S) {
+		auto emplit = offsets.try_emplace(S, strings.size());
+		if (emplit.second) {
+			strings += S;
+			strings += '\0';
+		}
+		return emplit.first->second;
+	}
+	// appends a list of chain callee names, returning where it starts
+	uint32_t chain(const SmallVectorImpl<Instruction*>& C) {
+		const uint32_t first = refs.size();
+		for (const Instruction* I : C) refs.push_back(str(PrimeBortDetectorPass::getChainName(I)));
+		return first;
+	}
+	const std::string& getStrings() const {return strings;}
+};
+
+template <typename T>
+void writeArray(raw_ostream& OS, const std::vector<T>& A) {
+	OS.write(reinterpret_cast<const char*>(A.data()), A.size() * sizeof(T));
+}
+
+uint64_t alignTo8(const uint64_t n) {return (n + 7) & ~(uint64_t) 7;}
+
+} // anonymous namespace
+
+namespace llvm {
+
+void PrimeBortDetectorPass::writeIndex(Module& M) {
+	if (IndexFile.empty()) return;
+
+	IndexBuilder B;
+	std::vector<PBIndexTx> txs;
+	std::vector<PBIndexExit> exits;
+	// functions run inside txs, with the ids of those txs
+	MapVector<Function*, SmallVector<uint32_t, 4> > inside;
+
+	for (unsigned t = 0; t < S->foundTx.size(); ++t) {
+		const TxInfo& info = S->foundTx[t];
+		PBIndexTx T;
+		std::memset(&T, 0, sizeof(T));
+		T.ancestor = B.str(info.ancestor->getName());
+		T.entry = B.str(getLocKey(info.entry));
+		T.lock = B.str(describeLock(info));
+		T.flags = info.props.flags;
+		T.txLat = maxTxLat(info);
+		T.rtLat = minRtLat(info);
+		T.readBytes = info.props.readBytes;
+		T.writeBytes = info.props.writeBytes;
+		T.firstExit = exits.size();
+		T.numExits = info.exits.size();
+		for (unsigned i = 0; i < info.exits.size(); ++i) {
+			PBIndexExit E;
+			std::memset(&E, 0, sizeof(E));
+			E.loc = B.str(getLocKey(info.exits[i]));
+			E.chain = B.chain(info.exitChains[i]);
+			E.chainLen = info.exitChains[i].size();
+			E.txLat = info.txLat[i];
+			E.rtLat = info.rtLat[i];
+			exits.push_back(E);
+		}
+		T.entryChain = B.chain(info.entryChain);
+		T.entryChainLen = info.entryChain.size();
+
+		T.callees = B.refs.size();
+		for (const auto* L : {&info.props.funcs, &info.props.externCalls}) {
+			for (Function* F : *L) {
+				B.refs.push_back(B.str(F->getName()));
+				inside[F].push_back(t);
+			}
+		}
+		T.numCallees = B.refs.size() - T.callees;
+		txs.push_back(T);
+	}
+
+	std::vector<PBIndexFunc> funcs;
+	for (auto& E : inside) {
+		Function* F = E.first;
+		PBIndexFunc R;
+		std::memset(&R, 0, sizeof(R));
+		R.name = B.str(F->getName());
+		if (F->isDeclaration()) {
+			R.flags = classifyExternCall(F->getName());
+		} else {
+			R.flags = getFuncProps(F).flags;
+			std::pair<size_t, size_t> lat = estimateFuncLat(F);
+			R.minLat = lat.first;
+			R.maxLat = lat.second;
+		}
+		R.txs = B.refs.size();
+		R.numTxs = E.second.size();
+		for (uint32_t t : E.second) {
+			B.refs.push_back(t);
+			R.txLat = std::max<uint64_t>(R.txLat, txs[t].txLat);
+		}
+		funcs.push_back(R);
+	}
+	// by name, so a lookup can bisect
+	const std::string& strings = B.getStrings();
+	std::sort(funcs.begin(), funcs.end(), [&](const PBIndexFunc& A, const PBIndexFunc& F) {
+		return std::strcmp(&strings[A.name], &strings[F.name]) < 0;
+	});
+
+	PBIndexHeader H;
+	std::memset(&H, 0, sizeof(H));
+	std::memcpy(H.magic, PBINDEX_MAGIC, sizeof(H.magic));
+	H.version = PBINDEX_VERSION;
+	H.byteOrder = PBINDEX_BYTE_ORDER;
+	H.module = B.str(M.getSourceFileName());
+	H.numTxs = txs.size();
+	H.numExits = exits.size();
+	H.numFuncs = funcs.size();
+	H.numRefs = B.refs.size();
+	H.stringsSize = strings.size();
+	H.txOffset = sizeof(H);
+	H.exitOffset = H.txOffset + txs.size() * sizeof(PBIndexTx);
+	H.funcOffset = H.exitOffset + exits.size() * sizeof(PBIndexExit);
+	H.refOffset = H.funcOffset + funcs.size() * sizeof(PBIndexFunc);
+	H.stringOffset = alignTo8(H.refOffset + B.refs.size() * sizeof(uint32_t));
+
+	std::error_code EC;
+	raw_fd_ostream OS(IndexFile, EC, sys::fs::OF_None);
+	if (EC) {
+		errs() << "PrimeBort: could not write the index to " << IndexFile << ": " <<
+			EC.message() << "\n";
+		return;
+	}
+	OS.write(reinterpret_cast<const char*>(&H), sizeof(H));
+	writeArray(OS, txs);
+	writeArray(OS, exits);
+	writeArray(OS, funcs);
+	writeArray(OS, B.refs);
+	OS.write_zeros(H.stringOffset - (H.refOffset + B.refs.size() * sizeof(uint32_t)));
+	OS << strings;
+	LLVM_DEBUG(dbgs() << "Indexed " << txs.size() << " txs, " << funcs.size() <<
+			" functions in " << IndexFile << '\n');
+}
+
+} // namespace llvm
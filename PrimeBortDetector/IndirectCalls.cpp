@@ -0,0 +1,220 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/Analysis/TypeMetadataUtils.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+#include "LibCost.h"
+
+/*
+ * Possible targets of indirect calls, for costing them and for climbing the caller
+ * graph through them. In order of preference:
+ * - virtual calls guarded by llvm.type.test or made through llvm.type.checked.load
+ *   (-fwhole-program-vtables, -fsanitize=cfi): the function at the call's offset in
+ *   every vtable carrying the same !type id
+ * - a callee that is a select/phi of known functions
+ * - every address-taken function of the call's type, if there are only a few
+ * The first two are precise; a call resolved only by its signature is still flagged
+ * RF_INDIRECT, and is only used to climb the caller graph if it has a single target.
+ * Target sets are shared by all calls with the same type id and offset, or the same
+ * function type, and cache the bound combined over their targets' summaries.
+ */
+
+using namespace llvm;
+
+static cl::opt<bool> ResolveIndirect("primebort-resolve-indirect",
+		cl::desc("Cost indirect calls by their possible targets"),
+		cl::init(true));
+
+static cl::opt<unsigned> MaxSignatureTargets("primebort-max-signature-targets",
+		cl::desc("Most address-taken functions a call resolved by its signature may have"),
+		cl::init(16));
+
+// most values followed through selects and phis for a local callee
+#define MAX_LOCAL_VALUES 16
+
+namespace llvm {
+
+void PrimeBortDetectorPass::scanTypeTests(Module& M) {
+	S->typeTestsScanned = true;
+	DenseMap<Function*, std::unique_ptr<DominatorTree> > trees;
+	auto getDT = [&trees](Function* F) -> DominatorTree& {
+		std::unique_ptr<DominatorTree>& DT = trees[F];
+		if (!DT) DT = std::make_unique<DominatorTree>(*F);
+		return *DT;
+	};
+
+	// vtables by type id, with the offset of the address point
+	DenseMap<const Metadata*, SmallVector<std::pair<GlobalVariable*, uint64_t>, 4> > vtables;
+	SmallVector<MDNode*, 2> types;
+	for (GlobalVariable& GV : M.globals()) {
+		if (!GV.hasDefinitiveInitializer()) continue;
+		types.clear();
+		GV.getMetadata(LLVMContext::MD_type, types);
+		for (MDNode* T : types) {
+			auto* off = mdconst::extract<ConstantInt>(T->getOperand(0));
+			vtables[T->getOperand(1).get()].emplace_back(&GV, off->getZExtValue());
+		}
+	}
+
+	auto resolve = [&](const Metadata* id, SmallVectorImpl<DevirtCallSite>& calls) {
+		for (DevirtCallSite& DC : calls) {
+			bool created;
+			TargetSet& TS = getTargetSet(id, DC.Offset, created);
+			if (created) {
+				TS.precise = true;
+				for (auto& V : vtables.lookup(id)) {
+					Constant* P = getPointerAtOffset(V.first->getInitializer(),
+							V.second + DC.Offset, M);
+					Function* F = (P) ? dyn_cast<Function>(P->stripPointerCasts()) : NULL;
+					if (F && !is_contained(TS.funcs, F)) TS.funcs.push_back(F);
+				}
+			}
+			S->callTargets[&DC.CB] = &TS;
+		}
+	};
+
+	if (Function* TT = M.getFunction("llvm.type.test")) {
+		for (User* U : TT->users()) {
+			CallInst* CI = dyn_cast<CallInst>(U);
+			if (!CI) continue;
+			auto* id = dyn_cast<MetadataAsValue>(CI->getArgOperand(1));
+			if (!id) continue;
+			SmallVector<DevirtCallSite, 1> calls;
+			SmallVector<CallInst*, 1> assumes;
+			findDevirtualizableCallsForTypeTest(calls, assumes, CI, getDT(CI->getFunction()));
+			resolve(id->getMetadata(), calls);
+		}
+	}
+	if (Function* TCL = M.getFunction("llvm.type.checked.load")) {
+		for (User* U : TCL->users()) {
+			CallInst* CI = dyn_cast<CallInst>(U);
+			if (!CI) continue;
+			auto* id = dyn_cast<MetadataAsValue>(CI->getArgOperand(2));
+			if (!id) continue;
+			SmallVector<DevirtCallSite, 1> calls;
+			SmallVector<Instruction*, 1> loads, preds;
+			bool otherUses;
+			findDevirtualizableCallsForTypeCheckedLoad(calls, loads, preds, otherUses, CI,
+					getDT(CI->getFunction()));
+			resolve(id->getMetadata(), calls);
+		}
+	}
+	LLVM_DEBUG(dbgs() << "Resolved " << S->callTargets.size() << " virtual calls\n");
+}
+
+PrimeBortDetectorPass::TargetSet& PrimeBortDetectorPass::getTargetSet(const void* key,
+		const uint64_t off, bool& created) {
+	TargetSet*& TS = S->targetSets[std::make_pair(key, off)];
+	created = !TS;
+	if (created) TS = new (S->targetSetAlloc.Allocate()) TargetSet();
+	return *TS;
+}
+
+PrimeBortDetectorPass::TargetSet* PrimeBortDetectorPass::getIndirectTargets(CallBase& CB) {
+	if (!ResolveIndirect || CB.isInlineAsm()) return NULL;
+	if (!S->typeTestsScanned) scanTypeTests(*CB.getModule());
+	auto c_it = S->callTargets.find(&CB);
+	if (c_it != S->callTargets.end()) return c_it->second;
+
+	// a callee picked from known functions
+	SmallVector<Function*, 4> local;
+	SmallVector<const Value*, 4> work = {CB.getCalledOperand()};
+	SmallPtrSet<const Value*, 8> seen;
+	bool known = true;
+	while (known && !work.empty()) {
+		const Value* V = work.pop_back_val()->stripPointerCasts();
+		if (!seen.insert(V).second) continue;
+		if (seen.size() > MAX_LOCAL_VALUES) known = false;
+		else if (const Function* F = dyn_cast<Function>(V)) {
+			if (!is_contained(local, F)) local.push_back(const_cast<Function*>(F));
+		} else if (const SelectInst* SI = dyn_cast<SelectInst>(V)) {
+			work.push_back(SI->getTrueValue());
+			work.push_back(SI->getFalseValue());
+		} else if (const PHINode* P = dyn_cast<PHINode>(V)) {
+			work.append(P->value_op_begin(), P->value_op_end());
+		} else known = false;
+	}
+	if (known && !local.empty()) {
+		bool created;
+		TargetSet& TS = getTargetSet(&CB, UINT64_MAX, created);
+		TS.funcs = std::move(local);
+		TS.precise = true;
+		return S->callTargets[&CB] = &TS;
+	}
+
+	// anything of the right type whose address is taken
+	FunctionType* FTy = CB.getFunctionType();
+	bool created;
+	TargetSet& TS = getTargetSet(FTy, UINT64_MAX - 1, created);
+	if (created) {
+		for (Function& F : *CB.getModule()) {
+			if (F.getFunctionType() == FTy && F.hasAddressTaken()) TS.funcs.push_back(&F);
+		}
+		if (TS.funcs.size() > MaxSignatureTargets) TS.funcs.clear();
+		LLVM_DEBUG(dbgs() << "Indirect calls of type " << *FTy << ": " <<
+				TS.funcs.size() << " targets\n");
+	}
+	return S->callTargets[&CB] = &TS;
+}
+
+size_t PrimeBortDetectorPass::estimateIndirectCallLat(CallBase& CB, ScalarEvolution& SE,
+		const size_t prev_lat, const unsigned topLevelTag, const bool longest,
+		const bool handleLoops) {
+	TargetSet* TS = getIndirectTargets(CB);
+	if (!TS || TS->funcs.empty()) return 0;
+	const unsigned mode = (unsigned) longest | (unsigned) handleLoops << 1;
+	if (TS->hasLat[mode]) return TS->lat[mode];
+
+	// the bound is shared by every call of the set, so it can only be kept if it
+	// doesn't depend on this call's arguments and every target's summary was kept
+	bool keep = !S->curContext &&
+		none_of(CB.args(), [](const Use& U) {return isa<ConstantInt>(U);});
+	size_t lat = (longest) ? 0 : SIZE_MAX;
+	for (Function* F : TS->funcs) {
+		size_t t_lat = 0;
+		if (S->txBoundaryFuncs.count(F)) {
+			// not costed, like a direct call to it
+		} else if (!F->isDeclaration()) {
+			t_lat = estimateCallLat(CB, F, prev_lat, topLevelTag, longest, handleLoops);
+			keep &= S->funcSummaries.count(std::make_pair(getSummaryLeader(F), mode)) != 0;
+		} else if (const LibCostTable::Model* LM = S->libCost->lookup(F->getName())) {
+			t_lat = S->libCost->getLat(CB, *LM, &SE, longest);
+			keep &= LM->sizeArg < 0;
+		}
+		if ((longest && t_lat > lat) || (!longest && t_lat < lat)) lat = t_lat;
+	}
+
+	if (keep) {
+		TS->lat[mode] = lat;
+		TS->hasLat[mode] = true;
+	}
+	return lat;
+}
+
+void PrimeBortDetectorPass::getCallers(Function* F, SmallVectorImpl<CallInst*>& callers) {
+	for (User* U : F->users()) {
+		CallInst* CI = dyn_cast<CallInst>(U);
+		if (CI && CI->getCalledOperand() == F) callers.push_back(CI);
+	}
+	if (!ResolveIndirect) return;
+
+	if (!S->indirectCallersFound) {
+		S->indirectCallersFound = true;
+		for (Function& C : *F->getParent()) {
+			for (Instruction& I : instructions(C)) {
+				CallInst* CI = dyn_cast<CallInst>(&I);
+				if (!CI || CI->getCalledFunction() || CI->isInlineAsm()) continue;
+				const TargetSet* TS = getIndirectTargets(*CI);
+				if (!TS || !(TS->precise || TS->funcs.size() == 1)) continue;
+				for (Function* T : TS->funcs) S->indirectCallers[T].push_back(CI);
+			}
+		}
+	}
+	auto i_it = S->indirectCallers.find(F);
+	if (i_it != S->indirectCallers.end())
+		callers.append(i_it->second.begin(), i_it->second.end());
+}
+
+} // namespace llvm
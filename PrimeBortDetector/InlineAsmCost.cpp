@@ -0,0 +1,307 @@
+#include "InlineAsmCost.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCParser/MCAsmParser.h"
+#include "llvm/MC/MCParser/MCTargetAsmParser.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSchedule.h"
+#include "llvm/MC/MCStreamer.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/MCTargetOptions.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#define DEBUG_TYPE "primebort"
+
+using namespace llvm;
+
+static cl::opt<std::string> AsmCPU("primebort-asm-cpu",
+		cl::desc("CPU whose scheduling model costs inline asm"),
+		cl::init("icelake-client"));
+static cl::opt<unsigned> AsmUnknownLat("primebort-asm-unknown-lat",
+		cl::desc("Latency (cycles) of an inline asm statement that can't be costed"),
+		cl::init(50));
+
+// LOCK is parsed as a separate prefix instruction with no latency of its own;
+// charge it like the atomics in LatencyVisitor (LOCK XADD 21 vs ADD m/r 7, roughly)
+#define LOCK_PREFIX_LAT 15
+
+namespace {
+
+// collects the parsed instructions instead of encoding them
+class InstCollector : public MCStreamer {
+	public:
+	SmallVector<MCInst, 8> insts;
+
+	InstCollector(MCContext& C) : MCStreamer(C) {}
+	void emitInstruction(const MCInst& I, const MCSubtargetInfo&) override {insts.push_back(I);}
+	bool emitSymbolAttribute(MCSymbol*, MCSymbolAttr) override {return true;}
+	void emitCommonSymbol(MCSymbol*, uint64_t, unsigned) override {}
+	void emitZerofill(MCSection*, MCSymbol*, uint64_t, unsigned, SMLoc) override {}
+};
+
+// names of the x86 GPRs in each width, for the letters that pin a register
+const char* pinnedReg(const char c, const unsigned bits) {
+	static const char* const regs[][4] = {
+		{"al", "ax", "eax", "rax"}, {"bl", "bx", "ebx", "rbx"},
+		{"cl", "cx", "ecx", "rcx"}, {"dl", "dx", "edx", "rdx"},
+		{"sil", "si", "esi", "rsi"}, {"dil", "di", "edi", "rdi"}
+	};
+	const unsigned w = (bits <= 8) ? 0 : (bits <= 16) ? 1 : (bits <= 32) ? 2 : 3;
+	switch (c) {
+	case 'a': return regs[0][w];
+	case 'b': return regs[1][w];
+	case 'c': return regs[2][w];
+	case 'd': return regs[3][w];
+	case 'S': return regs[4][w];
+	case 'D': return regs[5][w];
+	default: return nullptr;
+	}
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+InlineAsmCost::InlineAsmCost(const Module& M) :
+		triple(M.getTargetTriple()), T(nullptr), tried(false) {
+	if (triple.empty()) triple = sys::getDefaultTargetTriple();
+}
+
+InlineAsmCost::~InlineAsmCost() = default;
+
+bool InlineAsmCost::init() {
+	// the tool running the pass has to have registered the target's asm parser,
+	// which opt and clang both do
+	std::string err;
+	T = TargetRegistry::lookupTarget(triple, err);
+	if (!T || !T->hasMCAsmParser()) {
+		LLVM_DEBUG(dbgs() << "No asm parser for " << triple << ", inline asm costs " <<
+				AsmUnknownLat << " per call\n");
+		T = nullptr;
+		return false;
+	}
+	MCTargetOptions opts;
+	MRI.reset(T->createMCRegInfo(triple));
+	if (MRI) MAI.reset(T->createMCAsmInfo(*MRI, triple, opts));
+	STI.reset(T->createMCSubtargetInfo(triple, AsmCPU, ""));
+	MII.reset(T->createMCInstrInfo());
+	if (!MRI || !MAI || !STI || !MII) T = nullptr;
+	return T != nullptr;
+}
+
+// replace the operand references in the asm string with something of the right kind
+// for each operand's constraint: the parser only needs the shape to pick an opcode
+std::string InlineAsmCost::substitute(const CallBase& CB, const bool intel) {
+	const InlineAsm* IA = cast<InlineAsm>(CB.getCalledOperand());
+	InlineAsm::ConstraintInfoVector constraints = IA->ParseConstraints();
+
+	struct Operand {
+		const InlineAsm::ConstraintInfo* C;
+		Type* T;
+		const Value* V; // argument, null for direct outputs
+	};
+	SmallVector<Operand, 8> ops;
+	unsigned retNo = 0, argNo = 0;
+	for (const InlineAsm::ConstraintInfo& C : constraints) {
+		if (C.Type == InlineAsm::isClobber) continue;
+		if (C.hasArg()) {
+			const Value* V = CB.getArgOperand(argNo++);
+			ops.push_back({&C, V->getType(), V});
+		} else if (StructType* ST = dyn_cast<StructType>(CB.getType())) {
+			ops.push_back({&C, ST->getElementType(retNo++), nullptr});
+		} else {
+			ops.push_back({&C, CB.getType(), nullptr});
+		}
+	}
+
+	auto operandText = [&](unsigned n, const char mod, raw_ostream& OS) {
+		// a tied operand is the operand it is tied to
+		for (unsigned hops = 0; n < ops.size() && hops < ops.size(); ++hops) {
+			StringRef code = ops[n].C->Codes.empty() ? "r" : ops[n].C->Codes[0];
+			unsigned tied;
+			if (code.getAsInteger(10, tied)) break;
+			n = tied;
+		}
+		if (n >= ops.size()) {
+			OS << (intel ? "rax" : "%rax");
+			return;
+		}
+		const Operand& O = ops[n];
+		StringRef code = O.C->Codes.empty() ? "r" : O.C->Codes[0];
+		unsigned bits = 64;
+		if (O.T->isIntegerTy()) bits = O.T->getIntegerBitWidth();
+		else if (O.T->isVectorTy()) bits = O.T->getPrimitiveSizeInBits().getFixedSize();
+		switch (mod) {
+		case 'b': case 'h': bits = 8; break;
+		case 'w': bits = 16; break;
+		case 'k': bits = 32; break;
+		case 'q': bits = 64; break;
+		}
+		const char* reg = nullptr;
+		std::string buf;
+
+		if (O.C->isIndirect || code == "m" || code == "o" || code == "V" || code == "p") {
+			OS << (intel ? "[rsp]" : "(%rsp)");
+			return;
+		} else if (code.size() == 1 && StringRef("inIJKLMNeZ").contains(code[0])) {
+			int64_t imm = 1;
+			if (const ConstantInt* CI = dyn_cast_or_null<ConstantInt>(O.V))
+				imm = CI->getSExtValue();
+			if (mod == 'n') imm = -imm;
+			if (!intel && mod != 'c' && mod != 'n') OS << '$';
+			OS << imm;
+			return;
+		} else if (code.startswith("{") && code.endswith("}")) {
+			StringRef name = code.drop_front().drop_back();
+			reg = StringSwitch<const char*>(name)
+				.Case("ax", pinnedReg('a', bits)).Case("bx", pinnedReg('b', bits))
+				.Case("cx", pinnedReg('c', bits)).Case("dx", pinnedReg('d', bits))
+				.Case("si", pinnedReg('S', bits)).Case("di", pinnedReg('D', bits))
+				.Default(nullptr);
+			if (!reg) {
+				buf = name.str();
+				reg = buf.c_str();
+			}
+		} else if (code.size() == 1 && pinnedReg(code[0], bits)) {
+			reg = pinnedReg(code[0], bits);
+		} else if (code == "x" || code == "v" || code == "Yz") {
+			buf = (bits > 256 ? "zmm" : bits > 128 ? "ymm" : "xmm") + std::to_string(n % 16);
+			reg = buf.c_str();
+		} else if (code == "t" || code == "f") {
+			reg = "st(0)";
+		} else if (code == "u") {
+			reg = "st(1)";
+		} else {
+			// any other register class: one of r8-r15, by operand number so they don't clash
+			buf = "r" + std::to_string(8 + n % 8) +
+				(bits <= 8 ? "b" : bits <= 16 ? "w" : bits <= 32 ? "d" : "");
+			reg = buf.c_str();
+		}
+		if (!intel) OS << '%';
+		OS << reg;
+	};
+
+	// $N, ${N}, ${N:mod}, $$, and $( $| $) for the per-dialect alternatives, of which
+	// the first one is used (AT&T, the only dialect the alternatives appear in)
+	StringRef S = IA->getAsmString();
+	std::string out;
+	raw_string_ostream OS(out);
+	unsigned alt = 0;
+	bool inAlt = false;
+	for (size_t i = 0; i < S.size(); ++i) {
+		const bool emit = !inAlt || alt == 0;
+		if (S[i] != '$' || i+1 == S.size()) {
+			if (emit) OS << S[i];
+			continue;
+		}
+		const char c = S[++i];
+		if (c == '(') {
+			inAlt = true;
+			alt = 0;
+		} else if (c == '|') {
+			++alt;
+		} else if (c == ')') {
+			inAlt = false;
+		} else if (c == '$') {
+			if (emit) OS << '$';
+		} else if (isDigit(c)) {
+			size_t j = i;
+			while (j < S.size() && isDigit(S[j])) ++j;
+			unsigned n;
+			S.slice(i, j).getAsInteger(10, n);
+			if (emit) operandText(n, 0, OS);
+			i = j - 1;
+		} else if (c == '{') {
+			const size_t j = S.find('}', i);
+			if (j == StringRef::npos) break;
+			StringRef ref = S.slice(i+1, j);
+			const std::pair<StringRef, StringRef> parts = ref.split(':');
+			unsigned n;
+			if (emit && !parts.first.getAsInteger(10, n))
+				operandText(n, parts.second.empty() ? 0 : parts.second[0], OS);
+			i = j;
+		} else if (emit) {
+			OS << '$' << c;
+		}
+	}
+	return OS.str();
+}
+
+size_t InlineAsmCost::costAsm(StringRef text, const unsigned dialect) {
+	SourceMgr SM;
+	SM.AddNewSourceBuffer(MemoryBuffer::getMemBufferCopy(text, "<inline asm>"), SMLoc());
+	// count errors instead of printing them, each one is a statement we can't cost
+	unsigned errors = 0;
+	SM.setDiagHandler([](const SMDiagnostic& D, void* ctx) {
+		if (D.getKind() == SourceMgr::DK_Error) ++*static_cast<unsigned*>(ctx);
+	}, &errors);
+
+	MCContext Ctx(Triple(triple), MAI.get(), MRI.get(), STI.get(), &SM);
+	std::unique_ptr<MCObjectFileInfo> MOFI(T->createMCObjectFileInfo(Ctx, false));
+	Ctx.setObjectFileInfo(MOFI.get());
+	InstCollector S(Ctx);
+	std::unique_ptr<MCAsmParser> P(createMCAsmParser(SM, Ctx, S, *MAI));
+	MCTargetOptions opts;
+	std::unique_ptr<MCTargetAsmParser> TAP(T->createMCAsmParser(*STI, *P, *MII, opts));
+	if (!TAP) return AsmUnknownLat;
+	P->setTargetParser(*TAP);
+	P->setAssemblerDialect(dialect);
+	// don't finalize, local labels used by the asm may be defined elsewhere
+	P->Run(false, true);
+
+	// data directives in inline asm are almost always hand-encoded instructions
+	// the assembler doesn't know yet, one per statement
+	SmallVector<StringRef, 8> stmts;
+	SplitString(text, stmts, "\n;");
+	for (StringRef stmt : stmts) {
+		stmt = stmt.ltrim();
+		if (stmt.startswith(".byte") || stmt.startswith(".short") || stmt.startswith(".word") ||
+				stmt.startswith(".long") || stmt.startswith(".int") || stmt.startswith(".quad"))
+			++errors;
+	}
+
+	size_t lat = (size_t) errors * AsmUnknownLat;
+	const MCSchedModel& SchedModel = STI->getSchedModel();
+	for (const MCInst& I : S.insts) {
+		if (MII->getName(I.getOpcode()) == "LOCK_PREFIX") {
+			lat += LOCK_PREFIX_LAT;
+			continue;
+		}
+		const int l = SchedModel.computeInstrLatency(*STI, *MII, I);
+		lat += (l < 0) ? (size_t) AsmUnknownLat : (size_t) l;
+	}
+	return lat;
+}
+
+size_t InlineAsmCost::getLat(const CallBase& CB) {
+	if (!tried) {
+		tried = true;
+		init();
+	}
+	if (!T) return AsmUnknownLat;
+
+	const InlineAsm* IA = cast<InlineAsm>(CB.getCalledOperand());
+	const bool intel = IA->getDialect() == InlineAsm::AD_Intel;
+	const std::string text = substitute(CB, intel);
+	auto c_it = cache.find((intel ? "i" : "a") + text);
+	if (c_it != cache.end()) return c_it->second;
+
+	const size_t lat = costAsm(text, intel ? 1 : 0);
+	LLVM_DEBUG(dbgs() << "inline asm \"" << text << "\": " << lat << " cycles\n");
+	cache[(intel ? "i" : "a") + text] = lat;
+	return lat;
+}
+
+} // namespace llvm
@@ -0,0 +1,44 @@
+#pragma once
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Module.h"
+#include <memory>
+
+/*
+ * Latency estimates for inline asm. The asm string has its operands replaced with
+ * concrete registers/memory/immediates picked from the constraints, is parsed with
+ * the target's MC assembler, and each instruction is costed with the MC scheduling
+ * model of the CPU set by -primebort-asm-cpu. Statements that don't parse, and raw
+ * bytes emitted with data directives, cost -primebort-asm-unknown-lat each.
+ * Results are cached per substituted string.
+ */
+namespace llvm {
+
+class MCAsmInfo;
+class MCInstrInfo;
+class MCRegisterInfo;
+class MCSubtargetInfo;
+class Target;
+
+class InlineAsmCost {
+	private:
+	std::string triple;
+	const Target* T;
+	std::unique_ptr<MCRegisterInfo> MRI;
+	std::unique_ptr<MCAsmInfo> MAI;
+	std::unique_ptr<MCSubtargetInfo> STI;
+	std::unique_ptr<MCInstrInfo> MII;
+	bool tried; // MC setup attempted, T is null if it failed
+	StringMap<size_t> cache;
+
+	bool init();
+	std::string substitute(const CallBase&, const bool);
+	size_t costAsm(StringRef, const unsigned);
+
+	public:
+	explicit InlineAsmCost(const Module&);
+	~InlineAsmCost();
+	size_t getLat(const CallBase&);
+};
+
+} // namespace llvm
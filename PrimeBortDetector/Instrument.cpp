@@ -0,0 +1,118 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+/*
+ * Timing probes for calibrating the static estimates against real runs.
+ * Every tx found gets a descriptor (see PrimeBortRuntime/primebort_rt.h) holding
+ * its static estimates, a call to __primebort_tx_enter right after its entry, and a
+ * call to __primebort_tx_exit right before each of its exits. The runtime takes the
+ * timestamps, so a probe is a call plus an RDTSC(P). A call inside an RTM tx can abort
+ * it (the thread's first probe allocates), so RTM txs are probed outside: right before
+ * the entry and right after each exit, with __primebort_tx_abort at the start of the
+ * abort side of the status check, where the attempt's open entry is dropped.
+ * The descriptor table is shared with the other runtime-assisted modes.
+ */
+
+using namespace llvm;
+
+namespace llvm {
+
+cl::opt<bool> PrimeBortInstrument("primebort-instrument",
+		cl::desc("Insert timing probes at tx entries and exits (link with the PrimeBort runtime)"),
+		cl::init(false));
+
+GlobalVariable* PrimeBortDetectorPass::getTxDescTable(Module& M) {
+	if (S->txDescTable) return S->txDescTable;
+
+	LLVMContext& C = M.getContext();
+	Type* VoidTy = Type::getVoidTy(C);
+	IntegerType* I32 = Type::getInt32Ty(C);
+	IntegerType* I64 = Type::getInt64Ty(C);
+	StructType* DescTy = StructType::create(C,
+			{I32, I32, Type::getInt8PtrTy(C), I64, I64}, "primebort.txdesc");
+
+	// one descriptor per tx, named after its lock and entry location
+	IRBuilder<> B(C);
+	SmallVector<Constant*, 8> descs;
+	for (const TxInfo& info : S->foundTx) {
+		std::string name;
+		raw_string_ostream OS(name);
+		OS << describeLock(info) << " @ ";
+		printLoc(OS, info.entry);
+		descs.push_back(ConstantStruct::get(DescTy, {
+			ConstantInt::get(I32, UINT32_MAX), ConstantInt::get(I32, 0),
+			B.CreateGlobalStringPtr(OS.str(), "primebort.txname", 0, &M),
+			ConstantInt::get(I64, maxTxLat(info)), ConstantInt::get(I64, minRtLat(info))
+		}));
+	}
+	ArrayType* TableTy = ArrayType::get(DescTy, descs.size());
+	S->txDescTable = new GlobalVariable(M, TableTy, false,
+			GlobalValue::InternalLinkage, ConstantArray::get(TableTy, descs),
+			"primebort.txdesc");
+
+	// register the descriptors before main
+	FunctionCallee regFn = M.getOrInsertFunction("__primebort_register",
+			VoidTy, DescTy->getPointerTo(), I32);
+	Function* ctor = Function::Create(FunctionType::get(VoidTy, false),
+			GlobalValue::InternalLinkage, "primebort.register", M);
+	B.SetInsertPoint(BasicBlock::Create(C, "", ctor));
+	B.CreateCall(regFn, {getTxDesc(0), ConstantInt::get(I32, descs.size())});
+	B.CreateRetVoid();
+	appendToGlobalCtors(M, ctor, 0);
+
+	return S->txDescTable;
+}
+
+Constant* PrimeBortDetectorPass::getTxDesc(const unsigned i) {
+	assert(S->txDescTable && i < S->foundTx.size());
+	IntegerType* I32 = Type::getInt32Ty(S->txDescTable->getContext());
+	return ConstantExpr::getInBoundsGetElementPtr(S->txDescTable->getValueType(), S->txDescTable,
+			ArrayRef<Constant*>({ConstantInt::get(I32, 0), ConstantInt::get(I32, i)}));
+}
+
+bool PrimeBortDetectorPass::instrumentTx(Module& M) {
+	if (!PrimeBortInstrument || S->foundTx.empty()) return false;
+
+	getTxDescTable(M);
+	Type* VoidTy = Type::getVoidTy(M.getContext());
+	Type* DescPtrTy = getTxDesc(0)->getType();
+	FunctionCallee enterFn = M.getOrInsertFunction("__primebort_tx_enter", VoidTy, DescPtrTy);
+	FunctionCallee exitFn = M.getOrInsertFunction("__primebort_tx_exit", VoidTy, DescPtrTy);
+	FunctionCallee abortFn = M.getOrInsertFunction("__primebort_tx_abort", VoidTy, DescPtrTy);
+
+	IRBuilder<> B(M.getContext());
+	for (unsigned i = 0; i < S->foundTx.size(); ++i) {
+		const TxInfo& info = S->foundTx[i];
+		Constant* desc = getTxDesc(i);
+		if (isRTMTx(info)) {
+			B.SetInsertPoint(info.entry);
+			B.CreateCall(enterFn, {desc});
+			for (Instruction* exit : info.exits) {
+				B.SetInsertPoint(exit->getNextNode());
+				B.CreateCall(exitFn, {desc});
+			}
+			// without a recognized status check, the runtime restarts the entry the
+			// next attempt finds open
+			if (BranchInst* BI = info.abort.check) {
+				const ICmpInst* C = cast<ICmpInst>(BI->getCondition());
+				BasicBlock* abortBB = BI->getSuccessor(
+						(C->getPredicate() == ICmpInst::ICMP_EQ) ? 1 : 0);
+				B.SetInsertPoint(&*abortBB->getFirstInsertionPt());
+				B.CreateCall(abortFn, {desc});
+			}
+			continue;
+		}
+		B.SetInsertPoint(afterBoundary(info.entry));
+		B.CreateCall(enterFn, {desc});
+		for (Instruction* exit : info.exits) {
+			B.SetInsertPoint(exit);
+			B.CreateCall(exitFn, {desc});
+		}
+	}
+
+	return true;
+}
+
+} // namespace llvm
@@ -0,0 +1,201 @@
+#include "LatencyVisitor.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+/*
+ * The vector side of LatencyVisitor. A vector op costs what the same instruction
+ * costs on one register of the target's vector width (-primebort-vector-width), plus
+ * a cycle for each further register a wider vector is split into, since the parts
+ * pipeline; division doesn't pipeline, and integer division isn't vectorized at all,
+ * so it is charged per element. Shuffles cost nothing if they only pick a register
+ * out of a wider one, a cycle if they stay within 128 bits, and a lane crossing
+ * permute otherwise. Masked loads and stores, gathers, scatters and reductions are
+ * costed here instead of being taken for calls.
+ * Instructions the visitor has no model for used to be printed on every visit; they
+ * are counted per run and printed once, by what is missing.
+ */
+
+using namespace llvm;
+
+static cl::opt<unsigned> VectorWidth("primebort-vector-width",
+		cl::desc("Width in bits of the target's vector registers (128, 256 or 512)"),
+		cl::init(512));
+
+namespace llvm {
+
+void LatencyVisitor::noteUnknown(const Instruction& I, const char* what) {
+	if (!unknownOps) {
+		errs() << "LatencyVisitor: " << what << ": " << I << "\n";
+		return;
+	}
+	auto emplit = unknownOps->try_emplace((Twine(what) + ": " + I.getOpcodeName()).str(),
+			0, &I);
+	++emplit.first->second.first;
+}
+
+void LatencyVisitor::printUnknownOps(raw_ostream& OS, const UnknownOps& ops) {
+	if (ops.empty()) return;
+	SmallVector<const UnknownOps::value_type*, 8> sorted;
+	for (const auto& E : ops) sorted.push_back(&E);
+	std::sort(sorted.begin(), sorted.end(),
+		[](const UnknownOps::value_type* A, const UnknownOps::value_type* B) {
+			if (A->second.first != B->second.first) return A->second.first > B->second.first;
+			return A->first() < B->first();
+		});
+
+	OS << "PrimeBort instructions without a latency model (costed 1 cycle)\n=====\n";
+	for (const UnknownOps::value_type* E : sorted) {
+		const Instruction* I = E->second.second;
+		OS << E->second.first << " x " << E->first() << ", e.g. in " <<
+			I->getFunction()->getName() << ":" << *I << '\n';
+	}
+	OS << "=====\n";
+}
+
+unsigned LatencyVisitor::getParts(const Type* T) {
+	const VectorType* VT = dyn_cast<VectorType>(T);
+	if (!VT) return 0;
+	const FixedVectorType* FVT = dyn_cast<FixedVectorType>(VT);
+	if (!FVT) return 1;
+	const uint64_t bits = FVT->getNumElements() * FVT->getScalarSizeInBits();
+	return std::max<uint64_t>(1, divideCeil(bits, VectorWidth));
+}
+
+bool LatencyVisitor::isZMMOp(const Instruction& I) {
+	if (VectorWidth < 512 || isa<LoadInst>(I) || isa<StoreInst>(I) || isa<CastInst>(I) ||
+			isa<PHINode>(I)) {
+		return false;
+	}
+	auto isZMM = [](const Type* T) {
+		const FixedVectorType* FVT = dyn_cast<FixedVectorType>(T);
+		return FVT && FVT->getNumElements() * FVT->getScalarSizeInBits() >= 512;
+	};
+	return isZMM(I.getType()) ||
+		any_of(I.operands(), [&](const Use& U) {return isZMM(U->getType());});
+}
+
+unsigned LatencyVisitor::getVectorBinOpLat(BinaryOperator& I, const unsigned parts) {
+	const unsigned elemBits = I.getType()->getScalarSizeInBits();
+	switch (I.getOpcode()) {
+	case Instruction::Add: // VPADDD z/z/z
+	case Instruction::Sub: // VPSUBD z/z/z
+	case Instruction::And: // VPANDD z/z/z
+	case Instruction::Or: // VPORD z/z/z
+	case Instruction::Xor: // VPXORD z/z/z
+	case Instruction::Shl: // VPSLLVD z/z/z
+	case Instruction::LShr: // VPSRLVD z/z/z
+	case Instruction::AShr: // VPSRAVD z/z/z
+		return 1 + parts - 1;
+	case Instruction::Mul: // VPMULLW / VPMULLD / VPMULLQ z/z/z
+		return ((elemBits <= 16) ? 5 : (elemBits <= 32) ? 10 : 15) + parts - 1;
+	case Instruction::UDiv:
+	case Instruction::SDiv:
+	case Instruction::URem:
+	case Instruction::SRem: // no vector DIV: VPEXTRD + DIV r64 + VPINSRD per element
+		return cast<VectorType>(I.getType())->getElementCount().getKnownMinValue() *
+			(15 + 2 + 2);
+	case Instruction::FAdd: // VADDPS z/z/z
+	case Instruction::FSub: // VSUBPS z/z/z
+	case Instruction::FMul: // VMULPS z/z/z
+		return 4 + parts - 1;
+	case Instruction::FDiv: { // VDIVPS / VDIVPD, 11 / 13 up to ymm, 18 / 23 for zmm
+		// by the registers this divide uses, a narrow one stays in xmm/ymm on any target
+		const bool zmm = isZMMOp(I);
+		return ((elemBits <= 32) ? ((zmm) ? 18 : 11) : ((zmm) ? 23 : 13)) * parts;
+	}
+	default:
+		noteUnknown(I, "unrecognized vector binary op");
+		return parts;
+	}
+}
+
+void LatencyVisitor::visitShuffleVectorInst(ShuffleVectorInst& I) {
+	const unsigned parts = getParts(I.getType());
+	if (I.isIdentity() || I.isIdentityWithPadding() || I.isIdentityWithExtract()) {
+		return; // a register out of a wider one, or into one
+	}
+	const VectorType* VT = cast<VectorType>(I.getType());
+	const bool inLane = VT->getPrimitiveSizeInBits().getKnownMinSize() <= 128;
+	if (inLane && I.isSingleSource()) lat += 1; // PSHUFD x/x/i
+	else lat += 3 + parts - 1; // VPERMD z/z/z, VPERMT2D z/z/z, VPBROADCASTD z/x
+}
+
+void LatencyVisitor::visitCastInst(CastInst& I) {
+	const unsigned parts = std::max(getParts(I.getSrcTy()), getParts(I.getDestTy()));
+	if (!parts) return;
+	switch (I.getOpcode()) {
+	case Instruction::SIToFP: // VCVTDQ2PS z/z
+	case Instruction::UIToFP: // VCVTUDQ2PS z/z
+	case Instruction::FPToSI: // VCVTTPS2DQ z/z
+	case Instruction::FPToUI: // VCVTTPS2UDQ z/z
+		lat += 4 + parts - 1; break;
+	case Instruction::FPExt: // VCVTPS2PD z/y
+	case Instruction::FPTrunc: // VCVTPD2PS y/z
+		lat += 7 + parts - 1; break;
+	case Instruction::ZExt: // VPMOVZXBD z/x
+	case Instruction::SExt: // VPMOVSXBD z/x
+	case Instruction::Trunc: // VPMOVDB x/z
+		lat += 3 + parts - 1; break;
+	default: // bitcasts and pointer casts are reinterps
+		break;
+	}
+}
+
+bool LatencyVisitor::visitVectorIntrinsic(IntrinsicInst& I) {
+	// the vector operand of each intrinsic: what the op is as wide as
+	auto partsOf = [&](const unsigned arg) {return getParts(I.getArgOperand(arg)->getType());};
+	auto elemsOf = [&](const unsigned arg) {
+		const FixedVectorType* FVT = dyn_cast<FixedVectorType>(I.getArgOperand(arg)->getType());
+		return (FVT) ? FVT->getNumElements() : 1;
+	};
+	// a reduction is log2(elements) halving steps of a shuffle and the op,
+	// after the registers of a split vector are combined
+	auto reduceLat = [&](const unsigned arg, const unsigned opLat) -> size_t {
+		const unsigned parts = std::max(partsOf(arg), 1u);
+		return (parts - 1) * opLat + Log2_32_Ceil(elemsOf(arg) / parts) * (3 + opLat);
+	};
+
+	switch (I.getIntrinsicID()) {
+	case Intrinsic::masked_load: // VMOVDQU32 z{k}/m
+		lat += 7 + getParts(I.getType()) - 1; break;
+	case Intrinsic::masked_store: // VMOVDQU32 m{k}/z
+		lat += 5 + partsOf(0) - 1; break;
+	case Intrinsic::masked_expandload: // VPEXPANDD z{k}/m
+		lat += 8 + getParts(I.getType()) - 1; break;
+	case Intrinsic::masked_compressstore: // VPCOMPRESSD m{k}/z
+		lat += 11 + partsOf(0) - 1; break;
+	// an element at a time through the load and store ports
+	case Intrinsic::masked_gather: // VPGATHERDD z{k}/vm
+		lat += 14 + cast<VectorType>(I.getType())->getElementCount().getKnownMinValue() / 2;
+		break;
+	case Intrinsic::masked_scatter: // VPSCATTERDD vm{k}/z
+		lat += 4 + elemsOf(0); break;
+	case Intrinsic::vector_reduce_add:
+	case Intrinsic::vector_reduce_and:
+	case Intrinsic::vector_reduce_or:
+	case Intrinsic::vector_reduce_xor:
+	case Intrinsic::vector_reduce_smax:
+	case Intrinsic::vector_reduce_smin:
+	case Intrinsic::vector_reduce_umax:
+	case Intrinsic::vector_reduce_umin:
+		lat += reduceLat(0, 1); break;
+	case Intrinsic::vector_reduce_mul:
+		lat += reduceLat(0, 10); break;
+	case Intrinsic::vector_reduce_fmax:
+	case Intrinsic::vector_reduce_fmin:
+		lat += reduceLat(0, 4); break;
+	case Intrinsic::vector_reduce_fadd:
+	case Intrinsic::vector_reduce_fmul:
+		// in order unless reassociation is allowed: one VADDSS per element
+		if (I.hasAllowReassoc()) lat += reduceLat(1, 4);
+		else lat += elemsOf(1) * 4;
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+} // namespace llvm
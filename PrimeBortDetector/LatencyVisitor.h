@@ -1,7 +1,11 @@
 #pragma once
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/InstVisitor.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instruction.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "InlineAsmCost.h"
 	
 /*
  * This class provides a latency estimate in cycles for a visited BasicBlock.
@@ -12,26 +16,70 @@
  * has my best choice for the corresponding x86 instruction commented next to it.
  * All latencies are taken from Agner Fog's tables for Ice/Tiger Lake:
  * https://www.agner.org/optimize/instruction_tables.pdf starting at p. 313
+ * Vector ops, shuffles and the masked/gather/scatter intrinsics are costed in
+ * LatencyVisitor.cpp, by the registers they take at the target's vector width.
  */
 namespace llvm {
 
 class LatencyVisitor : public InstVisitor<LatencyVisitor> {
+	public:
+	// instructions without a latency model, by what is missing: count and an example
+	typedef StringMap<std::pair<unsigned, const Instruction*> > UnknownOps;
+
 	private:
 	SmallVector<CallBase*, 4> calls;
 	size_t lat;
+	InlineAsmCost* asmCost; // inline asm is skipped without one
+
+	UnknownOps* unknownOps; // printed right away without one
+	// post-ISel latencies replacing the model, see MachineLatency.cpp
+	const DenseMap<const Instruction*, unsigned>* machineLat;
+
+	void noteUnknown(const Instruction& I, const char* what);
+	// registers a vector of type T takes, 0 if T isn't a vector
+	static unsigned getParts(const Type* T);
+	unsigned getVectorBinOpLat(BinaryOperator& I, const unsigned parts);
+	bool visitVectorIntrinsic(IntrinsicInst& I);
 
 	public:
-	LatencyVisitor() : calls(), lat(0) {}
+	LatencyVisitor(InlineAsmCost* AC = nullptr, UnknownOps* unknown = nullptr,
+			const DenseMap<const Instruction*, unsigned>* machine = nullptr)
+		: calls(), lat(0), asmCost(AC), unknownOps(unknown), machineLat(machine) {}
 	bool hasCall () const {return !calls.empty();}
 	CallBase* popCall () {return calls.pop_back_val();}
 	size_t getLat() const {return lat;}
+	// whether I works on 512-bit registers, which lowers the core's clock
+	static bool isZMMOp(const Instruction& I);
+	static void printUnknownOps(raw_ostream& OS, const UnknownOps& ops);
 
-	void visitLoadInst (LoadInst& I) {lat += 3;} // MOV r/m
-	void visitStoreInst (StoreInst& I) {lat += 2;} // MOV m/r
+	// the model still runs for instructions with a post-ISel latency, for the calls
+	using InstVisitor<LatencyVisitor>::visit;
+	void visit(Instruction& I) {
+		const size_t before = lat;
+		InstVisitor<LatencyVisitor>::visit(I);
+		if (!machineLat) return;
+		auto m_it = machineLat->find(&I);
+		if (m_it != machineLat->end()) lat = before + m_it->second;
+	}
+	void visit(Instruction* I) {visit(*I);}
+
+	// a vector split over several registers takes one more cycle per register
+	void visitLoadInst (LoadInst& I) { // MOV r/m, VMOVDQU z/m
+		const unsigned parts = getParts(I.getType());
+		lat += 3 + ((parts) ? parts - 1 : 0);
+	}
+	void visitStoreInst (StoreInst& I) { // MOV m/r, VMOVDQU m/z
+		const unsigned parts = getParts(I.getValueOperand()->getType());
+		lat += 2 + ((parts) ? parts - 1 : 0);
+	}
 	// TODO: memory op lats assume line is in L1 -- not sure how to improve this
 	void visitAtomicCmpXchgInst (AtomicCmpXchgInst& I) {lat += 22;} // LOCK CMPXCHG m/r
 	void visitAtomicRMWInst(AtomicRMWInst& I) {lat += 21;} // LOCK XADD m/r
 	void visitBinaryOperator(BinaryOperator& I) {
+		if (const unsigned parts = getParts(I.getType())) {
+			lat += getVectorBinOpLat(I, parts);
+			return;
+		}
 		// instructions with dest memory operands have significantly higher latencies
 		// not the case with src memory operands, interestingly.
 		if (I.mayWriteToMemory()) { 
@@ -47,26 +95,26 @@ class LatencyVisitor : public InstVisitor<LatencyVisitor> {
 			case Instruction::AShr: // SAR m/r
 				lat += 2; break;
 			case Instruction::Mul:
-				errs() << "LV: int mul with dest memory operand: " << I << "\n"; 
+				noteUnknown(I, "int mul with dest memory operand");
 				lat += 4; break;
 			case Instruction::UDiv:
 			case Instruction::SDiv: 
 			case Instruction::URem:
 			case Instruction::SRem:
-				errs() << "LV: int div with dest memory operand: " << I << "\n"; 
+				noteUnknown(I, "int div with dest memory operand");
 				lat += 15; break;
 			case Instruction::FAdd: // FADD m
 			case Instruction::FSub: // FSUB m 
-				errs() << "LV: FP op with dest memory operand: " << I << "\n"; 
+				noteUnknown(I, "FP op with dest memory operand");
 				lat += 3; break;
 			case Instruction::FMul:
-				errs() << "LV: FP op with dest memory operand: " << I << "\n"; 
+				noteUnknown(I, "FP op with dest memory operand");
 				lat += 4; break;
 			case Instruction::FDiv:
-				errs() << "LV: FP op with dest memory operand: " << I << "\n"; 
+				noteUnknown(I, "FP op with dest memory operand");
 				lat += 15; break;
 			default:
-				errs() << "LatencyVisitor: Unrecognized binary op: " << I << "\n";
+				noteUnknown(I, "unrecognized binary op");
 				lat += 1;
 			}
 		} else {
@@ -95,23 +143,34 @@ class LatencyVisitor : public InstVisitor<LatencyVisitor> {
 			case Instruction::FDiv: // FDIV r
 				lat += 15; break;
 			default:
-				errs() << "LatencyVisitor: Unrecognized binary op: " << I << "\n";
+				noteUnknown(I, "unrecognized binary op");
 				lat += 1;
 			}
 		}
 	}
 
 	void visitBranchInst (BranchInst& I) {lat += (I.isConditional()) ? 2 : 1;} // JMP(xx) i
+	void visitIntrinsicInst (IntrinsicInst& I) {
+		if (!visitVectorIntrinsic(I)) visitCallBase(I);
+	}
 	void visitCallBase (CallBase& I) {
 		if (!I.isInlineAsm()) {
 			lat += 3; // CALL r
 			calls.push_back(&I);
+		} else if (asmCost) {
+			lat += asmCost->getLat(I); // costed through MC, no actual call
 		}
 	}
 	// TODO: visitCatchReturnInst, visitCatchSwitchInst, visitCleanupReturnInst
 	// cmpInst is broken out into children
-	void visitICmpInst (ICmpInst& I) {lat += 1;} // CMP r/r, should be .25 cycles
-	void visitFCmpInst (FCmpInst& I) {lat += 3;} // FCOMP r
+	void visitICmpInst (ICmpInst& I) { // CMP r/r, should be .25 cycles; VPCMPD k/z/z
+		const unsigned parts = getParts(I.getOperand(0)->getType());
+		lat += (parts) ? 3 + parts - 1 : 1;
+	}
+	void visitFCmpInst (FCmpInst& I) { // FCOMP r; VCMPPS k/z/z
+		const unsigned parts = getParts(I.getOperand(0)->getType());
+		lat += 3 + ((parts) ? parts - 1 : 0);
+	}
 	// FP vectors have the same insert/extract latency as integer
 	void visitExtractElementInst(ExtractElementInst& I) {lat += 3;} // VEXTRACTI128 x/y/i
 	void visitFenceInst (FenceInst& I) {
@@ -128,28 +187,33 @@ class LatencyVisitor : public InstVisitor<LatencyVisitor> {
 	void visitGetElementPtrInst(GetElementPtrInst& I) {lat += 1;} 
 	void visitIndirectBrInst(IndirectBrInst& I) {lat += 2;} // JMP r
 	void visitInsertElementInst(InsertElementInst& I) {lat += 3;} // VINSERTI128 y/y/x/i
-	// TODO: visitInsertValueInst
+	// aggregates live in registers (cmpxchg results, multiple returns)
+	void visitInsertValueInst(InsertValueInst& I) {lat += 1;} // MOV r/r
+	void visitExtractValueInst(ExtractValueInst& I) {lat += 1;} // MOV r/r
 	void visitLandingPadInst(LandingPadInst& I) {} // ENDBR for a exception, no real op
 	void visitPHINode(PHINode& I) {} // no real op
 	void visitResumeInst(ResumeInst& I) {} // more exception stuff.
 	void visitReturnInst(ReturnInst& I) {lat += 2;} // RET or RET i
-	void visitSelectInst(SelectInst& I) {lat += 1;} // ternary operator: CMP + CMOV (.5 + .5)
-	// TODO: visitShuffleVectorInst
+	void visitSelectInst(SelectInst& I) { // ternary operator: CMP + CMOV (.5 + .5); VPBLENDMD
+		const unsigned parts = getParts(I.getType());
+		lat += 1 + ((parts) ? parts - 1 : 0);
+	}
+	void visitShuffleVectorInst(ShuffleVectorInst& I);
 	void visitUnaryOperator(UnaryOperator& I) {
 		// The only implemented unary op seems to be FP negation
 		assert(I.getOpcode() == Instruction::FNeg);
 		lat += 1; // FCHS
 	}
-	void visitCastInst(CastInst& I) {} // TODO: assumes all casts are reinterps
+	// scalar casts are assumed to be reinterps, vector ones are costed
+	void visitCastInst(CastInst& I);
 	void visitUnreachableInst (UnreachableInst& I) {} // probably fine
 	void visitAllocaInst(AllocaInst& I) { // stack variable alloc: PUSH m
-		static DataLayout DL = DataLayout(I.getModule());
 		if (I.isArrayAllocation()) {
 			auto V = I.getArraySize();
 			if ( ConstantInt* C = dyn_cast<ConstantInt>(V) ) {
 				lat += (size_t) C->getLimitedValue();
 			} else {
-				errs() << "LatencyVisitor: Non-fixed size AllocaInst!";
+				noteUnknown(I, "non-fixed size alloca");
 				lat += 1;
 			}
 		} else lat += 1;
@@ -157,7 +221,7 @@ class LatencyVisitor : public InstVisitor<LatencyVisitor> {
 	
 	// fall-through (default block in switch-case, basically)
 	void visitInstruction(Instruction& I) {
-		errs() << "LatencyVisitor: unrecognized instruction " << I << "\n";
+		noteUnknown(I, "unrecognized instruction");
 		lat += 1;
 	}
 };
@@ -0,0 +1,255 @@
+#include "LibCost.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MemoryBuffer.h"
+#define DEBUG_TYPE "primebort"
+
+using namespace llvm;
+
+static cl::opt<std::string> LibCostFile("primebort-libcost-file",
+		cl::desc("File of library call cost models to add to/override the built-in ones"),
+		cl::init(""));
+static cl::opt<unsigned> LibCostDefaultSize("primebort-libcost-default-size",
+		cl::desc("Size (bytes) assumed for a library call whose size argument is unknown"),
+		cl::init(256));
+
+// sizes beyond this are clamped, SCEV ranges of unknown values are 2^64 wide
+#define MAX_KNOWN_SIZE (1 << 20)
+
+namespace {
+
+typedef PrimeBortDetectorPass P;
+
+struct BuiltinModel {
+	const char* name;
+	size_t base;
+	double perByte;
+	int sizeArg;
+	int countArg;
+	unsigned flags;
+	bool unbounded;
+};
+
+// Rough numbers for glibc on Ice Lake: the memory functions stream at 16-32B/cycle
+// from L1, a syscall round trip is on the order of 1000 cycles with mitigations,
+// and the allocator fast paths are a few dozen cycles.
+const BuiltinModel builtinModels[] = {
+	{"memcpy", 20, 1.0/16, 2, -1, 0, false},
+	{"memmove", 24, 1.0/16, 2, -1, 0, false},
+	{"memset", 16, 1.0/32, 2, -1, 0, false},
+	{"memcmp", 16, 1.0/8, 2, -1, 0, false},
+	{"strlen", 12, 0, -1, -1, 0, false},
+	{"strcmp", 12, 0, -1, -1, 0, false},
+	{"strcpy", 16, 0, -1, -1, 0, false},
+
+	{"malloc", 60, 0, -1, -1, P::RF_ALLOC, false},
+	{"calloc", 70, 1.0/32, 0, 1, P::RF_ALLOC, false},
+	{"realloc", 100, 1.0/16, 1, -1, P::RF_ALLOC, false},
+	{"free", 40, 0, -1, -1, P::RF_ALLOC, false},
+	{"aligned_alloc", 80, 0, -1, -1, P::RF_ALLOC, false},
+	{"posix_memalign", 80, 0, -1, -1, P::RF_ALLOC, false},
+	{"memalign", 80, 0, -1, -1, P::RF_ALLOC, false},
+	{"valloc", 80, 0, -1, -1, P::RF_ALLOC, false},
+	{"_Znwm", 60, 0, -1, -1, P::RF_ALLOC, false},
+	{"_Znam", 60, 0, -1, -1, P::RF_ALLOC, false},
+	{"_ZdlPv", 40, 0, -1, -1, P::RF_ALLOC, false},
+	{"_ZdaPv", 40, 0, -1, -1, P::RF_ALLOC, false},
+	{"_ZdlPvm", 40, 0, -1, -1, P::RF_ALLOC, false},
+
+	// buffered stdio is a syscall whenever the buffer flushes, which a line does on a tty
+	{"printf", 1500, 0, -1, -1, P::RF_IO, false},
+	{"fprintf", 1500, 0, -1, -1, P::RF_IO, false},
+	{"vprintf", 1500, 0, -1, -1, P::RF_IO, false},
+	{"vfprintf", 1500, 0, -1, -1, P::RF_IO, false},
+	{"puts", 1200, 0, -1, -1, P::RF_IO, false},
+	{"fputs", 1200, 0, -1, -1, P::RF_IO, false},
+	{"perror", 1500, 0, -1, -1, P::RF_IO, false},
+	{"putchar", 30, 0, -1, -1, P::RF_IO, false},
+	{"putc", 30, 0, -1, -1, P::RF_IO, false},
+	{"fputc", 30, 0, -1, -1, P::RF_IO, false},
+	{"getc", 30, 0, -1, -1, P::RF_IO, false},
+	{"fgetc", 30, 0, -1, -1, P::RF_IO, false},
+	{"fgets", 200, 1.0/4, 1, -1, P::RF_IO, false},
+	{"fwrite", 200, 1.0/4, 1, 2, P::RF_IO, false},
+	{"fread", 200, 1.0/4, 1, 2, P::RF_IO, false},
+	{"fflush", 1200, 0, -1, -1, P::RF_IO, false},
+	{"fopen", 5000, 0, -1, -1, P::RF_IO, false},
+	{"fclose", 2000, 0, -1, -1, P::RF_IO, false},
+	{"open", 3000, 0, -1, -1, P::RF_IO, false},
+	{"openat", 3000, 0, -1, -1, P::RF_IO, false},
+	{"close", 800, 0, -1, -1, P::RF_IO, false},
+	{"read", 1200, 1.0/4, 2, -1, P::RF_IO, false},
+	{"write", 1200, 1.0/4, 2, -1, P::RF_IO, false},
+	{"pread", 1200, 1.0/4, 2, -1, P::RF_IO, false},
+	{"pwrite", 1200, 1.0/4, 2, -1, P::RF_IO, false},
+	{"readv", 1400, 0, -1, -1, P::RF_IO, false},
+	{"writev", 1400, 0, -1, -1, P::RF_IO, false},
+	{"send", 2500, 1.0/4, 2, -1, P::RF_IO, false},
+	{"sendto", 2500, 1.0/4, 2, -1, P::RF_IO, false},
+	{"sendmsg", 2500, 0, -1, -1, P::RF_IO, false},
+	{"getchar", 0, 0, -1, -1, P::RF_IO, true},
+	{"scanf", 0, 0, -1, -1, P::RF_IO, true},
+	{"fscanf", 0, 0, -1, -1, P::RF_IO, true},
+	{"recv", 0, 0, -1, -1, P::RF_IO, true},
+	{"recvfrom", 0, 0, -1, -1, P::RF_IO, true},
+	{"recvmsg", 0, 0, -1, -1, P::RF_IO, true},
+	{"accept", 0, 0, -1, -1, P::RF_IO, true},
+
+	{"syscall", 1000, 0, -1, -1, P::RF_SYSCALL, false},
+	{"getpid", 700, 0, -1, -1, P::RF_SYSCALL, false},
+	{"sched_yield", 800, 0, -1, -1, P::RF_SYSCALL, false},
+	{"mmap", 3000, 0, -1, -1, P::RF_SYSCALL, false},
+	{"munmap", 4000, 0, -1, -1, P::RF_SYSCALL, false},
+	{"mprotect", 2500, 0, -1, -1, P::RF_SYSCALL, false},
+	{"madvise", 2500, 0, -1, -1, P::RF_SYSCALL, false},
+	{"ioctl", 1500, 0, -1, -1, P::RF_SYSCALL, false},
+	{"fcntl", 800, 0, -1, -1, P::RF_SYSCALL, false},
+	{"kill", 2000, 0, -1, -1, P::RF_SYSCALL, false},
+	{"raise", 2000, 0, -1, -1, P::RF_SYSCALL, false},
+	{"abort", 2000, 0, -1, -1, P::RF_SYSCALL, false},
+	{"exit", 2000, 0, -1, -1, P::RF_SYSCALL, false},
+	{"sleep", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"usleep", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"nanosleep", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"clock_nanosleep", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"select", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"poll", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"epoll_wait", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"pause", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"wait", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"waitpid", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"sem_wait", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"pthread_cond_wait", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"pthread_cond_timedwait", 0, 0, -1, -1, P::RF_SYSCALL, true},
+	{"pthread_join", 0, 0, -1, -1, P::RF_SYSCALL, true},
+
+	// uncontended; nested locks are costed as txs of their own
+	{"pthread_mutex_lock", 25, 0, -1, -1, P::RF_LOCK, false},
+	{"pthread_mutex_trylock", 25, 0, -1, -1, P::RF_LOCK, false},
+	{"pthread_mutex_unlock", 20, 0, -1, -1, P::RF_LOCK, false},
+	{"pthread_rwlock_rdlock", 30, 0, -1, -1, P::RF_LOCK, false},
+	{"pthread_rwlock_wrlock", 30, 0, -1, -1, P::RF_LOCK, false},
+	{"pthread_rwlock_unlock", 25, 0, -1, -1, P::RF_LOCK, false},
+	{"pthread_spin_lock", 22, 0, -1, -1, P::RF_LOCK, false},
+	{"pthread_spin_trylock", 22, 0, -1, -1, P::RF_LOCK, false},
+	{"pthread_spin_unlock", 5, 0, -1, -1, P::RF_LOCK, false},
+	{"mtx_lock", 25, 0, -1, -1, P::RF_LOCK, false},
+	{"mtx_timedlock", 25, 0, -1, -1, P::RF_LOCK, false},
+	{"mtx_trylock", 25, 0, -1, -1, P::RF_LOCK, false},
+	{"mtx_unlock", 20, 0, -1, -1, P::RF_LOCK, false},
+};
+
+// the value of a size argument: constants exactly, otherwise the bound of its SCEV
+// range matching the path we're estimating
+uint64_t sizeOf(const Value* V, ScalarEvolution* SE, const bool longest,
+		ValueToSCEVMapTy* bindings) {
+	if (const ConstantInt* C = dyn_cast<ConstantInt>(V))
+		return std::min<uint64_t>(C->getLimitedValue(), MAX_KNOWN_SIZE);
+	if (SE && SE->isSCEVable(V->getType())) {
+		const SCEV* S = SE->getSCEV(const_cast<Value*>(V));
+		if (bindings) S = SCEVParameterRewriter::rewrite(S, *SE, *bindings);
+		const ConstantRange R = SE->getUnsignedRange(S);
+		if (!R.isFullSet()) {
+			const APInt& B = (longest) ? R.getUnsignedMax() : R.getUnsignedMin();
+			return std::min<uint64_t>(B.getLimitedValue(), MAX_KNOWN_SIZE);
+		}
+	}
+	return LibCostDefaultSize;
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+LibCostTable::LibCostTable() {
+	for (const BuiltinModel& B : builtinModels) {
+		Model& M = models[B.name];
+		M.base = B.base;
+		M.perByte = B.perByte;
+		M.sizeArg = B.sizeArg;
+		M.countArg = B.countArg;
+		M.flags = B.flags;
+		M.unbounded = B.unbounded;
+	}
+	if (!LibCostFile.empty() && !loadFile(LibCostFile))
+		errs() << "PrimeBort: could not load library cost models from " << LibCostFile << "\n";
+}
+
+bool LibCostTable::loadFile(StringRef path) {
+	ErrorOr<std::unique_ptr<MemoryBuffer> > buf = MemoryBuffer::getFile(path);
+	if (!buf) return false;
+
+	SmallVector<StringRef, 16> lines;
+	(*buf)->getBuffer().split(lines, '\n');
+	for (unsigned n = 0; n < lines.size(); ++n) {
+		StringRef line = lines[n].split('#').first.trim();
+		if (line.empty()) continue;
+		SmallVector<StringRef, 5> fields;
+		SplitString(line, fields);
+
+		Model M;
+		bool ok = fields.size() == 5 && !fields[1].getAsInteger(10, M.base) &&
+			!fields[2].getAsDouble(M.perByte);
+		if (ok && fields[3] != "-") {
+			std::pair<StringRef, StringRef> args = fields[3].split('*');
+			ok = !args.first.getAsInteger(10, M.sizeArg) &&
+				(args.second.empty() || !args.second.getAsInteger(10, M.countArg));
+		}
+		if (ok && fields[4] != "-") {
+			SmallVector<StringRef, 4> flags;
+			fields[4].split(flags, ',');
+			for (StringRef F : flags) {
+				if (F == "io") M.flags |= P::RF_IO;
+				else if (F == "syscall") M.flags |= P::RF_SYSCALL;
+				else if (F == "alloc") M.flags |= P::RF_ALLOC;
+				else if (F == "lock") M.flags |= P::RF_LOCK;
+				else if (F == "unbounded") M.unbounded = true;
+				else ok = false;
+			}
+		}
+		if (!ok) {
+			errs() << path << ":" << n+1 << ": bad library cost model: " << lines[n] << "\n";
+			continue;
+		}
+		models[fields[0]] = M;
+	}
+	LLVM_DEBUG(dbgs() << "Loaded library cost models from " << path << "\n");
+	return true;
+}
+
+const LibCostTable::Model* LibCostTable::lookup(StringRef name) const {
+	auto m_it = models.find(name);
+	return (m_it == models.end()) ? nullptr : &m_it->second;
+}
+
+const LibCostTable::Model* LibCostTable::lookup(const CallBase& CB) const {
+	const Function* F = CB.getCalledFunction();
+	if (!F) return nullptr;
+	if (const MemIntrinsic* MI = dyn_cast<MemIntrinsic>(&CB)) {
+		// same argument order as the libc functions
+		if (isa<MemSetInst>(MI)) return lookup("memset");
+		if (isa<MemMoveInst>(MI)) return lookup("memmove");
+		return lookup("memcpy");
+	}
+	if (F->isIntrinsic()) return nullptr;
+	return lookup(F->getName());
+}
+
+size_t LibCostTable::getLat(const CallBase& CB, const Model& M,
+		ScalarEvolution* SE, const bool longest, ValueToSCEVMapTy* bindings) const {
+	// a blocking call may also return at once: only its longest latency is unbounded
+	if (M.unbounded && longest) return MAX_SEARCH_DIST;
+	size_t lat = M.base;
+	if (M.perByte > 0 && M.sizeArg >= 0 && (unsigned) M.sizeArg < CB.arg_size()) {
+		uint64_t size = sizeOf(CB.getArgOperand(M.sizeArg), SE, longest, bindings);
+		if (M.countArg >= 0 && (unsigned) M.countArg < CB.arg_size())
+			size = std::min<uint64_t>(size * sizeOf(CB.getArgOperand(M.countArg), SE, longest, bindings),
+					MAX_KNOWN_SIZE);
+		lat += (size_t) (size * M.perByte);
+	}
+	return lat;
+}
+
+} // namespace llvm
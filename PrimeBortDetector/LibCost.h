@@ -0,0 +1,47 @@
+#pragma once
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/ADT/StringMap.h"
+
+/*
+ * Cost models for calls to functions we have no body for: libc, the allocator,
+ * syscall wrappers and the memory intrinsics. Each model is a base latency plus a
+ * per-byte cost scaled by a size argument (or the product of two, for calloc), and
+ * the RegionFlags the call sets. Blocking calls are unbounded: MAX_SEARCH_DIST on the
+ * longest path, their base latency on the shortest.
+ * The built-in table can be extended or overridden with -primebort-libcost-file,
+ * one model per line:
+ *   name base cycles-per-byte size-arg flags
+ * where size-arg is an argument number, two of them joined by '*', or '-' for none,
+ * and flags is a comma-separated list of io, syscall, alloc, lock, unbounded, or '-'.
+ * '#' starts a comment.
+ */
+namespace llvm {
+
+class LibCostTable {
+	public:
+	struct Model {
+		size_t base = 0;
+		double perByte = 0;
+		int sizeArg = -1; // -1 if the cost doesn't scale
+		int countArg = -1; // multiplies sizeArg if not -1
+		unsigned flags = 0; // PrimeBortDetectorPass::RegionFlag
+		bool unbounded = false; // may block indefinitely
+	};
+
+	LibCostTable();
+	// the model for a declared-only callee, null if there is none
+	const Model* lookup(StringRef) const;
+	// the model for a call, looking through memory intrinsics; null if there is none
+	const Model* lookup(const CallBase&) const;
+	// latency of a call; the size comes from constants or the range of its SCEV,
+	// taking the bound matching the path being estimated, with arguments of the
+	// caller bound to constants if bindings are given. SE may be null.
+	size_t getLat(const CallBase&, const Model&, ScalarEvolution*, const bool,
+			ValueToSCEVMapTy* = nullptr) const;
+
+	private:
+	StringMap<Model> models;
+	bool loadFile(StringRef);
+};
+
+} // namespace llvm
@@ -0,0 +1,164 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
+#include <algorithm>
+#include <map>
+
+/*
+ * Lock hold time and nesting report. Locks are named by the object passed to the
+ * lock call (see describeLock), so every section taking the same lock is grouped
+ * together. A lock B is nested in A if a tx on B begins inside a tx on A, in which
+ * case anything holding B delays A as well: A's own worst case contains the B
+ * sections it runs, but not the wait for another thread's section on B, which can
+ * be as long as B's hold time including its own nesting. The hold time of A
+ * including nesting adds the longest of those waits to A's own worst case.
+ */
+
+using namespace llvm;
+
+static cl::opt<bool> LockReport("primebort-lock-report",
+		cl::desc("Print worst-case lock hold times and the lock nesting graph"),
+		cl::init(false));
+
+namespace {
+
+struct LockEdge {
+	size_t hold; // worst-case hold time of the inner lock
+	const Instruction* site; // where the inner lock is taken
+};
+
+struct LockNode {
+	unsigned sections = 0;
+	size_t hold = 0; // worst-case hold time over all sections
+	size_t nestedHold = 0; // including locks nested inside, see nestedHoldOf
+	unsigned state = 0; // 0 = unvisited, 1 = on stack, 2 = done
+	std::map<std::string, LockEdge> inner;
+};
+
+typedef std::map<std::string, LockNode> LockGraph;
+
+size_t nestedHoldOf(LockGraph& G, const std::string& name,
+		SmallVectorImpl<std::pair<std::string, std::string> >& cycles) {
+	LockNode& N = G[name];
+	if (N.state == 2) return N.nestedHold;
+	N.state = 1;
+	size_t worstInner = 0;
+	for (auto& E : N.inner) {
+		LockNode& M = G[E.first];
+		// a cycle in the lock order can deadlock, and has no finite nested hold time
+		if (M.state == 1) {
+			cycles.emplace_back(name, E.first);
+			continue;
+		}
+		worstInner = std::max(worstInner, nestedHoldOf(G, E.first, cycles));
+	}
+	N.nestedHold = N.hold + worstInner;
+	N.state = 2;
+	return N.nestedHold;
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+std::string PrimeBortDetectorPass::describeLock(const TxInfo& info) const {
+	if (isRTMTx(info)) return "<rtm>";
+	const SmallVectorImpl<Instruction*>& chain = info.entryChain;
+	const Instruction* leaf = chain.back();
+	const Value* V = S->boundaryLocks.lookup(leaf);
+	if (!V) {
+		const CallBase* CB = cast<CallBase>(leaf);
+		if (CB->arg_size() == 0)
+			return ("<" + CB->getCalledOperand()->stripPointerCasts()->getName() + ">").str();
+		V = CB->getArgOperand(0);
+	}
+	V = V->stripPointerCasts();
+
+	// an argument of a lock wrapper is whatever its caller passed in
+	for (unsigned i = chain.size()-1; i > 0; --i) {
+		const Argument* A = dyn_cast<Argument>(V);
+		if (!A || A->getParent() != chain[i]->getFunction()) break;
+		V = cast<CallBase>(chain[i-1])->getArgOperand(A->getArgNo())->stripPointerCasts();
+	}
+
+	const DataLayout& DL = leaf->getModule()->getDataLayout();
+	APInt off(DL.getIndexTypeSizeInBits(V->getType()), 0);
+	const Value* base = V->stripAndAccumulateConstantOffsets(DL, off, true);
+
+	std::string s;
+	raw_string_ostream OS(s);
+	if (const GlobalValue* GV = dyn_cast<GlobalValue>(base)) {
+		OS << '@' << GV->getName();
+	} else if (const GEPOperator* GEP = dyn_cast<GEPOperator>(V)) {
+		// a lock embedded in an object: name it after the object's type
+		Type* T = GEP->getSourceElementType();
+		StructType* ST = dyn_cast<StructType>(T);
+		if (ST && ST->hasName()) OS << '%' << ST->getName();
+		else OS << *T;
+	} else if (const Argument* A = dyn_cast<Argument>(base)) {
+		OS << "argument " << A->getArgNo() << " of " << A->getParent()->getName();
+	} else {
+		base->printAsOperand(OS, false);
+		if (const Instruction* I = dyn_cast<Instruction>(base))
+			OS << " in " << I->getFunction()->getName();
+	}
+	if (!off.isZero()) OS << '+' << off.getSExtValue();
+	return OS.str();
+}
+
+void PrimeBortDetectorPass::printLockReport(raw_ostream& OS) {
+	if (!LockReport) return;
+
+	DenseMap<const Instruction*, const TxInfo*> byEntry;
+	for (const TxInfo& info : S->foundTx) byEntry[info.entry] = &info;
+
+	LockGraph G;
+	for (const TxInfo& info : S->foundTx) {
+		const std::string name = describeLock(info);
+		LockNode& N = G[name];
+		++N.sections;
+		N.hold = std::max(N.hold, maxTxLat(info));
+
+		for (const Instruction* CI : info.props.nestedEntries) {
+			const TxInfo* inner = byEntry.lookup(CI);
+			assert(inner);
+			auto emplit = N.inner.emplace(describeLock(*inner),
+					LockEdge{maxTxLat(*inner), CI});
+			if (!emplit.second && emplit.first->second.hold < maxTxLat(*inner))
+				emplit.first->second = {maxTxLat(*inner), CI};
+		}
+	}
+
+	SmallVector<std::pair<std::string, std::string>, 2> cycles;
+	SmallVector<const LockGraph::value_type*, 8> ranked;
+	for (auto& L : G) {
+		nestedHoldOf(G, L.first, cycles);
+		ranked.push_back(&L);
+	}
+	std::stable_sort(ranked.begin(), ranked.end(),
+		[](const LockGraph::value_type* A, const LockGraph::value_type* B) {
+			return A->second.nestedHold > B->second.nestedHold;
+		});
+
+	OS << "PrimeBort lock report\n=====\n";
+	OS << "Locks by worst-case hold time including nested locks:\n";
+	for (const LockGraph::value_type* L : ranked) {
+		OS << "  " << L->first << "\tsections " << L->second.sections <<
+			"\thold " << L->second.hold << "\tnested " << L->second.nestedHold << '\n';
+	}
+	OS << "Nesting (outer -> inner, inner hold, taken at):\n";
+	for (const LockGraph::value_type* L : ranked) {
+		for (auto& E : L->second.inner) {
+			OS << "  " << L->first << " -> " << E.first << '\t' << E.second.hold << '\t';
+			printLoc(OS, E.second.site);
+			OS << '\n';
+		}
+	}
+	if (!cycles.empty()) {
+		OS << "Lock order cycles (possible deadlock):\n";
+		for (auto& C : cycles) OS << "  " << C.first << " -> " << C.second << '\n';
+	}
+	OS << "=====\n";
+}
+
+} // namespace llvm
@@ -0,0 +1,211 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/TargetSchedule.h"
+#include "llvm/CodeGen/TargetSubtargetInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+#include <algorithm>
+#include "LatencyVisitor.h"
+
+/*
+ * Post-ISel latencies: the txs re-costed on the MachineInstrs that ship, which have the
+ * spills and reloads, the expansions of IR instructions into several MIs and the
+ * lowering of intrinsics that the IR model can't see. The machine pass
+ * (primebort-machine) sums TargetSchedModel latencies over the MIs of each IR block,
+ * split at calls, since calls are what an IR block and its MIs agree on: the blocks
+ * codegen adds belong to the block laid out before them, and a block whose calls don't
+ * match (a memcpy that became a call, a call that was expanded) is taken as a whole.
+ * Once every function is done, the IR analysis runs again on the module the MIR came
+ * with, with the latency of each stretch spread over its IR instructions in proportion
+ * to what the model charges them, so paths that start or stop inside a stretch still
+ * get their share. Inline asm keeps its MC cost, callees without MIs their IR costs.
+ * Txs are reported by the ids the !primebort.lat metadata of -primebort-annotate gave
+ * them, next to the IR estimates it recorded; run on MIR from
+ *   opt -primebort -primebort-annotate | llc -stop-after=pseudo-probe-inserter
+ * with llc -run-pass=primebort-machine.
+ */
+
+using namespace llvm;
+
+namespace {
+
+// where the IR side of a block is split: calls that are still calls after ISel
+bool isSegmentEnd(const Instruction& I) {
+	const CallBase* CB = dyn_cast<CallBase>(&I);
+	if (!CB || CB->isInlineAsm()) return false;
+	const Function* F = CB->getCalledFunction();
+	return !F || !F->isIntrinsic();
+}
+
+bool isInlineAsm(const Instruction& I) {
+	const CallBase* CB = dyn_cast<CallBase>(&I);
+	return CB && CB->isInlineAsm();
+}
+
+// the id, txLat and rtLat -primebort-annotate put on a tx entry
+bool getAnnotation(const Instruction* I, uint64_t& id, uint64_t& txLat, uint64_t& rtLat) {
+	const MDNode* N = I->getMetadata("primebort.lat");
+	if (!N || N->getNumOperands() < 4) return false;
+	const MDString* kind = dyn_cast<MDString>(N->getOperand(0));
+	if (!kind || kind->getString() != "tx") return false;
+	id = mdconst::extract<ConstantInt>(N->getOperand(1))->getZExtValue();
+	txLat = mdconst::extract<ConstantInt>(N->getOperand(2))->getZExtValue();
+	rtLat = mdconst::extract<ConstantInt>(N->getOperand(3))->getZExtValue();
+	return true;
+}
+
+class PrimeBortMachinePass : public MachineFunctionPass {
+	// of every function seen so far
+	PrimeBortDetectorPass::MachineLatMap blockLat;
+
+	public:
+	static char ID;
+	PrimeBortMachinePass() : MachineFunctionPass(ID) {}
+	StringRef getPassName() const override {return "PrimeBort post-ISel latencies";}
+	void getAnalysisUsage(AnalysisUsage& AU) const override {
+		AU.setPreservesAll();
+		MachineFunctionPass::getAnalysisUsage(AU);
+	}
+	bool runOnMachineFunction(MachineFunction&) override;
+	bool doFinalization(Module&) override;
+};
+
+} // anonymous namespace
+
+char PrimeBortMachinePass::ID = 0;
+static RegisterPass<PrimeBortMachinePass> regMachine("primebort-machine",
+		"PrimeBort post-ISel latencies");
+
+bool PrimeBortMachinePass::runOnMachineFunction(MachineFunction& MF) {
+	TargetSchedModel SM;
+	SM.init(&MF.getSubtarget());
+
+	const BasicBlock* BB = NULL;
+	for (const MachineBasicBlock& MBB : MF) {
+		if (MBB.getBasicBlock()) BB = MBB.getBasicBlock();
+		if (!BB) continue;
+		SmallVector<unsigned, 2>& segs = blockLat[BB];
+		if (segs.empty()) segs.push_back(0);
+		for (const MachineInstr& MI : MBB) {
+			if (MI.isMetaInstruction() || MI.isInlineAsm()) continue;
+			segs.back() += SM.computeInstrLatency(&MI);
+			if (MI.isCall()) segs.push_back(0);
+		}
+	}
+	return false;
+}
+
+bool PrimeBortMachinePass::doFinalization(Module& M) {
+	if (blockLat.empty()) return false;
+
+	// no IR pass manager runs with llc's machine passes
+	PrimeBortFunctionAnalyses analyses(M);
+	PrimeBortDetectorPass P;
+	analyses.attach(P);
+	P.machineBlockLat = &blockLat;
+	P.runImpl(M, true);
+
+	// by the ids the IR run gave the txs, where it annotated them
+	struct Row {
+		uint64_t id;
+		bool annotated;
+		uint64_t txLat, rtLat;
+		const PrimeBortDetectorPass::TxInfo* info;
+	};
+	SmallVector<Row, 16> rows;
+	const auto& txs = P.getTxs();
+	for (unsigned t = 0; t < txs.size(); ++t) {
+		Row R = {t, false, 0, 0, &txs[t]};
+		R.annotated = getAnnotation(txs[t].entry, R.id, R.txLat, R.rtLat);
+		rows.push_back(R);
+	}
+	std::stable_sort(rows.begin(), rows.end(),
+		[](const Row& A, const Row& B) {return A.id < B.id;});
+
+	raw_ostream& OS = errs();
+	OS << "PrimeBort post-ISel latencies (IR estimate -> machine)\n=====\n" <<
+		"tx\ttxLat\t\trtLat\t\tentry\n";
+	for (const Row& R : rows) {
+		OS << R.id << '\t';
+		if (R.annotated) OS << R.txLat;
+		else OS << '?';
+		OS << " -> " << PrimeBortDetectorPass::maxTxLat(*R.info) << '\t';
+		if (R.annotated) OS << R.rtLat;
+		else OS << '?';
+		OS << " -> " << PrimeBortDetectorPass::minRtLat(*R.info) << '\t';
+		PrimeBortDetectorPass::printLoc(OS, R.info->entry);
+		OS << '\n';
+	}
+	OS << "=====\n";
+
+	P.releaseMemory();
+	blockLat.clear();
+	return false;
+}
+
+namespace llvm {
+
+MachineFunctionPass* createPrimeBortMachinePass() {return new PrimeBortMachinePass;}
+
+void PrimeBortDetectorPass::distributeMachineLat() {
+	unsigned split = 0, whole = 0;
+	for (const auto& E : *machineBlockLat) {
+		// only visited, to weigh the instructions
+		BasicBlock& BB = const_cast<BasicBlock&>(*E.first);
+		SmallVector<SmallVector<Instruction*, 16>, 2> segs(1);
+		for (Instruction& I : BB) {
+			if (I.isDebugOrPseudoInst()) {
+				S->machineLat[&I] = 0;
+				continue;
+			}
+			if (isInlineAsm(I)) continue;
+			segs.back().push_back(&I);
+			if (isSegmentEnd(I)) segs.emplace_back();
+		}
+		SmallVector<unsigned, 2> lats(E.second.begin(), E.second.end());
+		if (lats.size() == segs.size()) {
+			++split;
+		} else {
+			// a call lowered into no call, or the other way round
+			++whole;
+			unsigned total = 0;
+			for (unsigned l : lats) total += l;
+			lats.assign(1, total);
+			for (unsigned i = 1; i < segs.size(); ++i)
+				segs.front().append(segs[i].begin(), segs[i].end());
+			segs.resize(1);
+		}
+
+		for (unsigned i = 0; i < segs.size(); ++i) {
+			SmallVectorImpl<Instruction*>& seg = segs[i];
+			// e.g. after an invoke: its latency goes with the stretch before
+			if (seg.empty()) {
+				if (i > 0 && !segs[i-1].empty()) S->machineLat[segs[i-1].back()] += lats[i];
+				continue;
+			}
+			// in proportion to the model, cumulatively so the parts add up
+			SmallVector<size_t, 16> cum;
+			size_t total = 0;
+			for (Instruction* I : seg) {
+				LatencyVisitor LV(S->asmCost.get(), &S->unknownOps);
+				LV.visit(I);
+				total += LV.getLat();
+				cum.push_back(total);
+			}
+			size_t prev = 0;
+			for (unsigned j = 0; j < seg.size(); ++j) {
+				const size_t here = (total) ? (size_t) lats[i] * cum[j] / total :
+					((j + 1 == seg.size()) ? lats[i] : 0);
+				S->machineLat[seg[j]] += here - prev;
+				prev = here;
+			}
+		}
+	}
+	LLVM_DEBUG(dbgs() << "Post-ISel latencies for " << split << " blocks split at calls, " <<
+			whole << " taken whole\n");
+}
+
+} // namespace llvm
@@ -1,12 +1,28 @@
 #include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/IntrinsicsX86.h"
+#include "llvm/Support/Timer.h"
 #define DEBUG_TYPE "primebort"
 #include <cassert>
 #include "LatencyVisitor.h"
+#include "InlineAsmCost.h"
+#include "LibCost.h"
+#include "Reachability.h"
 
 // maximum number of instructions to search past a tx start for a corresponding commit
 #define INST_SEARCH_LIMIT 8192 
 
+// setting this high is actually a decent heuristic, because
+// non-canonical loops are pretty suspicious in a tx
+#define FALLBACK_ITER_COUNT 128
+
 using namespace llvm;
 
 //INITIALIZE_PASS(PrimeBortDetectorPass, "primebort", "Prime+Abort detector", false, false)
@@ -18,33 +34,118 @@ char PrimeBortDetectorPass::ID = 0;
 
 PrimeBortDetectorPass *createPrimeBortDetectorPass() {return new PrimeBortDetectorPass;}
 
-using CI_list = PrimeBortDetectorPass::CI_list;
+using BI_list = PrimeBortDetectorPass::BI_list;
 using TxInfo = PrimeBortDetectorPass::TxInfo;
 
 PrimeBortDetectorPass::PrimeBortDetectorPass() : ModulePass(ID) {}
 
-#define COPY(x) x(src.x)
-PrimeBortDetectorPass::PrimeBortDetectorPass(const PrimeBortDetectorPass& src) : 
-		ModulePass(ID),
-		COPY(txCommitCallers), COPY(txCommitCallees),
-		COPY(txBeginCallers), COPY(txBeginCallees), COPY(foundTx) {}
+// the new pass manager copies passes before running them; results aren't copied
+PrimeBortDetectorPass::PrimeBortDetectorPass(const PrimeBortDetectorPass&) :
+		ModulePass(ID) {}
+
+PrimeBortDetectorPass::~PrimeBortDetectorPass() = default;
+
+PrimeBortDetectorPass::RunState::RunState(Module& M) :
+		asmCost(std::make_unique<InlineAsmCost>(M)),
+		libCost(std::make_unique<LibCostTable>()) {}
+
+PrimeBortDetectorPass::RunState::~RunState() = default;
+
+void PrimeBortDetectorPass::releaseMemory() {
+	S.reset();
+}
 
 PreservedAnalyses PrimeBortDetectorPass::run(Module &M, ModuleAnalysisManager &AM) {
-	runOnModule(M);
-	return PreservedAnalyses::all();
+	FunctionAnalysisManager& FAM =
+		AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+	LIGetter = [&FAM](Function& F) -> LoopInfo& {return FAM.getResult<LoopAnalysis>(F);};
+	SEGetter = [&FAM](Function& F) -> ScalarEvolution& {
+		return FAM.getResult<ScalarEvolutionAnalysis>(F);
+	};
+	const bool changed = runImpl(M, false);
+	releaseMemory();
+	return (changed) ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
+
+// tier 0: match tx begin/commit calls through the caller graph and report counts
+// tier 1: also estimate latencies, but only within each tx's common ancestor
+// tier 2: full interprocedural estimates through the call chains and callers
+static cl::opt<unsigned> AnalysisTier("primebort-tier",
+		cl::desc("Analysis depth: 0 = count txs, 1 = intra-procedural, 2 = full"),
+		cl::init(2));
+static cl::opt<bool> TimePhases("primebort-time-phases",
+		cl::desc("Time each phase of the analysis"), cl::init(false));
+// the clock drops for ~2 ms after the last 512-bit op, i.e. for the whole tx
+static cl::opt<unsigned> AVX512Slowdown("primebort-avx512-slowdown",
+		cl::desc("Percentage txLat grows by in txs with 512-bit vector ops, for the "
+			"lower frequency license they run at (0 = off)"),
+		cl::init(0));
+
+#define PHASE_TIMER(name, desc) \
+	NamedRegionTimer phaseTimer(name, desc, "primebort", "PrimeBort phases", TimePhases)
+
+extern cl::opt<bool> PrimeBortInstrument;
+extern cl::opt<bool> PrimeBortGuard;
+extern cl::opt<bool> PrimeBortShrink;
+extern cl::opt<bool> PrimeBortContention;
+
+bool PrimeBortDetectorPass::transformsIR() {
+	return PrimeBortInstrument || PrimeBortGuard || PrimeBortShrink;
+}
+
+
+struct PrimeBortFunctionAnalyses::FuncAnalyses {
+	DominatorTree DT;
+	LoopInfo LI;
+	AssumptionCache AC;
+	ScalarEvolution SE;
+
+	FuncAnalyses(Function& F, TargetLibraryInfo& TLI) :
+		DT(F), LI(DT), AC(F), SE(F, TLI, AC, DT, LI) {}
+};
+
+PrimeBortFunctionAnalyses::PrimeBortFunctionAnalyses(const Module& M) :
+	TLII(std::make_unique<TargetLibraryInfoImpl>(Triple(M.getTargetTriple()))),
+	TLI(std::make_unique<TargetLibraryInfo>(*TLII)) {}
+
+PrimeBortFunctionAnalyses::~PrimeBortFunctionAnalyses() = default;
+
+PrimeBortFunctionAnalyses::FuncAnalyses& PrimeBortFunctionAnalyses::get(Function& F) {
+	std::unique_ptr<FuncAnalyses>& A = analyses[&F];
+	if (!A) A = std::make_unique<FuncAnalyses>(F, *TLI);
+	return *A;
+}
+
+void PrimeBortFunctionAnalyses::attach(PrimeBortDetectorPass& P) {
+	P.LIGetter = [this](Function& F) -> LoopInfo& {return get(F).LI;};
+	P.SEGetter = [this](Function& F) -> ScalarEvolution& {return get(F).SE;};
 }
 
+void PrimeBortFunctionAnalyses::forget(Function* F) {analyses.erase(F);}
+void PrimeBortFunctionAnalyses::clear() {analyses.clear();}
 
 bool PrimeBortDetectorPass::runOnModule(Module &M) {
+	PrimeBortFunctionAnalyses analyses(M);
+	analyses.attach(*this);
+	const bool changed = runImpl(M, false);
+	LIGetter = nullptr;
+	SEGetter = nullptr;
+	return changed;
+}
+
+bool PrimeBortDetectorPass::runImpl(Module &M, const bool analysisOnly) {
 	LLVM_DEBUG(dbgs() << "Start Prime+Abort detector pass\n");
+	bool changed = false;
+	if (keepState && S) beginRerun();
+	else S = std::make_unique<RunState>(M);
 
-	// get leaf callable objects
-	SmallVector<Function*, 4> txBegin; 
-	SmallVector<Function*, 4> txCommit;
+	// get tx boundaries: lock calls, RTM intrinsics and spin lock patterns
+	SmallVector<Instruction*, 16> txBegin;
+	SmallVector<Instruction*, 16> txCommit;
 	populateLeafSets(M, txBegin, txCommit);
+	if (S->rerun) checkKeptBoundaries();
 
-	if (!txBegin.empty()) {
-		assert(!txCommit.empty());
+	if (!txBegin.empty() && !txCommit.empty()) {
 
 		/*
 		 * For each call to txBegin, find an ancestor function
@@ -54,21 +155,23 @@ bool PrimeBortDetectorPass::runOnModule(Module &M) {
 
 		// check graph one level at a time until all call sites are matched or we hit the
 		// top of the graph
-		CI_list prev_blevel, prev_clevel, new_blevel, new_clevel, rem_blevel, rem_clevel;
+		BI_list prev_blevel, prev_clevel, new_blevel, new_clevel, rem_blevel, rem_clevel;
+		{
+		PHASE_TIMER("match", "Match tx begin/commit calls");
 		do {
 			// get next graph level
 			new_blevel = levelUpCallerGraph(txBegin, prev_blevel,
-									txBeginCallees);
+									S->txBeginCallees);
 			new_clevel = levelUpCallerGraph(txCommit, prev_clevel,
-								txCommitCallees);
+								S->txCommitCallees);
 
 			// find tx entries and exits in the same function and add them to foundTx
-			// return matched CallInst that were removed from the lists
+			// return matched boundaries that were removed from the lists
 			auto prunes = findCandidates(new_blevel, new_clevel);
 
 			// remove remnants that were matched at this level
-			pruneRemnant(prunes.first, rem_blevel, txBeginCallees);
-			pruneRemnant(prunes.second, rem_clevel, txCommitCallees);
+			pruneRemnant(prunes.first, rem_blevel, S->txBeginCallees);
+			pruneRemnant(prunes.second, rem_clevel, S->txCommitCallees);
 
 			// old levels go to remnant sets
 			rem_blevel.splice(rem_blevel.end(), prev_blevel);
@@ -86,24 +189,24 @@ bool PrimeBortDetectorPass::runOnModule(Module &M) {
 		if (!rem_blevel.empty() || !prev_clevel.empty()) {
 			
 			auto prunes = findCandidates(rem_blevel, rem_clevel);
-			pruneRemnant(prunes.first, rem_blevel, txBeginCallees);
-			pruneRemnant(prunes.second, rem_clevel, txCommitCallees);
+			pruneRemnant(prunes.first, rem_blevel, S->txBeginCallees);
+			pruneRemnant(prunes.second, rem_clevel, S->txCommitCallees);
 
 			while (!rem_blevel.empty()) {
-				const CI_list::iterator orig_end = rem_blevel.end();
+				const BI_list::iterator orig_end = rem_blevel.end();
 				for (auto it = rem_blevel.begin(); it != orig_end; ++it) {
 					// TODO: this is inefficient here
-					CallInst* CI = *it;
-					auto f_it = candidateMap.find(CI->getFunction());
-					if (f_it != candidateMap.end()) {
+					Instruction* CI = *it;
+					auto f_it = S->candidateMap.find(CI->getFunction());
+					if (f_it != S->candidateMap.end()) {
 						f_it->second.first.push_back(CI);
 						continue;
 					}
 					for (auto U = CI->user_begin(); U != CI->user_end(); ++U) {
 						if (isa<CallInst>(*U)) {
 							CallInst* T = cast<CallInst>(*U);
-							auto f_it = candidateMap.find(T->getFunction());
-							if (f_it != candidateMap.end()) {
+							auto f_it = S->candidateMap.find(T->getFunction());
+							if (f_it != S->candidateMap.end()) {
 								f_it->second.first.push_back(T);
 							} else {
 								rem_blevel.push_back(T);
@@ -114,20 +217,20 @@ bool PrimeBortDetectorPass::runOnModule(Module &M) {
 				rem_blevel.erase(rem_blevel.begin(), orig_end);
 			}
 			while (!rem_clevel.empty()) {
-				const CI_list::iterator orig_end = rem_clevel.end();
+				const BI_list::iterator orig_end = rem_clevel.end();
 				for (auto it = rem_clevel.begin(); it != orig_end; ++it) {
 					// TODO: this is inefficient here
-					CallInst* CI = *it;
-					auto f_it = candidateMap.find(CI->getFunction());
-					if (f_it != candidateMap.end()) {
+					Instruction* CI = *it;
+					auto f_it = S->candidateMap.find(CI->getFunction());
+					if (f_it != S->candidateMap.end()) {
 						f_it->second.second.push_back(CI);
 						continue;
 					}
 					for (auto U = CI->use_begin(); U != CI->use_end(); ++U) {
 						if (isa<CallInst>(*U)) {
 							CallInst* T = cast<CallInst>(*U);
-							auto f_it = candidateMap.find(T->getFunction());
-							if (f_it != candidateMap.end()) {
+							auto f_it = S->candidateMap.find(T->getFunction());
+							if (f_it != S->candidateMap.end()) {
 								f_it->second.second.push_back(T);
 							} else {
 								rem_clevel.push_back(T);
@@ -138,42 +241,33 @@ bool PrimeBortDetectorPass::runOnModule(Module &M) {
 				rem_clevel.erase(rem_clevel.begin(), orig_end);
 			}
 		}
+		}
 
 LLVM_DEBUG(
-		for (CallInst* CI : rem_blevel) 
+		for (Instruction* CI : rem_blevel) 
 			dbgs() << "Unmatched " << *CI << " @ " << *(CI->getFunction()) << '\n';
-		for (CallInst* CI : rem_clevel) 
+		for (Instruction* CI : rem_clevel) 
 			dbgs() << "Unmatched " << *CI << " @ " << *(CI->getFunction()) << '\n';
 );
 		
-		// match entries to exits
-		for (auto it = candidateMap.begin(); it != candidateMap.end(); ++it) {
-			auto F = it->second;
-			const SmallVectorImpl<CallInst*>& entries = F.first;
-			const SmallVectorImpl<CallInst*>& exits = F.second;
-			// each entry is its own transaction, with one or more exits
-			for (CallInst* entry : entries) {
-				TxInfo info;
-				info.entry = entry;
-				info.ancestor = it->first;
-				// find any of these exits that are reachable and record them in info
-				boundTxInFunc(entry->getParent(), exits, info);
-				if (info.exits.empty()) {
-					LLVM_DEBUG(dbgs() << "Entry point " << *entry << " in function " << 
-						entry->getFunction()->getName() << "has no reachable exits!";);
-				} else {
-					foundTx.push_back(info);
-				}
-			}
+		if (AnalysisTier == 0) {
+			if (!analysisOnly) printTriage(errs(), txBegin, txCommit);
+			return false;
 		}
 
+		{
+		PHASE_TIMER("bound", "Bound txs and scan their regions");
+		// match entries to exits
+		for (auto it = S->candidateMap.begin(); it != S->candidateMap.end(); ++it)
+			boundTxInFunc(*it->first, it->second.first, it->second.second);
+
 		// get call chains to entry and exit for each found tx
-		for (auto it = foundTx.begin(); it != foundTx.end(); ++it) {
+		for (auto it = S->foundTx.begin(); it != S->foundTx.end(); ++it) {
 			TxInfo& info = *it;
-			CallInst* CI = info.entry;
+			Instruction* CI = info.entry;
 			do {
 				info.entryChain.push_back(CI);
-				CI = txBeginCallees[CI];
+				CI = S->txBeginCallees[CI];
 			} while (CI);
 			for (unsigned i = 0; i < info.exits.size(); ++i) {
 				CI = info.exits[i];
@@ -181,30 +275,40 @@ LLVM_DEBUG(
 				assert(info.exitChains.size() == i+1);
 				do {
 					info.exitChains[i].push_back(CI);
-					CI = txCommitCallees[CI];
+					CI = S->txCommitCallees[CI];
 				} while (CI);
 			}
 		}
 
+		// scan the code inside each tx, noting where other txs begin inside it
+		for (const TxInfo& info : S->foundTx) S->txEntries.insert(info.entry);
+		for (TxInfo& info : S->foundTx) {
+			if (!reuseTx(info)) scanTxRegion(info);
+		}
+		// lines other txs write too cost the estimates below a transfer each
+		findContention();
+		if (S->rerun) checkKeptContention();
+		}
+
 		/*
 		 * For each tx entry found, estimate the longest path through the tx and
 		 * the shortest path back to the beginning for all reachable exits.
 		 */
 
-		for (auto it = foundTx.begin(); it != foundTx.end(); ++it) {
-			TxInfo& info = *it;
-			for (unsigned i = 0; i < info.exits.size(); ++i) {
-				size_t txLat = estimateLongestPath(info.entryChain, info.exitChains[i]);
-				size_t rtLat = estimateShortestPath(info.exitChains[i], info.entryChain);
-				info.txLat.push_back(txLat);
-				info.rtLat.push_back(rtLat);
-				assert(info.txLat.size() == info.rtLat.size() && info.txLat.size() == i+1);
-			}
+		{
+		PHASE_TIMER("estimate", "Estimate tx latencies");
+		if (machineBlockLat) distributeMachineLat();
+		for (TxInfo& info : S->foundTx) {
+			// reused txs come with their estimates
+			if (info.txLat.empty()) estimateTx(info);
+		}
+		// the fallback of an RTM tx is costed with the estimates of its lock's tx
+		for (TxInfo& info : S->foundTx) analyzeAbort(info);
 		}
 
 LLVM_DEBUG(
-		dbgs() << "FOUND " << foundTx.size() << " TRANSACTIONS:\n=====\n";
-		for (auto it = foundTx.begin(); it != foundTx.end(); ++it) {
+		dbgs() << "FOUND " << S->foundTx.size() << " TRANSACTIONS:\n=====\n";
+		for (auto it = S->foundTx.begin(); it != S->foundTx.end(); ++it) {
 			TxInfo& info = *it;
 			dbgs() << "Common Func: " << info.ancestor->getName() <<
 				"\nEntry point: " << *info.entry << " -->" << *(info.entryChain.back()) <<
@@ -218,33 +322,33 @@ LLVM_DEBUG(
 			dbgs() << "=====\n";
 		}
 );
-	}
-
-	// does not modify code
-	return false;
-}
-
-#define PUSH_IF_EXISTS(vec, val) \
-	do { \
-		auto v = val; \
-		if (v != NULL) vec.push_back(v); \
-	} while (false)
-
-void PrimeBortDetectorPass::populateLeafSets(const Module& M,
-		SmallVector<Function*, 4>& begin, SmallVector<Function*, 4>& commit) {
 
-	PUSH_IF_EXISTS(begin, M.getFunction("llvm.x86.xbegin"));
-	PUSH_IF_EXISTS(commit, M.getFunction("llvm.x86.xend"));
+		if (analysisOnly) return false;
+
+		// shrinking changes the critical sections everything below describes
+		changed |= shrinkTx(M);
+
+		serializeTx(M);
+		writeIndex(M);
+		printElisionReport(errs());
+		printLockReport(errs());
+		printContentionReport(errs());
+		printAbortReport(errs());
+		printWitnessReport(errs());
+		LatencyVisitor::printUnknownOps(errs(), S->unknownOps);
+
+		// the other transforms go last, after everything has been reported;
+		// metadata first, so it describes the code as it was analysed
+		changed |= annotateIR(M);
+		changed |= instrumentTx(M);
+		changed |= guardTx(M);
+	}
 
-	PUSH_IF_EXISTS(begin, M.getFunction("pthread_mutex_lock"));
-	PUSH_IF_EXISTS(begin, M.getFunction("pthread_rwlock_rdlock"));
-	PUSH_IF_EXISTS(begin, M.getFunction("pthread_rwlock_wrlock"));
-	PUSH_IF_EXISTS(commit, M.getFunction("pthread_mutex_unlock"));
-	PUSH_IF_EXISTS(commit, M.getFunction("pthread_rwlock_unlock"));
+	return changed;
 }
 
-void PrimeBortDetectorPass::pruneRemnant(CI_list& prune, CI_list& rem,
-		const DenseMap<CallInst*, CallInst*>& links) {
+void PrimeBortDetectorPass::pruneRemnant(BI_list& prune, BI_list& rem,
+		const DenseMap<Instruction*, Instruction*>& links) {
 	if (rem.empty()) return;
 	// find chains for each element of original prune list
 	// add chains to prune list
@@ -253,7 +357,7 @@ void PrimeBortDetectorPass::pruneRemnant(CI_list& prune, CI_list& rem,
 	for (size_t i = 0; i < osz; ++i) {
 		const auto f_it = links.find(*(it++));
 		assert(f_it != links.end());
-		CallInst* CI = f_it->second; 
+		Instruction* CI = f_it->second; 
 		while (CI) {
 			prune.push_back(CI);
 			const auto f_it = links.find(CI);
@@ -273,7 +377,7 @@ void PrimeBortDetectorPass::pruneRemnant(CI_list& prune, CI_list& rem,
 		else if (*R_it < *P_it) ++R_it;
 		else {
 			// remove all instances of this call from both lists
-			const CallInst* CI = *P_it;
+			const Instruction* CI = *P_it;
 			do {
 				auto old = R_it++;
 				rem.erase(old);
@@ -286,43 +390,47 @@ void PrimeBortDetectorPass::pruneRemnant(CI_list& prune, CI_list& rem,
 	}
 }
 
-bool PrimeBortDetectorPass::compCallInstByFunction(const CallInst* A, const CallInst* B) {
-	return A->getFunction() < B->getFunction();
+bool PrimeBortDetectorPass::compInstByFunction(const Instruction* A,
+		const Instruction* B) const {
+	return S->funcOrder.lookup(A->getFunction()) < S->funcOrder.lookup(B->getFunction());
 }
 
-std::pair<CI_list, CI_list>
-PrimeBortDetectorPass::findCandidates(CI_list& A, CI_list& B) {	
+std::pair<BI_list, BI_list>
+PrimeBortDetectorPass::findCandidates(BI_list& A, BI_list& B) {	
 	// values to be removed at the end
-	SmallVector<CI_list::iterator, 8> rmA;
-	SmallVector<CI_list::iterator, 8> rmB;
+	SmallVector<BI_list::iterator, 8> rmA;
+	SmallVector<BI_list::iterator, 8> rmB;
 
 	// diff requires sort first
-	A.sort(compCallInstByFunction);
-	B.sort(compCallInstByFunction);
+	auto comp = [this](const Instruction* X, const Instruction* Y) {
+		return compInstByFunction(X, Y);
+	};
+	A.sort(comp);
+	B.sort(comp);
 
 	// find the intersection of the lists 
 	auto A_it = A.begin();
 	auto B_it = B.begin();
 	while (A_it != A.end() && B_it != B.end()) {
-		if (compCallInstByFunction(*A_it, *B_it)) {
+		if (compInstByFunction(*A_it, *B_it)) {
 			++A_it;
-		} else if (compCallInstByFunction(*B_it, *A_it)) {
+		} else if (compInstByFunction(*B_it, *A_it)) {
 			++B_it;
 		} else { // equal
 			// there may be multiple in either A or B that match the function,
 			// we want all of them
 			Function* F = (*A_it)->getFunction();
-			candidateMap[F].first.push_back(*A_it);
+			S->candidateMap[F].first.push_back(*A_it);
 			rmA.push_back(A_it);
 			while ( ++A_it != A.end() && (*A_it)->getFunction() == F) {
-				candidateMap[F].first.push_back(*A_it);
+				S->candidateMap[F].first.push_back(*A_it);
 				rmA.push_back(A_it);
 			}
 
-			candidateMap[F].second.push_back(*B_it);
+			S->candidateMap[F].second.push_back(*B_it);
 			rmB.push_back(B_it);
 			while (++B_it != B.end() && (*B_it)->getFunction() == F) {
-				candidateMap[F].second.push_back(*B_it);
+				S->candidateMap[F].second.push_back(*B_it);
 				rmB.push_back(B_it);
 			}
 		}
@@ -330,38 +438,35 @@ PrimeBortDetectorPass::findCandidates(CI_list& A, CI_list& B) {
 
 	// remove intersection from sets and return it for remnant pruning
 	// lists to return removed values
-	CI_list A_tomb, B_tomb;
+	BI_list A_tomb, B_tomb;
 	while (!rmA.empty()) {A_tomb.splice(A_tomb.end(), A, rmA.pop_back_val());}
 	while (!rmB.empty()) {B_tomb.splice(B_tomb.end(), B, rmB.pop_back_val());}
 	return std::make_pair(A_tomb, B_tomb);
 }
 
-CI_list PrimeBortDetectorPass::levelUpCallerGraph(SmallVectorImpl<Function*>& root, CI_list& prev_level,
-		DenseMap<CallInst*, CallInst*>& links) {
+BI_list PrimeBortDetectorPass::levelUpCallerGraph(SmallVectorImpl<Instruction*>& leaves,
+		BI_list& prev_level, DenseMap<Instruction*, Instruction*>& links) {
 
-	CI_list new_level;
-	if (links.empty()) { // get next level from root sets
+	BI_list new_level;
+	if (links.empty()) { // the boundaries themselves
 		assert(prev_level.empty());
-		for (unsigned i = 0; i < root.size(); ++i) {
-			for (auto U = root[i]->user_begin(); U != root[i]->user_end(); ++U) {
-				if (isa<CallInst>(*U)) {
-					CallInst* CI = cast<CallInst>(*U);
-					new_level.push_back(CI);
-					auto emplit = links.try_emplace(CI, nullptr);
-					assert(emplit.second || emplit.first->second == nullptr);
-				}
-			}
+		for (Instruction* I : leaves) {
+			auto emplit = links.try_emplace(I, nullptr);
+			assert(emplit.second);
+			new_level.push_back(I);
 		}
 	} else { // get next level from previous level
 		for (auto I = prev_level.begin(); I != prev_level.end(); ++I) {
 			Function* F = (*I)->getFunction();
-			for (auto U = F->user_begin(); U != F->user_end(); ++U) {
-				if (isa<CallInst>(*U)) {
-					CallInst* CI = cast<CallInst>(*U);
-					auto emplit = links.try_emplace(CI, *I);
-					assert(emplit.second || emplit.first->second == *I);
-					new_level.push_back(CI);
-				}
+			SmallVector<CallInst*, 8> callers;
+			getCallers(F, callers);
+			for (CallInst* CI : callers) {
+				auto emplit = links.try_emplace(CI, *I);
+				// an indirect call reaching several functions of this level follows the first
+				if (!emplit.second && emplit.first->second != *I &&
+						!CI->getCalledFunction()) continue;
+				assert(emplit.second || emplit.first->second == *I);
+				new_level.push_back(CI);
 			}	
 		}
 	}
@@ -369,145 +474,202 @@ CI_list PrimeBortDetectorPass::levelUpCallerGraph(SmallVectorImpl<Function*>& ro
 	return new_level;
 }
 
-void PrimeBortDetectorPass::boundTxInFunc(BasicBlock* current,
-			const SmallVectorImpl<CallInst*>& exits, TxInfo& info) {
-	// clear marked BBs for each new entry point
-	static TxInfo* infoaddr_last = &info;
-	static DenseMap<BasicBlock*, bool> visited;
-	if (&info != infoaddr_last) {
-		visited.clear();
-		infoaddr_last = &info;
+void PrimeBortDetectorPass::boundTxInFunc(Function& F,
+		const SmallVectorImpl<Instruction*>& entries,
+		const SmallVectorImpl<Instruction*>& exits) {
+	// paths end at the first exit they reach; a block with several exits
+	// ends the tx at the first one listed
+	SmallPtrSet<const BasicBlock*, 16> stops;
+	for (Instruction* exit : exits) {
+		assert(exit->getFunction() == &F);
+		stops.insert(exit->getParent());
 	}
-	// mark BBs to avoid multiple visits
-	if (visited[current] == true) return;
-	else visited[current] = true;
-	
-	// if we have reached an exit add it to exit list and return
-	for (CallInst* exit : exits) {
-		assert(exit->getFunction() == current->getParent());
-		if (current == exit->getParent()) {
-			info.exits.push_back(exit);
-			return;
-		}
+	BlockReachability R(F, stops);
+	BitVector exitBlocks(R.size());
+	SmallVector<Instruction*, 16> firstExit(R.size());
+	for (Instruction* exit : exits) {
+		const unsigned n = R.getNumber(exit->getParent());
+		if (exitBlocks.test(n)) continue;
+		exitBlocks.set(n);
+		firstExit[n] = exit;
 	}
-	const Instruction* T = current->getTerminator();
-	// if we hit a return without an exit just return
-	if (isa<ReturnInst>(T)) {
+
+	// each entry is its own transaction, with one or more exits
+	for (Instruction* entry : entries) {
+		TxInfo info;
+		info.entry = entry;
+		info.ancestor = &F;
+		BitVector reached = R.reachableFrom(entry->getParent());
 LLVM_DEBUG(
-		dbgs() << "PrimeBort: Hit return without tx commit in common caller: "
-		<< current->getParent() << " @ " << current << "\n";
+		for (unsigned n : reached.set_bits()) {
+			if (!exitBlocks.test(n) && isa<ReturnInst>(R.getBlock(n)->getTerminator()))
+				dbgs() << "PrimeBort: Hit return without tx commit in common caller: "
+					<< F.getName() << " @ " << R.getBlock(n)->getName() << "\n";
+		}
 );
-		return;
+		reached &= exitBlocks;
+		for (unsigned n : reached.set_bits()) info.exits.push_back(firstExit[n]);
+		if (info.exits.empty()) {
+			LLVM_DEBUG(dbgs() << "Entry point " << *entry << " in function " <<
+				F.getName() << " has no reachable exits!\n";);
+		} else {
+			S->foundTx.push_back(info);
+		}
 	}
-	// otherwise, recurse on successors
-	for (unsigned i = 0; i < T->getNumSuccessors(); ++i) 
-		boundTxInFunc(T->getSuccessor(i), exits, info);
-
-	return;
 }
 
 size_t PrimeBortDetectorPass::estimatePathFromChains(
-		const SmallVectorImpl<CallInst*>& startChain,
-		const SmallVectorImpl<CallInst*>& destChain,
-		const bool longest) {
+		const SmallVectorImpl<Instruction*>& startChain,
+		const SmallVectorImpl<Instruction*>& destChain,
+		const bool longest, SmallVectorImpl<WitnessStep>* witness) {
 	size_t lat = 0;
 	assert(startChain.front()->getFunction() == destChain.front()->getFunction());
+
+	// tier 1: only the path between the two calls in the common ancestor, with
+	// every callee costed from its summary, the chains' wrappers included: their
+	// whole bodies, not just the parts past the start or before the dest.
+	// If the dest is only reached again through a caller, the path to the return
+	// of the ancestor stands in for it.
+	if (AnalysisTier == 1) {
+		const unsigned tag = newCacheTag();
+		auto retp = estimatePathLat(startChain.front(), destChain.front(), 0,
+				tag, longest, true, true);
+		if (witness) collectWitness(startChain.front(), destChain.front(), tag,
+				longest, true, *witness);
+		return retp.first;
+	}
 	
 	// get latency in each function in start chain
 	for (unsigned i = startChain.size()-1; i > 0; --i) {
-		auto retp = estimatePathLat(startChain[i]->getParent()->getFirstNonPHIOrDbg(),
-				NULL, lat, newCacheTag(), longest, true, false);
+		Instruction* start = startChain[i]->getParent()->getFirstNonPHIOrDbg();
+		const unsigned tag = newCacheTag();
+		auto retp = estimatePathLat(start, NULL, lat, tag, longest, true, false);
 		assert(!retp.second);
+		if (witness) collectWitness(start, NULL, tag, longest, true, *witness);
 		lat += retp.first;
 	}
 
 	// get latency between calls in common ancestor,
-	// moving up in the call graph if necessary
-	lat += estimateLatThroughCallers(startChain.front(), destChain.front(),
-			lat, longest);
+	// moving up in the call graph if necessary;
+	// the rest of a wrapper was counted above, so not its call
+	Instruction* start = startChain.front();
+	if (startChain.size() > 1) start = start->getNextNonDebugInstruction();
+	lat += estimateLatThroughCallers(start, destChain.front(), lat, longest, witness);
 
 	// get latency in each function in dest chain
 	std::pair<size_t, bool> retp;
 	for (unsigned i = 1; i < destChain.size(); ++i) {
-		retp = estimatePathLat(
-				destChain[i-1]->getCalledFunction()->getEntryBlock().getFirstNonPHIOrDbg(),
-				destChain[i], lat, newCacheTag(), longest, true, false);
+		start = destChain[i]->getFunction()->getEntryBlock().getFirstNonPHIOrDbg();
+		const unsigned tag = newCacheTag();
+		retp = estimatePathLat(start, destChain[i], lat, tag, longest, true, false);
+		if (witness) collectWitness(start, destChain[i], tag, longest, true, *witness);
 		lat += retp.first;
 	}
-	assert(retp.second);
+	// an exit called directly in the common ancestor was already hit above,
+	// and walks past the search limit stop before reaching it
+	assert(destChain.size() == 1 || retp.second || lat >= MAX_SEARCH_DIST);
 
 	return lat;
 }
 
+void PrimeBortDetectorPass::estimateTx(TxInfo& info) {
+	info.txLat.clear();
+	info.rtLat.clear();
+	const size_t contentionLat = getContentionLat(info.props);
+	for (unsigned i = 0; i < info.exits.size(); ++i) {
+		size_t txLat = estimateLongestPath(info.entryChain, info.exitChains[i]);
+		if (info.props.flags & RF_ZMM) txLat += txLat * AVX512Slowdown / 100;
+		txLat += contentionLat;
+		size_t rtLat = estimateShortestPath(info.exitChains[i], info.entryChain);
+		info.txLat.push_back(txLat);
+		info.rtLat.push_back(rtLat);
+		assert(info.txLat.size() == info.rtLat.size() && info.txLat.size() == i+1);
+	}
+}
+
 size_t PrimeBortDetectorPass::estimateShortestPath(
-		const SmallVectorImpl<CallInst*>& startChain,
-		const SmallVectorImpl<CallInst*>& destChain) {
+		const SmallVectorImpl<Instruction*>& startChain,
+		const SmallVectorImpl<Instruction*>& destChain) {
 	return estimatePathFromChains(startChain, destChain, false);	
 }
 
 size_t PrimeBortDetectorPass::estimateLongestPath(
-		const SmallVectorImpl<CallInst*>& startChain,
-		const SmallVectorImpl<CallInst*>& destChain) {
+		const SmallVectorImpl<Instruction*>& startChain,
+		const SmallVectorImpl<Instruction*>& destChain) {
 	return estimatePathFromChains(startChain, destChain, true);	
 }
 
 size_t PrimeBortDetectorPass::estimateLatThroughCallers (
-		Instruction* start, const CallInst* dest,
-		const size_t prev_lat, const bool longest) {
+		Instruction* start, const Instruction* dest,
+		const size_t prev_lat, const bool longest,
+		SmallVectorImpl<WitnessStep>* witness) {
 	
 	if (prev_lat >= MAX_SEARCH_DIST) return prev_lat;
 
 	assert(start->getFunction() == dest->getFunction());
 	Function* F = start->getFunction();
 
-	auto retp = estimatePathLat(start, dest, prev_lat, newCacheTag(), longest, true, true);
+	const unsigned tag = newCacheTag();
+	auto retp = estimatePathLat(start, dest, prev_lat, tag, longest, true, true);
+	if (witness) collectWitness(start, dest, tag, longest, true, *witness);
 	// return if dest is reachable at this level
 	if (retp.second) return retp.first;
 
 	// otherwise, recurse upwards in the call graph
 	size_t here_lat = retp.first;
 	size_t more_lat = (longest) ? 0 : SIZE_MAX;
-	for (auto U = F->use_begin(); U != F->use_end(); ++U) {
-		if (isa<CallInst>(*U)) {
-			CallInst* CI = cast<CallInst>(*U);
-			assert(CI->getNextNonDebugInstruction() != NULL);
-			size_t c_lat = estimateLatThroughCallers(CI->getNextNonDebugInstruction(),
-					CI, prev_lat + here_lat, longest);
-			if ((longest && c_lat > more_lat) ||
-					(!longest && c_lat < more_lat)) {
-				more_lat = c_lat;
-			}
+	SmallVector<WitnessStep, 16> c_witness, more_witness;
+	SmallVector<CallInst*, 8> callers;
+	getCallers(F, callers);
+	for (CallInst* CI : callers) {
+		assert(CI->getNextNonDebugInstruction() != NULL);
+		c_witness.clear();
+		size_t c_lat = estimateLatThroughCallers(CI->getNextNonDebugInstruction(),
+				CI, prev_lat + here_lat, longest, (witness) ? &c_witness : NULL);
+		if ((longest && c_lat > more_lat) ||
+				(!longest && c_lat < more_lat)) {
+			more_lat = c_lat;
+			std::swap(more_witness, c_witness);
 		}
 	}
+	if (witness) witness->append(more_witness.begin(), more_witness.end());
+	if (more_lat == SIZE_MAX) more_lat = 0; // no callers to return to
 
 	return here_lat + more_lat;
 }
 
-// setting this high is actually a decent heuristic, because
-// non-canonical loops are pretty suspicious in a tx
-#define FALLBACK_ITER_COUNT 128
 size_t PrimeBortDetectorPass::estimateTotalLoopLat (const Loop* L,
-		BasicBlock*& entry, const unsigned topLevelTag, const bool longest) {	
-	// get exit BBs and loop analysis results
+		ScalarEvolution& SE, BasicBlock*& entry, const bool longest, unsigned* iter) {	
+	// get exit BBs and trip counts before walking: L and SE are only valid
+	// until the walk requests analyses for another block
 	SmallVector<BasicBlock*, 4> exits;
 	L->getExitingBlocks(exits);
-	ScalarEvolution& SE = 
-		getAnalysis<ScalarEvolutionWrapperPass>(*(entry->getParent())).getSE();
-
-	size_t ret = (longest) ? 0 : SIZE_MAX;
+	SmallVector<unsigned, 4> iters;
 	unsigned fallback_iter = SE.getSmallConstantMaxTripCount(L);
 	if (fallback_iter == 0) fallback_iter = FALLBACK_ITER_COUNT;
+	for (BasicBlock* BB : exits) {
+		unsigned iter = SE.getSmallConstantTripCount(L, BB);
+		if (iter == 0) iter = getContextTripCount(SE, L, BB);
+		iters.push_back((iter) ? iter : fallback_iter);
+	}
+	SmallPtrSet<const BasicBlock*, 16> blocks(L->block_begin(), L->block_end());
+
+	size_t ret = (longest) ? 0 : SIZE_MAX;
 	BasicBlock* sel_bb = NULL;
-	for (auto BB = exits.begin(); BB != exits.end(); ++BB) {
-		unsigned iter = SE.getSmallConstantTripCount(L, *BB);
-		if (iter == 0) iter = fallback_iter;
+	for (unsigned i = 0; i < exits.size(); ++i) {
+		// one iteration, header to the exiting branch, without leaving the loop;
+		// a fresh tag keeps the blocks cached by the enclosing walk from cutting it short
+		const SmallPtrSetImpl<const BasicBlock*>* outerLoop = S->walkLoop;
+		S->walkLoop = &blocks;
 		auto retp = estimatePathLat(entry->getFirstNonPHIOrDbg(),
-				 (*BB)->getTerminator(), 0, topLevelTag, longest, false, true);
-		size_t tlat = retp.first * iter;
+				 exits[i]->getTerminator(), 0, newCacheTag(), longest, false, true);
+		S->walkLoop = outerLoop;
+		size_t tlat = retp.first * iters[i];
 		if ((longest && tlat > ret)
 				|| (!longest && tlat < ret)) {
 			ret = tlat;
-			sel_bb = *BB;
+			sel_bb = exits[i];
+			if (iter) *iter = iters[i];
 		}
 	}
 	// return the selected exit to the caller
@@ -516,6 +678,44 @@ size_t PrimeBortDetectorPass::estimateTotalLoopLat (const Loop* L,
 	return ret;	
 }
 
+size_t PrimeBortDetectorPass::estimateCallsLat(LatencyVisitor& LV, BasicBlock* BB,
+		const size_t prev_lat, const unsigned topLevelTag, const bool longest,
+		const bool handleLoops, std::pair<CallBase*, size_t>* top) {
+	size_t lat = 0;
+	// fetched once for the block, on the first call that needs it
+	ScalarEvolution* SE = NULL;
+	while (LV.hasCall()) {
+		CallBase* CB = LV.popCall();
+		Function* F = CB->getCalledFunction();
+		size_t c_lat = 0;
+		if (F && !(F->empty())) {
+			c_lat = estimateCallLat(*CB, F, prev_lat + lat, topLevelTag,
+					longest, handleLoops);
+		} else if (!F) {
+			if (!SE) SE = &getSE(*(BB->getParent()));
+			c_lat = estimateIndirectCallLat(*CB, *SE, prev_lat + lat, topLevelTag,
+					longest, handleLoops);
+		} else if (S->txBoundaryFuncs.count(F)) {
+			continue;
+		} else if (const LibCostTable::Model* LM = S->libCost->lookup(*CB)) {
+			// library calls and memory intrinsics; other intrinsics are ignored
+			if (!SE) SE = &getSE(*(BB->getParent()));
+			ValueToSCEVMapTy bindings;
+			c_lat = S->libCost->getLat(*CB, *LM, SE, longest,
+					bindContext(*SE, BB->getParent(), bindings) ? &bindings : NULL);
+		}
+		lat += c_lat;
+		if (top && c_lat > top->second) *top = std::make_pair(CB, c_lat);
+	}
+	return lat;
+}
+
+size_t PrimeBortDetectorPass::estimateBlockLat(BasicBlock* BB, const bool longest) {
+	LatencyVisitor LV(S->asmCost.get(), &S->unknownOps, &S->machineLat);
+	LV.visit(*BB);
+	return LV.getLat() + estimateCallsLat(LV, BB, 0, newCacheTag(), longest, true);
+}
+
 // TODO: does not properly explore exit paths from loops in some cases
 // not a huge issue since loops with multiple exits are unusual
 std::pair<size_t, bool>
@@ -529,25 +729,13 @@ PrimeBortDetectorPass::estimatePathLat (Instruction* start, const Instruction* d
 	size_t here_lat = 0;
 	BasicBlock* BB = start->getParent();
 	BasicBlock* entry_BB = BB; // loop coalescing might change BB
-	// pseudo-coalesce loops into a single block by finding the longest
-	// path through them and jumping to the corresponding exit
-	// unless the destination is in the same loop
-	if (handleLoops) {
-		LoopInfo& LI = getAnalysis<LoopInfoWrapperPass>(*(BB->getParent())).getLoopInfo();
-		Loop* L = LI.getLoopFor(BB);
-		Loop* dL = (dest) ? LI.getLoopFor(dest->getParent()) : NULL; 
-		if (L && L != dL) {
-			here_lat = estimateTotalLoopLat(L, BB, topLevelTag, longest);
-		}
-	}
 
 	// if the tag matches, the cached value is returned; if not,
 	// an empty value is placed in the map and filled out when we return
 	//
-	// this handles reconvergent paths, and stops endless
-	// recursion when using estimateTotalLoopLat
-	auto f_it = BBLatCache.find(BB);
-	if (f_it != BBLatCache.end()) {
+	// this handles reconvergent paths and stops endless recursion
+	auto f_it = S->BBLatCache.find(BB);
+	if (f_it != S->BBLatCache.end()) {
 		BBLatEntry& nt = f_it->second;
 		if (nt.tag == topLevelTag) {
 			return nt.prev;
@@ -555,43 +743,50 @@ PrimeBortDetectorPass::estimatePathLat (Instruction* start, const Instruction* d
 			f_it->second = {topLevelTag, std::make_pair(0, false)};
 		}
 	} else {
-		auto emplit = BBLatCache.try_emplace(BB, topLevelTag, std::make_pair(0, false));
+		auto emplit = S->BBLatCache.try_emplace(BB, topLevelTag, std::make_pair(0, false));
 		assert(emplit.second);
 	}
 
-	// get latency for the current block
-	LatencyVisitor LV;
+	// pseudo-coalesce loops into a single block by finding the longest
+	// path through them and jumping to the corresponding exit
+	// unless the destination is in the same loop
+	SmallPtrSet<const BasicBlock*, 16> coalesced;
+	if (handleLoops) {
+		ScalarEvolution& SE = getSE(*(BB->getParent()));
+		LoopInfo& LI = getLI(*(BB->getParent()));
+		Loop* L = LI.getLoopFor(BB);
+		Loop* dL = (dest) ? LI.getLoopFor(dest->getParent()) : NULL; 
+		if (L && L != dL && !(dL && L->contains(dL))) {
+			coalesced.insert(L->block_begin(), L->block_end());
+			here_lat = estimateTotalLoopLat(L, SE, BB, longest);
+			// the loop walk retagged the header, put the placeholder back
+			S->BBLatCache.find(entry_BB)->second = {topLevelTag, std::make_pair(0, false)};
+		}
+	}
+
+	// get latency for the current block, up to the destination if it is here
+	// (a coalesced loop already includes its exiting block)
+	LatencyVisitor LV(S->asmCost.get(), &S->unknownOps, &S->machineLat);
 	bool hitDest = false;
-	if (dest && dest->getParent() == BB) { // we have reached our destination, probably
-		for (Instruction* I = start; I && I != BB->getTerminator();
-				I = I->getNextNonDebugInstruction()) {
+	if (coalesced.empty()) {
+		for (Instruction* I = start; I; I = I->getNextNonDebugInstruction()) {
 			LV.visit(I);
 			if (I == dest) {
 				hitDest = true;
 				break;
 			}
 		}
-	} else {
-		LV.visit(BB);
 	}
 	here_lat += LV.getLat();
 
 	// add latency for functions called in this BB
-	while (LV.hasCall()) {
-		CallBase* CB = LV.popCall();
-		Function* F = CB->getCalledFunction();
-		if (F && !(F->empty())) { // ignore intrinsics
-			// TODO: ignores indirect calls
-			auto retp = estimatePathLat(F->getEntryBlock().getFirstNonPHIOrDbg(),
-					NULL, prev_lat + here_lat, topLevelTag, longest, handleLoops, false);
-			here_lat += retp.first;
-		}
-	}
+	here_lat += estimateCallsLat(LV, BB, prev_lat + here_lat, topLevelTag,
+			longest, handleLoops);
 
 	if (hitDest) {
 		auto ret = std::make_pair(here_lat, true);
-		auto f_it = BBLatCache.find(entry_BB);
-		assert(f_it != BBLatCache.end());
+		auto f_it = S->BBLatCache.find(entry_BB);
+		assert(f_it != S->BBLatCache.end());
 		f_it->second = {topLevelTag, ret};
 		return ret;
 	}
@@ -599,16 +794,21 @@ PrimeBortDetectorPass::estimatePathLat (Instruction* start, const Instruction* d
 	// recurse on each successor, and select the longest/shortest path,
 	// optionally preferring hits 
 	size_t more_lat = (longest) ? 0 : SIZE_MAX;
+	BasicBlock* next = NULL;
 	if (!isa<ReturnInst>(BB->getTerminator())) { // stop following if block returns
 		const Instruction* T = BB->getTerminator(); 
 		for (unsigned i = 0; i < T->getNumSuccessors(); ++i) {
+			// leave a coalesced loop through its exits only, and stay inside
+			// the loop being walked by estimateTotalLoopLat
+			if (coalesced.count(T->getSuccessor(i))) continue;
+			if (S->walkLoop && !S->walkLoop->count(T->getSuccessor(i))) continue;
 			auto retp = estimatePathLat(T->getSuccessor(i)->getFirstNonPHIOrDbg(),
 					dest, prev_lat + here_lat, topLevelTag, longest, handleLoops, preferHits);
 			// split up the conditional for readability
 			// this is the base condition: whether this is the longest/shortest path seen
 			bool selPath =
 				(longest && retp.first > more_lat) ||
-				(!longest && retp.second < more_lat);
+				(!longest && retp.first < more_lat);
 			// if preferHits is true, only use miss values
 			// if we have not seen a hit yet
 			if ((retp.second || !hitDest || !preferHits) &&
@@ -616,16 +816,261 @@ PrimeBortDetectorPass::estimatePathLat (Instruction* start, const Instruction* d
 					((retp.second != hitDest) || selPath)) { // finding shortest
 				more_lat = retp.first;
 				hitDest = retp.second;
+				next = T->getSuccessor(i);
 			}
 		}
 	} else more_lat = 0; // don't add SIZE_MAX when returning from a function
+	if (more_lat == SIZE_MAX) more_lat = 0; // or when no successor was followed
 
 	auto ret = std::make_pair(here_lat + more_lat, hitDest);
-	f_it = BBLatCache.find(entry_BB);
-	assert(f_it != BBLatCache.end());
-	f_it->second = {topLevelTag, ret};
+	f_it = S->BBLatCache.find(entry_BB);
+	assert(f_it != S->BBLatCache.end());
+	f_it->second = {topLevelTag, ret, next};
 	return ret;	
 }
+
+void PrimeBortDetectorPass::printLoc(raw_ostream& OS, const Instruction* I) {
+	if (const DebugLoc& DL = I->getDebugLoc()) {
+		OS << DL->getFilename() << ':' << DL.getLine() << " (" << 
+			I->getFunction()->getName() << ')';
+	} else {
+		OS << I->getFunction()->getName();
+	}
+}
+
+bool PrimeBortDetectorPass::isRTMTx(const TxInfo& info) {
+	const CallBase* CB = dyn_cast<CallBase>(info.entryChain.back());
+	const Function* F = (CB) ? CB->getCalledFunction() : NULL;
+	return F && F->getIntrinsicID() == Intrinsic::x86_xbegin;
+}
+
+size_t PrimeBortDetectorPass::maxTxLat(const TxInfo& info) {
+	size_t lat = 0;
+	for (size_t l : info.txLat) lat = std::max(lat, l);
+	return lat;
+}
+
+size_t PrimeBortDetectorPass::minRtLat(const TxInfo& info) {
+	size_t lat = SIZE_MAX;
+	for (size_t l : info.rtLat) lat = std::min(lat, l);
+	return lat;
+}
+
+unsigned PrimeBortDetectorPass::classifyExternCall(StringRef Name) const {
+	const LibCostTable::Model* M = S->libCost->lookup(Name);
+	if (!M) return RF_EXTERN;
+	return M->flags | ((M->unbounded) ? (unsigned) RF_BLOCKING : 0u);
+}
+
+void PrimeBortDetectorPass::mergeProps(RegionProps& dst, const RegionProps& src) {
+	dst.readBytes += src.readBytes;
+	dst.writeBytes += src.writeBytes;
+	dst.flags |= src.flags;
+	for (Function* F : src.externCalls) {
+		if (!is_contained(dst.externCalls, F)) dst.externCalls.push_back(F);
+	}
+	for (Function* F : src.funcs) {
+		if (!is_contained(dst.funcs, F)) dst.funcs.push_back(F);
+	}
+	for (Instruction* CI : src.nestedEntries) {
+		if (!is_contained(dst.nestedEntries, CI)) dst.nestedEntries.push_back(CI);
+	}
+	for (Instruction* I : src.sharedWrites) {
+		if (!is_contained(dst.sharedWrites, I)) dst.sharedWrites.push_back(I);
+	}
+}
+
+void PrimeBortDetectorPass::scanTxRegion(TxInfo& info) {
+	AccessSet seen;
+	SmallPtrSet<const Instruction*, 4> stops;
+
+	// in the common ancestor: everything after the entry until one of the exits
+	for (Instruction* exit : info.exits) stops.insert(exit);
+	scanInstRange(afterBoundary(info.entry), stops, info.props, seen);
+	// the entry itself may be reached again through a loop
+	erase_value(info.props.nestedEntries, info.entry);
+
+	// below the ancestor: the rest of each function the entry returns through...
+	stops.clear();
+	for (unsigned i = 1; i < info.entryChain.size(); ++i)
+		scanInstRange(afterBoundary(info.entryChain[i]), stops, info.props, seen);
+
+	// ...and the start of each function the exits are called through,
+	// which is usually the same few wrappers for every exit
+	SmallPtrSet<const Instruction*, 4> scanned;
+	for (const auto& chain : info.exitChains) {
+		for (unsigned i = 1; i < chain.size(); ++i) {
+			if (!scanned.insert(chain[i]).second) continue;
+			stops.clear();
+			stops.insert(chain[i]);
+			scanInstRange(&chain[i]->getFunction()->getEntryBlock().front(),
+					stops, info.props, seen);
+		}
+	}
+
+	// a spin lock's own word: the acquire is before the entry and the release store
+	// is where the scan stops, so neither was seen above
+	if (!PrimeBortContention) return;
+	SmallVector<Instruction*, 4> lockWrites;
+	lockWrites.push_back(findSpinAcquire(info.entryChain.back()));
+	for (const auto& chain : info.exitChains) {
+		if (isa<StoreInst>(chain.back()) && S->boundaryLocks.count(chain.back()))
+			lockWrites.push_back(chain.back());
+	}
+	for (Instruction* I : lockWrites) {
+		SharedLoc loc;
+		if (I && getSharedLoc(*I, loc) && !is_contained(info.props.sharedWrites, I))
+			info.props.sharedWrites.push_back(I);
+	}
+}
+
+void PrimeBortDetectorPass::scanInstRange(Instruction* start,
+		const SmallPtrSetImpl<const Instruction*>& stops, RegionProps& props,
+		AccessSet& seen) {
+	Function* F = start->getFunction();
+	SmallVector<Function*, 8> callees;
+	{
+		// callees are collected here and scanned afterwards
+		LoopInfo& LI = getLI(*F);
+		ScalarEvolution& SE = getSE(*F);
+
+		SmallPtrSet<const BasicBlock*, 16> visited;
+		SmallVector<Instruction*, 16> work;
+		work.push_back(start);
+		while (!work.empty()) {
+			Instruction* I = work.pop_back_val();
+			BasicBlock* BB = I->getParent();
+			const Loop* L = LI.getLoopFor(BB);
+			unsigned iter = 1;
+			if (L) {
+				// a max trip count is usually just the range of the induction variable
+				iter = SE.getSmallConstantTripCount(L);
+				if (iter == 0) iter = SE.getSmallConstantMaxTripCount(L);
+				if (iter == 0 || iter > FALLBACK_ITER_COUNT) iter = FALLBACK_ITER_COUNT;
+			}
+
+			bool stopped = false;
+			for (; I; I = I->getNextNode()) {
+				if (stops.count(I)) {
+					stopped = true;
+					break;
+				}
+				accountInst(*I, L, iter, props, seen, callees);
+			}
+			if (stopped) continue;
+			for (BasicBlock* Succ : successors(BB)) {
+				if (visited.insert(Succ).second) work.push_back(&Succ->front());
+			}
+		}
+	}
+
+	for (Function* C : callees) {
+		mergeProps(props, getFuncProps(C));
+		if (!is_contained(props.funcs, C)) props.funcs.push_back(C);
+	}
+}
+
+void PrimeBortDetectorPass::accountInst(Instruction& I, const Loop* L, const unsigned iter,
+		RegionProps& props, AccessSet& seen,
+		SmallVectorImpl<Function*>& callees) {
+	const DataLayout& DL = I.getModule()->getDataLayout();
+	// bytes touched by an access, scaled by the trip count if it moves with the loop
+	auto accessBytes = [&](const Value* P, Type* T) -> size_t {
+		size_t sz = DL.getTypeStoreSize(T);
+		if (L && !L->isLoopInvariant(P)) sz *= iter;
+		return sz;
+	};
+	auto account = [&](const Value* P, Type* T, const bool write) {
+		P = P->stripPointerCasts();
+		if (!seen.insert(std::make_pair(P, (unsigned) write)).second) return;
+		if (write) props.writeBytes += accessBytes(P, T);
+		else props.readBytes += accessBytes(P, T);
+	};
+
+	if (S->txEntries.count(&I) && !is_contained(props.nestedEntries, &I))
+		props.nestedEntries.push_back(&I);
+
+	SharedLoc loc;
+	if (PrimeBortContention && getSharedLoc(I, loc) && !is_contained(props.sharedWrites, &I))
+		props.sharedWrites.push_back(&I);
+
+	if (LatencyVisitor::isZMMOp(I)) props.flags |= RF_ZMM;
+
+	if (LoadInst* LD = dyn_cast<LoadInst>(&I)) {
+		account(LD->getPointerOperand(), LD->getType(), false);
+	} else if (StoreInst* ST = dyn_cast<StoreInst>(&I)) {
+		account(ST->getPointerOperand(), ST->getValueOperand()->getType(), true);
+	} else if (AtomicRMWInst* RMW = dyn_cast<AtomicRMWInst>(&I)) {
+		account(RMW->getPointerOperand(), RMW->getValOperand()->getType(), false);
+		account(RMW->getPointerOperand(), RMW->getValOperand()->getType(), true);
+	} else if (AtomicCmpXchgInst* CX = dyn_cast<AtomicCmpXchgInst>(&I)) {
+		account(CX->getPointerOperand(), CX->getNewValOperand()->getType(), false);
+		account(CX->getPointerOperand(), CX->getNewValOperand()->getType(), true);
+	} else if (MemIntrinsic* MI = dyn_cast<MemIntrinsic>(&I)) {
+		if (ConstantInt* C = dyn_cast<ConstantInt>(MI->getLength())) {
+			props.writeBytes += C->getLimitedValue();
+			if (isa<MemTransferInst>(MI)) props.readBytes += C->getLimitedValue();
+		}
+	} else if (CallBase* CB = dyn_cast<CallBase>(&I)) {
+		if (CB->isInlineAsm()) {
+			props.flags |= RF_ASM;
+			return;
+		}
+		Function* F = CB->getCalledFunction();
+		if (!F) {
+			// the possible targets are scanned like direct callees,
+			// but a guess from the signature alone is still flagged
+			const TargetSet* TS = getIndirectTargets(*CB);
+			if (!TS || !TS->precise) props.flags |= RF_INDIRECT;
+			if (!TS) return;
+			for (Function* T : TS->funcs) {
+				if (T->isDeclaration()) {
+					props.flags |= classifyExternCall(T->getName());
+					if (!is_contained(props.externCalls, T)) props.externCalls.push_back(T);
+				} else if (!is_contained(callees, T)) {
+					callees.push_back(T);
+				}
+			}
+		} else if (F->isIntrinsic()) {
+			return;
+		} else if (F->isDeclaration()) {
+			props.flags |= classifyExternCall(F->getName());
+			if (!is_contained(props.externCalls, F)) props.externCalls.push_back(F);
+		} else if (!is_contained(callees, F)) {
+			callees.push_back(F);
+		}
+	}
+}
+
+const PrimeBortDetectorPass::RegionProps&
+PrimeBortDetectorPass::getFuncProps(Function* F) {
+	auto f_it = S->funcProps.find(F);
+	if (f_it != S->funcProps.end()) return f_it->second;
+	// an empty placeholder stops recursion
+	S->funcProps.try_emplace(F);
+
+	RegionProps props;
+	AccessSet seen;
+	SmallPtrSet<const Instruction*, 1> stops;
+	scanInstRange(&F->getEntryBlock().front(), stops, props, seen);
+
+	RegionProps& slot = S->funcProps[F];
+	slot = std::move(props);
+	return slot;
+}
 			
-} // namespace llvm
+void PrimeBortDetectorPass::printTriage(raw_ostream& OS,
+		const SmallVectorImpl<Instruction*>& txBegin, const SmallVectorImpl<Instruction*>& txCommit) {
+	unsigned entries = 0, exits = 0;
+	for (auto& C : S->candidateMap) {
+		entries += C.second.first.size();
+		exits += C.second.second.size();
+	}
+	OS << "PrimeBort triage\n=====\n";
+	OS << "tx begin sites " << txBegin.size() << ", tx commit sites " << txCommit.size() << '\n';
+	OS << "functions bounding txs " << S->candidateMap.size() << ": " << entries <<
+		" entries, " << exits << " exits\n";
+	OS << "=====\n";
+}
 
+} // namespace llvm
@@ -4,10 +4,20 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
+#include <functional>
 #include <list>
+#include <map>
+#include <memory>
 #include <unordered_map>
 #include <utility>
 
@@ -15,90 +25,447 @@
 
 namespace llvm {
 
+class InlineAsmCost;
+class LatencyVisitor;
+class LibCostTable;
+class MachineFunctionPass;
+class TargetLibraryInfo;
+class TargetLibraryInfoImpl;
+
 class PrimeBortDetectorPass : public ModulePass {
 
 	public:
-	typedef std::list<CallInst*> CI_list;
+	typedef std::list<Instruction*> BI_list; // tx boundaries and the calls leading to them
 	bool runOnModule (Module &M);
 	PreservedAnalyses run (Module &M, ModuleAnalysisManager &AM);
+	// the analysis and reports, with the per-function analyses from either pass manager;
+	// only the analysis is run if analysisOnly is set
+	bool runImpl (Module &M, const bool analysisOnly);
+	std::function<LoopInfo& (Function&)> LIGetter;
+	std::function<ScalarEvolution& (Function&)> SEGetter;
+	// post-ISel latencies of IR blocks, one per stretch up to and including each call
+	// and after the last; if set, the estimates use them, see MachineLatency.cpp
+	typedef DenseMap<const BasicBlock*, SmallVector<unsigned, 2> > MachineLatMap;
+	const MachineLatMap* machineBlockLat = nullptr;
+	// keep a run's state for the next run, which then reuses the callee summaries and tx
+	// results invalidate() left alone, see Incremental.cpp
+	bool keepState = false;
+	// drops what depends on the bodies of these functions, before they are replaced;
+	// the txs of the last run are not to be used until the next one
+	void invalidate(const SmallPtrSetImpl<Function*>&);
 	PrimeBortDetectorPass();
 	PrimeBortDetectorPass(const PrimeBortDetectorPass&);
+	~PrimeBortDetectorPass();
+	void releaseMemory() override;
 	static char ID;
 	static StringRef name() {return "primebort";}
+	void printPipeline(raw_ostream& OS, function_ref<StringRef(StringRef)>) {OS << name();}
 	
 	void getAnalysisUsage(AnalysisUsage &AU) const override {
-		AU.addRequired<ScalarEvolutionWrapperPass>();
-		AU.addRequired<LoopInfoWrapperPass>();
-		AU.setPreservesAll();
+		if (!transformsIR()) AU.setPreservesAll();
 	}
+	// true if any of the transform modes is enabled
+	static bool transformsIR();
+
+	// what the code run inside a tx (or a callee) touches and calls
+	enum RegionFlag : unsigned {
+		RF_IO = 1 << 0, // stdio, read/write, ...
+		RF_SYSCALL = 1 << 1, // other syscalls and blocking calls
+		RF_ALLOC = 1 << 2, // heap allocator
+		RF_INDIRECT = 1 << 3, // indirect call, callee unknown
+		RF_ASM = 1 << 4, // inline asm
+		RF_LOCK = 1 << 5, // lock call, i.e. nested locking
+		RF_EXTERN = 1 << 6, // call to a declared-only function without a cost model
+		RF_BLOCKING = 1 << 7, // call that may block indefinitely
+		RF_ZMM = 1 << 8 // 512-bit vector ops, run at a lower clock
+	};
+	struct RegionProps {
+		size_t readBytes = 0;
+		size_t writeBytes = 0;
+		unsigned flags = 0;
+		SmallVector<Function*, 4> externCalls; // declared-only callees, no duplicates
+		SmallVector<Function*, 4> funcs; // callees with a body, directly or not, no duplicates
+		SmallVector<Instruction*, 2> nestedEntries; // entries of other txs begun inside
+		// stores and atomics to lines other txs may write, under -primebort-contention
+		SmallVector<Instruction*, 4> sharedWrites;
+	};
+
+	// accessed pointers, split by read (0) and write (1)
+	typedef DenseSet<std::pair<const Value*, unsigned> > AccessSet;
+
+	// what an RTM tx does after an abort, see AbortPath.cpp
+	struct AbortInfo {
+		BranchInst* check = nullptr; // the branch on XBEGIN's status, if recognized
+		bool retried = false; // an abort can start the tx again
+		unsigned maxRetries = 0; // trip bound of the retry loop, 0 if unbounded
+		bool exitsOnStatus = false; // an unbounded retry loop still checks the status
+		size_t retryLat = 0; // from an abort back to XBEGIN, the abort itself included
+		Instruction* fallback = nullptr; // entry of the lock tx taken instead, if any
+		size_t fallbackLat = 0; // from an abort to the end of that lock's section
+	};
 
 	struct TxInfo {
-		CallInst* entry;
+		Instruction* entry;
 		Function* ancestor;
-		SmallVector<CallInst*, 4> exits;
-		SmallVector<CallInst*, 4> entryChain;
-		SmallVector<SmallVector<CallInst*, 4>, 4> exitChains;
+		SmallVector<Instruction*, 4> exits;
+		// calls down to the boundary itself, which is last
+		SmallVector<Instruction*, 4> entryChain;
+		SmallVector<SmallVector<Instruction*, 4>, 4> exitChains;
 		SmallVector<size_t, 4> txLat;
 		SmallVector<size_t, 4> rtLat;
+		RegionProps props; // filled in by scanTxRegion
+		AbortInfo abort; // RTM txs only, filled in by analyzeAbort
+	};
+	// one block of the path an estimate chose, see Witness.cpp
+	struct WitnessStep {
+		BasicBlock* BB;
+		size_t lat; // of the block and its calls, or of the whole loop collapsed at it
+		unsigned iter; // trips of that loop, 0 if none was collapsed
+		CallBase* topCall; // costliest call in the block or loop, if any
+		size_t topCallLat; // for one run of it
 	};
 
 	private:
 	struct BBLatEntry {
 		unsigned tag;
 		std::pair<size_t, bool> prev;
+		// successor the chosen path continues to, if any; witnesses follow these
+		BasicBlock* next;
 
-		BBLatEntry(const unsigned t, const std::pair<size_t, bool> p) 
-			: tag(t), prev(p) {}
+		BBLatEntry(const unsigned t, const std::pair<size_t, bool> p,
+				BasicBlock* n = nullptr) : tag(t), prev(p), next(n) {}
 	};
-	DenseMap<BasicBlock*, BBLatEntry> BBLatCache;
-	unsigned tagCounter;
 	unsigned newCacheTag () {
-		unsigned r = ++tagCounter;
-		if (r == 0) BBLatCache.clear();
+		unsigned r = ++S->tagCounter;
+		if (r == 0) S->BBLatCache.clear();
 		return r;
 	}
 
-	CI_list txCommitCallers;
-	DenseMap<CallInst*, CallInst*> txCommitCallees;
+	Function* getSummaryLeader(Function*);
+	// latency of a call to a function with a body, from its summary if there is one
+	size_t estimateCallLat(CallBase&, Function*, const size_t, const unsigned,
+			const bool, const bool);
+
+	// constant arguments of the call being costed, for context-sensitive summaries
+	struct CallContext {
+		Function* F; // summary leader the arguments belong to
+		unsigned depth; // calls since the outermost context-free summary
+		SmallVector<std::pair<unsigned, ConstantInt*>, 4> args; // by argument number
+	};
+	// possible targets of indirect calls, see IndirectCalls.cpp
+	struct TargetSet {
+		SmallVector<Function*, 4> funcs; // empty if unresolved
+		bool precise = false; // from type metadata or local values, not the signature alone
+		size_t lat[4]; // combined bound, by the same mode as funcSummaries
+		bool hasLat[4] = {false, false, false, false};
+	};
+	void scanTypeTests(Module&);
+	// the set for a key, allocated with the run's state if there is none yet
+	TargetSet& getTargetSet(const void*, const uint64_t, bool&);
+	TargetSet* getIndirectTargets(CallBase&);
+	// longest/shortest summary over the possible targets, 0 if there are none;
+	// SE is the calling function's, for library targets
+	size_t estimateIndirectCallLat(CallBase&, ScalarEvolution& SE, const size_t,
+			const unsigned, const bool, const bool);
+	// call sites that may call F, indirect ones only if resolved precisely
+	void getCallers(Function*, SmallVectorImpl<CallInst*>&);
+
+	// binds the arguments of F to the constants of the current context
+	bool bindContext(ScalarEvolution&, const Function*, ValueToSCEVMapTy&);
+	// trip count of a loop with the current context's arguments, 0 if unknown
+	unsigned getContextTripCount(ScalarEvolution&, const Loop*, BasicBlock*);
+
+	// a cache line written inside more than one tx, see Contention.cpp
+	// a global, or the struct type of objects that atomics write into
+	typedef PointerUnion<const GlobalVariable*, StructType*> SharedObject;
+	// where a store or atomic writes: the object, the pointer it is reached through,
+	// and the offset from it, in pieces of the object known to be in one cache line
+	struct SharedLoc {
+		SharedObject object;
+		const Value* base; // the global, or the pointer to the struct
+		uint64_t offset;
+		uint64_t chunkSize; // the base's alignment, up to a line
+	};
+	struct ContendedLine {
+		SharedObject object;
+		uint64_t begin, size; // the bytes of the object known to be in one line
+		bool trueSharing; // some field is written by two txs
+		SmallVector<std::pair<unsigned, Instruction*>, 4> writes; // with the tx ids
+	};
+
+	// everything a run finds out about its module, made fresh by runImpl and
+	// freed in one go by releaseMemory (or the next run), so nothing outlives the
+	// module it points into and a pass object can be reused across modules
+	struct RunState {
+		DenseMap<BasicBlock*, BBLatEntry> BBLatCache;
+		unsigned tagCounter = 0;
+
+		// inline asm latencies through the MC layer, see InlineAsmCost.h
+		std::unique_ptr<InlineAsmCost> asmCost;
+		// cost models for declared-only callees, see LibCost.h
+		std::unique_ptr<LibCostTable> libCost;
+		// tx begin/commit functions; calls to them are the tx boundaries, not costed
+		DenseSet<const Function*> txBoundaryFuncs;
+		// the lock taken or released by a boundary found by pattern
+		DenseMap<const Instruction*, const Value*> boundaryLocks;
+
+		// whole-function latency summaries for callees, shared by structurally identical
+		// functions (see CallSummary.cpp), keyed by leader and longest | handleLoops << 1
+		DenseMap<std::pair<Function*, unsigned>, size_t> funcSummaries;
+		DenseMap<Function*, Function*> summaryLeader;
+		DenseMap<FunctionComparator::FunctionHash, SmallVector<Function*, 2> > summaryBuckets;
+		GlobalNumberState globalNumbers;
+		// summaries being computed, and whether they were cut short by recursion
+		SmallVector<std::pair<Function*, bool>, 8> summaryStack;
+		const CallContext* curContext = nullptr;
+		std::map<std::pair<std::pair<Function*, unsigned>,
+			SmallVector<std::pair<unsigned, ConstantInt*>, 4> >, size_t> contextSummaries;
+
+		// keyed by type id and vtable offset, by call site, or by function type;
+		// allocated together and freed with the run
+		SpecificBumpPtrAllocator<TargetSet> targetSetAlloc;
+		DenseMap<std::pair<const void*, uint64_t>, TargetSet*> targetSets;
+		DenseMap<const CallBase*, TargetSet*> callTargets;
+		bool typeTestsScanned = false;
+		DenseMap<const Function*, SmallVector<CallInst*, 2> > indirectCallers;
+		bool indirectCallersFound = false;
 
-	CI_list txBeginCallers;
-	DenseMap<CallInst*, CallInst*> txBeginCallees;
+		DenseMap<Instruction*, Instruction*> txCommitCallees;
+		DenseMap<Instruction*, Instruction*> txBeginCallees;
 
-	DenseMap<Function*,
-		std::pair<SmallVector<CallInst*, 4>, SmallVector<CallInst*, 4> > > candidateMap;
-	SmallVector<TxInfo, 0> foundTx;
+		// position of each function in the module, boundaries are sorted by it
+		DenseMap<const Function*, unsigned> funcOrder;
+		// in the order ancestors are found, which fixes the tx ids
+		MapVector<Function*,
+			std::pair<SmallVector<Instruction*, 4>, SmallVector<Instruction*, 4> > > candidateMap;
+		SmallVector<TxInfo, 0> foundTx;
 
-	// comparator to order CallInsts by their parent function
-	static bool compCallInstByFunction(const CallInst*, const CallInst*);
+		// whole-body region properties of functions called inside a tx
+		DenseMap<Function*, RegionProps> funcProps;
+		DenseSet<const Instruction*> txEntries;
+		// lines written in more than one tx, and the writes to them
+		SmallVector<ContendedLine, 0> contendedLines;
+		DenseSet<const Instruction*> contendedWrites;
+		// instructions LatencyVisitor has no model for, printed once at the end
+		StringMap<std::pair<unsigned, const Instruction*> > unknownOps;
+		// machineBlockLat spread over the instructions, see MachineLatency.cpp
+		DenseMap<const Instruction*, unsigned> machineLat;
+
+		// blocks of the loop being walked by estimateTotalLoopLat, paths don't leave it
+		const SmallPtrSetImpl<const BasicBlock*>* walkLoop = nullptr;
+		// descriptor table for the runtime, see Instrument.cpp
+		GlobalVariable* txDescTable = nullptr;
+
+		// what a run with keepState takes over from the last one, see Incremental.cpp:
+		// the functions invalidated since, the txs that don't depend on them (by entry),
+		// the boundaries the summaries were computed with and the contended writes
+		bool rerun = false;
+		DenseSet<const Function*> invalidated;
+		DenseMap<const Instruction*, TxInfo> keptTx;
+		DenseSet<const Function*> keptBoundaryFuncs;
+		DenseSet<const Instruction*> keptContendedWrites;
+
+		explicit RunState(Module&);
+		~RunState();
+	};
+	std::unique_ptr<RunState> S;
+
+	// comparator to order boundaries by their parent function's position in the module
+	bool compInstByFunction(const Instruction*, const Instruction*) const;
 	// returns the intersection of two graphs, removing those elements from the operands
-	std::pair<CI_list, CI_list> findCandidates (CI_list&, CI_list&);
-	void populateLeafSets(const Module&, 
-			SmallVector<Function*,4>&, SmallVector<Function*,4>&);
+	std::pair<BI_list, BI_list> findCandidates (BI_list&, BI_list&);
+	// finds every tx boundary in one pass over the module, see Boundaries.cpp
+	void populateLeafSets(Module&, SmallVectorImpl<Instruction*>&,
+			SmallVectorImpl<Instruction*>&);
+	// for a spin lock acquire, the first instruction run with the lock held
+	Instruction* matchSpinAcquire(Instruction&, const Value*&);
+	// the atomic that takes the spin lock a tx begun by pattern holds, NULL for other txs
+	Instruction* findSpinAcquire(Instruction*);
 	// removes any elements in the remnant set that are in call chains of the prune set
-	void pruneRemnant(CI_list&, CI_list&, const DenseMap<CallInst*, CallInst*>&);
+	void pruneRemnant(BI_list&, BI_list&, const DenseMap<Instruction*, Instruction*>&);
 	// computes and returns the next level of a caller graph
-	CI_list levelUpCallerGraph(SmallVectorImpl<Function*>&,
-			CI_list&, DenseMap<CallInst*, CallInst*>&);
+	BI_list levelUpCallerGraph(SmallVectorImpl<Instruction*>&,
+			BI_list&, DenseMap<Instruction*, Instruction*>&);
 	// match tx entry points with reachable exit points in the same function
-	void boundTxInFunc(BasicBlock*, const SmallVectorImpl<CallInst*>&, TxInfo&);
-	// estimates total latency for a loop
-	size_t estimateTotalLoopLat(const Loop*, BasicBlock*&, const unsigned, const bool);
+	void boundTxInFunc(Function&, const SmallVectorImpl<Instruction*>&,
+			const SmallVectorImpl<Instruction*>&);
+	// estimates total latency for a loop, optionally returning the trips of the exit taken
+	size_t estimateTotalLoopLat(const Loop*, ScalarEvolution&, BasicBlock*&, const bool,
+			unsigned* = nullptr);
 	// estimator that can climb up the call graph
-	size_t estimateLatThroughCallers(Instruction*, const CallInst*,
-			const size_t, const bool);
+	size_t estimateLatThroughCallers(Instruction*, const Instruction*,
+			const size_t, const bool, SmallVectorImpl<WitnessStep>* = nullptr);
 	// estimate longest/shortest path between two instructions given call chains
-	// up to their common ancestor
-	size_t estimatePathFromChains(const SmallVectorImpl<CallInst*>&,
-			const SmallVectorImpl<CallInst*>&, const bool);
+	// up to their common ancestor, optionally appending the path taken to a witness
+	size_t estimatePathFromChains(const SmallVectorImpl<Instruction*>&,
+			const SmallVectorImpl<Instruction*>&, const bool,
+			SmallVectorImpl<WitnessStep>* = nullptr);
 	// wrappers for estimatePathFromChains
-	size_t estimateLongestPath(const SmallVectorImpl<CallInst*>&,
-			const SmallVectorImpl<CallInst*>&);
-	size_t estimateShortestPath(const SmallVectorImpl<CallInst*>&,
-			const SmallVectorImpl<CallInst*>&);
+	size_t estimateLongestPath(const SmallVectorImpl<Instruction*>&,
+			const SmallVectorImpl<Instruction*>&);
+	size_t estimateShortestPath(const SmallVectorImpl<Instruction*>&,
+			const SmallVectorImpl<Instruction*>&);
+	// fills txLat and rtLat for every exit of a tx
+	void estimateTx(TxInfo&);
+	// costs the retry and fallback paths of an RTM tx, see AbortPath.cpp
+	void analyzeAbort(TxInfo&);
+	void printAbortReport(raw_ostream&);
+	// spreads machineBlockLat over the instructions of each block, see MachineLatency.cpp
+	void distributeMachineLat();
 	// implementation for the above fns
 	std::pair<size_t, bool> estimatePathLat(Instruction*, const Instruction*,
 			const size_t, const unsigned, const bool, const bool, const bool);
+	// appends the blocks a walk tagged with the given tag went through, with their costs;
+	// must run before any other walk reuses those blocks
+	void collectWitness(Instruction*, const Instruction*, const unsigned, const bool,
+			const bool, SmallVectorImpl<WitnessStep>&);
+	// witness paths behind the txLat/rtLat of each tx, see Witness.cpp
+	void printWitnessReport(raw_ostream&);
+	// with keepState: sets the last run's results aside to be reused, see Incremental.cpp
+	void beginRerun();
+	// the results of a tx with the same entry, exits and chains, if they were kept
+	bool reuseTx(TxInfo&);
+	// drop the kept summaries (and txs) if the boundaries or contention changed
+	void checkKeptBoundaries();
+	void checkKeptContention();
+	void dropSummaries();
+
+	// where a store or atomic writes, if other threads may reach it
+	static bool getSharedLoc(const Instruction&, SharedLoc&);
+	// lines written in more than one tx
+	void findContention();
+	// the transfers a tx is charged: one for each contended line it writes
+	size_t getContentionLat(const RegionProps&) const;
+	void printContentionReport(raw_ostream&);
+	// collect the properties of everything run between a tx entry and its exits
+	void scanTxRegion(TxInfo&);
+	// walk instructions from a start point until a stop point or return
+	void scanInstRange(Instruction*, const SmallPtrSetImpl<const Instruction*>&,
+			RegionProps&, AccessSet&);
+	// account a single instruction, collecting called functions for later
+	void accountInst(Instruction&, const Loop*, const unsigned, RegionProps&,
+			AccessSet&, SmallVectorImpl<Function*>&);
+	const RegionProps& getFuncProps(Function*);
+	static void mergeProps(RegionProps&, const RegionProps&);
+	// RegionFlags for a call to a declared-only function, from its cost model
+	unsigned classifyExternCall(StringRef) const;
+	// counts of matched tx boundaries, all tier 0 reports
+	void printTriage(raw_ostream&, const SmallVectorImpl<Instruction*>&,
+			const SmallVectorImpl<Instruction*>&);
+	// lock elision advisor, see ElisionAdvisor.cpp
+	void printElisionReport(raw_ostream&);
+	// lock hold time and nesting graph, see LockGraph.cpp
+	void printLockReport(raw_ostream&);
+	// insert runtime timing probes around each tx, see Instrument.cpp
+	bool instrumentTx(Module&);
+	// per-tx descriptors for the runtime, created on first use
+	GlobalVariable* getTxDescTable(Module&);
+	Constant* getTxDesc(const unsigned);
+	// the analyses for a function, from whichever pass manager we run under
+	LoopInfo& getLI(Function& F) {return LIGetter(F);}
+	ScalarEvolution& getSE(Function& F) {return SEGetter(F);}
+	// latency of a single block, calls included
+	size_t estimateBlockLat(BasicBlock*, const bool);
+	// latency of the calls a visited block makes, optionally noting the costliest
+	size_t estimateCallsLat(LatencyVisitor&, BasicBlock*, const size_t,
+			const unsigned, const bool, const bool,
+			std::pair<CallBase*, size_t>* = nullptr);
+	// write the found txs to -primebort-serialize, see Serialize.cpp
+	void serializeTx(Module&);
+	// write the txs and the functions run inside them to -primebort-index, see Index.cpp
+	void writeIndex(Module&);
+	// [shortest, longest] from the entry of a function to any return
+	std::pair<size_t, size_t> estimateFuncLat(Function*);
+	// attach !primebort.lat metadata, see Annotate.cpp
+	bool annotateIR(Module&);
+	// move code that doesn't touch shared memory out of txs, see Shrink.cpp
+	bool shrinkTx(Module&);
+	unsigned hoistFromTx(Instruction*, const DenseSet<const Instruction*>&);
+	unsigned sinkFromTx(Instruction*, const DenseSet<const Instruction*>&);
+	// 1 for an allocator call returning fresh memory, -1 for a free, 0 otherwise
+	int allocKind(const Instruction&) const;
+	// a call to a library tx begin/commit function
+	bool isLibBoundary(const Instruction&) const;
+	// Prime+Abort guard at suspicious RTM tx entries, see Guard.cpp
+	bool guardTx(Module&);
+	bool needsGuard(const TxInfo&);
+	void insertGuard(CallInst*, Constant*);
+
+	public:
+	// per-block [shortest, longest] latencies, callees included, of every function
+	// a tx runs code in; filled in by exportLatencies
+	typedef DenseMap<const BasicBlock*, std::pair<size_t, size_t> > BlockLatMap;
+	typedef DenseMap<const Function*, std::pair<size_t, size_t> > FuncLatMap;
+	// hands the found txs and block/function latencies over, see Annotate.cpp
+	void exportLatencies(SmallVectorImpl<TxInfo>&, BlockLatMap&, FuncLatMap&);
+	// the txs the last run found, until releaseMemory
+	const SmallVectorImpl<TxInfo>& getTxs() const {return S->foundTx;}
+
+	// prints the source location of an instruction, or its function if there is no debug info
+	static void printLoc(raw_ostream&, const Instruction*);
+	// "file:line:col" of an instruction, "" without debug info
+	static std::string getLocKey(const Instruction*);
+	// what an element of a call chain calls: the callee, "<indirect>" or "<spin>"
+	static StringRef getChainName(const Instruction*);
+	// true if the tx is bounded by RTM intrinsics rather than a lock
+	static bool isRTMTx(const TxInfo&);
+	// longest txLat / shortest rtLat over all exits of a tx
+	static size_t maxTxLat(const TxInfo&);
+	static size_t minRtLat(const TxInfo&);
+	// names the lock object taken by a tx, resolving wrapper arguments through
+	// the entry chain; locks in the same field of different objects share a name
+	std::string describeLock(const TxInfo&) const;
+	// first instruction run inside a tx after a boundary or a call leading to one;
+	// boundaries found by pattern are already the first instruction with the lock held,
+	// which may be a call as well
+	Instruction* afterBoundary(Instruction* I) const {
+		return (S->boundaryLocks.count(I)) ? I : I->getNextNode();
+	}
+};
+
+// the IR analyses of each function of a module, built on first request and kept until
+// forgotten, so a Loop* or SCEV stays valid while other functions are analysed; for
+// running the pass where no pass manager keeps them: the legacy manager recomputes
+// on-the-fly analyses on every request, llc's machine passes and the server run none
+class PrimeBortFunctionAnalyses {
+	struct FuncAnalyses;
+	std::unique_ptr<TargetLibraryInfoImpl> TLII;
+	std::unique_ptr<TargetLibraryInfo> TLI;
+	std::map<Function*, std::unique_ptr<FuncAnalyses> > analyses;
+	FuncAnalyses& get(Function&);
+
+	public:
+	explicit PrimeBortFunctionAnalyses(const Module&);
+	~PrimeBortFunctionAnalyses();
+	// points the pass's LIGetter and SEGetter here
+	void attach(PrimeBortDetectorPass&);
+	// drops the analyses of a function, before its body is replaced
+	void forget(Function*);
+	void clear();
 };
 
 PrimeBortDetectorPass* createPrimeBortDetectorPass();
+// re-costs the txs on the final MachineInstrs, see MachineLatency.cpp
+MachineFunctionPass* createPrimeBortMachinePass();
+
+// the same numbers !primebort.lat carries, for new-PM passes that want them without
+// reading metadata; computed without reports or transforms
+class PrimeBortAnalysis : public AnalysisInfoMixin<PrimeBortAnalysis> {
+	friend AnalysisInfoMixin<PrimeBortAnalysis>;
+	static AnalysisKey Key;
+
+	public:
+	struct Result {
+		SmallVector<PrimeBortDetectorPass::TxInfo, 0> txs; // ids are indices
+		PrimeBortDetectorPass::BlockLatMap blockLat;
+		PrimeBortDetectorPass::FuncLatMap funcLat;
+		// holds pointers into the IR: stale after any pass that doesn't preserve it
+		bool invalidate(Module&, const PreservedAnalyses& PA,
+				ModuleAnalysisManager::Invalidator&) {
+			auto PAC = PA.getChecker<PrimeBortAnalysis>();
+			return !PAC.preserved() && !PAC.preservedSet<AllAnalysesOn<Module> >();
+		}
+	};
+	Result run(Module&, ModuleAnalysisManager&);
+};
 }
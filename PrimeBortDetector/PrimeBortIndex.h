@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+
+/*
+ * Layout of the -primebort-index files, written by Index.cpp and mapped by
+ * tools/primebort-query. Everything is fixed size and 8-byte aligned so a mapped file
+ * is used as is, without parsing:
+ *   PBIndexHeader
+ *   PBIndexTx[numTxs]      in tx id order
+ *   PBIndexExit[numExits]  each tx's exits together, in order
+ *   PBIndexFunc[numFuncs]  the functions run inside txs, by name
+ *   uint32_t[numRefs]      lists: chains and callees as string offsets, txs as ids
+ *   char[stringsSize]      NUL-terminated strings, referenced by offset
+ * Lists are a (first, count) pair into the refs. Numbers are in the byte order of the
+ * host that wrote the file, which byteOrder tells apart.
+ */
+
+namespace llvm {
+
+#define PBINDEX_MAGIC "PBINDEX" // with its NUL, 8 bytes
+#define PBINDEX_VERSION 1
+#define PBINDEX_BYTE_ORDER 0x01020304u
+
+struct PBIndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t module; // source file name
+	uint32_t numTxs;
+	uint32_t numExits;
+	uint32_t numFuncs;
+	uint32_t numRefs;
+	uint32_t stringsSize;
+	// from the start of the file
+	uint64_t txOffset;
+	uint64_t exitOffset;
+	uint64_t funcOffset;
+	uint64_t refOffset;
+	uint64_t stringOffset;
+};
+
+struct PBIndexTx {
+	uint32_t ancestor; // function the entry and exits are in
+	uint32_t entry; // "file:line:col", or "" without debug info
+	uint32_t lock; // see describeLock, "<rtm>" for RTM txs
+	uint32_t flags; // RegionFlags
+	uint64_t txLat; // longest over the exits
+	uint64_t rtLat; // shortest over the exits
+	uint64_t readBytes;
+	uint64_t writeBytes;
+	uint32_t firstExit, numExits;
+	uint32_t entryChain, entryChainLen; // callee names down to the boundary
+	// every function called inside, directly or not; declared ones included
+	uint32_t callees, numCallees;
+};
+
+struct PBIndexExit {
+	uint32_t loc;
+	uint32_t chain, chainLen;
+	uint32_t pad;
+	uint64_t txLat;
+	uint64_t rtLat;
+};
+
+struct PBIndexFunc {
+	uint32_t name;
+	uint32_t flags; // RegionFlags of its whole body
+	uint64_t minLat; // entry to any return, 0 if only declared
+	uint64_t maxLat;
+	uint64_t txLat; // longest txLat of the txs it runs inside
+	uint32_t txs, numTxs; // ids of those txs
+};
+
+static_assert(sizeof(PBIndexHeader) % 8 == 0 && sizeof(PBIndexTx) % 8 == 0 &&
+		sizeof(PBIndexExit) % 8 == 0 && sizeof(PBIndexFunc) % 8 == 0,
+		"index records must keep 8-byte alignment");
+
+} // namespace llvm
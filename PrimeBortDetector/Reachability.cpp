@@ -0,0 +1,72 @@
+#include "Reachability.h"
+#include "llvm/IR/CFG.h"
+#include <algorithm>
+
+using namespace llvm;
+
+BlockReachability::BlockReachability(const Function& F,
+		const SmallPtrSetImpl<const BasicBlock*>& stops) {
+	for (const BasicBlock& BB : F) {
+		number[&BB] = blocks.size();
+		blocks.push_back(&BB);
+	}
+	const unsigned N = blocks.size();
+	SmallVector<SmallVector<unsigned, 2>, 32> succs(N);
+	for (unsigned i = 0; i < N; ++i) {
+		if (stops.count(blocks[i])) continue;
+		for (const BasicBlock* S : successors(blocks[i])) succs[i].push_back(number.lookup(S));
+	}
+
+	// Tarjan's SCCs, iteratively; the work list holds a block and its next successor
+	const unsigned NONE = ~0u;
+	SmallVector<unsigned, 32> index(N, NONE), low(N), stack, members;
+	BitVector onStack(N);
+	SmallVector<std::pair<unsigned, unsigned>, 32> work;
+	unsigned next = 0;
+	sccOf.assign(N, NONE);
+	auto visit = [&](const unsigned v) {
+		index[v] = low[v] = next++;
+		stack.push_back(v);
+		onStack.set(v);
+		work.emplace_back(v, 0);
+	};
+
+	for (unsigned root = 0; root < N; ++root) {
+		if (index[root] != NONE) continue;
+		visit(root);
+		while (!work.empty()) {
+			const unsigned v = work.back().first;
+			if (work.back().second < succs[v].size()) {
+				const unsigned w = succs[v][work.back().second++];
+				if (index[w] == NONE) visit(w);
+				else if (onStack.test(w)) low[v] = std::min(low[v], index[w]);
+				continue;
+			}
+			work.pop_back();
+			if (!work.empty()) {
+				const unsigned u = work.back().first;
+				low[u] = std::min(low[u], low[v]);
+			}
+			if (low[v] != index[v]) continue;
+
+			// v roots an SCC, and every other SCC it reaches is already closed
+			const unsigned scc = sccReach.size();
+			sccReach.emplace_back(N);
+			BitVector& reach = sccReach.back();
+			members.clear();
+			unsigned w;
+			do {
+				w = stack.pop_back_val();
+				onStack.reset(w);
+				sccOf[w] = scc;
+				reach.set(w);
+				members.push_back(w);
+			} while (w != v);
+			for (unsigned m : members) {
+				for (unsigned s : succs[m]) {
+					if (sccOf[s] != scc) reach |= sccReach[sccOf[s]];
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Function.h"
+
+/*
+ * Which blocks of a function reach which, built once and then queried per block.
+ * Blocks are numbered in layout order; the CFG is condensed into its strongly
+ * connected components with Tarjan's algorithm, which finishes each SCC after all
+ * those it reaches, so the transitive closure is one pass of bitset ORs in that
+ * order. Every block of an SCC shares its SCC's row.
+ * Successors of the stop blocks given to the constructor aren't followed, so
+ * paths end at them.
+ */
+namespace llvm {
+
+class BlockReachability {
+	public:
+	BlockReachability(const Function&, const SmallPtrSetImpl<const BasicBlock*>&);
+
+	unsigned size() const {return blocks.size();}
+	unsigned getNumber(const BasicBlock* BB) const {return number.lookup(BB);}
+	const BasicBlock* getBlock(const unsigned n) const {return blocks[n];}
+	// blocks reachable from BB, BB included, by number
+	const BitVector& reachableFrom(const BasicBlock* BB) const {
+		return sccReach[sccOf[getNumber(BB)]];
+	}
+
+	private:
+	SmallVector<const BasicBlock*, 32> blocks;
+	DenseMap<const BasicBlock*, unsigned> number;
+	SmallVector<unsigned, 32> sccOf;
+	SmallVector<BitVector, 0> sccReach;
+};
+
+} // namespace llvm
@@ -0,0 +1,106 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include <limits>
+
+/*
+ * Serialized results of a run, for comparing builds with tools/primebort-diff.
+ * One JSON object per module:
+ *   {"version": 1, "module": <source file>, "txs": [<tx>, ...]}
+ *   <tx> = {"ancestor": <name>, "entry": <loc>, "entryChain": [<callee>, ...],
+ *     "rtm": bool, "readBytes": n, "writeBytes": n, "flags": <RegionFlags>,
+ *     "exits": [<exit>, ...]}
+ *   <exit> = {"loc": <loc>, "chain": [<callee>, ...], "txLat": n, "rtLat": n}
+ * A loc is "file:line:col", or "" without debug info. A chain names the functions
+ * called from the ancestor down to the boundary, "<spin>" for a spin lock found by
+ * pattern. Tx ids are the same from run to run on one module, but follow the
+ * ancestors' positions in it, which changes elsewhere shift, so the ancestor, locs
+ * and chains are what runs are matched by.
+ */
+
+using namespace llvm;
+
+static cl::opt<std::string> SerializeFile("primebort-serialize",
+		cl::desc("Write the found txs and their estimates as JSON to this file"),
+		cl::value_desc("file"), cl::init(""));
+
+namespace {
+
+void writeChain(json::OStream& J, const SmallVectorImpl<Instruction*>& chain) {
+	J.array([&] {
+		for (const Instruction* I : chain) J.value(PrimeBortDetectorPass::getChainName(I));
+	});
+}
+
+// over-limit estimates can exceed what JSON integers hold
+int64_t clampInt(const size_t n) {
+	return (int64_t) std::min<size_t>(n, std::numeric_limits<int64_t>::max());
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+std::string PrimeBortDetectorPass::getLocKey(const Instruction* I) {
+	const DebugLoc& DL = I->getDebugLoc();
+	if (!DL) return "";
+	return (DL->getFilename() + ":" + Twine(DL.getLine()) + ":" + Twine(DL.getCol())).str();
+}
+
+StringRef PrimeBortDetectorPass::getChainName(const Instruction* I) {
+	const CallBase* CB = dyn_cast<CallBase>(I);
+	if (!CB) return "<spin>";
+	if (const Function* F = CB->getCalledFunction()) return F->getName();
+	return "<indirect>";
+}
+
+void PrimeBortDetectorPass::serializeTx(Module& M) {
+	if (SerializeFile.empty()) return;
+
+	std::error_code EC;
+	raw_fd_ostream OS(SerializeFile, EC, sys::fs::OF_None);
+	if (EC) {
+		errs() << "PrimeBort: could not write results to " << SerializeFile << ": " <<
+			EC.message() << "\n";
+		return;
+	}
+
+	json::OStream J(OS, 1);
+	J.object([&] {
+		J.attribute("version", 1);
+		J.attribute("module", M.getSourceFileName());
+		J.attributeArray("txs", [&] {
+			for (const TxInfo& info : S->foundTx) {
+				J.object([&] {
+					J.attribute("ancestor", info.ancestor->getName());
+					J.attribute("entry", getLocKey(info.entry));
+					J.attributeBegin("entryChain");
+					writeChain(J, info.entryChain);
+					J.attributeEnd();
+					J.attribute("rtm", isRTMTx(info));
+					J.attribute("readBytes", clampInt(info.props.readBytes));
+					J.attribute("writeBytes", clampInt(info.props.writeBytes));
+					J.attribute("flags", (int64_t) info.props.flags);
+					J.attributeArray("exits", [&] {
+						for (unsigned i = 0; i < info.exits.size(); ++i) {
+							J.object([&] {
+								J.attribute("loc", getLocKey(info.exits[i]));
+								J.attributeBegin("chain");
+								writeChain(J, info.exitChains[i]);
+								J.attributeEnd();
+								J.attribute("txLat", clampInt(info.txLat[i]));
+								J.attribute("rtLat", clampInt(info.rtLat[i]));
+							});
+						}
+					});
+				});
+			}
+		});
+	});
+	OS << '\n';
+}
+
+} // namespace llvm
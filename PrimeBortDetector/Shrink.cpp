@@ -0,0 +1,228 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+#include "LibCost.h"
+
+/*
+ * Critical section shrinking. Code at the edges of a tx that doesn't touch memory
+ * other threads can see is moved out of it:
+ * - above the entry, from the rest of the entry's block: instructions whose operands
+ *   are all live-in to the section (defined before the entry, or hoisted themselves)
+ * - below each exit, from the exit's block: instructions that aren't live-out of what
+ *   is left of the section (no users before the exit that stay)
+ * Movable are pure arithmetic (speculatable, for hoisting past calls that may not
+ * return), simple loads of stack objects whose address isn't captured or of
+ * thread-local globals that nothing passed over may write, and allocator calls
+ * returning fresh memory; frees are only sunk. Library lock calls don't write
+ * either kind of object, wrappers with a body and pattern boundaries are checked
+ * like any other instruction.
+ * Only the entry and exit blocks are searched, and the search stops at any other
+ * tx's boundary. Spin lock entries aren't hoisted above: their block is only
+ * entered through the acquire loop. The txs are estimated again afterwards, and
+ * the report gives txLat before and after for each tx that changed.
+ */
+
+using namespace llvm;
+
+namespace llvm {
+
+cl::opt<bool> PrimeBortShrink("primebort-shrink",
+		cl::desc("Move code that doesn't touch shared memory out of tx critical sections"),
+		cl::init(false));
+
+} // namespace llvm
+
+namespace {
+
+// the stack or thread-local object a load reads, if no other thread can see it
+const Value* getPrivateObject(const LoadInst& LI) {
+	if (!LI.isSimple()) return NULL;
+	const Value* O = getUnderlyingObject(LI.getPointerOperand());
+	if (const AllocaInst* AI = dyn_cast<AllocaInst>(O))
+		return (PointerMayBeCaptured(AI, true, true)) ? NULL : AI;
+	const GlobalVariable* GV = dyn_cast<GlobalVariable>(O);
+	return (GV && GV->isThreadLocal()) ? GV : NULL;
+}
+
+// whether J may write the private object O
+bool mayClobber(const Instruction& J, const Value* O) {
+	if (!J.mayWriteToMemory()) return false;
+	auto mayBeO = [O](const Value* P) {
+		const Value* U = getUnderlyingObject(P);
+		return U == O || !isIdentifiedObject(U);
+	};
+	if (const StoreInst* SI = dyn_cast<StoreInst>(&J)) return mayBeO(SI->getPointerOperand());
+	if (const AtomicRMWInst* RMW = dyn_cast<AtomicRMWInst>(&J))
+		return mayBeO(RMW->getPointerOperand());
+	if (const AtomicCmpXchgInst* CX = dyn_cast<AtomicCmpXchgInst>(&J))
+		return mayBeO(CX->getPointerOperand());
+	// a call only reaches an uncaptured stack object through its arguments
+	const CallBase* CB = dyn_cast<CallBase>(&J);
+	if (CB && isa<AllocaInst>(O)) {
+		return any_of(CB->args(),
+				[&mayBeO](const Use& U) {return U->getType()->isPointerTy() && mayBeO(U);});
+	}
+	return true;
+}
+
+bool isPure(const Instruction& I) {
+	return !isa<PHINode>(I) && !isa<AllocaInst>(I) && !isa<CallBase>(I) &&
+		!I.isTerminator() && !I.isEHPad() && !I.mayReadOrWriteMemory() &&
+		!I.mayHaveSideEffects();
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+// the kind of allocator call: 1 allocates fresh memory, -1 frees, 0 neither
+int PrimeBortDetectorPass::allocKind(const Instruction& I) const {
+	const CallInst* CI = dyn_cast<CallInst>(&I);
+	const Function* F = (CI) ? CI->getCalledFunction() : NULL;
+	if (!F || !F->isDeclaration()) return 0;
+	const LibCostTable::Model* LM = S->libCost->lookup(F->getName());
+	if (!LM || !(LM->flags & RF_ALLOC)) return 0;
+	const bool ptrArgs = any_of(CI->args(),
+			[](const Use& U) {return U->getType()->isPointerTy();});
+	if (CI->getType()->isPointerTy() && !ptrArgs) return 1; // malloc, calloc, new
+	if (CI->getType()->isVoidTy() && ptrArgs) return -1; // free, delete
+	return 0; // realloc, posix_memalign
+}
+
+bool PrimeBortDetectorPass::isLibBoundary(const Instruction& I) const {
+	const CallBase* CB = dyn_cast<CallBase>(&I);
+	const Function* F = (CB) ? CB->getCalledFunction() : NULL;
+	return F && F->isDeclaration() && S->txBoundaryFuncs.count(F);
+}
+
+unsigned PrimeBortDetectorPass::hoistFromTx(Instruction* entry,
+		const DenseSet<const Instruction*>& barriers) {
+	if (!isa<CallBase>(entry)) return 0;
+	SmallVector<Instruction*, 8> hoist;
+	SmallPtrSet<const Instruction*, 16> kept; // passed over, still inside
+	kept.insert(entry);
+
+	for (Instruction* I = entry->getNextNode(); I && !I->isTerminator() &&
+			!barriers.count(I); I = I->getNextNode()) {
+		if (isa<DbgInfoIntrinsic>(I)) continue;
+		// live-in: nothing it uses is defined inside
+		bool ok = none_of(I->operands(), [&kept](const Use& U) {
+			const Instruction* OI = dyn_cast<Instruction>(U);
+			return OI && kept.count(OI);
+		});
+		if (ok) {
+			if (LoadInst* LI = dyn_cast<LoadInst>(I)) {
+				const Value* O = getPrivateObject(*LI);
+				ok = O && isSafeToSpeculativelyExecute(LI) &&
+					none_of(kept, [&](const Instruction* K) {
+						return !(K == entry && isLibBoundary(*K)) && mayClobber(*K, O);
+					});
+			} else {
+				ok = (isPure(*I) && isSafeToSpeculativelyExecute(I)) || allocKind(*I) > 0;
+			}
+		}
+		if (ok) hoist.push_back(I);
+		else kept.insert(I);
+	}
+
+	for (Instruction* I : hoist) {
+		LLVM_DEBUG(dbgs() << "Hoisting" << *I << " above" << *entry << '\n');
+		I->moveBefore(entry);
+	}
+	return hoist.size();
+}
+
+unsigned PrimeBortDetectorPass::sinkFromTx(Instruction* exit,
+		const DenseSet<const Instruction*>& barriers) {
+	SmallVector<Instruction*, 8> sink; // last first
+	SmallPtrSet<const Instruction*, 16> kept;
+	kept.insert(exit);
+
+	for (Instruction* I = exit->getPrevNode(); I && !isa<PHINode>(I) &&
+			!barriers.count(I); I = I->getPrevNode()) {
+		if (isa<DbgInfoIntrinsic>(I)) continue;
+		// not live-out of what stays inside
+		bool ok = none_of(I->users(), [&kept](const User* U) {
+			const Instruction* UI = dyn_cast<Instruction>(U);
+			return UI && kept.count(UI);
+		});
+		if (ok) {
+			if (LoadInst* LI = dyn_cast<LoadInst>(I)) {
+				const Value* O = getPrivateObject(*LI);
+				ok = O && none_of(kept, [&](const Instruction* K) {
+					return !(K == exit && isLibBoundary(*K)) && mayClobber(*K, O);
+				});
+			} else {
+				ok = isPure(*I) || allocKind(*I) != 0;
+			}
+		}
+		if (ok) sink.push_back(I);
+		else kept.insert(I);
+	}
+
+	// in their original order
+	for (Instruction* I : sink) {
+		LLVM_DEBUG(dbgs() << "Sinking" << *I << " below" << *exit << '\n');
+		I->moveAfter(exit);
+	}
+	return sink.size();
+}
+
+bool PrimeBortDetectorPass::shrinkTx(Module& M) {
+	if (!PrimeBortShrink || S->foundTx.empty()) return false;
+
+	// code is never moved past another tx's boundary, or the calls leading to one
+	DenseSet<const Instruction*> barriers;
+	for (const TxInfo& info : S->foundTx) {
+		barriers.insert(info.entryChain.begin(), info.entryChain.end());
+		for (const auto& chain : info.exitChains) barriers.insert(chain.begin(), chain.end());
+	}
+
+	SmallVector<size_t, 16> before;
+	SmallVector<std::pair<unsigned, unsigned>, 16> moved; // hoisted, sunk
+	DenseMap<Instruction*, unsigned> sunkAt;
+	for (const TxInfo& info : S->foundTx) {
+		before.push_back(maxTxLat(info));
+		moved.emplace_back(hoistFromTx(info.entry, barriers), 0);
+	}
+	// exits shared by several txs are only searched once
+	for (unsigned i = 0; i < S->foundTx.size(); ++i) {
+		for (Instruction* exit : S->foundTx[i].exits) {
+			auto emplit = sunkAt.try_emplace(exit, 0);
+			if (emplit.second) emplit.first->second = sinkFromTx(exit, barriers);
+			moved[i].second += emplit.first->second;
+		}
+	}
+	if (none_of(moved, [](const std::pair<unsigned, unsigned>& P) {
+				return P.first || P.second;})) {
+		return false;
+	}
+
+	// the same blocks hold the same code, so the summaries still stand
+	for (TxInfo& info : S->foundTx) {
+		info.props = RegionProps();
+		scanTxRegion(info);
+		estimateTx(info);
+	}
+	for (TxInfo& info : S->foundTx) analyzeAbort(info);
+
+	raw_ostream& OS = errs();
+	OS << "PrimeBort critical section shrinking\n=====\n" <<
+		"txLat before\tafter\thoisted\tsunk\ttx\n";
+	for (unsigned i = 0; i < S->foundTx.size(); ++i) {
+		if (!moved[i].first && !moved[i].second) continue;
+		OS << "  " << before[i] << '\t' << maxTxLat(S->foundTx[i]) << '\t' <<
+			moved[i].first << '\t' << moved[i].second << '\t';
+		printLoc(OS, S->foundTx[i].entry);
+		OS << '\n';
+	}
+	OS << "=====\n";
+	return true;
+}
+
+} // namespace llvm
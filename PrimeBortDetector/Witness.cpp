@@ -0,0 +1,167 @@
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#define DEBUG_TYPE "primebort"
+#include <algorithm>
+#include "LatencyVisitor.h"
+
+/*
+ * Witness paths: the blocks behind a txLat or rtLat estimate, so a long one can be
+ * traced to the code that makes it long. The estimator only remembers which successor
+ * each cached block chose (BBLatEntry::next); a witness is rebuilt on request by
+ * estimating the same chains again and following those choices from the start of
+ * each walk before the next walk reuses the cache. The blocks are then costed one at
+ * a time: a loop the estimator collapsed is one step, with the trips of the exit it
+ * was left through, and each step notes its costliest call (from the summaries, which
+ * are already computed). Nothing is recorded beyond the successor when no witness is
+ * asked for.
+ */
+
+using namespace llvm;
+
+static cl::opt<bool> WitnessReport("primebort-witness",
+		cl::desc("Print the path behind each tx's longest txLat and shortest rtLat: "
+			"its blocks, collapsed loops and costliest calls"),
+		cl::init(false));
+
+// costliest calls summed up per witness
+#define WITNESS_TOP_CALLS 3
+
+namespace {
+
+typedef PrimeBortDetectorPass::WitnessStep WitnessStep;
+
+// where a block is in the source, or at least which function it is in
+const Instruction* getBlockLoc(const BasicBlock* BB) {
+	for (const Instruction& I : *BB)
+		if (I.getDebugLoc()) return &I;
+	return BB->getTerminator();
+}
+
+void printCall(raw_ostream& OS, const CallBase* CB, const size_t lat) {
+	const Function* F = CB->getCalledFunction();
+	OS << ((F) ? F->getName() : StringRef("<indirect>")) << ' ' << lat << " @ ";
+	PrimeBortDetectorPass::printLoc(OS, CB);
+}
+
+void printWitness(raw_ostream& OS, const SmallVectorImpl<WitnessStep>& W, const size_t total) {
+	OS << "\tlat\ttrips\tblock\tcostliest call\n";
+	for (const WitnessStep& WS : W) {
+		OS << '\t' << WS.lat << '\t';
+		if (WS.iter) OS << WS.iter;
+		else OS << '-';
+		OS << '\t';
+		PrimeBortDetectorPass::printLoc(OS, getBlockLoc(WS.BB));
+		OS << ' ';
+		WS.BB->printAsOperand(OS, false);
+		if (WS.topCall) {
+			OS << '\t';
+			printCall(OS, WS.topCall, WS.topCallLat);
+		}
+		OS << '\n';
+	}
+
+	// a call in a collapsed loop costs once per trip
+	SmallVector<std::pair<const CallBase*, size_t>, 16> calls;
+	for (const WitnessStep& WS : W) {
+		if (!WS.topCall) continue;
+		calls.emplace_back(WS.topCall, WS.topCallLat * std::max(WS.iter, 1u));
+	}
+	std::stable_sort(calls.begin(), calls.end(),
+		[](const std::pair<const CallBase*, size_t>& A,
+				const std::pair<const CallBase*, size_t>& B) {return A.second > B.second;});
+	if (calls.size() > WITNESS_TOP_CALLS) calls.resize(WITNESS_TOP_CALLS);
+	for (const auto& C : calls) {
+		OS << "\t  ";
+		printCall(OS, C.first, C.second);
+		if (total) OS << " (" << C.second * 100 / total << "%)";
+		OS << '\n';
+	}
+}
+
+} // anonymous namespace
+
+namespace llvm {
+
+void PrimeBortDetectorPass::collectWitness(Instruction* start, const Instruction* dest,
+		const unsigned tag, const bool longest, const bool handleLoops,
+		SmallVectorImpl<WitnessStep>& witness) {
+	// follow the choices first: costing the blocks below walks again
+	SmallVector<BasicBlock*, 16> blocks;
+	SmallPtrSet<const BasicBlock*, 16> seen;
+	for (BasicBlock* BB = start->getParent(); BB && seen.insert(BB).second; ) {
+		auto f_it = S->BBLatCache.find(BB);
+		if (f_it == S->BBLatCache.end() || f_it->second.tag != tag) break;
+		blocks.push_back(BB);
+		BB = f_it->second.next;
+	}
+
+	for (BasicBlock* BB : blocks) {
+		WitnessStep WS = {BB, 0, 0, NULL, 0};
+		std::pair<CallBase*, size_t> top(NULL, 0);
+
+		// the same loops the estimator collapsed
+		Function& F = *(BB->getParent());
+		ScalarEvolution& SE = getSE(F);
+		LoopInfo& LI = getLI(F);
+		Loop* L = (handleLoops) ? LI.getLoopFor(BB) : NULL;
+		Loop* dL = (dest) ? LI.getLoopFor(dest->getParent()) : NULL;
+		if (L && L != dL && !(dL && L->contains(dL))) {
+			BasicBlock* exiting = BB;
+			WS.lat = estimateTotalLoopLat(L, SE, exiting, longest, &WS.iter);
+			for (BasicBlock* LB : L->blocks()) {
+				LatencyVisitor LV(S->asmCost.get(), &S->unknownOps, &S->machineLat);
+				LV.visit(*LB);
+				estimateCallsLat(LV, LB, 0, newCacheTag(), longest, handleLoops, &top);
+			}
+		} else {
+			LatencyVisitor LV(S->asmCost.get(), &S->unknownOps, &S->machineLat);
+			Instruction* I = (BB == start->getParent()) ? start : BB->getFirstNonPHIOrDbg();
+			for (; I; I = I->getNextNonDebugInstruction()) {
+				LV.visit(I);
+				if (I == dest) break;
+			}
+			WS.lat = LV.getLat() +
+				estimateCallsLat(LV, BB, 0, newCacheTag(), longest, handleLoops, &top);
+		}
+		WS.topCall = top.first;
+		WS.topCallLat = top.second;
+		witness.push_back(WS);
+	}
+}
+
+void PrimeBortDetectorPass::printWitnessReport(raw_ostream& OS) {
+	if (!WitnessReport) return;
+
+	OS << "PrimeBort witness paths\n=====\n";
+	for (unsigned t = 0; t < S->foundTx.size(); ++t) {
+		const TxInfo& info = S->foundTx[t];
+		OS << "tx " << t << ": ";
+		printLoc(OS, info.entry);
+		OS << '\n';
+
+		// the exits the reports rank the tx by
+		const unsigned txExit = std::max_element(info.txLat.begin(), info.txLat.end()) -
+			info.txLat.begin();
+		const unsigned rtExit = std::min_element(info.rtLat.begin(), info.rtLat.end()) -
+			info.rtLat.begin();
+
+		SmallVector<WitnessStep, 16> W;
+		size_t lat = estimatePathFromChains(info.entryChain, info.exitChains[txExit],
+				true, &W);
+		OS << "  txLat " << lat << " to ";
+		printLoc(OS, info.exits[txExit]);
+		OS << '\n';
+		printWitness(OS, W, lat);
+
+		W.clear();
+		lat = estimatePathFromChains(info.exitChains[rtExit], info.entryChain, false, &W);
+		OS << "  rtLat " << lat << " from ";
+		printLoc(OS, info.exits[rtExit]);
+		OS << '\n';
+		printWitness(OS, W, lat);
+	}
+	OS << "=====\n";
+}
+
+} // namespace llvm
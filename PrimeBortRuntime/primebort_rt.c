@@ -0,0 +1,492 @@
+#include "primebort_rt.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#define MAX_TX 4096 // registered tx descriptors, later ones are not recorded
+#define NUM_BUCKETS 64 // bucket b holds samples in [2^(b-1), 2^b)
+#define RING_SIZE 4096 // samples buffered per thread, must be a power of 2
+#define MAX_DEPTH 32 // open (nested) txs per thread
+#define NUM_COUNTERS 4 // perf_event counters, see counter_defs
+#define GUARD_WINDOW 64 // attempts per abort rate window
+#define GUARD_STORM 32 // aborts in one window that make an abort storm
+#define GUARD_MIN_BACKOFF 16 // pause iterations after the first storm, doubled per storm
+#define GUARD_MAX_BACKOFF 65536
+#define GUARD_FALLBACK_AT 2048 // backoff from which attempts go straight to the fallback
+
+static struct primebort_txdesc* descs[MAX_TX];
+static atomic_uint num_descs;
+
+// shared histograms, threads fold their ring buffers into them in batches
+static atomic_ullong hist[MAX_TX][NUM_BUCKETS];
+static atomic_ullong sum_cycles[MAX_TX];
+static atomic_ullong max_cycles[MAX_TX];
+static atomic_ullong dropped;
+
+// perf_event mode
+static int perf_mode;
+static const struct {
+	uint32_t type;
+	uint64_t config;
+	const char* name;
+} counter_defs[NUM_COUNTERS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+	{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "l1d-miss"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "llc-miss"},
+	{PERF_TYPE_RAW, 0x04c9, "rtm-abort"} // RTM_RETIRED.ABORTED, Intel only
+};
+#define SOFT_CLOCK (1u << NUM_COUNTERS) // in perf_avail: some thread had no perf events
+static atomic_uint perf_avail; // counters any thread managed to open
+static atomic_ullong perf_sum[MAX_TX][NUM_COUNTERS];
+static atomic_ullong perf_count[MAX_TX];
+
+// Prime+Abort guard
+__thread struct primebort_guard __primebort_guard __attribute__((tls_model("initial-exec")));
+static atomic_ullong guard_aborts[MAX_TX];
+static atomic_ullong guard_storms;
+static atomic_ullong guard_fallbacks;
+
+struct sample {
+	uint32_t slot;
+	uint64_t cycles;
+};
+
+struct open_tx {
+	uint32_t slot;
+	uint32_t reentered; // live re-entries of the slot that found the stack full
+	uintptr_t frame; // stack position of the entry probe
+	uint64_t start;
+	uint64_t counters[NUM_COUNTERS]; // perf mode only
+	int counted; // counters were read at the entry, i.e. outside any RTM tx
+};
+
+struct thread_state {
+	// only the owning thread produces; whoever holds drain_lock consumes
+	struct sample ring[RING_SIZE];
+	atomic_uint head; // next sample to write
+	atomic_uint tail; // next sample to read
+	atomic_flag drain_lock;
+	struct open_tx open[MAX_DEPTH];
+	unsigned depth;
+	int perf_fd; // group leader, -1 if using the software clock
+	int perf_idx[NUM_COUNTERS]; // position in a group read, -1 if not opened
+	int perf_fds[NUM_COUNTERS];
+	struct thread_state* next; // all threads ever seen, for the exit handler
+};
+
+static _Atomic(struct thread_state*) threads;
+static __thread struct thread_state* self;
+static pthread_key_t exit_key;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static uint64_t soft_clock () {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// entry timestamps don't need to wait for the lock acquire to retire,
+// exit timestamps should wait for the critical section
+static inline uint64_t read_start () {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return soft_clock();
+#endif
+}
+
+static inline uint64_t read_end () {
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned aux;
+	return __rdtscp(&aux);
+#else
+	return read_start();
+#endif
+}
+
+static int have_rtm () {
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned a, b, c, d;
+	return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 11));
+#else
+	return 0;
+#endif
+}
+
+// XTEST faults without RTM, and CPUID would abort the tx, so it's checked once at init
+static int rtm_avail;
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("rtm"))) static int in_tx () {
+	return rtm_avail && _xtest();
+}
+#else
+static int in_tx () {
+	return 0;
+}
+#endif
+
+static void open_counters (struct thread_state* ts) {
+	int n = 0;
+	ts->perf_fd = -1;
+	for (unsigned c = 0; c < NUM_COUNTERS; ++c) {
+		ts->perf_idx[c] = -1;
+		ts->perf_fds[c] = -1;
+		// the raw event means something else on CPUs without TSX
+		if (counter_defs[c].type == PERF_TYPE_RAW && !have_rtm()) continue;
+		// nothing to group the others with
+		if (c > 0 && ts->perf_fd < 0) break;
+
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counter_defs[c].type;
+		attr.config = counter_defs[c].config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		const int fd = syscall(SYS_perf_event_open, &attr, 0, -1, ts->perf_fd, 0);
+		if (fd < 0) continue;
+		if (ts->perf_fd < 0) ts->perf_fd = fd;
+		ts->perf_fds[c] = fd;
+		ts->perf_idx[c] = n++;
+		atomic_fetch_or(&perf_avail, 1u << c);
+	}
+	if (ts->perf_fd < 0) atomic_fetch_or(&perf_avail, SOFT_CLOCK);
+}
+
+static void read_counters (struct thread_state* ts, uint64_t* out) {
+	if (ts->perf_fd < 0) {
+		out[0] = soft_clock();
+		return;
+	}
+	uint64_t buf[1 + NUM_COUNTERS]; // PERF_FORMAT_GROUP: count, then values
+	if (read(ts->perf_fd, buf, sizeof(buf)) < (ssize_t) sizeof(uint64_t)) buf[0] = 0;
+	for (unsigned c = 0; c < NUM_COUNTERS; ++c) {
+		const int i = ts->perf_idx[c];
+		out[c] = (i >= 0 && (uint64_t) i < buf[0]) ? buf[1 + i] : 0;
+	}
+}
+
+static void drain (struct thread_state* ts) {
+	if (atomic_flag_test_and_set_explicit(&ts->drain_lock, memory_order_acquire)) return;
+
+	unsigned tail = atomic_load_explicit(&ts->tail, memory_order_relaxed);
+	const unsigned head = atomic_load_explicit(&ts->head, memory_order_acquire);
+	for (; tail != head; ++tail) {
+		const struct sample* s = &ts->ring[tail & (RING_SIZE-1)];
+		unsigned b = (s->cycles) ? 64 - __builtin_clzll(s->cycles) : 0;
+		if (b >= NUM_BUCKETS) b = NUM_BUCKETS-1;
+		atomic_fetch_add_explicit(&hist[s->slot][b], 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&sum_cycles[s->slot], s->cycles, memory_order_relaxed);
+		unsigned long long m = atomic_load_explicit(&max_cycles[s->slot], memory_order_relaxed);
+		while (s->cycles > m && !atomic_compare_exchange_weak_explicit(&max_cycles[s->slot],
+					&m, s->cycles, memory_order_relaxed, memory_order_relaxed));
+	}
+	atomic_store_explicit(&ts->tail, tail, memory_order_release);
+
+	atomic_flag_clear_explicit(&ts->drain_lock, memory_order_release);
+}
+
+static void record (struct thread_state* ts, const uint32_t slot, const uint64_t cycles) {
+	const unsigned head = atomic_load_explicit(&ts->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ts->tail, memory_order_acquire) == RING_SIZE) {
+		drain(ts);
+		// the exit handler is draining us right now
+		if (head - atomic_load_explicit(&ts->tail, memory_order_acquire) == RING_SIZE) {
+			atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+			return;
+		}
+	}
+	ts->ring[head & (RING_SIZE-1)].slot = slot;
+	ts->ring[head & (RING_SIZE-1)].cycles = cycles;
+	atomic_store_explicit(&ts->head, head+1, memory_order_release);
+}
+
+// upper bound of the bucket holding the q-th quantile
+static uint64_t quantile (const unsigned slot, const uint64_t count, const double q) {
+	const uint64_t target = (uint64_t) (q * count);
+	uint64_t seen = 0;
+	for (unsigned b = 0; b < NUM_BUCKETS; ++b) {
+		seen += atomic_load(&hist[slot][b]);
+		if (seen > target) return (b == 0) ? 0 : (b == 63) ? UINT64_MAX : 1ull << b;
+	}
+	return UINT64_MAX;
+}
+
+static void write_guard_report (FILE* out, const unsigned n) {
+	const uint64_t storms = atomic_load(&guard_storms);
+	if (storms == 0) {
+		unsigned slot = 0;
+		while (slot < n && atomic_load(&guard_aborts[slot]) == 0) ++slot;
+		if (slot == n) return;
+	}
+	fprintf(out, "PrimeBort guard\n=====\nabort storms %llu, forced fallbacks %llu\naborts\ttx\n",
+			(unsigned long long) storms, (unsigned long long) atomic_load(&guard_fallbacks));
+	for (unsigned slot = 0; slot < n; ++slot) {
+		const uint64_t c = atomic_load(&guard_aborts[slot]);
+		if (c) fprintf(out, "%llu\t%s\n", (unsigned long long) c, descs[slot]->name);
+	}
+	fprintf(out, "=====\n");
+}
+
+static void write_profile (FILE* out, const unsigned n) {
+	uint64_t samples = atomic_load(&dropped);
+	for (unsigned slot = 0; slot < n && !samples; ++slot) {
+		for (unsigned b = 0; b < NUM_BUCKETS; ++b) samples += atomic_load(&hist[slot][b]);
+	}
+	if (samples == 0) return;
+
+	// percentiles are bucket upper bounds
+	fprintf(out, "PrimeBort runtime profile (cycles)\n=====\n"
+			"est_tx\test_rt\tcount\tmean\tp50\tp99\tmax\ttx\n");
+	for (unsigned slot = 0; slot < n; ++slot) {
+		uint64_t count = 0;
+		for (unsigned b = 0; b < NUM_BUCKETS; ++b) count += atomic_load(&hist[slot][b]);
+		if (count == 0) continue;
+		fprintf(out, "%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%s\n",
+				(unsigned long long) descs[slot]->est_tx,
+				(unsigned long long) descs[slot]->est_rt,
+				(unsigned long long) count,
+				(unsigned long long) (atomic_load(&sum_cycles[slot]) / count),
+				(unsigned long long) quantile(slot, count, 0.5),
+				(unsigned long long) quantile(slot, count, 0.99),
+				(unsigned long long) atomic_load(&max_cycles[slot]),
+				descs[slot]->name);
+		for (unsigned b = 0; b < NUM_BUCKETS; ++b) {
+			const uint64_t c = atomic_load(&hist[slot][b]);
+			if (c) fprintf(out, "\t< 2^%u\t%llu\n", b, (unsigned long long) c);
+		}
+	}
+	if (atomic_load(&dropped))
+		fprintf(out, "dropped %llu samples\n", (unsigned long long) atomic_load(&dropped));
+	fprintf(out, "=====\n");
+}
+
+static void write_report (void) {
+	for (struct thread_state* ts = atomic_load(&threads); ts; ts = ts->next) drain(ts);
+
+	FILE* out = stderr;
+	const char* path = getenv("PRIMEBORT_PROFILE");
+	if (path && !(out = fopen(path, "w"))) {
+		perror("primebort: cannot open PRIMEBORT_PROFILE");
+		out = stderr;
+	}
+
+	unsigned n = atomic_load(&num_descs);
+	if (n > MAX_TX) n = MAX_TX;
+	write_profile(out, n);
+
+	// nothing to print if every tx ran inside an RTM tx, or none ran
+	unsigned first = 0;
+	while (first < n && atomic_load(&perf_count[first]) == 0) ++first;
+	if (perf_mode && first < n) {
+		const unsigned avail = atomic_load(&perf_avail);
+		// averages per tx execution; cycles are nanoseconds for threads on the software clock
+		fprintf(out, "PrimeBort hardware counters (average per tx)%s\n=====\ncount",
+				(avail & SOFT_CLOCK) ? ", software clock in use" : "");
+		for (unsigned c = 0; c < NUM_COUNTERS; ++c) fprintf(out, "\t%s", counter_defs[c].name);
+		fprintf(out, "\ttx\n");
+		for (unsigned slot = 0; slot < n; ++slot) {
+			const uint64_t count = atomic_load(&perf_count[slot]);
+			if (count == 0) continue;
+			fprintf(out, "%llu", (unsigned long long) count);
+			for (unsigned c = 0; c < NUM_COUNTERS; ++c) {
+				if (avail & (1u << c) || (c == 0 && avail & SOFT_CLOCK)) {
+					fprintf(out, "\t%.1f", (double) atomic_load(&perf_sum[slot][c]) / count);
+				} else {
+					fprintf(out, "\t-");
+				}
+			}
+			fprintf(out, "\t%s\n", descs[slot]->name);
+		}
+		fprintf(out, "=====\n");
+	}
+
+	write_guard_report(out, n);
+
+	if (out != stderr) fclose(out);
+}
+
+static void thread_exit (void* p) {
+	struct thread_state* ts = (struct thread_state*) p;
+	drain(ts);
+	if (perf_mode && ts->perf_fd >= 0) {
+		for (unsigned c = 0; c < NUM_COUNTERS; ++c) {
+			if (ts->perf_fds[c] >= 0) close(ts->perf_fds[c]);
+		}
+		ts->perf_fd = -1;
+	}
+}
+
+static void init_runtime (void) {
+	const char* perf = getenv("PRIMEBORT_PERF");
+	perf_mode = perf && *perf && *perf != '0';
+	rtm_avail = have_rtm();
+	pthread_key_create(&exit_key, thread_exit);
+	atexit(write_report);
+}
+
+static struct thread_state* get_self (void) {
+	if (__builtin_expect(self != NULL, 1)) return self;
+	// setting up allocates and makes syscalls, which abort a tx we are in:
+	// the thread's probes are skipped until its first one outside a tx
+	if (in_tx()) return NULL;
+	pthread_once(&init_once, init_runtime);
+
+	struct thread_state* ts = calloc(1, sizeof(*ts));
+	if (!ts) return NULL;
+	atomic_flag_clear(&ts->drain_lock);
+	if (perf_mode) open_counters(ts);
+	ts->next = atomic_load(&threads);
+	while (!atomic_compare_exchange_weak(&threads, &ts->next, ts));
+	pthread_setspecific(exit_key, ts);
+	self = ts;
+	return ts;
+}
+
+void __primebort_register (struct primebort_txdesc* d, uint32_t count) {
+	pthread_once(&init_once, init_runtime);
+	for (uint32_t i = 0; i < count; ++i) {
+		const unsigned slot = atomic_fetch_add(&num_descs, 1);
+		if (slot >= MAX_TX) {
+			d[i].slot = UINT32_MAX;
+			continue;
+		}
+		descs[slot] = &d[i];
+		d[i].slot = slot;
+	}
+}
+
+void __primebort_tx_enter (struct primebort_txdesc* d) {
+	struct thread_state* ts = get_self();
+	if (!ts || d->slot == UINT32_MAX) return;
+
+	// The slot may be open already. Entered from deeper in the stack, that is a
+	// recursive re-entry (of a recursive mutex, say) and both are timed. Entered
+	// from the same frame or one further out, the function that opened it has
+	// gone past it or returned: it lost its exit, e.g. on an abort path the pass
+	// didn't recognize, and is restarted on top of the stack.
+	const uintptr_t frame = (uintptr_t) __builtin_frame_address(0);
+	unsigned i = ts->depth;
+	for (;;) {
+		while (i > 0 && ts->open[i-1].slot != d->slot) --i;
+		if (i == 0 || ts->open[i-1].frame > frame) break;
+		memmove(&ts->open[i-1], &ts->open[i], (ts->depth - i) * sizeof(ts->open[0]));
+		--ts->depth;
+		--i;
+	}
+	if (ts->depth == MAX_DEPTH) {
+		// its exit must not close the open one
+		if (i > 0) ++ts->open[i-1].reentered;
+		return;
+	}
+
+	ts->open[ts->depth].slot = d->slot;
+	ts->open[ts->depth].reentered = 0;
+	ts->open[ts->depth].frame = frame;
+	// the read is a syscall, which would abort an RTM tx we are in
+	ts->open[ts->depth].counted = perf_mode && !in_tx();
+	if (ts->open[ts->depth].counted) read_counters(ts, ts->open[ts->depth].counters);
+	ts->open[ts->depth].start = read_start();
+	++ts->depth;
+}
+
+void __primebort_tx_exit (struct primebort_txdesc* d) {
+	const uint64_t end = read_end();
+	struct thread_state* ts = self;
+	if (!ts) return;
+
+	// usually the innermost open tx, but locks can be released out of order
+	unsigned i = ts->depth;
+	while (i > 0 && ts->open[i-1].slot != d->slot) --i;
+	// exit on a path that didn't come through a probed entry
+	if (i == 0) return;
+	if (ts->open[i-1].reentered > 0) {
+		--ts->open[i-1].reentered;
+		return;
+	}
+
+	if (ts->open[i-1].counted && !in_tx()) {
+		uint64_t now[NUM_COUNTERS];
+		read_counters(ts, now);
+		for (unsigned c = 0; c < NUM_COUNTERS; ++c) {
+			atomic_fetch_add_explicit(&perf_sum[d->slot][c],
+					now[c] - ts->open[i-1].counters[c], memory_order_relaxed);
+		}
+		atomic_fetch_add_explicit(&perf_count[d->slot], 1, memory_order_relaxed);
+	}
+
+	const uint64_t start = ts->open[i-1].start;
+	memmove(&ts->open[i-1], &ts->open[i], (ts->depth - i) * sizeof(ts->open[0]));
+	--ts->depth;
+	record(ts, d->slot, end - start);
+}
+
+void __primebort_tx_abort (struct primebort_txdesc* d) {
+	struct thread_state* ts = self;
+	if (!ts) return;
+
+	// the attempt is dropped; everything the tx pushed was rolled back with it
+	unsigned i = ts->depth;
+	while (i > 0 && ts->open[i-1].slot != d->slot) --i;
+	if (i == 0) return;
+	if (ts->open[i-1].reentered > 0) {
+		--ts->open[i-1].reentered;
+		return;
+	}
+	memmove(&ts->open[i-1], &ts->open[i], (ts->depth - i) * sizeof(ts->open[0]));
+	--ts->depth;
+}
+
+int32_t __primebort_guard_slow (struct primebort_txdesc* d) {
+	(void) d;
+	struct primebort_guard* g = &__primebort_guard;
+	const uint32_t b = g->backoff;
+	for (uint32_t i = 0; i < b; ++i) {
+#if defined(__x86_64__) || defined(__i386__)
+		_mm_pause();
+#endif
+	}
+	// decays once a whole window passes without a storm
+	if (g->attempts - g->win_start >= GUARD_WINDOW) {
+		g->backoff = (b / 2 < GUARD_MIN_BACKOFF) ? 0 : b / 2;
+		g->win_start = g->attempts;
+		g->win_aborts = 0;
+	}
+	if (b >= GUARD_FALLBACK_AT) {
+		atomic_fetch_add_explicit(&guard_fallbacks, 1, memory_order_relaxed);
+		return (int32_t) PRIMEBORT_GUARD_FALLBACK;
+	}
+	return 0;
+}
+
+void __primebort_guard_abort (struct primebort_txdesc* d, int32_t status) {
+	(void) status;
+	struct primebort_guard* g = &__primebort_guard;
+	if (d->slot != UINT32_MAX)
+		atomic_fetch_add_explicit(&guard_aborts[d->slot], 1, memory_order_relaxed);
+
+	if (g->attempts - g->win_start >= GUARD_WINDOW) {
+		g->win_start = g->attempts;
+		g->win_aborts = 0;
+	}
+	if (++g->win_aborts >= GUARD_STORM) {
+		g->backoff = (g->backoff == 0) ? GUARD_MIN_BACKOFF :
+			(g->backoff >= GUARD_MAX_BACKOFF / 2) ? GUARD_MAX_BACKOFF : g->backoff * 2;
+		g->win_start = g->attempts;
+		g->win_aborts = 0;
+		atomic_fetch_add_explicit(&guard_storms, 1, memory_order_relaxed);
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+/*
+ * Runtime for code instrumented by the PrimeBort pass with -primebort-instrument.
+ * The pass calls __primebort_tx_enter right after each tx entry it found (once the
+ * lock is held) and __primebort_tx_exit right before each exit, and registers its tx
+ * descriptors from a module constructor. Probes inside an RTM transaction would abort
+ * it, so RTM txs are timed from right before XBEGIN to right after XEND, and their
+ * abort path calls __primebort_tx_abort, which drops the attempt. The time between the
+ * two is recorded into a per-thread ring buffer and folded into a log2 histogram per
+ * tx, which is written out at exit next to the pass's static estimates. A tx entered
+ * again from deeper in the stack before its exit (a recursive mutex) is timed at each
+ * level; one entered again from the same frame or further out lost its exit and is
+ * restarted.
+ *
+ * Setting PRIMEBORT_PERF=1 also opens perf_event counters (cycles, L1D read misses,
+ * LLC misses and, on TSX hardware, RTM aborts) once per thread, reads them in the same
+ * probes and attributes the deltas to each tx. Reading them is a syscall per probe,
+ * so this is much slower than the cycle histograms alone; since a syscall aborts an
+ * RTM tx, lock txs entered inside one aren't counted (the RTM tx's counts include
+ * them). Where perf events can't be opened (perf_event_paranoid, containers) a
+ * software clock stands in for cycles.
+ *
+ * Code built with -primebort-guard also calls into the guard below from the inline
+ * fast path the pass puts in front of suspicious XBEGINs. The guard state lives in
+ * initial-exec TLS, so the runtime has to be linked in, not dlopen'd.
+ *
+ * Build: cc -O2 -shared -fPIC -o libprimebort_rt.so primebort_rt.c -lpthread
+ * Output goes to the file named by PRIMEBORT_PROFILE, or stderr.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// must match the layout of primebort.txdesc emitted by the pass
+struct primebort_txdesc {
+	uint32_t slot; // assigned by the runtime at registration
+	uint32_t flags; // unused for now
+	const char* name; // lock and source location of the tx entry
+	uint64_t est_tx; // static longest path through the tx (txLat), in cycles
+	uint64_t est_rt; // static shortest path back to the entry (rtLat), in cycles
+};
+
+// must match the layout of primebort.guard emitted by the pass
+struct primebort_guard {
+	uint32_t attempts; // XBEGINs attempted by this thread, bumped inline
+	uint32_t win_start; // attempts at the start of the current abort rate window
+	uint32_t win_aborts; // aborts in the current window
+	uint32_t backoff; // pause iterations before the next attempt, 0 on the fast path
+};
+extern __thread struct primebort_guard __primebort_guard;
+
+// status the slow path hands back instead of running XBEGIN: an explicit abort with
+// code 0xfe and no retry bit, so the program takes its fallback path
+#define PRIMEBORT_GUARD_FALLBACK 0xfe000001u
+
+void __primebort_register(struct primebort_txdesc* descs, uint32_t count);
+int32_t __primebort_guard_slow(struct primebort_txdesc* desc);
+void __primebort_guard_abort(struct primebort_txdesc* desc, int32_t status);
+void __primebort_tx_enter(struct primebort_txdesc* desc);
+void __primebort_tx_exit(struct primebort_txdesc* desc);
+void __primebort_tx_abort(struct primebort_txdesc* desc);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,43 @@
+# Starts primebort-server on a socket, sends it one request per argument after '--',
+# prints each request and the response to it, and waits for the server to exit.
+#   server-client.py <socket> [<bitcode>...] -- <request>...
+
+import os
+import socket
+import subprocess
+import sys
+import time
+
+args = sys.argv[1:]
+sep = args.index('--')
+sock_path, modules, requests = args[0], args[1:sep], args[sep + 1:]
+
+server = subprocess.Popen(['primebort-server', '-socket', sock_path] + modules,
+                          stderr=subprocess.DEVNULL)
+s = socket.socket(socket.AF_UNIX)
+for _ in range(300):
+    try:
+        s.connect(sock_path)
+        break
+    except OSError:
+        if server.poll() is not None:
+            sys.exit('server exited with %d' % server.returncode)
+        time.sleep(0.1)
+else:
+    server.kill()
+    sys.exit('server not listening on ' + sock_path)
+
+f = s.makefile('rw')
+for req in requests:
+    print('>', req)
+    f.write(req + '\n')
+    f.flush()
+    while True:
+        line = f.readline()
+        if not line:
+            sys.exit('connection closed')
+        print(line, end='')
+        if line == 'ok\n' or line.startswith('error:'):
+            break
+s.close()
+sys.exit(server.wait(timeout=30))
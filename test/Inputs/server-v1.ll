@@ -0,0 +1,19 @@
+source_filename = "queue.c"
+%struct.m = type { [40 x i8] }
+@m = global %struct.m zeroinitializer
+@total = global i64 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+define void @add(i64 %x) {
+  call i32 @pthread_mutex_lock(%struct.m* @m)
+  call void @bump(i64 %x)
+  call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+define void @bump(i64 %x) {
+  %t = load i64, i64* @total
+  %s = add i64 %t, %x
+  store i64 %s, i64* @total
+  ret void
+}
@@ -0,0 +1,118 @@
+; The abort side of each RTM tx: whether and how often it is retried, what a retry
+; costs, and the lock it falls back to.
+; RUN: %opt -primebort -primebort-abort-report -disable-output %s 2>&1 | FileCheck %s
+
+; CHECK-LABEL: PrimeBort RTM abort paths (150 cycles per abort)
+; CHECK: {{^}}  tx {{[0-9]+}}: bounded txLat
+; CHECK-NEXT: retry: at most 3 times, {{[0-9]+}} cycles per abort, storm
+; CHECK-NEXT: fallback: bounded, {{[0-9]+}} cycles to the end of its section
+; CHECK: {{^}}! tx {{[0-9]+}}: unbounded txLat
+; CHECK-NEXT: retry: UNBOUNDED, {{[0-9]+}} cycles per abort, leaves on some abort codes
+; CHECK-NEXT: fallback: unbounded
+; CHECK: {{^}}  tx {{[0-9]+}}: giveup txLat
+; CHECK-NEXT: retry: no
+; CHECK-NEXT: fallback: none, gives up
+; the status comes back through a begin wrapper
+; CHECK: {{^}}! tx {{[0-9]+}}: spinforever txLat
+; CHECK-NEXT: retry: UNBOUNDED, {{[0-9]+}} cycles per abort, never leaves
+; CHECK-NEXT: fallback: none, gives up
+; CHECK: =====
+
+%struct.m = type { [40 x i8] }
+@m = global %struct.m zeroinitializer
+@cnt = global [16 x i64] zeroinitializer
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+declare i32 @llvm.x86.xbegin()
+declare void @llvm.x86.xend()
+
+; three tries, then the lock
+define void @bounded(i32 %k) {
+entry:
+  br label %try
+try:
+  %t = phi i32 [0, %entry], [%t1, %aborted]
+  %s = call i32 @llvm.x86.xbegin()
+  %ok = icmp eq i32 %s, -1
+  br i1 %ok, label %body, label %aborted
+body:
+  %p = getelementptr [16 x i64], [16 x i64]* @cnt, i32 0, i32 %k
+  %v = load i64, i64* %p
+  %v1 = add i64 %v, 1
+  store i64 %v1, i64* %p
+  call void @llvm.x86.xend()
+  ret void
+aborted:
+  %t1 = add i32 %t, 1
+  %again = icmp slt i32 %t1, 3
+  br i1 %again, label %try, label %slow
+slow:
+  %r = call i32 @pthread_mutex_lock(%struct.m* @m)
+  %q = getelementptr [16 x i64], [16 x i64]* @cnt, i32 0, i32 %k
+  %w = load i64, i64* %q
+  %w1 = add i64 %w, 1
+  store i64 %w1, i64* %q
+  %r2 = call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+
+; retried while the abort status says it may succeed
+define void @unbounded(i32 %k) {
+entry:
+  br label %try
+try:
+  %s = call i32 @llvm.x86.xbegin()
+  %ok = icmp ne i32 %s, -1
+  br i1 %ok, label %aborted, label %body
+body:
+  %p = getelementptr [16 x i64], [16 x i64]* @cnt, i32 0, i32 %k
+  %v = load i64, i64* %p
+  %v1 = add i64 %v, 2
+  store i64 %v1, i64* %p
+  call void @llvm.x86.xend()
+  ret void
+aborted:
+  %bit = and i32 %s, 2
+  %retry = icmp ne i32 %bit, 0
+  br i1 %retry, label %try, label %slow
+slow:
+  %r = call i32 @pthread_mutex_lock(%struct.m* @m)
+  %r2 = call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+
+; retried until it commits
+define i32 @begin() {
+  %s = call i32 @llvm.x86.xbegin()
+  ret i32 %s
+}
+
+define void @spinforever(i32 %k) {
+entry:
+  br label %try
+try:
+  %s = call i32 @begin()
+  %ok = icmp eq i32 %s, -1
+  br i1 %ok, label %body, label %try
+body:
+  %p = getelementptr [16 x i64], [16 x i64]* @cnt, i32 0, i32 %k
+  %v = load i64, i64* %p
+  %v1 = add i64 %v, 3
+  store i64 %v1, i64* %p
+  call void @llvm.x86.xend()
+  ret void
+}
+
+; the caller handles the failure
+define i32 @giveup(i32 %k) {
+  %s = call i32 @llvm.x86.xbegin()
+  %ok = icmp eq i32 %s, -1
+  br i1 %ok, label %body, label %fail
+body:
+  %p = getelementptr [16 x i64], [16 x i64]* @cnt, i32 0, i32 %k
+  store i64 4, i64* %p
+  call void @llvm.x86.xend()
+  ret i32 1
+fail:
+  ret i32 0
+}
@@ -0,0 +1,57 @@
+; -primebort-annotate attaches !primebort.lat to the functions and blocks a tx runs code
+; in, and to the tx's entry and exit calls; functions outside txs get none.
+; RUN: %opt -primebort -primebort-annotate -S %s | FileCheck %s
+; RUN: %opt -primebort -S %s | FileCheck %s --check-prefix=OFF
+
+; CHECK: define void @bump() !primebort.lat ![[BUMP:[0-9]+]] {
+; CHECK: ret void, !primebort.lat ![[BUMP_RET:[0-9]+]]
+; CHECK: define void @put(i1 %full) !primebort.lat ![[PUT:[0-9]+]] {
+; CHECK: call i32 @pthread_mutex_lock({{.*}}), !primebort.lat ![[TX:[0-9]+]]
+; CHECK-NEXT: br i1 %full, {{.*}}, !primebort.lat ![[ENTRY:[0-9]+]]
+; CHECK: br label %done, !primebort.lat ![[SLOW:[0-9]+]]
+; CHECK: call i32 @pthread_mutex_unlock({{.*}}), !primebort.lat ![[EXIT:[0-9]+]]
+; CHECK-NEXT: ret void, !primebort.lat ![[ENTRY]]
+; CHECK: define void @idle() {
+; CHECK-DAG: ![[BUMP]] = !{!"func", i64 8, i64 8}
+; CHECK-DAG: ![[BUMP_RET]] = !{!"block", i64 8, i64 8}
+; CHECK-DAG: ![[PUT]] = !{!"func", i64 10, i64 24}
+; txLat through the slow path, rtLat, 8 bytes read, 16 written
+; CHECK-DAG: ![[TX]] = !{!"tx", i32 0, i64 22, i64 5, i64 8, i64 16}
+; CHECK-DAG: ![[ENTRY]] = !{!"block", i64 5, i64 5}
+; the block with the call to @bump counts the callee
+; CHECK-DAG: ![[SLOW]] = !{!"block", i64 14, i64 14}
+; CHECK-DAG: ![[EXIT]] = !{!"tx.exit", i32 0, i64 22, i64 5}
+
+; OFF-NOT: primebort.lat
+
+%struct.m = type { [40 x i8] }
+@m = global %struct.m zeroinitializer
+@counter = global i64 0
+@buf = global [4 x i64] zeroinitializer
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+define void @bump() {
+  %c = load i64, i64* @counter
+  %c1 = add i64 %c, 1
+  store i64 %c1, i64* @counter
+  ret void
+}
+
+define void @put(i1 %full) {
+entry:
+  %r = call i32 @pthread_mutex_lock(%struct.m* @m)
+  br i1 %full, label %slow, label %done
+slow:
+  call void @bump()
+  store i64 1, i64* getelementptr ([4 x i64], [4 x i64]* @buf, i32 0, i32 3)
+  br label %done
+done:
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+
+; runs no tx code
+define void @idle() {
+  ret void
+}
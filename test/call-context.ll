@@ -0,0 +1,72 @@
+; Callees are costed with the constant arguments of their call site, forwarded through
+; up to -primebort-context-depth nested calls: @spin's trip count comes from @wrap's
+; caller, and @copy's memcpy size from its own.
+; RUN: %opt -primebort -primebort-serialize=%t.json -disable-output %s
+; RUN: FileCheck %s < %t.json
+; RUN: %opt -primebort -primebort-context-depth=1 -primebort-serialize=%t.1.json \
+; RUN:   -disable-output %s
+; RUN: FileCheck %s --check-prefix=DEPTH1 < %t.1.json
+; RUN: %opt -primebort -primebort-context-depth=0 -primebort-serialize=%t.0.json \
+; RUN:   -disable-output %s
+; RUN: FileCheck %s --check-prefix=OFF < %t.0.json
+
+; CHECK: "ancestor": "f"
+; CHECK: "txLat": 74,
+; CHECK: "ancestor": "g"
+; CHECK: "txLat": 1001,
+; the memcpy sizes are known, @spin's trip count isn't
+; DEPTH1: "ancestor": "f"
+; DEPTH1: "txLat": 15032385573,
+; DEPTH1: "ancestor": "g"
+; DEPTH1: "txLat": 15032385828,
+; both txs cost the same without contexts
+; OFF: "ancestor": "f"
+; OFF: "txLat": 15032385588,
+; OFF: "ancestor": "g"
+; OFF: "txLat": 15032385588,
+
+declare void @pthread_mutex_lock(i8*)
+declare void @pthread_mutex_unlock(i8*)
+declare i8* @memcpy(i8*, i8*, i64)
+@m = global i8 0
+@buf = global [4096 x i8] zeroinitializer
+@src = global [4096 x i8] zeroinitializer
+
+define void @spin(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i1, %loop]
+  %x = load volatile i8, i8* @m
+  %i1 = add i32 %i, 1
+  %c = icmp slt i32 %i1, %n
+  br i1 %c, label %loop, label %out
+out:
+  ret void
+}
+
+define void @copy(i64 %len) {
+  %r = call i8* @memcpy(i8* getelementptr ([4096 x i8], [4096 x i8]* @buf, i64 0, i64 0), i8* getelementptr ([4096 x i8], [4096 x i8]* @src, i64 0, i64 0), i64 %len)
+  ret void
+}
+
+define void @wrap(i32 %n) {
+  call void @spin(i32 %n)
+  ret void
+}
+
+define void @f() {
+  call void @pthread_mutex_lock(i8* @m)
+  call void @wrap(i32 4)
+  call void @copy(i64 16)
+  call void @pthread_mutex_unlock(i8* @m)
+  ret void
+}
+
+define void @g() {
+  call void @pthread_mutex_lock(i8* @m)
+  call void @wrap(i32 100)
+  call void @copy(i64 4096)
+  call void @pthread_mutex_unlock(i8* @m)
+  ret void
+}
@@ -0,0 +1,108 @@
+; Identical functions share one callee summary, and a function on a call cycle keeps none:
+; estimates are the same with summaries shared or not.
+; RUN: %opt -primebort -primebort-serialize=%t.json -disable-output %s
+; RUN: FileCheck %s < %t.json
+; RUN: %opt -primebort -primebort-dedup-functions=false -primebort-serialize=%t.off.json \
+; RUN:   -disable-output %s
+; RUN: FileCheck %s < %t.off.json
+
+; CHECK: "ancestor": "use_a"
+; CHECK: "txLat": 712,
+; fill_b is costed from fill_a's summary, twice
+; CHECK: "ancestor": "use_b"
+; CHECK: "txLat": 1418,
+; f and g recurse into each other from either tx
+; CHECK: "ancestor": "f"
+; CHECK: "txLat": 725,
+; CHECK: "ancestor": "h"
+; CHECK: "txLat": 740,
+
+%struct.m = type { [40 x i8] }
+@m = global %struct.m zeroinitializer
+@a = global [1024 x i32] zeroinitializer
+@b = global [1024 x i32] zeroinitializer
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+; two copies of the same function, as template instantiations give
+define void @fill_a(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i1, %loop ]
+  %p = getelementptr [1024 x i32], [1024 x i32]* @a, i32 0, i32 %i
+  store i32 %n, i32* %p
+  %i1 = add i32 %i, 1
+  %c = icmp ult i32 %i1, 100
+  br i1 %c, label %loop, label %done
+done:
+  ret void
+}
+define void @fill_b(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i1, %loop ]
+  %p = getelementptr [1024 x i32], [1024 x i32]* @a, i32 0, i32 %i
+  store i32 %n, i32* %p
+  %i1 = add i32 %i, 1
+  %c = icmp ult i32 %i1, 100
+  br i1 %c, label %loop, label %done
+done:
+  ret void
+}
+
+define void @use_a(i32 %n) {
+  call i32 @pthread_mutex_lock(%struct.m* @m)
+  call void @fill_a(i32 %n)
+  call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+define void @use_b(i32 %n) {
+  call i32 @pthread_mutex_lock(%struct.m* @m)
+  call void @fill_b(i32 %n)
+  call void @fill_b(i32 %n)
+  call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+define i32 @work(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i1, %loop ]
+  %p = getelementptr [1024 x i32], [1024 x i32]* @a, i32 0, i32 %i
+  store i32 %n, i32* %p
+  %i1 = add i32 %i, 1
+  %c = icmp ult i32 %i1, 100
+  br i1 %c, label %loop, label %done
+done:
+  ret i32 %i1
+}
+
+; f holds the lock around g, and g calls back into f; so does h
+define i32 @f(i32 %n) {
+  call i32 @pthread_mutex_lock(%struct.m* @m)
+  %r = call i32 @g(i32 %n)
+  call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret i32 %r
+}
+define i32 @g(i32 %n) {
+entry:
+  %c = icmp sgt i32 %n, 0
+  br i1 %c, label %rec, label %base
+rec:
+  %n1 = sub i32 %n, 1
+  %r = call i32 @f(i32 %n1)
+  %w = call i32 @work(i32 %n)
+  %s = add i32 %r, %w
+  ret i32 %s
+base:
+  ret i32 0
+}
+define i32 @h(i32 %n) {
+  call i32 @pthread_mutex_lock(%struct.m* @m)
+  %n2 = mul i32 %n, 3
+  %r = call i32 @g(i32 %n2)
+  call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret i32 %r
+}
@@ -0,0 +1,170 @@
+; Lines written inside more than one tx are reported, spin lock words included, and each
+; tx is charged one transfer per contended line it writes, however often it writes it.
+; An object is split into pieces of its alignment, the most known to share a line: two
+; fields of @loose can't be told to share one. A lock word in an object reached through
+; a pointer is only contended if the txs use the same pointer.
+; RUN: %opt -primebort -primebort-contention -primebort-serialize=%t.json -disable-output \
+; RUN:   %s 2>&1 | FileCheck %s --implicit-check-not=@loose --implicit-check-not=lock_x \
+; RUN:   --implicit-check-not=lock_y
+; RUN: FileCheck %s --check-prefix=LAT < %t.json
+; RUN: %opt -primebort -primebort-serialize=%t.off.json -disable-output %s
+; RUN: FileCheck %s --check-prefix=OFF < %t.off.json
+
+; CHECK-LABEL: PrimeBort contended cache lines (+70 cycles per line and tx)
+; CHECK-DAG: @counter bytes 0-7: 2 txs, shared
+; CHECK-DAG: @stats bytes 0-15: 2 txs, false sharing
+; CHECK-DAG: @padded line 0: 2 txs, false sharing
+; CHECK-DAG: @gl bytes 0-3: 2 txs, shared
+; CHECK-DAG: tx {{[0-9]+}} +0 cmpxchg spin_a
+; CHECK-DAG: tx {{[0-9]+}} +0 store spin_a
+; CHECK-DAG: tx {{[0-9]+}} +0 cmpxchg spin_b
+; CHECK-DAG: tx {{[0-9]+}} +0 store spin_b
+; CHECK-DAG: %struct.obj bytes 4-7: 2 txs, shared
+; CHECK: =====
+
+; @counter, a piece of @stats and a line of @padded: three transfers, though the loop
+; writes @counter 100 times
+; LAT: "ancestor": "loop"
+; LAT: "txLat": 1426,
+; LAT: "ancestor": "once"
+; LAT: "txLat": 227,
+; the lock word: one transfer
+; LAT: "ancestor": "spin_a"
+; LAT: "txLat": 75,
+; LAT: "ancestor": "lock_x"
+; LAT: "txLat": 2,
+; LAT: "ancestor": "lock_y"
+; LAT: "txLat": 2,
+; LAT: "ancestor": "both"
+; LAT: "txLat": 72,
+; OFF: "ancestor": "loop"
+; OFF: "txLat": 1216,
+; OFF: "ancestor": "once"
+; OFF: "txLat": 17,
+; OFF: "ancestor": "spin_a"
+; OFF: "txLat": 5,
+; OFF: "ancestor": "both"
+; OFF: "txLat": 2,
+
+%struct.m = type { [40 x i8] }
+%struct.stats = type { i64, i64, [14 x i64] }
+%struct.obj = type { i32, i32, i64 }
+@ma = global %struct.m zeroinitializer
+@mb = global %struct.m zeroinitializer
+@gl = global i32 0
+@counter = global i64 0
+@stats = global %struct.stats zeroinitializer
+; aligned to a line, and aligned only to 16 bytes
+@padded = global %struct.stats zeroinitializer, align 64
+@loose = global %struct.stats zeroinitializer
+@private = thread_local global i64 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+define void @loop() {
+entry:
+  %r = call i32 @pthread_mutex_lock(%struct.m* @ma)
+  br label %body
+body:
+  %i = phi i32 [ 0, %entry ], [ %i1, %body ]
+  %c = load i64, i64* @counter
+  %c1 = add i64 %c, 1
+  store i64 %c1, i64* @counter
+  store i64 %c1, i64* @private
+  %i1 = add i32 %i, 1
+  %done = icmp eq i32 %i1, 100
+  br i1 %done, label %out, label %body
+out:
+  %s = getelementptr %struct.stats, %struct.stats* @stats, i32 0, i32 0
+  store i64 1, i64* %s
+  %p = getelementptr %struct.stats, %struct.stats* @padded, i32 0, i32 1
+  store i64 1, i64* %p
+  %l = getelementptr %struct.stats, %struct.stats* @loose, i32 0, i32 1
+  store i64 1, i64* %l
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @ma)
+  ret void
+}
+
+define void @once() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @mb)
+  store i64 0, i64* @counter
+  %s = getelementptr %struct.stats, %struct.stats* @stats, i32 0, i32 1
+  store i64 1, i64* %s
+  %p = getelementptr %struct.stats, %struct.stats* @padded, i32 0, i32 2, i32 0
+  store i64 1, i64* %p
+  %l = getelementptr %struct.stats, %struct.stats* @loose, i32 0, i32 2, i32 0
+  store i64 1, i64* %l
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @mb)
+  ret void
+}
+
+; two sections under one spin lock: its word is written by both
+define void @spin_a() {
+entry:
+  br label %acq
+acq:
+  %r = cmpxchg i32* @gl, i32 0, i32 1 acquire monotonic
+  %ok = extractvalue { i32, i1 } %r, 1
+  br i1 %ok, label %cs, label %acq
+cs:
+  %v = load i64, i64* @private
+  store atomic i32 0, i32* @gl release, align 4
+  ret void
+}
+define void @spin_b() {
+entry:
+  br label %acq
+acq:
+  %r = cmpxchg i32* @gl, i32 0, i32 1 acquire monotonic
+  %ok = extractvalue { i32, i1 } %r, 1
+  br i1 %ok, label %cs, label %acq
+cs:
+  store i64 2, i64* @private
+  store atomic i32 0, i32* @gl release, align 4
+  ret void
+}
+
+; per-object spin locks: one instance in each function, the same one twice in @both
+define void @lock_x(%struct.obj* %o) {
+entry:
+  %w = getelementptr %struct.obj, %struct.obj* %o, i32 0, i32 1
+  br label %acq
+acq:
+  %r = cmpxchg i32* %w, i32 0, i32 1 acquire monotonic
+  %ok = extractvalue { i32, i1 } %r, 1
+  br i1 %ok, label %cs, label %acq
+cs:
+  store atomic i32 0, i32* %w release, align 4
+  ret void
+}
+define void @lock_y(%struct.obj* %o) {
+entry:
+  %w = getelementptr %struct.obj, %struct.obj* %o, i32 0, i32 1
+  br label %acq
+acq:
+  %r = cmpxchg i32* %w, i32 0, i32 1 acquire monotonic
+  %ok = extractvalue { i32, i1 } %r, 1
+  br i1 %ok, label %cs, label %acq
+cs:
+  store atomic i32 0, i32* %w release, align 4
+  ret void
+}
+define void @both(%struct.obj* %o) {
+entry:
+  %w = getelementptr %struct.obj, %struct.obj* %o, i32 0, i32 1
+  br label %acq
+acq:
+  %r = cmpxchg i32* %w, i32 0, i32 1 acquire monotonic
+  %ok = extractvalue { i32, i1 } %r, 1
+  br i1 %ok, label %cs, label %acq
+cs:
+  store atomic i32 0, i32* %w release, align 4
+  br label %acq2
+acq2:
+  %r2 = cmpxchg i32* %w, i32 0, i32 1 acquire monotonic
+  %ok2 = extractvalue { i32, i1 } %r2, 1
+  br i1 %ok2, label %cs2, label %acq2
+cs2:
+  store atomic i32 0, i32* %w release, align 4
+  ret void
+}
@@ -0,0 +1,65 @@
+; Lock critical sections ranked by how well they would suit elision, with the reasons
+; the others don't.
+; RUN: %opt -primebort -primebort-elision-report -disable-output %s 2>&1 | FileCheck %s
+; RUN: %opt -primebort -primebort-elision-report -primebort-elision-max-write=512 \
+; RUN:   -primebort-elision-max-lat=1000000000 -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=LIMITS
+
+; CHECK-LABEL: PrimeBort lock elision report
+; CHECK: Elision candidates (1):
+; CHECK-NEXT: #1 txLat 12 rtLat 5 rd 8B wr 8B short
+; CHECK-NEXT: Not elidable (2):
+; CHECK-NEXT: #1 txLat {{[0-9]+}} rtLat 5 rd 0B wr 0B sleepy
+; CHECK-NEXT: too long, syscall/I/O: usleep, may block
+; CHECK-NEXT: #2 txLat {{[0-9]+}} rtLat 5 rd 0B wr 1024B fill
+; CHECK-NEXT: too long
+; CHECK-NEXT: =====
+
+; LIMITS: Not elidable (2):
+; LIMITS: sleepy
+; LIMITS-NEXT: syscall/I/O: usleep, may block
+; LIMITS: fill
+; LIMITS-NEXT: write set too large
+
+%struct.m = type { [40 x i8] }
+@a = global %struct.m zeroinitializer
+@b = global %struct.m zeroinitializer
+@c = global %struct.m zeroinitializer
+@cnt = global i64 0
+@big = global [65536 x i64] zeroinitializer
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+declare i32 @usleep(i32)
+declare i32 @puts(i8*)
+
+define void @short() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @a)
+  %v = load i64, i64* @cnt
+  %v1 = add i64 %v, 1
+  store i64 %v1, i64* @cnt
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @a)
+  ret void
+}
+
+define void @sleepy() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @b)
+  %s = call i32 @usleep(i32 10)
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @b)
+  ret void
+}
+
+define void @fill() {
+entry:
+  %r = call i32 @pthread_mutex_lock(%struct.m* @c)
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %p = getelementptr [65536 x i64], [65536 x i64]* @big, i64 0, i64 %i
+  store i64 %i, i64* %p
+  %i1 = add i64 %i, 1
+  %d = icmp eq i64 %i1, 65536
+  br i1 %d, label %out, label %loop
+out:
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @c)
+  ret void
+}
@@ -0,0 +1,104 @@
+; An XBEGIN is guarded if its tx is long next to the way back to its entry, or if its
+; abort path starts it again; a loop that only leaves on an abort isn't a retry loop.
+; RUN: %opt -primebort -primebort-guard -S %s | FileCheck %s
+
+%struct.m = type { [40 x i8] }
+@m = global %struct.m zeroinitializer
+@cnt = global [16 x i64] zeroinitializer
+@a = global [64 x i32] zeroinitializer
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+declare i32 @llvm.x86.xbegin()
+declare void @llvm.x86.xend()
+
+; short, but retried
+; CHECK-LABEL: define void @retried(
+; CHECK: call i32 @__primebort_guard_slow(
+; CHECK: %s = call i32 @llvm.x86.xbegin()
+; CHECK: call void @__primebort_guard_abort(
+define void @retried(i32 %k) {
+entry:
+  br label %try
+try:
+  %t = phi i32 [0, %entry], [%t1, %aborted]
+  %s = call i32 @llvm.x86.xbegin()
+  %ok = icmp eq i32 %s, -1
+  br i1 %ok, label %body, label %aborted
+body:
+  %p = getelementptr [16 x i64], [16 x i64]* @cnt, i32 0, i32 %k
+  %v = load i64, i64* %p
+  %v1 = add i64 %v, 1
+  store i64 %v1, i64* %p
+  call void @llvm.x86.xend()
+  ret void
+aborted:
+  %t1 = add i32 %t, 1
+  %again = icmp slt i32 %t1, 3
+  br i1 %again, label %try, label %slow
+slow:
+  %r = call i32 @pthread_mutex_lock(%struct.m* @m)
+  %r2 = call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+
+; a tx per iteration, and an abort ends the loop
+; CHECK-LABEL: define i32 @batch(
+; CHECK-NOT: @__primebort_guard
+; CHECK: ret i32
+define i32 @batch(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i1, %body ]
+  %s = call i32 @llvm.x86.xbegin()
+  %ok = icmp eq i32 %s, -1
+  br i1 %ok, label %body, label %out
+body:
+  %p = getelementptr [64 x i32], [64 x i32]* @a, i32 0, i32 %i
+  store i32 %i, i32* %p
+  call void @llvm.x86.xend()
+  %i1 = add i32 %i, 1
+  %c = icmp ult i32 %i1, %n
+  br i1 %c, label %loop, label %out
+out:
+  %r = phi i32 [ %s, %loop ], [ 0, %body ]
+  ret i32 %r
+}
+
+; short and not retried
+; CHECK-LABEL: define i32 @giveup(
+; CHECK-NOT: @__primebort_guard
+; CHECK: ret i32 0
+define i32 @giveup(i32 %k) {
+  %s = call i32 @llvm.x86.xbegin()
+  %ok = icmp eq i32 %s, -1
+  br i1 %ok, label %body, label %fail
+body:
+  %p = getelementptr [16 x i64], [16 x i64]* @cnt, i32 0, i32 %k
+  store i64 4, i64* %p
+  call void @llvm.x86.xend()
+  ret i32 1
+fail:
+  ret i32 0
+}
+
+; long next to the way back
+; CHECK-LABEL: define void @long(
+; CHECK: call i32 @__primebort_guard_slow(
+; CHECK: %s = call i32 @llvm.x86.xbegin()
+define void @long(i64 %x) {
+  %s = call i32 @llvm.x86.xbegin()
+  %ok = icmp eq i32 %s, -1
+  br i1 %ok, label %body, label %fail
+body:
+  %d1 = udiv i64 %x, 3
+  %d2 = udiv i64 %d1, 5
+  %d3 = udiv i64 %d2, 7
+  %d4 = udiv i64 %d3, 11
+  %p = getelementptr [16 x i64], [16 x i64]* @cnt, i32 0, i32 0
+  store i64 %d4, i64* %p
+  call void @llvm.x86.xend()
+  ret void
+fail:
+  ret void
+}
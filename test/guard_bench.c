@@ -0,0 +1,125 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <cpuid.h>
+#include <immintrin.h>
+#include "../PrimeBortRuntime/primebort_rt.h"
+
+/*
+ * Overhead of the -primebort-guard fast path on benign contention.
+ * Each thread bumps a shared counter in an RTM transaction falling back to a
+ * spinlock, once as written and once with the same guard sequence the pass emits
+ * around XBEGIN. Without TSX both go straight to the lock, which still measures
+ * the guard's inline cost. One run of each mostly measures how the lock handoffs
+ * happened to go under contention, so the two are run in alternating rounds after
+ * a warm-up, and the medians are compared.
+ * Build: cc -O2 -mrtm -pthread test/guard_bench.c PrimeBortRuntime/primebort_rt.c
+ * Usage: ./a.out [threads] [iterations per thread]
+ */
+
+static struct primebort_txdesc desc = {0, 0, "guard_bench", 0, 0};
+static volatile int fallback_lock;
+static volatile uint64_t counter;
+static int use_rtm;
+static unsigned long iters = 1000000;
+#define ROUNDS 7
+
+static void lock () {
+	while (__atomic_exchange_n(&fallback_lock, 1, __ATOMIC_ACQUIRE)) _mm_pause();
+}
+
+static void unlock () {
+	__atomic_store_n(&fallback_lock, 0, __ATOMIC_RELEASE);
+}
+
+static unsigned xbegin_plain () {
+	return use_rtm ? _xbegin() : 0;
+}
+
+// what the pass puts in front of a guarded XBEGIN
+static unsigned xbegin_guarded () {
+	++__primebort_guard.attempts;
+	if (__builtin_expect(__primebort_guard.backoff != 0, 0)) {
+		const int32_t s = __primebort_guard_slow(&desc);
+		if (s != 0) return s;
+	}
+	if (!use_rtm) return 0;
+	const unsigned s = _xbegin();
+	if (__builtin_expect(s != _XBEGIN_STARTED, 0)) __primebort_guard_abort(&desc, s);
+	return s;
+}
+
+#define INCREMENT(XBEGIN) do { \
+	if (XBEGIN() == _XBEGIN_STARTED) { \
+		if (fallback_lock) _xabort(0xff); \
+		++counter; \
+		_xend(); \
+	} else { \
+		lock(); \
+		++counter; \
+		unlock(); \
+	} \
+} while (0)
+
+static void* run_plain (void* p) {
+	(void) p;
+	for (unsigned long i = 0; i < iters; ++i) INCREMENT(xbegin_plain);
+	return NULL;
+}
+
+static void* run_guarded (void* p) {
+	(void) p;
+	for (unsigned long i = 0; i < iters; ++i) INCREMENT(xbegin_guarded);
+	return NULL;
+}
+
+static double run (void* (*fn) (void*), const unsigned nthreads) {
+	pthread_t th[nthreads];
+	struct timespec a, b;
+	counter = 0;
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	for (unsigned i = 0; i < nthreads; ++i) pthread_create(&th[i], NULL, fn, NULL);
+	for (unsigned i = 0; i < nthreads; ++i) pthread_join(th[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	if (counter != nthreads * iters) {
+		fprintf(stderr, "lost updates: %llu of %llu\n", (unsigned long long) counter,
+				(unsigned long long) nthreads * iters);
+		exit(1);
+	}
+	return (b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec);
+}
+
+static int cmp_double (const void* a, const void* b) {
+	const double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+int main (int argc, char** argv) {
+	const unsigned nthreads = (argc > 1) ? atoi(argv[1]) : 4;
+	if (argc > 2) iters = strtoul(argv[2], NULL, 10);
+
+	unsigned a, b, c, d;
+	use_rtm = __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 11));
+
+	__primebort_register(&desc, 1);
+	double plain_t[ROUNDS], guarded_t[ROUNDS];
+	run(run_plain, nthreads);
+	run(run_guarded, nthreads);
+	for (unsigned r = 0; r < ROUNDS; ++r) {
+		plain_t[r] = run(run_plain, nthreads);
+		guarded_t[r] = run(run_guarded, nthreads);
+	}
+	qsort(plain_t, ROUNDS, sizeof(double), cmp_double);
+	qsort(guarded_t, ROUNDS, sizeof(double), cmp_double);
+	const double plain = plain_t[ROUNDS/2], guarded = guarded_t[ROUNDS/2];
+	const double ops = (double) nthreads * iters;
+	printf("%s, %u threads, median of %u rounds\n"
+			"unguarded %.2f ns/op (%.2f-%.2f)\nguarded   %.2f ns/op (%.2f-%.2f, %+.1f%%)\n",
+			use_rtm ? "RTM" : "no RTM, lock only", nthreads, ROUNDS,
+			plain / ops, plain_t[0] / ops, plain_t[ROUNDS-1] / ops,
+			guarded / ops, guarded_t[0] / ops, guarded_t[ROUNDS-1] / ops,
+			100.0 * (guarded - plain) / plain);
+	return 0;
+}
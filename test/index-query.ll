@@ -0,0 +1,59 @@
+; REQUIRES: primebort-query
+; The index records each tx with its lock, latencies and the functions run inside it,
+; and primebort-query selects txs from it by those.
+; RUN: rm -rf %t && mkdir -p %t
+; RUN: %opt -primebort -primebort-index=%t/m.pbidx -disable-output %s
+; RUN: primebort-query %t/m.pbidx | FileCheck %s --check-prefix=ALL
+; RUN: primebort-query -calls=malloc -locks %t | FileCheck %s --check-prefix=MALLOC
+; RUN: primebort-query -min-txlat=1000 -funcs %t | FileCheck %s --check-prefix=LONG
+; RUN: primebort-query -lock=@b -ancestor=put %t/m.pbidx | FileCheck %s --check-prefix=NONE
+; RUN: not primebort-query %t/missing.pbidx 2>&1 | FileCheck %s --check-prefix=ERR
+
+; ALL: txLat rtLat bytes flags lock tx
+; ALL-DAG: alloc @a put @ {{.*}}index-query.ll
+; ALL-DAG: syscall,blocking @b nap @ {{.*}}index-query.ll
+; ALL: 2 of 2 txs in 1 indexes
+
+; malloc is called through a helper
+; MALLOC: txLat txs lock
+; MALLOC-NEXT: 1 @a
+; MALLOC-NEXT: =====
+; MALLOC-NEXT: 1 of 2 txs in 1 indexes
+
+; LONG: latency flags function
+; LONG-NEXT: 1 extern syscall,blocking usleep
+; LONG-NEXT: =====
+; LONG-NEXT: 1 of 2 txs in 1 indexes
+
+; NONE: 0 of 2 txs in 1 indexes
+
+; ERR: missing.pbidx
+
+%struct.m = type { [40 x i8] }
+@a = global %struct.m zeroinitializer
+@b = global %struct.m zeroinitializer
+@head = global i8* null
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+declare i8* @malloc(i64)
+declare i32 @usleep(i32)
+
+define i8* @node() {
+  %p = call i8* @malloc(i64 32)
+  ret i8* %p
+}
+
+define void @put() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @a)
+  %p = call i8* @node()
+  store i8* %p, i8** @head
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @a)
+  ret void
+}
+
+define void @nap() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @b)
+  %s = call i32 @usleep(i32 10)
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @b)
+  ret void
+}
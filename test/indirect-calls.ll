@@ -0,0 +1,131 @@
+; Indirect calls are costed by their possible targets: the vtable slot of every vtable
+; with the call's type id, the functions a select picks from, or every address-taken
+; function of the call's type. A lock taken through a pointer that can only be the lock
+; function is a tx boundary.
+; RUN: %opt -primebort -primebort-serialize=%t.json -disable-output %s
+; RUN: FileCheck %s < %t.json
+; RUN: %opt -primebort -primebort-max-signature-targets=1 -primebort-serialize=%t.sig.json \
+; RUN:   -disable-output %s
+; RUN: FileCheck %s --check-prefix=SIG1 < %t.sig.json
+; RUN: %opt -primebort -primebort-resolve-indirect=false -primebort-serialize=%t.off.json \
+; RUN:   -disable-output %s
+; RUN: FileCheck %s --check-prefix=OFF --implicit-check-not=tx_fp < %t.off.json
+
+; the longest of A.slow and B.slow
+; CHECK: "ancestor": "tx_virtual"
+; CHECK: "flags": 0,
+; CHECK: "txLat": 730,
+; CHECK: "ancestor": "tx_select"
+; CHECK: "flags": 0,
+; CHECK: "txLat": 26,
+; h1 or h2, by the signature: still flagged indirect
+; CHECK: "ancestor": "tx_sig"
+; CHECK: "flags": 8,
+; CHECK: "txLat": 41,
+; CHECK: "ancestor": "tx_fp"
+; CHECK: "txLat": 8,
+
+; two targets are too many
+; SIG1: "ancestor": "tx_sig"
+; SIG1: "flags": 8,
+; SIG1: "txLat": 9,
+
+; OFF: "ancestor": "tx_virtual"
+; OFF: "flags": 8,
+; OFF: "txLat": 27,
+; OFF: "ancestor": "tx_select"
+; OFF: "flags": 8,
+; OFF: "txLat": 9,
+; OFF: "ancestor": "tx_sig"
+; OFF: "flags": 8,
+; OFF: "txLat": 9,
+
+%struct.m = type { [40 x i8] }
+@mtx = global %struct.m zeroinitializer
+@cnt = global i32 0
+@cb = global void (i32)* null
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+declare i1 @llvm.type.test(i8*, metadata)
+declare void @llvm.assume(i1)
+
+@vt.A = constant [2 x i8*] [i8* bitcast (void (i8*)* @A.cheap to i8*), i8* bitcast (void (i8*)* @A.slow to i8*)], !type !0
+@vt.B = constant [2 x i8*] [i8* bitcast (void (i8*)* @B.cheap to i8*), i8* bitcast (void (i8*)* @B.slow to i8*)], !type !0
+!0 = !{i64 0, !"_ZTS4Base"}
+
+define void @A.cheap(i8* %this) { ret void }
+define void @B.cheap(i8* %this) {
+  %v = load i32, i32* @cnt
+  ret void
+}
+define void @A.slow(i8* %this) {
+entry:
+  br label %l
+l:
+  %i = phi i32 [0, %entry], [%i1, %l]
+  %v = load volatile i32, i32* @cnt
+  %i1 = add i32 %i, 1
+  %e = icmp eq i32 %i1, 100
+  br i1 %e, label %d, label %l
+d:
+  ret void
+}
+define void @B.slow(i8* %this) {
+  %d = sdiv i32 7, 3
+  ret void
+}
+
+define void @vcall(i8* %obj) {
+  %vtp = bitcast i8* %obj to i8***
+  %vt = load i8**, i8*** %vtp
+  %vt8 = bitcast i8** %vt to i8*
+  %t = call i1 @llvm.type.test(i8* %vt8, metadata !"_ZTS4Base")
+  call void @llvm.assume(i1 %t)
+  %slot = getelementptr i8*, i8** %vt, i64 1
+  %fp = load i8*, i8** %slot
+  %f = bitcast i8* %fp to void (i8*)*
+  call void %f(i8* %obj)
+  ret void
+}
+
+define void @h1(i32 %x) { ret void }
+define void @h2(i32 %x) {
+  %d = udiv i32 %x, 3
+  %e = udiv i32 %d, 3
+  ret void
+}
+define void @setcb() {
+  store void (i32)* @h2, void (i32)** @cb
+  store void (i32)* @h1, void (i32)** @cb
+  ret void
+}
+
+define void @tx_virtual(i8* %obj) {
+  call i32 @pthread_mutex_lock(%struct.m* @mtx)
+  call void @vcall(i8* %obj)
+  call i32 @pthread_mutex_unlock(%struct.m* @mtx)
+  ret void
+}
+define void @tx_select(i1 %c) {
+  %f = select i1 %c, void (i8*)* @A.cheap, void (i8*)* @B.slow
+  call i32 @pthread_mutex_lock(%struct.m* @mtx)
+  call void %f(i8* null)
+  call i32 @pthread_mutex_unlock(%struct.m* @mtx)
+  ret void
+}
+define void @tx_sig() {
+  %f = load void (i32)*, void (i32)** @cb
+  call i32 @pthread_mutex_lock(%struct.m* @mtx)
+  call void %f(i32 5)
+  call i32 @pthread_mutex_unlock(%struct.m* @mtx)
+  ret void
+}
+
+; lock taken through a function pointer
+define void @tx_fp() {
+  %l = select i1 true, i32 (%struct.m*)* @pthread_mutex_lock, i32 (%struct.m*)* @pthread_mutex_lock
+  call i32 %l(%struct.m* @mtx)
+  store i32 1, i32* @cnt
+  call i32 @pthread_mutex_unlock(%struct.m* @mtx)
+  ret void
+}
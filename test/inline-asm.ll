@@ -0,0 +1,60 @@
+; REQUIRES: x86-registered-target
+; Inline asm is costed by its instructions, operands substituted; what the assembler
+; can't parse, such as hand-encoded bytes, costs -primebort-asm-unknown-lat.
+; RUN: %opt -primebort -primebort-serialize=%t.json -disable-output %s
+; RUN: FileCheck %s < %t.json
+; RUN: %opt -primebort -primebort-asm-unknown-lat=500 -primebort-serialize=%t.500.json \
+; RUN:   -disable-output %s
+; RUN: FileCheck %s --check-prefix=UNKNOWN < %t.500.json
+
+; CHECK: "ancestor": "empty"
+; CHECK: "flags": 16,
+; CHECK: "txLat": 6,
+; CHECK: "ancestor": "fence"
+; CHECK: "txLat": 9,
+; CHECK: "ancestor": "bytes"
+; CHECK: "txLat": 56,
+; CHECK: "ancestor": "operands"
+; CHECK: "txLat": 10,
+
+; UNKNOWN: "ancestor": "fence"
+; UNKNOWN: "txLat": 9,
+; UNKNOWN: "ancestor": "bytes"
+; UNKNOWN: "txLat": 506,
+
+target triple = "x86_64-pc-linux-gnu"
+%struct.m = type { [40 x i8] }
+@a = global %struct.m zeroinitializer
+@b = global %struct.m zeroinitializer
+@c = global %struct.m zeroinitializer
+@d = global %struct.m zeroinitializer
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+define void @empty() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @a)
+  call void asm sideeffect "", "~{memory}"()
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @a)
+  ret void
+}
+
+define void @fence() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @b)
+  call void asm sideeffect "mfence", "~{memory}"()
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @b)
+  ret void
+}
+
+define void @bytes() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @c)
+  call void asm sideeffect ".byte 0x0f,0x01,0xd5", ""()
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @c)
+  ret void
+}
+
+define void @operands(i64 %x) {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @d)
+  %y = call i64 asm sideeffect "addq $$3, $0; imulq $0, $0", "=r,0"(i64 %x)
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @d)
+  ret void
+}
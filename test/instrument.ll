@@ -0,0 +1,55 @@
+; Timing probes: inside a lock's section, right after the lock and right before the
+; unlock; outside an RTM tx, before XBEGIN, after XEND and on the abort path, since the
+; runtime can't run inside one. Each tx gets a descriptor, registered at startup.
+; RUN: %opt -primebort -primebort-instrument -S %s | FileCheck %s
+
+; CHECK: @primebort.txdesc = internal global [2 x %primebort.txdesc]
+; CHECK: @llvm.global_ctors = {{.*}} @primebort.register
+
+; CHECK-LABEL: define void @locked(
+; CHECK-NEXT: call i32 @pthread_mutex_lock(
+; CHECK-NEXT: call void @__primebort_tx_enter({{.*}}, i32 0, i32 0))
+; CHECK-NEXT: store i64 1
+; CHECK-NEXT: call void @__primebort_tx_exit({{.*}}, i32 0, i32 0))
+; CHECK-NEXT: call i32 @pthread_mutex_unlock(
+
+; CHECK-LABEL: define i32 @rtm(
+; CHECK-NEXT: call void @__primebort_tx_enter({{.*}}, i32 0, i32 1))
+; CHECK-NEXT: %s = call i32 @llvm.x86.xbegin()
+; CHECK-LABEL: body:
+; CHECK-NEXT: store i64 2
+; CHECK-NEXT: call void @llvm.x86.xend()
+; CHECK-NEXT: call void @__primebort_tx_exit({{.*}}, i32 0, i32 1))
+; CHECK-LABEL: fail:
+; CHECK-NEXT: call void @__primebort_tx_abort({{.*}}, i32 0, i32 1))
+; CHECK-NEXT: ret i32 0
+
+; CHECK-LABEL: define internal void @primebort.register()
+; CHECK-NEXT: call void @__primebort_register({{.*}}, i32 2)
+
+%struct.m = type { [40 x i8] }
+@m = global %struct.m zeroinitializer
+@cnt = global i64 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+declare i32 @llvm.x86.xbegin()
+declare void @llvm.x86.xend()
+
+define void @locked() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @m)
+  store i64 1, i64* @cnt
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+
+define i32 @rtm() {
+  %s = call i32 @llvm.x86.xbegin()
+  %ok = icmp eq i32 %s, -1
+  br i1 %ok, label %body, label %fail
+body:
+  store i64 2, i64* @cnt
+  call void @llvm.x86.xend()
+  ret i32 1
+fail:
+  ret i32 0
+}
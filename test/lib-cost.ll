@@ -0,0 +1,93 @@
+; Library calls are charged their model's base cost plus a per-byte cost on the size
+; argument: a constant, the upper bound of its range, or count times size for calloc.
+; A blocking call is unbounded only on the longest path. Models from
+; -primebort-libcost-file add to the builtin ones; a bad line is reported.
+; RUN: %opt -primebort -primebort-serialize=%t.json -disable-output %s
+; RUN: FileCheck %s --check-prefixes=CHECK,BUILTIN < %t.json
+; RUN: %opt -primebort -primebort-libcost-file=%S/Inputs/libcost.txt \
+; RUN:   -primebort-serialize=%t.file.json -disable-output %s 2>&1 | FileCheck %s --check-prefix=ERR
+; RUN: FileCheck %s --check-prefixes=CHECK,FILE < %t.file.json
+
+; ERR: libcost.txt:4: bad library cost model: bogus line
+
+; memcpy: 20 + 4096/16
+; CHECK: "ancestor": "page"
+; CHECK: "flags": 0,
+; CHECK: "txLat": 285,
+; memcpy: 20 + 1023/16
+; CHECK: "ancestor": "masked"
+; CHECK: "flags": 0,
+; CHECK: "txLat": 93,
+; calloc: 70 + 16*64/32, an allocation
+; CHECK: "ancestor": "zeroed"
+; CHECK: "flags": 4,
+; CHECK: "txLat": 111,
+; my_hash: an extern call without a model, then 30 + 512/2
+; CHECK: "ancestor": "hashed"
+; BUILTIN: "flags": 64,
+; BUILTIN: "txLat": 9,
+; FILE: "flags": 0,
+; FILE: "txLat": 295,
+; usleep on the way back to the lock: it may return at once
+; CHECK: "ancestor": "poll_loop"
+; CHECK: "txLat": 8,
+; CHECK-NEXT: "rtLat": 7
+
+%struct.m = type { [40 x i8] }
+@a = global %struct.m zeroinitializer
+@b = global %struct.m zeroinitializer
+@c = global %struct.m zeroinitializer
+@d = global %struct.m zeroinitializer
+@src = global [4096 x i8] zeroinitializer
+@dst = global [4096 x i8] zeroinitializer
+@ready = global i64 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i1)
+declare i8* @calloc(i64, i64)
+declare i64 @my_hash(i8*, i64)
+declare i32 @usleep(i32)
+
+define void @page() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @a)
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* getelementptr ([4096 x i8], [4096 x i8]* @dst, i32 0, i32 0), i8* getelementptr ([4096 x i8], [4096 x i8]* @src, i32 0, i32 0), i64 4096, i1 false)
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @a)
+  ret void
+}
+
+; at most 1023 bytes
+define void @masked(i64 %n) {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @b)
+  %m = and i64 %n, 1023
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* getelementptr ([4096 x i8], [4096 x i8]* @dst, i32 0, i32 0), i8* getelementptr ([4096 x i8], [4096 x i8]* @src, i32 0, i32 0), i64 %m, i1 false)
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @b)
+  ret void
+}
+
+; count times size
+define void @zeroed() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @c)
+  %p = call i8* @calloc(i64 16, i64 64)
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @c)
+  ret void
+}
+
+; only known from the cost file
+define void @hashed() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @d)
+  %h = call i64 @my_hash(i8* getelementptr ([4096 x i8], [4096 x i8]* @src, i32 0, i32 0), i64 512)
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @d)
+  ret void
+}
+
+; waits between sections, never inside one
+define void @poll_loop() {
+entry:
+  br label %loop
+loop:
+  %r = call i32 @pthread_mutex_lock(%struct.m* @a)
+  store i64 1, i64* @ready
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @a)
+  %s = call i32 @usleep(i32 10)
+  br label %loop
+}
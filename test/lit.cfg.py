@@ -0,0 +1,56 @@
+# -*- Python -*-
+#
+# Regression tests for the pass and its tools. From an LLVM build with the pass built in:
+#   llvm-lit -sv --param tools_dir=<build>/bin test
+# or with the pass loaded as a plugin, and tools from anywhere on PATH:
+#   llvm-lit -sv --param plugin=<path>/PrimeBortDetector.so test
+# The benchmarks next to the tests (*.c) aren't run.
+
+import os
+import subprocess
+import sys
+
+import lit.formats
+import lit.util
+
+config.name = 'PrimeBort'
+config.test_format = lit.formats.ShTest(True)
+config.suffixes = ['.ll', '.test']
+config.excludes = ['Inputs']
+config.test_source_root = os.path.dirname(__file__)
+config.test_exec_root = lit_config.params.get('exec_root',
+        os.path.join(config.test_source_root, 'Output'))
+
+tools_dir = lit_config.params.get('tools_dir')
+path = os.environ.get('PATH', '')
+if tools_dir:
+    path = os.path.pathsep.join([tools_dir, path])
+config.environment['PATH'] = path
+
+# the legacy pass manager, where -primebort and its options are registered
+opt = 'opt -enable-new-pm=0'
+llc = 'llc'
+plugin = lit_config.params.get('plugin')
+if plugin:
+    opt += ' -load ' + os.path.abspath(plugin)
+    llc += ' -load ' + os.path.abspath(plugin)
+config.substitutions.append(('%opt', opt))
+# llc with primebort-machine, for running it on MIR
+config.substitutions.append(('%llc', llc))
+# the server is talked to by a script
+config.substitutions.append(('%python', sys.executable))
+
+for tool in ['opt', 'FileCheck', 'not', 'llvm-as']:
+    if not lit.util.which(tool, path):
+        lit_config.fatal('%s not found; pass --param tools_dir=<dir>' % tool)
+# tests of the tools are skipped where they weren't built
+for tool in ['primebort-diff', 'primebort-query', 'primebort-server']:
+    if lit.util.which(tool, path):
+        config.available_features.add(tool)
+
+# inline asm is costed through the X86 MC layer, and the machine pass is run on x86
+# MIR; both need the target registered, which llc lists
+llc_path = lit.util.which('llc', path)
+if llc_path and 'x86-64' in subprocess.run([llc_path, '--version'], stdout=subprocess.PIPE,
+        universal_newlines=True).stdout:
+    config.available_features.add('x86-registered-target')
@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <cpuid.h>
+#include <immintrin.h>
+#include <x86intrin.h>
+
+/*
+ * Multithreaded producer/consumer benchmark over the llfifo from test/llfifo_tx.c.
+ * Each thread enqueues a token and dequeues one, over and over, with the queue's
+ * critical sections synchronized by one of:
+ *   mutex  a pthread mutex
+ *   rtm    an RTM transaction, retried a few times before falling back to a spinlock
+ *          (straight to the spinlock without TSX)
+ *   ring   no critical section: a lock-free bounded MPMC ring (Vyukov's) instead
+ * For each mode and thread count it prints throughput and the p50/p99/p99.9/max
+ * latency of single enqueues and dequeues in TSC cycles, the unit of the pass's
+ * estimates. Tokens are checksummed, so lost or duplicated elements fail the run.
+ *
+ * Build: cc -O2 -mrtm -pthread test/llfifo_bench.c
+ * To compare the measured critical sections with the detector's estimates, run
+ * the pass on it with -primebort-instrument and link the runtime:
+ *   clang -O2 -mrtm -emit-llvm -c test/llfifo_bench.c -o bench.bc
+ *   opt -primebort -primebort-instrument bench.bc -o bench.inst.bc
+ *   clang -O2 -pthread bench.inst.bc PrimeBortRuntime/primebort_rt.c
+ *   PRIMEBORT_PROFILE=llfifo.prof ./a.out
+ * The profile lists each tx the pass found in llfifo_enqueue/llfifo_dequeue with
+ * its static txLat/rtLat next to the measured histogram.
+ * Usage: ./a.out [threads,...] [iterations per thread] [mode,...]
+ */
+
+#define MAX_THREADS 256
+#define RTM_RETRIES 8
+#define RING_SIZE 1024 // must be a power of 2
+
+enum sync_mode {SYNC_MUTEX, SYNC_RTM, SYNC_RING, NUM_MODES};
+static const char* const mode_names[NUM_MODES] = {"mutex", "rtm", "ring"};
+
+static enum sync_mode mode;
+static int use_rtm;
+static unsigned long iters = 200000;
+
+// the llfifo, as in llfifo_tx.c but without asserts inside its critical sections
+
+struct ll_node_s {
+	void* pt; // pointer to stored element
+	struct ll_node_s *next; // pointer to next element in chain
+};
+typedef struct ll_node_s ll_node_t;
+
+struct llfifo_s {
+	ll_node_t *head; // points to next element to dequeue
+	ll_node_t *tail; // points to last element enqueued (NULL if queue is empty)
+	ll_node_t *free_tail; // points to end of free node chain (attached to main chain)
+	int32_t init_cap; // initial capacity, used for memory management
+	int32_t length; // current length of fifo
+};
+typedef struct llfifo_s llfifo_t;
+
+static pthread_mutex_t fifo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int fallback_lock;
+static __thread int in_rtm; // XTEST faults without TSX
+static __thread unsigned long rtm_commits, rtm_fallbacks;
+
+static void spin_lock () {
+	while (__atomic_exchange_n(&fallback_lock, 1, __ATOMIC_ACQUIRE)) {
+		while (fallback_lock) _mm_pause();
+	}
+}
+
+static void spin_unlock () {
+	__atomic_store_n(&fallback_lock, 0, __ATOMIC_RELEASE);
+}
+
+static void fifo_lock () {
+	if (mode == SYNC_MUTEX) {
+		pthread_mutex_lock(&fifo_mutex);
+		return;
+	}
+	for (unsigned r = 0; use_rtm && r < RTM_RETRIES; ++r) {
+		const unsigned s = _xbegin();
+		if (s == _XBEGIN_STARTED) {
+			// reading the lock puts it in the read set, so a fallback aborts us
+			if (fallback_lock) _xabort(0xff);
+			in_rtm = 1;
+			return;
+		}
+		if (!(s & (_XABORT_RETRY | _XABORT_EXPLICIT))) break; // capacity, calloc, ...
+		while (fallback_lock) _mm_pause();
+	}
+	spin_lock();
+}
+
+static void fifo_unlock () {
+	if (mode == SYNC_MUTEX) {
+		pthread_mutex_unlock(&fifo_mutex);
+	} else if (in_rtm) {
+		_xend();
+		in_rtm = 0;
+		++rtm_commits;
+	} else {
+		spin_unlock();
+		++rtm_fallbacks;
+	}
+}
+
+static llfifo_t* llfifo_create (int capacity) {
+	if (capacity <= 0) return NULL;
+	// allocate everything we need (fifo struct + reqd node count) in one chunk
+	uint64_t* inalloc = calloc(capacity + 2, sizeof(ll_node_t));
+	if (inalloc == NULL) return NULL;
+	// first 32 bytes are fifo struct
+	llfifo_t* this = (llfifo_t*) inalloc;
+	ll_node_t* nodes = (ll_node_t*) &inalloc[4];
+	this->head = nodes;
+	this->tail = NULL;
+	for (int i = 0; i < capacity-1; ++i) nodes[i].next = &nodes[i+1];
+	this->init_cap = capacity;
+	this->free_tail = &nodes[capacity-1];
+	return this;
+}
+
+static int llfifo_enqueue (llfifo_t* fifo, void* element) {
+	if (!element) return -1;
+	fifo_lock();
+
+	if (fifo->tail == NULL) { // queue is empty
+		fifo->head->pt = element;
+		fifo->tail = fifo->head;
+	} else {
+		if (fifo->tail->next == NULL) { // need new node
+			fifo->tail->next = calloc(sizeof(ll_node_t), 1);
+			if (fifo->tail->next == NULL) {
+				fifo_unlock();
+				return -1;
+			}
+			fifo->free_tail = fifo->tail->next;
+		}
+		fifo->tail = fifo->tail->next;
+		fifo->tail->pt = element;
+	}
+
+	const int len = ++fifo->length;
+	fifo_unlock();
+	return len;
+}
+
+static void* llfifo_dequeue (llfifo_t* fifo) {
+	fifo_lock();
+
+	if (fifo->head->pt == NULL) {
+		fifo_unlock();
+		return NULL;
+	}
+
+	ll_node_t* node = fifo->head;
+	if (node == fifo->tail) { // last element being removed, leave head where it is
+		fifo->tail = NULL; // indicates queue is empty
+	} else { // pop head off and recycle its node
+		fifo->head = node->next;
+		node->next = NULL;
+		// put the disused node at the end of the free chain
+		fifo->free_tail->next = node;
+		fifo->free_tail = node;
+	}
+
+	void* element = node->pt;
+	node->pt = NULL;
+	--fifo->length;
+
+	fifo_unlock();
+	return element;
+}
+
+static void llfifo_destroy (llfifo_t *fifo) {
+	// find bounds of original block allocation
+	ll_node_t* block_front = (ll_node_t*) fifo;
+	ll_node_t* block_back = block_front + fifo->init_cap + 2;
+	ll_node_t* seek = fifo->head;
+	while (seek) {
+		ll_node_t* next = seek->next;
+		// free singly allocd nodes
+		if (seek >= block_back || seek < block_front) free (seek);
+		seek = next;
+	}
+	free(fifo);
+}
+
+// the lock-free alternative: a bounded MPMC ring, each cell tagged with the
+// position it can next be written (seq == pos) or read (seq == pos+1) at
+
+struct ring_cell {
+	_Alignas(64) unsigned long seq;
+	void* pt;
+};
+
+static struct ring_cell ring[RING_SIZE];
+static _Alignas(64) unsigned long ring_head; // next position to dequeue
+static _Alignas(64) unsigned long ring_tail; // next position to enqueue
+
+static void ring_init () {
+	for (unsigned long i = 0; i < RING_SIZE; ++i) ring[i].seq = i;
+	ring_head = ring_tail = 0;
+}
+
+static int ring_enqueue (void* element) {
+	unsigned long pos = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+	for (;;) {
+		struct ring_cell* c = &ring[pos & (RING_SIZE-1)];
+		const long dif = (long) (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - pos);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&ring_tail, &pos, pos+1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				c->pt = element;
+				__atomic_store_n(&c->seq, pos+1, __ATOMIC_RELEASE);
+				return 0;
+			}
+		} else if (dif < 0) {
+			return -1; // full, or the dequeue a lap back at pos hasn't freed the cell yet
+		} else {
+			pos = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void* ring_dequeue () {
+	unsigned long pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+	for (;;) {
+		struct ring_cell* c = &ring[pos & (RING_SIZE-1)];
+		const long dif = (long) (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (pos+1));
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&ring_head, &pos, pos+1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				void* element = c->pt;
+				__atomic_store_n(&c->seq, pos + RING_SIZE, __ATOMIC_RELEASE);
+				return element;
+			}
+		} else if (dif < 0) {
+			return NULL; // empty, or the enqueue at pos isn't published yet
+		} else {
+			pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+// the benchmark
+
+struct worker {
+	pthread_t th;
+	uintptr_t id;
+	uint32_t* lat; // cycles of each enqueue, then each dequeue
+	uint64_t sum_in, sum_out; // token checksums
+	unsigned long empty; // dequeues that found the queue empty
+	unsigned long full; // ring enqueues that found the ring full
+	unsigned long commits, fallbacks;
+};
+
+static llfifo_t* fifo;
+static pthread_barrier_t start_barrier;
+
+static void* run_worker (void* p) {
+	struct worker* w = (struct worker*) p;
+	unsigned aux;
+	pthread_barrier_wait(&start_barrier);
+	for (unsigned long i = 0; i < iters; ++i) {
+		void* token = (void*) ((w->id << 32) | (i+1)); // never NULL
+		// a ring cell stays full until the dequeue that claimed it a lap earlier
+		// releases it, which a preempted consumer holds up: retry, as dequeues do
+		uint64_t t, e;
+		for (;;) {
+			t = __rdtsc();
+			int ok = (mode == SYNC_RING) ? ring_enqueue(token) : llfifo_enqueue(fifo, token);
+			e = __rdtscp(&aux);
+			if (ok >= 0) break;
+			if (mode != SYNC_RING) {
+				fprintf(stderr, "enqueue failed\n");
+				exit(1);
+			}
+			++w->full;
+		}
+		w->lat[i] = (uint32_t) ((e - t > UINT32_MAX) ? UINT32_MAX : e - t);
+		w->sum_in += (uintptr_t) token;
+
+		// every thread has at least its own token in the queue, but a ring slot
+		// can still be claimed and not yet published
+		void* got;
+		for (;;) {
+			t = __rdtsc();
+			got = (mode == SYNC_RING) ? ring_dequeue() : llfifo_dequeue(fifo);
+			e = __rdtscp(&aux);
+			if (got) break;
+			++w->empty;
+		}
+		w->lat[iters + i] = (uint32_t) ((e - t > UINT32_MAX) ? UINT32_MAX : e - t);
+		w->sum_out += (uintptr_t) got;
+	}
+	w->commits = rtm_commits;
+	w->fallbacks = rtm_fallbacks;
+	return NULL;
+}
+
+static int cmp_u32 (const void* a, const void* b) {
+	const uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+	return (x > y) - (x < y);
+}
+
+// sorts v in place
+static void print_quantiles (const char* op, uint32_t* v, const size_t n) {
+	qsort(v, n, sizeof(uint32_t), cmp_u32);
+	printf("  %s\tp50 %u\tp99 %u\tp99.9 %u\tmax %u\n", op, v[n/2], v[(size_t) (n * 0.99)],
+			v[(size_t) (n * 0.999)], v[n-1]);
+}
+
+static void run (const unsigned nthreads) {
+	struct worker* ws = calloc(nthreads, sizeof(struct worker));
+	if (mode == SYNC_RING) ring_init();
+	else fifo = llfifo_create(2 * nthreads);
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	for (unsigned i = 0; i < nthreads; ++i) {
+		ws[i].id = i;
+		ws[i].lat = malloc(2 * iters * sizeof(uint32_t));
+		pthread_create(&ws[i].th, NULL, run_worker, &ws[i]);
+	}
+
+	struct timespec a, b;
+	pthread_barrier_wait(&start_barrier);
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	for (unsigned i = 0; i < nthreads; ++i) pthread_join(ws[i].th, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	const double ns = (b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec);
+
+	// gather the latencies by operation
+	const size_t n = (size_t) nthreads * iters;
+	uint32_t* enq = malloc(n * sizeof(uint32_t));
+	uint32_t* deq = malloc(n * sizeof(uint32_t));
+	uint64_t sum_in = 0, sum_out = 0;
+	unsigned long empty = 0, full = 0, commits = 0, fallbacks = 0;
+	for (unsigned i = 0; i < nthreads; ++i) {
+		memcpy(&enq[i * iters], ws[i].lat, iters * sizeof(uint32_t));
+		memcpy(&deq[i * iters], &ws[i].lat[iters], iters * sizeof(uint32_t));
+		sum_in += ws[i].sum_in;
+		sum_out += ws[i].sum_out;
+		empty += ws[i].empty;
+		full += ws[i].full;
+		commits += ws[i].commits;
+		fallbacks += ws[i].fallbacks;
+		free(ws[i].lat);
+	}
+	if (sum_in != sum_out) {
+		fprintf(stderr, "%s: lost or duplicated tokens\n", mode_names[mode]);
+		exit(1);
+	}
+
+	printf("%s, %u threads: %.2f Mops/s, %lu empty dequeues", mode_names[mode], nthreads,
+			2.0 * n / ns * 1e3, empty);
+	if (mode == SYNC_RING) printf(", %lu full enqueues", full);
+	if (mode == SYNC_RTM) {
+		printf(", %.1f%% of critical sections on the fallback lock",
+				100.0 * fallbacks / (commits + fallbacks));
+	}
+	printf("\n");
+	print_quantiles("enqueue", enq, n);
+	print_quantiles("dequeue", deq, n);
+
+	free(enq);
+	free(deq);
+	free(ws);
+	pthread_barrier_destroy(&start_barrier);
+	if (mode != SYNC_RING) llfifo_destroy(fifo);
+}
+
+int main (int argc, char** argv) {
+	unsigned threads[MAX_THREADS];
+	unsigned nthreads = 0;
+	if (argc > 1) {
+		for (char* s = strtok(argv[1], ","); s && nthreads < MAX_THREADS; s = strtok(NULL, ",")) {
+			const unsigned t = atoi(s);
+			if (t > 0 && t <= RING_SIZE) threads[nthreads++] = t;
+		}
+	} else {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		for (unsigned t = 1; t <= cpus && nthreads < MAX_THREADS; t *= 2) threads[nthreads++] = t;
+	}
+	if (argc > 2) iters = strtoul(argv[2], NULL, 10);
+	unsigned modes = (1u << NUM_MODES) - 1;
+	if (argc > 3) {
+		modes = 0;
+		for (char* s = strtok(argv[3], ","); s; s = strtok(NULL, ",")) {
+			for (unsigned m = 0; m < NUM_MODES; ++m) {
+				if (!strcmp(s, mode_names[m])) modes |= 1u << m;
+			}
+		}
+	}
+	if (nthreads == 0 || iters == 0 || modes == 0) {
+		fprintf(stderr, "usage: %s [threads,...] [iterations per thread] [mutex,rtm,ring]\n",
+				argv[0]);
+		return 1;
+	}
+
+	unsigned a, b, c, d;
+	use_rtm = __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 11));
+	printf("llfifo benchmark, %lu enqueue/dequeue pairs per thread, %s; latencies in TSC cycles\n",
+			iters, use_rtm ? "RTM" : "no RTM, rtm mode takes the fallback lock");
+
+	for (unsigned m = 0; m < NUM_MODES; ++m) {
+		if (!(modes & (1u << m))) continue;
+		mode = (enum sync_mode) m;
+		for (unsigned i = 0; i < nthreads; ++i) run(threads[i]);
+	}
+	return 0;
+}
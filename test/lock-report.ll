@@ -0,0 +1,44 @@
+; Locks by worst-case hold time, and the locks taken while another is held. A section
+; runs the sections nested in it, but may wait for another thread's section on the inner
+; lock first: the inner hold time adds to the outer one's.
+; RUN: %opt -primebort -primebort-lock-report -disable-output %s 2>&1 | FileCheck %s
+
+; CHECK-LABEL: Locks by worst-case hold time including nested locks:
+; CHECK-NEXT: @a sections 1 hold 52 nested 93
+; CHECK-NEXT: @b sections 1 hold 41 nested 41
+; CHECK-NEXT: @c sections 1 hold 8 nested 8
+; CHECK-NEXT: Nesting (outer -> inner, inner hold, taken at):
+; CHECK-NEXT: @a -> @b 41 inner
+; CHECK-NEXT: =====
+
+%struct.m = type { [40 x i8] }
+@a = global %struct.m zeroinitializer
+@b = global %struct.m zeroinitializer
+@c = global %struct.m zeroinitializer
+@cnt = global i64 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+define void @inner() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @b)
+  %v = load i64, i64* @cnt
+  %d = udiv i64 %v, 7
+  %e = udiv i64 %d, 9
+  store i64 %e, i64* @cnt
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @b)
+  ret void
+}
+
+define void @outer() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @a)
+  call void @inner()
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @a)
+  ret void
+}
+
+define void @alone() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @c)
+  store i64 0, i64* @cnt
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @c)
+  ret void
+}
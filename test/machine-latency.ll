@@ -0,0 +1,53 @@
+; primebort-machine re-costs the txs on the MachineInstrs of the MIR, under the ids
+; -primebort-annotate gave them, next to the IR estimates.
+; REQUIRES: x86-registered-target
+; RUN: %opt -primebort -primebort-annotate %s | llc -mtriple=x86_64-unknown-linux-gnu \
+; RUN:   -mcpu=skylake -stop-after=pseudo-probe-inserter -o %t.mir
+; RUN: %llc -mtriple=x86_64-unknown-linux-gnu -mcpu=skylake -run-pass=primebort-machine \
+; RUN:   %t.mir -o /dev/null 2>&1 | FileCheck %s
+
+; CHECK-LABEL: PrimeBort post-ISel latencies (IR estimate -> machine)
+; CHECK-NEXT: =====
+; CHECK-NEXT: tx txLat rtLat entry
+; CHECK-NEXT: 0 8 -> 21 5 -> 19 direct
+; CHECK-NEXT: 1 82 -> 122 30 -> 62 op
+; CHECK-NEXT: =====
+
+%struct.m = type { [40 x i8] }
+@m = global %struct.m zeroinitializer
+@x = global i64 0
+@y = global i64 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+; wrappers that keep working with the lock held
+define void @take() {
+  call i32 @pthread_mutex_lock(%struct.m* @m)
+  %v = load i64, i64* @y
+  %d = udiv i64 %v, 7
+  store i64 %d, i64* @y
+  ret void
+}
+define void @drop() {
+  %v = load i64, i64* @y
+  %d = udiv i64 %v, 3
+  store i64 %d, i64* @y
+  call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+
+define void @op() {
+  call void @take()
+  %v = load i64, i64* @x
+  %w = add i64 %v, 1
+  store i64 %w, i64* @x
+  call void @drop()
+  ret void
+}
+
+define void @direct() {
+  call i32 @pthread_mutex_lock(%struct.m* @m)
+  store i64 0, i64* @x
+  call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include "../PrimeBortRuntime/primebort_rt.h"
+
+/*
+ * Overhead of the -primebort-instrument probes on a short critical section.
+ * Each thread bumps a counter of its own under a mutex of its own, once as
+ * written and once with the enter and exit probes the pass puts after the lock
+ * and before the unlock, so the difference is the probes and the samples they
+ * record, not contention. As in guard_bench.c the two are run in alternating
+ * rounds after a warm-up, and the medians are compared. PRIMEBORT_PERF=1 times
+ * the perf_event mode instead. The profile goes to stderr at exit, or to
+ * PRIMEBORT_PROFILE.
+ * Build: cc -O2 -pthread test/probe_bench.c PrimeBortRuntime/primebort_rt.c
+ * Usage: ./a.out [threads] [iterations per thread] [work per section]
+ */
+
+static struct primebort_txdesc desc = {0, 0, "probe_bench", 0, 0};
+static unsigned long iters = 1000000;
+static unsigned work = 16;
+#define ROUNDS 7
+
+struct worker {
+	pthread_mutex_t m;
+	volatile uint64_t counter;
+	char pad[64];
+};
+
+static void section (struct worker* w) {
+	for (unsigned j = 0; j < work; ++j) ++w->counter;
+}
+
+static void* run_plain (void* p) {
+	struct worker* w = p;
+	for (unsigned long i = 0; i < iters; ++i) {
+		pthread_mutex_lock(&w->m);
+		section(w);
+		pthread_mutex_unlock(&w->m);
+	}
+	return NULL;
+}
+
+static void* run_probed (void* p) {
+	struct worker* w = p;
+	for (unsigned long i = 0; i < iters; ++i) {
+		pthread_mutex_lock(&w->m);
+		__primebort_tx_enter(&desc);
+		section(w);
+		__primebort_tx_exit(&desc);
+		pthread_mutex_unlock(&w->m);
+	}
+	return NULL;
+}
+
+static double run (void* (*fn) (void*), struct worker* w, const unsigned nthreads) {
+	pthread_t th[nthreads];
+	struct timespec a, b;
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	for (unsigned i = 0; i < nthreads; ++i) pthread_create(&th[i], NULL, fn, &w[i]);
+	for (unsigned i = 0; i < nthreads; ++i) pthread_join(th[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	return (b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec);
+}
+
+static int cmp_double (const void* a, const void* b) {
+	const double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+int main (int argc, char** argv) {
+	const unsigned nthreads = (argc > 1) ? atoi(argv[1]) : 1;
+	if (argc > 2) iters = strtoul(argv[2], NULL, 10);
+	if (argc > 3) work = atoi(argv[3]);
+
+	struct worker w[nthreads];
+	for (unsigned i = 0; i < nthreads; ++i) pthread_mutex_init(&w[i].m, NULL);
+
+	__primebort_register(&desc, 1);
+	double plain_t[ROUNDS], probed_t[ROUNDS];
+	run(run_plain, w, nthreads);
+	run(run_probed, w, nthreads);
+	for (unsigned r = 0; r < ROUNDS; ++r) {
+		plain_t[r] = run(run_plain, w, nthreads);
+		probed_t[r] = run(run_probed, w, nthreads);
+	}
+	qsort(plain_t, ROUNDS, sizeof(double), cmp_double);
+	qsort(probed_t, ROUNDS, sizeof(double), cmp_double);
+	const double plain = plain_t[ROUNDS/2], probed = probed_t[ROUNDS/2];
+	// per thread: each has a section of its own
+	const double ops = iters;
+	printf("%u threads, %u increments per section, median of %u rounds\n"
+			"plain  %.2f ns/section (%.2f-%.2f)\nprobed %.2f ns/section (%.2f-%.2f, %+.1f%%)\n",
+			nthreads, work, ROUNDS,
+			plain / ops, plain_t[0] / ops, plain_t[ROUNDS-1] / ops,
+			probed / ops, probed_t[0] / ops, probed_t[ROUNDS-1] / ops,
+			100.0 * (probed - plain) / plain);
+	return 0;
+}
@@ -0,0 +1,62 @@
+; Each entry is matched to the exits its block reaches. The second entry's paths run
+; through blocks the first entry's already reached, and it still finds its exit; a block
+; with two exits ends the tx at the first.
+; RUN: %opt -primebort -primebort-serialize=%t.json -disable-output %s
+; RUN: FileCheck %s < %t.json
+
+; through the loop, holding @m1 only
+; CHECK: "ancestor": "f"
+; CHECK: "readBytes": 4,
+; CHECK: "writeBytes": 4,
+; CHECK: "flags": 32,
+; CHECK: "exits": [
+; CHECK-NEXT: {
+; CHECK-NEXT: "loc": "",
+; CHECK-NEXT: "chain": [
+; CHECK-NEXT: "pthread_mutex_unlock"
+; CHECK-NEXT: ],
+; CHECK-NEXT: "txLat": 649,
+; CHECK-NEXT: "rtLat": 8
+; CHECK-NEXT: }
+; CHECK-NEXT: ]
+; @m2's section, ended by the unlock of @m1
+; CHECK: "ancestor": "f"
+; CHECK: "readBytes": 0,
+; CHECK: "writeBytes": 4,
+; CHECK: "flags": 0,
+; CHECK: "exits": [
+; CHECK-NEXT: {
+; CHECK-NEXT: "loc": "",
+; CHECK-NEXT: "chain": [
+; CHECK-NEXT: "pthread_mutex_unlock"
+; CHECK-NEXT: ],
+; CHECK-NEXT: "txLat": 9,
+; CHECK-NEXT: "rtLat": 8
+; CHECK-NEXT: }
+; CHECK-NEXT: ]
+; CHECK-NOT: "ancestor"
+
+%struct.m = type { [40 x i8] }
+@m1 = global %struct.m zeroinitializer
+@m2 = global %struct.m zeroinitializer
+@cnt = global i32 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+define void @f(i1 %c, i1 %d) {
+e:
+  %a1 = call i32 @pthread_mutex_lock(%struct.m* @m1)
+  br i1 %c, label %a, label %b
+a:
+  %a2 = call i32 @pthread_mutex_lock(%struct.m* @m2)
+  store i32 1, i32* @cnt
+  br label %m
+b:
+  br label %loop
+loop:
+  %v = load i32, i32* @cnt
+  br i1 %d, label %loop, label %m
+m:
+  %u1 = call i32 @pthread_mutex_unlock(%struct.m* @m1)
+  %u2 = call i32 @pthread_mutex_unlock(%struct.m* @m2)
+  ret void
+}
@@ -0,0 +1,102 @@
+; -primebort-shrink moves private work out of critical sections: arithmetic on live-ins,
+; allocations and thread-local loads above the entry, and frees and work on values the
+; section computed below the exit. Shared memory accesses, a division that may trap and
+; loads of an escaped stack slot stay.
+; RUN: %opt -primebort -primebort-shrink -S %s 2>%t.err | FileCheck %s
+; RUN: FileCheck %s --check-prefix=REPORT < %t.err
+
+; REPORT-LABEL: PrimeBort critical section shrinking
+; REPORT-NEXT: =====
+; REPORT-NEXT: txLat before after hoisted sunk tx
+; REPORT-NEXT: 114 36 8 1 push
+; REPORT-NEXT: 73 22 1 4 pop
+; REPORT-NEXT: =====
+
+; CHECK-LABEL: define void @push(
+; CHECK: %h = mul
+; CHECK-NEXT: %h2 = lshr
+; CHECK-NEXT: %mem = call i8* @malloc
+; CHECK-NEXT: %n = bitcast
+; CHECK-NEXT: %t = load i64, i64* @tls
+; CHECK-NEXT: %v = add
+; CHECK-NEXT: %f0 = getelementptr
+; CHECK-NEXT: %f1 = getelementptr
+; CHECK-NEXT: %r = call i32 @pthread_mutex_lock
+; CHECK-NEXT: %q = udiv
+; CHECK: store i64 %tot2, i64* @total
+; CHECK-NEXT: %u = call i32 @pthread_mutex_unlock
+; CHECK-NEXT: %after = mul
+
+; CHECK-LABEL: define i64 @pop(
+; CHECK: %l = load i64, i64* %loc
+; CHECK-NEXT: %r = call i32 @pthread_mutex_lock
+; CHECK-NEXT: %e = load i64, i64* %esc
+; CHECK: %v = load
+; CHECK-NEXT: %u = call i32 @pthread_mutex_unlock
+; CHECK-NEXT: %m = bitcast
+; CHECK-NEXT: call void @free
+; CHECK-NEXT: %s = mul
+; CHECK-NEXT: %s2 = add
+
+%struct.m = type { [40 x i8] }
+%node = type { i64, %node* }
+@mtx = global %struct.m zeroinitializer
+@head = global %node* null
+@total = global i64 0
+@tls = thread_local global i64 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+declare i8* @malloc(i64)
+declare void @free(i8*)
+declare void @use(i64*)
+
+; push: key math, the allocation and a TLS read can leave; the list update stays
+define void @push(i64 %k, i64 %d) {
+entry:
+  %r = call i32 @pthread_mutex_lock(%struct.m* @mtx)
+  %h = mul i64 %k, 2654435761
+  %h2 = lshr i64 %h, 7
+  %q = udiv i64 %k, %d
+  %mem = call i8* @malloc(i64 16)
+  %n = bitcast i8* %mem to %node*
+  %t = load i64, i64* @tls
+  %v = add i64 %h2, %t
+  %f0 = getelementptr %node, %node* %n, i32 0, i32 0
+  store i64 %v, i64* %f0
+  %old = load %node*, %node** @head
+  %f1 = getelementptr %node, %node* %n, i32 0, i32 1
+  store %node* %old, %node** %f1
+  store %node* %n, %node** @head
+  %tot = load i64, i64* @total
+  %tot2 = add i64 %tot, %q
+  store i64 %tot2, i64* @total
+  %after = mul i64 %tot2, 3
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @mtx)
+  %z = add i64 %after, 1
+  store i64 %z, i64* @tls
+  ret void
+}
+
+; pop: the free and the stats computed from the popped node sink
+define i64 @pop() {
+entry:
+  %loc = alloca i64
+  %esc = alloca i64
+  call void @use(i64* %esc)
+  store i64 5, i64* %loc
+  %r = call i32 @pthread_mutex_lock(%struct.m* @mtx)
+  %l = load i64, i64* %loc
+  %e = load i64, i64* %esc
+  %n = load %node*, %node** @head
+  %f1 = getelementptr %node, %node* %n, i32 0, i32 1
+  %next = load %node*, %node** %f1
+  store %node* %next, %node** @head
+  %f0 = getelementptr %node, %node* %n, i32 0, i32 0
+  %v = load i64, i64* %f0
+  %m = bitcast %node* %n to i8*
+  call void @free(i8* %m)
+  %s = mul i64 %v, %l
+  %s2 = add i64 %s, %e
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @mtx)
+  ret i64 %s2
+}
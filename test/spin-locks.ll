@@ -0,0 +1,139 @@
+; Spin locks written out in IR are tx boundaries; trylocks, CAS loops updating a value
+; and release stores to anything but a lock are not.
+; RUN: %opt -primebort -primebort-lock-report -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --implicit-check-not=@counter --implicit-check-not=@outer
+; RUN: %opt -primebort -primebort-match-spinlocks=false -primebort-lock-report \
+; RUN:   -disable-output %s 2>&1 | FileCheck %s --check-prefix=OFF
+
+; CHECK-LABEL: PrimeBort lock report
+; CHECK-DAG: @gl sections 2
+; CHECK-DAG: %struct.obj+4 sections 1
+; CHECK-DAG: @m sections 1
+; CHECK-LABEL: Nesting
+
+; OFF-LABEL: Locks by worst-case hold time
+; OFF-NEXT: @m sections 1
+; OFF-NEXT: Nesting
+
+%struct.obj = type { i32, i32, [8 x i64] }
+%union.pthread_mutex_t = type { [40 x i8] }
+@gl = global i32 0
+@m = global %union.pthread_mutex_t zeroinitializer
+@cnt = global i64 0
+@counter = global i64 0
+@outer = global i64 0
+declare i32 @pthread_mutex_lock(%union.pthread_mutex_t*)
+declare i32 @pthread_mutex_unlock(%union.pthread_mutex_t*)
+
+; cmpxchg from unlocked to locked, spinning on a load until the lock looks free
+define void @inline_cx() {
+entry:
+  br label %acq
+acq:
+  %r = cmpxchg i32* @gl, i32 0, i32 1 acquire monotonic
+  %ok = extractvalue { i32, i1 } %r, 1
+  br i1 %ok, label %cs, label %spin
+spin:
+  %v = load atomic i32, i32* @gl monotonic, align 4
+  %free = icmp eq i32 %v, 0
+  br i1 %free, label %acq, label %spin
+cs:
+  %c = load i64, i64* @cnt
+  %c1 = add i64 %c, 1
+  store i64 %c1, i64* @cnt
+  store atomic i32 0, i32* @gl release, align 4
+  ret void
+}
+
+; the first instruction with the lock held is a call
+define void @work() {
+  %c = load i64, i64* @cnt
+  %c1 = mul i64 %c, 7
+  store i64 %c1, i64* @cnt
+  ret void
+}
+define void @spin_then_call() {
+entry:
+  br label %acq
+acq:
+  %r = cmpxchg i32* @gl, i32 0, i32 1 acquire monotonic
+  %ok = extractvalue { i32, i1 } %r, 1
+  br i1 %ok, label %cs, label %acq
+cs:
+  call void @work()
+  store atomic i32 0, i32* @gl release, align 4
+  ret void
+}
+
+; test-and-set in wrappers, on a struct field
+define void @spin_lock(%struct.obj* %p) {
+entry:
+  %l = getelementptr %struct.obj, %struct.obj* %p, i32 0, i32 1
+  br label %loop
+loop:
+  %old = atomicrmw xchg i32* %l, i32 1 acquire
+  %was = icmp eq i32 %old, 0
+  br i1 %was, label %done, label %loop
+done:
+  ret void
+}
+define void @spin_unlock(%struct.obj* %p) {
+  %l = getelementptr %struct.obj, %struct.obj* %p, i32 0, i32 1
+  store atomic i32 0, i32* %l release, align 4
+  ret void
+}
+define void @wrapped(%struct.obj* %p) {
+  call void @spin_lock(%struct.obj* %p)
+  %f = getelementptr %struct.obj, %struct.obj* %p, i32 0, i32 0
+  %x = load i32, i32* %f
+  %y = mul i32 %x, %x
+  store i32 %y, i32* %f
+  call void @spin_unlock(%struct.obj* %p)
+  ret void
+}
+
+; a mutex taken right where a spin lock is held: the lock call is the boundary
+define void @spin_then_lock() {
+entry:
+  br label %acq
+acq:
+  %r = cmpxchg i64* @outer, i64 0, i64 1 acquire monotonic
+  %ok = extractvalue { i64, i1 } %r, 1
+  br i1 %ok, label %cs, label %acq
+cs:
+  call i32 @pthread_mutex_lock(%union.pthread_mutex_t* @m)
+  %c = load i64, i64* @cnt
+  %c1 = add i64 %c, 1
+  store i64 %c1, i64* @cnt
+  call i32 @pthread_mutex_unlock(%union.pthread_mutex_t* @m)
+  store atomic i64 0, i64* @outer release, align 8
+  ret void
+}
+
+; a single trylock, no retry
+define i1 @try() {
+  %r = cmpxchg i32* @gl, i32 0, i32 1 acquire monotonic
+  %ok = extractvalue { i32, i1 } %r, 1
+  br i1 %ok, label %a, label %b
+a:
+  ret i1 true
+b:
+  ret i1 false
+}
+
+; a CAS loop incrementing a counter retries the same way
+define void @bump() {
+entry:
+  %init = load i64, i64* @counter
+  br label %loop
+loop:
+  %old = phi i64 [ %init, %entry ], [ %seen, %loop ]
+  %new = add i64 %old, 1
+  %r = cmpxchg i64* @counter, i64 %old, i64 %new acq_rel monotonic
+  %seen = extractvalue { i64, i1 } %r, 0
+  %ok = extractvalue { i64, i1 } %r, 1
+  br i1 %ok, label %done, label %loop
+done:
+  store atomic i64 0, i64* @counter release, align 8
+  ret void
+}
@@ -0,0 +1,62 @@
+; Tier 0 stops at counting the matched boundaries. Tier 1 costs only the path between the
+; two calls in the common ancestor, where the wrappers are calls like any other, while
+; tier 2 walks the wrappers from the lock to the unlock.
+; RUN: %opt -primebort -primebort-tier=0 -disable-output %s 2>&1 | FileCheck %s --check-prefix=TRIAGE
+; RUN: %opt -primebort -primebort-tier=1 -primebort-serialize=%t.1.json -disable-output %s
+; RUN: FileCheck %s --check-prefix=TIER1 < %t.1.json
+; RUN: %opt -primebort -primebort-serialize=%t.2.json -disable-output %s
+; RUN: FileCheck %s --check-prefix=TIER2 < %t.2.json
+
+; TRIAGE-LABEL: PrimeBort triage
+; TRIAGE-NEXT: =====
+; TRIAGE-NEXT: tx begin sites 2, tx commit sites 2
+; TRIAGE-NEXT: functions bounding txs 2: 2 entries, 2 exits
+; TRIAGE-NEXT: =====
+
+; TIER1: "ancestor": "direct"
+; TIER1: "txLat": 8,
+; TIER1: "ancestor": "op"
+; TIER1: "txLat": 62,
+; TIER2: "ancestor": "direct"
+; TIER2: "txLat": 8,
+; TIER2: "ancestor": "op"
+; TIER2: "txLat": 82,
+
+%struct.m = type { [40 x i8] }
+@m = global %struct.m zeroinitializer
+@x = global i64 0
+@y = global i64 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+; wrappers that keep working with the lock held
+define void @take() {
+  call i32 @pthread_mutex_lock(%struct.m* @m)
+  %v = load i64, i64* @y
+  %d = udiv i64 %v, 7
+  store i64 %d, i64* @y
+  ret void
+}
+define void @drop() {
+  %v = load i64, i64* @y
+  %d = udiv i64 %v, 3
+  store i64 %d, i64* @y
+  call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+
+define void @op() {
+  call void @take()
+  %v = load i64, i64* @x
+  %w = add i64 %v, 1
+  store i64 %w, i64* @x
+  call void @drop()
+  ret void
+}
+
+define void @direct() {
+  call i32 @pthread_mutex_lock(%struct.m* @m)
+  store i64 0, i64* @x
+  call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
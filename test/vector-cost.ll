@@ -0,0 +1,66 @@
+; Vector ops are costed by the registers they take: a vector wider than
+; -primebort-vector-width takes several, and a divide only costs its zmm latency if it
+; is a zmm op itself. Instructions without a model are summed up at the end.
+; RUN: %opt -primebort -primebort-vector-width=256 -primebort-serialize=%t.256.json \
+; RUN:   -disable-output %s 2>&1 | FileCheck %s --check-prefix=UNKNOWN
+; RUN: FileCheck %s --check-prefix=YMM < %t.256.json
+; RUN: %opt -primebort -primebort-vector-width=512 -primebort-serialize=%t.512.json \
+; RUN:   -disable-output %s
+; RUN: FileCheck %s --check-prefix=ZMM < %t.512.json
+
+; UNKNOWN-LABEL: PrimeBort instructions without a latency model (costed 1 cycle)
+; UNKNOWN-DAG: 1 x unrecognized binary op: frem, e.g. in other:
+; UNKNOWN-DAG: 1 x unrecognized instruction: freeze, e.g. in other:
+
+; two ymm divides, or one zmm divide on a core that slows down for it
+; YMM: "ancestor": "wide"
+; YMM: "flags": 0,
+; YMM: "txLat": 35,
+; ZMM: "ancestor": "wide"
+; ZMM: "flags": 256,
+; ZMM: "txLat": 29,
+
+; an xmm divide costs the same on any target
+; YMM: "ancestor": "narrow"
+; YMM: "txLat": 22,
+; ZMM: "ancestor": "narrow"
+; ZMM: "flags": 0,
+; ZMM: "txLat": 22,
+
+%struct.m = type { [40 x i8] }
+@m = global %struct.m zeroinitializer
+@n = global %struct.m zeroinitializer
+@o = global %struct.m zeroinitializer
+@a = global <16 x float> zeroinitializer
+@x = global <4 x float> zeroinitializer
+@i = global i32 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+define void @wide() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @m)
+  %v = load <16 x float>, <16 x float>* @a
+  %d = fdiv <16 x float> %v, %v
+  store <16 x float> %d, <16 x float>* @a
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @m)
+  ret void
+}
+
+define void @narrow() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @n)
+  %v = load <4 x float>, <4 x float>* @x
+  %d = fdiv <4 x float> %v, %v
+  store <4 x float> %d, <4 x float>* @x
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @n)
+  ret void
+}
+
+define void @other() {
+  %r = call i32 @pthread_mutex_lock(%struct.m* @o)
+  %v = load i32, i32* @i
+  %f = freeze i32 %v
+  store i32 %f, i32* @i
+  %fr = frem float 1.0, 2.0
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @o)
+  ret void
+}
@@ -0,0 +1,49 @@
+; -primebort-witness prints the blocks behind each tx's longest txLat and shortest rtLat:
+; the loop is one step with its trip count, and the costliest calls are summed up.
+; RUN: %opt -primebort -primebort-witness -disable-output %s 2>&1 | FileCheck %s
+
+; CHECK-LABEL: PrimeBort witness paths
+; CHECK-NEXT: =====
+; CHECK-NEXT: tx 0: f
+; CHECK-NEXT: txLat 3308 to f
+; CHECK-NEXT: lat trips block costliest call
+; CHECK-NEXT: 5 - f %entry
+; CHECK-NEXT: 3300 100 f %loop step 26 @ f
+; CHECK-NEXT: 3 - f %done
+; CHECK-NEXT: step 2600 @ f (78%)
+; CHECK-NEXT: rtLat 5 from f
+; CHECK-NEXT: lat trips block costliest call
+; CHECK-NEXT: 5 - f %done
+; CHECK-NEXT: =====
+
+%struct.m = type { [40 x i8] }
+@mtx = global %struct.m zeroinitializer
+@g = global i64 0
+declare i32 @pthread_mutex_lock(%struct.m*)
+declare i32 @pthread_mutex_unlock(%struct.m*)
+
+define void @step(i64 %x) {
+  %v = load i64, i64* @g
+  %m = mul i64 %v, %x
+  %d = udiv i64 %m, 7
+  store i64 %d, i64* @g
+  ret void
+}
+
+define void @f(i1 %c) {
+entry:
+  %r = call i32 @pthread_mutex_lock(%struct.m* @mtx)
+  br i1 %c, label %loop, label %short
+loop:
+  %i = phi i64 [0, %entry], [%n, %loop]
+  call void @step(i64 %i)
+  %n = add i64 %i, 1
+  %e = icmp eq i64 %n, 100
+  br i1 %e, label %done, label %loop
+short:
+  store i64 1, i64* @g
+  br label %done
+done:
+  %u = call i32 @pthread_mutex_unlock(%struct.m* @mtx)
+  ret void
+}
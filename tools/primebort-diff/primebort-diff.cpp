@@ -0,0 +1,305 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+/*
+ * Compares the -primebort-serialize results of two builds, as a gate against
+ * commits that make critical sections longer. Each side is a results file, or a
+ * directory of them (one per module). Txs are matched by module, ancestor, entry
+ * location and entry chain, and their exits by location and exit chain; txs and
+ * exits left over are matched again without line and column numbers, in order,
+ * when both sides have the same number of them, which follows code that only moved.
+ * Every matched exit with a changed txLat or rtLat, or whose tx changed its footprint,
+ * is listed with the deltas, largest relative txLat growth first.
+ * Exits 1 if a txLat grew by more than -threshold percent (and at least -min-delta
+ * cycles) or a footprint by more than -threshold percent (and at least a cache line),
+ * or with -fail-on-new if there are new txs; 2 if the input can't be read.
+ */
+
+using namespace llvm;
+
+static cl::opt<std::string> OldPath(cl::Positional, cl::desc("<old results>"), cl::Required);
+static cl::opt<std::string> NewPath(cl::Positional, cl::desc("<new results>"), cl::Required);
+static cl::opt<unsigned> Threshold("threshold",
+		cl::desc("Fail if a txLat or footprint grows by more than this percentage"),
+		cl::init(10));
+static cl::opt<unsigned> MinDelta("min-delta",
+		cl::desc("Never fail on txLat growth of fewer cycles than this"),
+		cl::init(100));
+static cl::opt<bool> FailOnNew("fail-on-new",
+		cl::desc("Fail if the new build has txs the old one doesn't"), cl::init(false));
+static cl::opt<bool> ShowAll("all", cl::desc("List unchanged exits too"), cl::init(false));
+
+// footprint growth smaller than this never fails
+#define MIN_FOOTPRINT_DELTA 64
+
+namespace {
+
+struct ExitRec {
+	std::string key; // location and chain
+	std::string looseKey; // the same without line and column
+	std::string name; // for the report
+	int64_t txLat;
+	int64_t rtLat;
+	int match = -1; // index of the exit on the other side
+};
+
+struct TxRec {
+	std::string key; // module, ancestor, entry location and chain
+	std::string looseKey;
+	std::string name; // for the report
+	int64_t footprint; // bytes read and written
+	SmallVector<ExitRec, 2> exits;
+	int match = -1;
+};
+
+struct Results {
+	std::vector<TxRec> txs;
+	StringMap<unsigned> byKey;
+};
+
+// "file:line:col" without the line and column
+StringRef stripLine(StringRef loc) {
+	return loc.rsplit(':').first.rsplit(':').first;
+}
+
+std::string joinChain(const json::Array* A) {
+	std::string chain;
+	if (!A) return chain;
+	for (const json::Value& V : *A) {
+		if (!chain.empty()) chain += '>';
+		if (Optional<StringRef> S = V.getAsString()) chain += S->str();
+	}
+	return chain;
+}
+
+bool readFile(StringRef path, Results& R) {
+	ErrorOr<std::unique_ptr<MemoryBuffer> > buf = MemoryBuffer::getFile(path);
+	if (!buf) {
+		errs() << path << ": " << buf.getError().message() << "\n";
+		return false;
+	}
+	Expected<json::Value> V = json::parse((*buf)->getBuffer());
+	if (!V) {
+		errs() << path << ": " << toString(V.takeError()) << "\n";
+		return false;
+	}
+	const json::Object* top = V->getAsObject();
+	const json::Array* txs = (top) ? top->getArray("txs") : NULL;
+	if (!txs || top->getInteger("version").getValueOr(0) != 1) {
+		errs() << path << ": not PrimeBort results (version 1)\n";
+		return false;
+	}
+	const std::string module = top->getString("module").getValueOr("").str();
+
+	for (const json::Value& TV : *txs) {
+		const json::Object* T = TV.getAsObject();
+		if (!T) continue;
+		TxRec tx;
+		const StringRef ancestor = T->getString("ancestor").getValueOr("");
+		const StringRef entry = T->getString("entry").getValueOr("");
+		const std::string chain = joinChain(T->getArray("entryChain"));
+		tx.key = module + "|" + ancestor.str() + "|" + entry.str() + "|" + chain;
+		tx.looseKey = module + "|" + ancestor.str() + "|" + stripLine(entry).str() + "|" + chain;
+		tx.name = ancestor.str() + " @ " + ((entry.empty()) ? module : entry.str());
+		// the pass clamps each to the int64 range, and so does their sum
+		auto bytes = [T](StringRef key) {
+			return std::max<int64_t>(0, T->getInteger(key).getValueOr(0));
+		};
+		const int64_t readBytes = bytes("readBytes"), writeBytes = bytes("writeBytes");
+		tx.footprint = (readBytes > std::numeric_limits<int64_t>::max() - writeBytes) ?
+			std::numeric_limits<int64_t>::max() : readBytes + writeBytes;
+		if (const json::Array* exits = T->getArray("exits")) {
+			for (const json::Value& EV : *exits) {
+				const json::Object* E = EV.getAsObject();
+				if (!E) continue;
+				ExitRec exit;
+				const StringRef loc = E->getString("loc").getValueOr("");
+				const std::string echain = joinChain(E->getArray("chain"));
+				exit.key = loc.str() + "|" + echain;
+				exit.looseKey = stripLine(loc).str() + "|" + echain;
+				exit.name = (loc.empty()) ? echain : loc.str();
+				exit.txLat = E->getInteger("txLat").getValueOr(0);
+				exit.rtLat = E->getInteger("rtLat").getValueOr(0);
+				tx.exits.push_back(std::move(exit));
+			}
+		}
+
+		// txs the keys can't tell apart are matched in the order they were found
+		for (unsigned n = 1; R.byKey.count(tx.key); ++n) tx.key += "#" + std::to_string(n);
+		R.byKey[tx.key] = R.txs.size();
+		R.txs.push_back(std::move(tx));
+	}
+	return true;
+}
+
+bool readResults(StringRef path, Results& R) {
+	if (!sys::fs::is_directory(path)) return readFile(path, R);
+	std::error_code EC;
+	std::vector<std::string> files;
+	for (sys::fs::directory_iterator it(path, EC), end; it != end && !EC; it.increment(EC)) {
+		if (sys::path::extension(it->path()) == ".json") files.push_back(it->path());
+	}
+	if (EC) {
+		errs() << path << ": " << EC.message() << "\n";
+		return false;
+	}
+	// the same order on every run
+	std::sort(files.begin(), files.end());
+	for (const std::string& F : files) {
+		if (!readFile(F, R)) return false;
+	}
+	return true;
+}
+
+// pairs up what the exact keys left unmatched by their loose keys, where both sides
+// have the same number of them
+template <typename ListT>
+void matchLoose(ListT& A, ListT& B) {
+	StringMap<std::pair<SmallVector<unsigned, 1>, SmallVector<unsigned, 1> > > groups;
+	for (unsigned i = 0; i < A.size(); ++i)
+		if (A[i].match < 0) groups[A[i].looseKey].first.push_back(i);
+	for (unsigned i = 0; i < B.size(); ++i)
+		if (B[i].match < 0) groups[B[i].looseKey].second.push_back(i);
+	for (auto& G : groups) {
+		auto& sides = G.second;
+		if (sides.first.size() != sides.second.size()) continue;
+		for (unsigned n = 0; n < sides.first.size(); ++n) {
+			A[sides.first[n]].match = sides.second[n];
+			B[sides.second[n]].match = sides.first[n];
+		}
+	}
+}
+
+void printDelta(raw_ostream& OS, const int64_t before, const int64_t after) {
+	OS << after << '\t';
+	const int64_t d = after - before;
+	if (d > 0) OS << '+';
+	OS << d;
+	if (d && before) OS << " (" << ((d > 0) ? "+" : "") << (int64_t) (d * 100.0 / before) << "%)";
+	OS << '\t';
+}
+
+// growth by more than the threshold percentage and at least min
+bool overThreshold(const int64_t before, const int64_t after, const int64_t min) {
+	const int64_t d = after - before;
+	if (d < min || d <= 0) return false;
+	return !before || d * 100.0 > before * (double) Threshold;
+}
+
+struct Row {
+	const TxRec* oldTx;
+	const TxRec* newTx;
+	const ExitRec* oldExit;
+	const ExitRec* newExit;
+	double growth; // relative txLat change, for sorting
+	bool over;
+};
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	InitLLVM X(argc, argv);
+	cl::ParseCommandLineOptions(argc, argv, "PrimeBort latency diff\n");
+
+	Results oldR, newR;
+	if (!readResults(OldPath, oldR) || !readResults(NewPath, newR)) return 2;
+
+	// txs by their exact keys, then by their loose ones
+	for (unsigned i = 0; i < newR.txs.size(); ++i) {
+		auto it = oldR.byKey.find(newR.txs[i].key);
+		if (it == oldR.byKey.end()) continue;
+		newR.txs[i].match = it->second;
+		oldR.txs[it->second].match = i;
+	}
+	matchLoose(oldR.txs, newR.txs);
+
+	std::vector<Row> rows;
+	// txLat breaches count per exit, footprint ones per tx
+	unsigned over = 0, footprintsOver = 0, newTxs = 0, newExits = 0, goneExits = 0;
+	for (TxRec& NT : newR.txs) {
+		if (NT.match < 0) {
+			++newTxs;
+			continue;
+		}
+		TxRec& OT = oldR.txs[NT.match];
+		SmallVector<ExitRec, 2>& oldExits = OT.exits;
+		for (unsigned i = 0; i < NT.exits.size(); ++i) {
+			for (unsigned j = 0; j < oldExits.size(); ++j) {
+				if (oldExits[j].match < 0 && oldExits[j].key == NT.exits[i].key) {
+					NT.exits[i].match = j;
+					oldExits[j].match = i;
+					break;
+				}
+			}
+		}
+		matchLoose(oldExits, NT.exits);
+
+		const bool footOver = overThreshold(OT.footprint, NT.footprint, MIN_FOOTPRINT_DELTA);
+		if (footOver) ++footprintsOver;
+		for (const ExitRec& NE : NT.exits) {
+			if (NE.match < 0) {
+				++newExits;
+				continue;
+			}
+			const ExitRec& OE = oldExits[NE.match];
+			const bool changed = OE.txLat != NE.txLat || OE.rtLat != NE.rtLat ||
+				OT.footprint != NT.footprint;
+			if (!changed && !ShowAll) continue;
+			Row R = {&OT, &NT, &OE, &NE, 0, false};
+			R.growth = (OE.txLat) ? (double) (NE.txLat - OE.txLat) / OE.txLat :
+				(double) (NE.txLat > 0);
+			const bool latOver = overThreshold(OE.txLat, NE.txLat, MinDelta);
+			R.over = footOver || latOver;
+			if (latOver) ++over;
+			rows.push_back(R);
+		}
+		goneExits += count_if(oldExits, [](const ExitRec& E) {return E.match < 0;});
+	}
+	const unsigned goneTxs = count_if(oldR.txs, [](const TxRec& T) {return T.match < 0;});
+
+	std::stable_sort(rows.begin(), rows.end(),
+		[](const Row& A, const Row& B) {return A.growth > B.growth;});
+
+	raw_ostream& OS = outs();
+	OS << "PrimeBort latency diff: " << newR.txs.size() - newTxs << " txs matched, " <<
+		newTxs << " new, " << goneTxs << " removed; " << newExits << " new exits, " <<
+		goneExits << " removed\n=====\n";
+	OS << "txLat\tdelta\trtLat\tdelta\tfootprint\tdelta\ttx -> exit\n";
+	for (const Row& R : rows) {
+		OS << ((R.over) ? "! " : "  ");
+		printDelta(OS, R.oldExit->txLat, R.newExit->txLat);
+		printDelta(OS, R.oldExit->rtLat, R.newExit->rtLat);
+		printDelta(OS, R.oldTx->footprint, R.newTx->footprint);
+		OS << R.newTx->name << " -> " << R.newExit->name << '\n';
+	}
+	if (newTxs) {
+		OS << "New txs:\n";
+		for (const TxRec& T : newR.txs) {
+			if (T.match >= 0) continue;
+			int64_t txLat = 0;
+			for (const ExitRec& E : T.exits) txLat = std::max(txLat, E.txLat);
+			OS << "  txLat " << txLat << '\t' << T.name << '\n';
+		}
+	}
+	if (goneTxs) {
+		OS << "Removed txs:\n";
+		for (const TxRec& T : oldR.txs)
+			if (T.match < 0) OS << "  " << T.name << '\n';
+	}
+	OS << "=====\n" << over << " exits and " << footprintsOver << " tx footprints over the "
+		"threshold (" << Threshold << "%)\n";
+
+	return (over || footprintsOver || (FailOnNew && newTxs)) ? 1 : 0;
+}
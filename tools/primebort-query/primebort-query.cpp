@@ -0,0 +1,256 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortIndex.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Answers questions over the -primebort-index files of many modules, mapped rather than
+ * parsed, so that whole builds are searched in about the time it takes to page them in:
+ *   primebort-query -min-txlat=1000 -funcs build/     functions run inside long txs
+ *   primebort-query -calls=malloc -locks build/       locks held around malloc
+ * Each input is an index file, or a directory searched for *.pbidx. Txs are selected by
+ * all the given filters; by default they are listed, with -funcs the functions called
+ * inside them, with -locks their locks. Exits 2 if an input can't be read.
+ */
+
+using namespace llvm;
+
+static cl::list<std::string> Inputs(cl::Positional, cl::desc("<index files or directories>"),
+		cl::OneOrMore);
+static cl::opt<uint64_t> MinTxLat("min-txlat",
+		cl::desc("Only txs whose longest txLat is at least this many cycles"), cl::init(0));
+static cl::opt<std::string> Calls("calls",
+		cl::desc("Only txs that call this function, directly or not"), cl::init(""));
+static cl::opt<std::string> Lock("lock",
+		cl::desc("Only txs whose lock description contains this"), cl::init(""));
+static cl::opt<std::string> Ancestor("ancestor",
+		cl::desc("Only txs that begin and end in this function"), cl::init(""));
+static cl::opt<bool> ListFuncs("funcs",
+		cl::desc("List the functions run inside the selected txs"), cl::init(false));
+static cl::opt<bool> ListLocks("locks",
+		cl::desc("List the locks of the selected txs"), cl::init(false));
+
+namespace {
+
+// RegionFlags, see PrimeBortDetector.h
+const char* const flagNames[] = {"io", "syscall", "alloc", "indirect", "asm", "lock",
+	"extern", "blocking", "zmm"};
+
+std::string describeFlags(const uint32_t flags) {
+	std::string S;
+	for (unsigned b = 0; b < sizeof(flagNames) / sizeof(flagNames[0]); ++b) {
+		if (!(flags & (1u << b))) continue;
+		if (!S.empty()) S += ',';
+		S += flagNames[b];
+	}
+	return (S.empty()) ? "-" : S;
+}
+
+// one mapped index, checked once so the records can be read in place
+class Index {
+	std::unique_ptr<sys::fs::mapped_file_region> region;
+	const char* base = nullptr;
+
+	template <typename T>
+	const T* at(const uint64_t offset) const {return reinterpret_cast<const T*>(base + offset);}
+
+	public:
+	std::string path;
+	const PBIndexHeader* H = nullptr;
+
+	bool open(StringRef file);
+
+	const PBIndexTx& tx(const uint32_t i) const {return at<PBIndexTx>(H->txOffset)[i];}
+	// sorted by name
+	const PBIndexFunc* funcs() const {return at<PBIndexFunc>(H->funcOffset);}
+	// a list out of the refs, empty if it runs past them
+	ArrayRef<uint32_t> refs(const uint32_t first, const uint32_t count) const {
+		if ((uint64_t) first + count > H->numRefs) return None;
+		return makeArrayRef(at<uint32_t>(H->refOffset) + first, count);
+	}
+	StringRef str(const uint32_t offset) const {
+		if (offset >= H->stringsSize) return "?";
+		return StringRef(at<char>(H->stringOffset) + offset);
+	}
+};
+
+bool Index::open(StringRef file) {
+	path = file.str();
+	auto fail = [&](const Twine& why) {
+		errs() << path << ": " << why << "\n";
+		return false;
+	};
+	sys::fs::file_t fd;
+	if (std::error_code EC = sys::fs::openFileForRead(file, fd)) return fail(EC.message());
+	sys::fs::file_status status;
+	std::error_code EC = sys::fs::status(fd, status);
+	const uint64_t size = status.getSize();
+	if (!EC && size < sizeof(PBIndexHeader)) {
+		sys::fs::closeFile(fd);
+		return fail("not a PrimeBort index");
+	}
+	if (!EC) {
+		region = std::make_unique<sys::fs::mapped_file_region>(fd,
+				sys::fs::mapped_file_region::readonly, size, 0, EC);
+	}
+	sys::fs::closeFile(fd);
+	if (EC) return fail(EC.message());
+	base = region->const_data();
+	H = at<PBIndexHeader>(0);
+
+	if (std::memcmp(H->magic, PBINDEX_MAGIC, sizeof(H->magic)))
+		return fail("not a PrimeBort index");
+	if (H->byteOrder != PBINDEX_BYTE_ORDER)
+		return fail("written on a host of the other byte order");
+	if (H->version != PBINDEX_VERSION)
+		return fail("index version " + Twine(H->version) + ", expected " + Twine(PBINDEX_VERSION));
+	// every section inside the file and aligned, the strings terminated
+	auto inside = [&](const uint64_t offset, const uint64_t count, const uint64_t recSize) {
+		return offset % 8 == 0 && offset <= size && count <= (size - offset) / recSize;
+	};
+	if (!inside(H->txOffset, H->numTxs, sizeof(PBIndexTx)) ||
+			!inside(H->exitOffset, H->numExits, sizeof(PBIndexExit)) ||
+			!inside(H->funcOffset, H->numFuncs, sizeof(PBIndexFunc)) ||
+			!inside(H->refOffset, H->numRefs, sizeof(uint32_t)) ||
+			!inside(H->stringOffset, H->stringsSize, 1) ||
+			(H->stringsSize && base[H->stringOffset + H->stringsSize - 1])) {
+		return fail("truncated or corrupt index");
+	}
+	for (uint32_t t = 0; t < H->numTxs; ++t) {
+		if ((uint64_t) tx(t).firstExit + tx(t).numExits > H->numExits)
+			return fail("truncated or corrupt index");
+	}
+	return true;
+}
+
+bool findIndexes(StringRef path, std::vector<std::string>& files) {
+	if (!sys::fs::is_directory(path)) {
+		files.push_back(path.str());
+		return true;
+	}
+	std::error_code EC;
+	for (sys::fs::recursive_directory_iterator it(path, EC), end; it != end && !EC;
+			it.increment(EC)) {
+		if (sys::path::extension(it->path()) == ".pbidx") files.push_back(it->path());
+	}
+	if (EC) {
+		errs() << path << ": " << EC.message() << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool selected(const Index& X, const PBIndexTx& T) {
+	if (T.txLat < MinTxLat) return false;
+	if (!Lock.empty() && !X.str(T.lock).contains(Lock)) return false;
+	if (!Ancestor.empty() && X.str(T.ancestor) != Ancestor) return false;
+	if (!Calls.empty()) {
+		ArrayRef<uint32_t> callees = X.refs(T.callees, T.numCallees);
+		if (none_of(callees, [&](const uint32_t s) {return X.str(s) == Calls;})) return false;
+	}
+	return true;
+}
+
+// a function or lock, over every selected tx it was seen with
+struct Summary {
+	unsigned txs = 0;
+	uint64_t txLat = 0; // longest of those txs
+	uint32_t flags = 0;
+	uint64_t minLat = 0, maxLat = 0; // functions only
+	bool hasBody = false;
+};
+
+void printSummaries(raw_ostream& OS, const StringMap<Summary>& M, const bool funcs) {
+	std::vector<const StringMap<Summary>::value_type*> sorted;
+	for (const auto& E : M) sorted.push_back(&E);
+	std::sort(sorted.begin(), sorted.end(), [](const StringMap<Summary>::value_type* A,
+			const StringMap<Summary>::value_type* B) {
+		if (A->second.txLat != B->second.txLat) return A->second.txLat > B->second.txLat;
+		return A->first() < B->first();
+	});
+	OS << ((funcs) ? "txLat\ttxs\tlatency\tflags\tfunction\n" : "txLat\ttxs\tlock\n");
+	for (const auto* E : sorted) {
+		const Summary& S = E->second;
+		OS << S.txLat << '\t' << S.txs << '\t';
+		if (funcs) {
+			if (S.hasBody) OS << S.minLat << '-' << S.maxLat;
+			else OS << "extern";
+			OS << '\t' << describeFlags(S.flags) << '\t';
+		}
+		OS << E->first() << '\n';
+	}
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	InitLLVM X(argc, argv);
+	cl::ParseCommandLineOptions(argc, argv, "PrimeBort index query\n");
+
+	std::vector<std::string> files;
+	for (const std::string& I : Inputs) {
+		if (!findIndexes(I, files)) return 2;
+	}
+	// the same order on every run
+	std::sort(files.begin(), files.end());
+
+	raw_ostream& OS = outs();
+	StringMap<Summary> summaries;
+	unsigned numTxs = 0, numSelected = 0;
+	if (!ListFuncs && !ListLocks) OS << "txLat\trtLat\tbytes\tflags\tlock\ttx\n";
+	for (const std::string& F : files) {
+		Index X;
+		if (!X.open(F)) return 2;
+		for (uint32_t t = 0; t < X.H->numTxs; ++t) {
+			const PBIndexTx& T = X.tx(t);
+			++numTxs;
+			if (!selected(X, T)) continue;
+			++numSelected;
+
+			if (ListLocks) {
+				Summary& S = summaries[X.str(T.lock)];
+				++S.txs;
+				S.txLat = std::max(S.txLat, T.txLat);
+			} else if (ListFuncs) {
+				for (const uint32_t s : X.refs(T.callees, T.numCallees)) {
+					const StringRef name = X.str(s);
+					Summary& S = summaries[name];
+					++S.txs;
+					S.txLat = std::max(S.txLat, T.txLat);
+					// the function's own record, by name
+					const PBIndexFunc* begin = X.funcs();
+					const PBIndexFunc* end = begin + X.H->numFuncs;
+					const PBIndexFunc* R = std::lower_bound(begin, end, name,
+						[&](const PBIndexFunc& A, StringRef N) {return X.str(A.name) < N;});
+					if (R == end || X.str(R->name) != name) continue;
+					S.flags |= R->flags;
+					if (R->maxLat || R->minLat) {
+						S.minLat = (S.hasBody) ? std::min(S.minLat, R->minLat) : R->minLat;
+						S.maxLat = std::max(S.maxLat, R->maxLat);
+						S.hasBody = true;
+					}
+				}
+			} else {
+				OS << T.txLat << '\t' << T.rtLat << '\t' << T.readBytes + T.writeBytes << '\t' <<
+					describeFlags(T.flags) << '\t' << X.str(T.lock) << '\t' <<
+					X.str(T.ancestor) << " @ " <<
+					((T.entry < X.H->stringsSize && !X.str(T.entry).empty()) ?
+					 X.str(T.entry) : X.str(X.H->module)) << '\n';
+			}
+		}
+	}
+	if (ListFuncs || ListLocks) printSummaries(OS, summaries, ListFuncs);
+	OS << "=====\n" << numSelected << " of " << numTxs << " txs in " << files.size() <<
+		" indexes\n";
+	return 0;
+}
@@ -0,0 +1,636 @@
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/PrimeBortDetector/PrimeBortDetector.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Keeps a project's modules loaded and analysed, for editors and quick local
+ * iteration: the callee summaries, caller graph and txs of every module stay in memory,
+ * and a module that was compiled again only has what its changed functions affect
+ * recomputed (see Incremental.cpp). Requests come over a Unix socket (-socket), one per
+ * line, and every response ends with a line that is "ok" or starts with "error:":
+ *   load <bitcode>     analyse a module, replacing any loaded for the same source file
+ *   update <bitcode>   the same module compiled again: functions whose bodies changed
+ *                      are replaced in place and only they and their callers are redone
+ *   query <file>       the txs that begin or end in a source file, with their exits
+ *   unload <file>      forget the module of a source file, matched as by query
+ *   stats              the loaded modules
+ *   shutdown
+ * An update that changes the type of a function or global, or the initializer of a
+ * global other than a string literal or similar local constant, reloads the module
+ * instead; one that changes which functions have their address taken is analysed anew.
+ * A socket left behind by a server that died is replaced, but not one another server
+ * is listening on.
+ */
+
+using namespace llvm;
+
+static cl::opt<std::string> SocketPath("socket", cl::desc("Unix socket to listen on"),
+		cl::value_desc("path"), cl::Required);
+static cl::list<std::string> InitialModules(cl::Positional,
+		cl::desc("<bitcode to load at startup>"), cl::ZeroOrMore);
+
+namespace {
+
+// a loaded module, with the state its runs keep; each has a context of its own, which
+// its new builds are parsed into and which goes away with it
+struct Resident {
+	std::unique_ptr<LLVMContext> Ctx;
+	std::unique_ptr<Module> M;
+	// no pass manager runs here
+	PrimeBortFunctionAnalyses analyses;
+	PrimeBortDetectorPass P;
+
+	Resident(std::unique_ptr<LLVMContext> C, std::unique_ptr<Module> Mod) :
+			Ctx(std::move(C)), M(std::move(Mod)), analyses(*M) {
+		P.keepState = true;
+		analyses.attach(P);
+	}
+};
+
+/*
+ * A new build of a loaded module is parsed into its context, so equal constants
+ * and inline asm are the same objects, but its named struct types are new ones, renamed
+ * with a numeric suffix; they are mapped to the loaded module's types of the same name
+ * and layout, as the IR linker does. Its globals are mapped to the loaded module's by
+ * name, except local constants (string literals, ...), which are mapped by initializer,
+ * since their numbering follows the code.
+ */
+class TypeMapper : public ValueMapTypeRemapper {
+	// identified struct types of the loaded module, by name with and without a suffix
+	StringMap<SmallVector<StructType*, 1> > oldStructs;
+	DenseMap<Type*, Type*> map;
+
+	static StringRef stripSuffix(StringRef name) {
+		std::pair<StringRef, StringRef> parts = name.rsplit('.');
+		return (!parts.second.empty() && all_of(parts.second, isDigit)) ? parts.first : name;
+	}
+	Type* mapStruct(StructType* ST) {
+		SmallVector<StructType*, 2> candidates;
+		if (ST->hasName()) {
+			candidates.append(oldStructs.lookup(ST->getName()));
+			candidates.append(oldStructs.lookup(stripSuffix(ST->getName())));
+		}
+		for (StructType* C : candidates) {
+			if (C == ST) return ST;
+			if (C->isOpaque() != ST->isOpaque() || C->isPacked() != ST->isPacked() ||
+					C->getNumElements() != ST->getNumElements()) {
+				continue;
+			}
+			// provisionally, for types that contain themselves
+			map[ST] = C;
+			bool same = true;
+			for (unsigned i = 0; same && i < ST->getNumElements(); ++i)
+				same = remapType(ST->getElementType(i)) == C->getElementType(i);
+			if (same) return C;
+		}
+		// a type only the new build has; types belong to the context, not to a module
+		return ST;
+	}
+
+	public:
+	explicit TypeMapper(Module& Old) {
+		for (StructType* ST : Old.getIdentifiedStructTypes()) {
+			if (!ST->hasName()) continue;
+			oldStructs[ST->getName()].push_back(ST);
+			if (stripSuffix(ST->getName()) != ST->getName())
+				oldStructs[stripSuffix(ST->getName())].push_back(ST);
+		}
+	}
+	Type* remapType(Type* T) override {
+		auto m_it = map.find(T);
+		if (m_it != map.end()) return m_it->second;
+		Type* R = T;
+		if (StructType* ST = dyn_cast<StructType>(T)) {
+			if (!ST->isLiteral()) {
+				R = mapStruct(ST);
+			} else {
+				SmallVector<Type*, 8> elems;
+				for (Type* E : ST->elements()) elems.push_back(remapType(E));
+				R = StructType::get(T->getContext(), elems, ST->isPacked());
+			}
+		} else if (PointerType* PT = dyn_cast<PointerType>(T)) {
+			if (!PT->isOpaque())
+				R = PointerType::get(remapType(PT->getNonOpaquePointerElementType()),
+						PT->getAddressSpace());
+		} else if (ArrayType* AT = dyn_cast<ArrayType>(T)) {
+			R = ArrayType::get(remapType(AT->getElementType()), AT->getNumElements());
+		} else if (VectorType* VT = dyn_cast<VectorType>(T)) {
+			R = VectorType::get(remapType(VT->getElementType()), VT->getElementCount());
+		} else if (FunctionType* FT = dyn_cast<FunctionType>(T)) {
+			SmallVector<Type*, 8> params;
+			for (Type* P : FT->params()) params.push_back(remapType(P));
+			R = FunctionType::get(remapType(FT->getReturnType()), params, FT->isVarArg());
+		}
+		return map[T] = R;
+	}
+	// the types of byval, sret, ... attributes
+	AttributeList remapAttributes(LLVMContext& C, AttributeList Attrs) {
+		for (unsigned i = 0; i < Attrs.getNumAttrSets(); ++i) {
+			for (int kind = Attribute::FirstTypeAttr; kind <= Attribute::LastTypeAttr; ++kind) {
+				const Attribute::AttrKind K = (Attribute::AttrKind) kind;
+				if (!Attrs.hasAttributeAtIndex(i, K)) continue;
+				if (Type* T = Attrs.getAttributeAtIndex(i, K).getValueAsType())
+					Attrs = Attrs.replaceAttributeTypeAtIndex(C, i, K, remapType(T));
+			}
+		}
+		return Attrs;
+	}
+};
+
+// globals of the new build the moved code refers to and the loaded module doesn't have
+class GlobalMaterializer : public ValueMaterializer {
+	Module& Old;
+	Module& New;
+	TypeMapper& TM;
+
+	public:
+	// created variables whose initializers are still to be mapped
+	SmallVector<std::pair<GlobalVariable*, GlobalVariable*>, 4> pending;
+
+	GlobalMaterializer(Module& O, Module& N, TypeMapper& T) : Old(O), New(N), TM(T) {}
+	Value* materialize(Value* V) override {
+		GlobalValue* GV = dyn_cast<GlobalValue>(V);
+		if (!GV || GV->getParent() != &New) return nullptr;
+		if (Function* F = dyn_cast<Function>(GV)) {
+			Function* C = Function::Create(cast<FunctionType>(TM.remapType(F->getFunctionType())),
+					GlobalValue::ExternalLinkage, F->getAddressSpace(), F->getName(), &Old);
+			C->setCallingConv(F->getCallingConv());
+			C->setAttributes(TM.remapAttributes(F->getContext(), F->getAttributes()));
+			return C;
+		}
+		if (GlobalVariable* G = dyn_cast<GlobalVariable>(GV)) {
+			GlobalVariable* C = new GlobalVariable(Old, TM.remapType(G->getValueType()),
+					G->isConstant(), G->getLinkage(), nullptr, G->getName(), nullptr,
+					G->getThreadLocalMode(), G->getAddressSpace());
+			C->copyAttributesFrom(G);
+			if (G->hasInitializer()) pending.emplace_back(G, C);
+			return C;
+		}
+		return nullptr;
+	}
+};
+
+bool isLocalConstant(const GlobalVariable& GV) {
+	return GV.hasLocalLinkage() && GV.isConstant() && GV.hasInitializer();
+}
+
+const RemapFlags remapFlags = RF_IgnoreMissingLocals | RF_ReuseAndMutateDistinctMDs;
+
+// the new build's globals paired with the loaded module's, false if one changed its
+// type or initializer
+bool mapGlobals(Module& Old, Module& New, TypeMapper& TM,
+		SmallVectorImpl<std::pair<GlobalValue*, GlobalValue*> >& counterparts) {
+	ValueToValueMapTy VMap;
+	for (GlobalValue& GV : New.global_values()) {
+		GlobalVariable* V = dyn_cast<GlobalVariable>(&GV);
+		if (V && isLocalConstant(*V)) continue;
+		GlobalValue* OV = Old.getNamedValue(GV.getName());
+		if (!OV) continue;
+		if (OV->getValueID() != GV.getValueID() ||
+				OV->getValueType() != TM.remapType(GV.getValueType())) {
+			return false;
+		}
+		VMap[&GV] = OV;
+		counterparts.emplace_back(&GV, OV);
+	}
+	DenseMap<const Constant*, GlobalVariable*> oldConstants;
+	for (GlobalVariable& GV : Old.globals())
+		if (isLocalConstant(GV)) oldConstants.try_emplace(GV.getInitializer(), &GV);
+	for (GlobalVariable& GV : New.globals()) {
+		if (!GV.hasInitializer()) continue;
+		const Constant* init = cast<Constant>(MapValue(GV.getInitializer(), VMap, remapFlags, &TM));
+		if (isLocalConstant(GV)) {
+			GlobalVariable* OV = oldConstants.lookup(init);
+			if (OV && OV->getValueType() == init->getType()) counterparts.emplace_back(&GV, OV);
+			continue;
+		}
+		GlobalVariable* OV = cast_or_null<GlobalVariable>(VMap.lookup(&GV));
+		if (OV && (!OV->hasInitializer() || OV->getInitializer() != init)) return false;
+	}
+	for (GlobalAlias& GA : New.aliases()) {
+		GlobalAlias* OA = cast_or_null<GlobalAlias>(VMap.lookup(&GA));
+		if (OA && OA->getAliasee() != MapValue(GA.getAliasee(), VMap, remapFlags, &TM))
+			return false;
+	}
+	return true;
+}
+
+// the same code, at the same locations; debug intrinsics are left out
+bool sameBody(const Function& OF, const Function& NF, TypeMapper& TM, ValueToValueMapTy& VMap) {
+	if (OF.size() != NF.size() ||
+			OF.getAttributes() != TM.remapAttributes(OF.getContext(), NF.getAttributes()) ||
+			OF.hasPersonalityFn() != NF.hasPersonalityFn() ||
+			(OF.hasPersonalityFn() && OF.getPersonalityFn() !=
+				MapValue(NF.getPersonalityFn(), VMap, remapFlags, &TM))) {
+		return false;
+	}
+	for (unsigned i = 0; i < OF.arg_size(); ++i) VMap[NF.getArg(i)] = OF.getArg(i);
+	SmallVector<const Instruction*, 64> oldInsts, newInsts;
+	for (auto OB = OF.begin(), NB = NF.begin(); OB != OF.end(); ++OB, ++NB) {
+		VMap[&*NB] = const_cast<BasicBlock*>(&*OB);
+		for (const Instruction& I : *OB) if (!I.isDebugOrPseudoInst()) oldInsts.push_back(&I);
+		for (const Instruction& I : *NB) if (!I.isDebugOrPseudoInst()) newInsts.push_back(&I);
+	}
+	if (oldInsts.size() != newInsts.size()) return false;
+	for (unsigned i = 0; i < oldInsts.size(); ++i)
+		VMap[newInsts[i]] = const_cast<Instruction*>(oldInsts[i]);
+
+	for (unsigned i = 0; i < oldInsts.size(); ++i) {
+		const Instruction* OI = oldInsts[i];
+		const Instruction* NI = newInsts[i];
+		if (VMap.lookup(NI->getParent()) != OI->getParent() ||
+				PrimeBortDetectorPass::getLocKey(OI) != PrimeBortDetectorPass::getLocKey(NI))
+			return false;
+		// compared as it would be after moving it over
+		Instruction* C = NI->clone();
+		RemapInstruction(C, VMap, remapFlags, &TM);
+		const bool same = OI->isIdenticalTo(C);
+		C->deleteValue();
+		if (!same) return false;
+	}
+	return true;
+}
+
+class Server {
+	// by source file name
+	StringMap<std::unique_ptr<Resident> > modules;
+
+	std::unique_ptr<Module> parse(StringRef path, LLVMContext& Ctx, raw_ostream& OS) {
+		SMDiagnostic Err;
+		std::unique_ptr<Module> M = parseIRFile(path, Err, Ctx);
+		if (!M) {
+			OS << "error: ";
+			Err.print(path.str().c_str(), OS, false);
+		}
+		return M;
+	}
+	// the source file a module is for, which decides the context it is parsed into;
+	// bitcode is read lazily, so this is only its header
+	bool getSource(StringRef path, std::string& source, raw_ostream& OS) {
+		LLVMContext Ctx;
+		SMDiagnostic Err;
+		std::unique_ptr<Module> M = getLazyIRFileModule(path, Err, Ctx);
+		if (!M) {
+			OS << "error: ";
+			Err.print(path.str().c_str(), OS, false);
+			return false;
+		}
+		source = M->getSourceFileName();
+		return true;
+	}
+	void analyse(StringRef source, Resident& R, raw_ostream& OS) {
+		TimeRecord T = TimeRecord::getCurrentTime(true);
+		R.P.runImpl(*R.M, true);
+		T -= TimeRecord::getCurrentTime(false);
+		OS << source << ": " << R.P.getTxs().size() << " txs (" <<
+			(unsigned) (-T.getWallTime() * 1000) << " ms)\n";
+	}
+	bool replaceBodies(Resident& R, std::unique_ptr<Module> New, unsigned& numChanged);
+
+	public:
+	bool load(StringRef path, raw_ostream& OS);
+	bool update(StringRef path, raw_ostream& OS);
+	bool query(StringRef file, raw_ostream& OS);
+	bool unload(StringRef file, raw_ostream& OS);
+	void stats(raw_ostream& OS);
+};
+
+bool Server::load(StringRef path, raw_ostream& OS) {
+	std::unique_ptr<LLVMContext> Ctx = std::make_unique<LLVMContext>();
+	std::unique_ptr<Module> M = parse(path, *Ctx, OS);
+	if (!M) return false;
+	const std::string source = M->getSourceFileName();
+	std::unique_ptr<Resident>& R = modules[source];
+	R.reset();
+	R = std::make_unique<Resident>(std::move(Ctx), std::move(M));
+	analyse(source, *R, OS);
+	return true;
+}
+
+bool Server::update(StringRef path, raw_ostream& OS) {
+	std::string source;
+	if (!getSource(path, source, OS)) return false;
+	auto m_it = modules.find(source);
+	if (m_it == modules.end()) return load(path, OS);
+	Resident& R = *m_it->second;
+	std::unique_ptr<Module> New = parse(path, *R.Ctx, OS);
+	if (!New) return false;
+	unsigned numChanged = 0;
+	if (!replaceBodies(R, std::move(New), numChanged)) {
+		OS << source << ": reloaded\n";
+		return load(path, OS);
+	}
+	OS << source << ": " << numChanged << " functions changed\n";
+	analyse(source, R, OS);
+	return true;
+}
+
+// moves the bodies that changed into the loaded module; false if the module has to be
+// reloaded instead, in which case it is left as it was
+bool Server::replaceBodies(Resident& R, std::unique_ptr<Module> New, unsigned& numChanged) {
+	Module& Old = *R.M;
+	TypeMapper TM(Old);
+	SmallVector<std::pair<GlobalValue*, GlobalValue*>, 32> counterparts;
+	if (!mapGlobals(Old, *New, TM, counterparts)) return false;
+	// for comparing, and for moving code over; comparing maps what it can't find to itself
+	ValueToValueMapTy cmpMap, VMap;
+	for (auto& C : counterparts) {
+		cmpMap[C.first] = C.second;
+		VMap[C.first] = C.second;
+	}
+
+	// old and new definitions of each function; a new null is a function that went away
+	SmallVector<std::pair<Function*, Function*>, 8> changed;
+	for (Function& NF : *New) {
+		Function* OF = cast_or_null<Function>(VMap.lookup(&NF));
+		if (NF.isDeclaration()) {
+			if (OF && !OF->isDeclaration()) changed.emplace_back(OF, nullptr);
+			continue;
+		}
+		if (!OF || OF->isDeclaration() || !sameBody(*OF, NF, TM, cmpMap))
+			changed.emplace_back(OF, &NF);
+	}
+	for (Function& OF : Old) {
+		if (!OF.isDeclaration() && !New->getFunction(OF.getName()))
+			changed.emplace_back(&OF, nullptr);
+	}
+	numChanged = changed.size();
+	if (changed.empty()) return true;
+
+	// which functions have their address taken decides the targets of indirect calls,
+	// which every summary may depend on
+	auto addressTaken = [](Module& M) {
+		std::vector<std::string> names;
+		for (Function& F : M)
+			if (!F.isDeclaration() && F.hasAddressTaken()) names.push_back(F.getName().str());
+		std::sort(names.begin(), names.end());
+		return names;
+	};
+	const std::vector<std::string> takenBefore = addressTaken(Old);
+
+	SmallPtrSet<Function*, 8> stale;
+	for (auto& C : changed) if (C.first) stale.insert(C.first);
+	R.P.invalidate(stale);
+	for (Function* F : stale) R.analyses.forget(F);
+
+	// functions only in the new build get a definition to move their body into, before
+	// anything refers to them
+	for (auto& C : changed) {
+		Function* NF = C.second;
+		if (C.first) continue;
+		C.first = Function::Create(cast<FunctionType>(TM.remapType(NF->getFunctionType())),
+				NF->getLinkage(), NF->getAddressSpace(), NF->getName(), &Old);
+		C.first->setCallingConv(NF->getCallingConv());
+		VMap[NF] = C.first;
+	}
+
+	// the old bodies go and the new ones are moved over, their operands and types
+	// mapped to the loaded module's
+	GlobalMaterializer materializer(Old, *New, TM);
+	for (auto& C : changed) {
+		Function* OF = C.first;
+		Function* NF = C.second;
+		OF->dropAllReferences();
+		if (!NF) {
+			OF->setLinkage(GlobalValue::ExternalLinkage);
+			continue;
+		}
+		for (unsigned i = 0; i < NF->arg_size(); ++i) VMap[NF->getArg(i)] = OF->getArg(i);
+		OF->getBasicBlockList().splice(OF->end(), NF->getBasicBlockList());
+		for (Instruction& I : instructions(OF))
+			RemapInstruction(&I, VMap, remapFlags, &TM, &materializer);
+		OF->setLinkage(NF->getLinkage());
+		OF->setAttributes(TM.remapAttributes(OF->getContext(), NF->getAttributes()));
+		if (NF->hasPersonalityFn()) {
+			OF->setPersonalityFn(cast<Constant>(MapValue(NF->getPersonalityFn(), VMap, remapFlags,
+						&TM, &materializer)));
+		}
+		OF->copyMetadata(NF, 0);
+	}
+	// variables the moved code brought with it, whose initializers may bring more
+	while (!materializer.pending.empty()) {
+		std::pair<GlobalVariable*, GlobalVariable*> P = materializer.pending.pop_back_val();
+		P.second->setInitializer(cast<Constant>(MapValue(P.first->getInitializer(), VMap,
+					remapFlags, &TM, &materializer)));
+	}
+
+	if (addressTaken(Old) != takenBefore) {
+		R.P.releaseMemory();
+		R.analyses.clear();
+	}
+	return true;
+}
+
+// the same file if the paths agree as far as the shorter one goes
+bool sameFile(StringRef path, StringRef file) {
+	if (path.empty()) return false;
+	auto endsWithPath = [](StringRef A, StringRef B) {
+		return A == B || (A.endswith(B) && A[A.size() - B.size() - 1] == '/');
+	};
+	return endsWithPath(path, file) || endsWithPath(file, path);
+}
+
+// of "file:line:col"
+StringRef getLocFile(StringRef loc) {return loc.rsplit(':').first.rsplit(':').first;}
+
+bool Server::query(StringRef file, raw_ostream& OS) {
+	OS << "tx\tentry\tancestor\tlock\ttxLat\trtLat\tflags\n";
+	for (auto& E : modules) {
+		Resident& R = *E.second;
+		const auto& txs = R.P.getTxs();
+		for (unsigned t = 0; t < txs.size(); ++t) {
+			const PrimeBortDetectorPass::TxInfo& info = txs[t];
+			const std::string entry = PrimeBortDetectorPass::getLocKey(info.entry);
+			// without debug info, by the module's source file
+			bool in = sameFile((entry.empty()) ? E.first() : getLocFile(entry), file);
+			for (const Instruction* exit : info.exits)
+				in = in || sameFile(getLocFile(PrimeBortDetectorPass::getLocKey(exit)), file);
+			if (!in) continue;
+			OS << t << '\t' << ((entry.empty()) ? E.first() : entry) << '\t' <<
+				info.ancestor->getName() << '\t' << R.P.describeLock(info) << '\t' <<
+				PrimeBortDetectorPass::maxTxLat(info) << '\t' <<
+				PrimeBortDetectorPass::minRtLat(info) << '\t' << info.props.flags << '\n';
+			for (unsigned i = 0; i < info.exits.size(); ++i) {
+				OS << "\texit\t" << PrimeBortDetectorPass::getLocKey(info.exits[i]) << '\t' <<
+					info.txLat[i] << '\t' << info.rtLat[i] << '\n';
+			}
+		}
+	}
+	return true;
+}
+
+// matched like a query's file, but only one module may match
+bool Server::unload(StringRef file, raw_ostream& OS) {
+	SmallVector<StringRef, 2> matches;
+	for (auto& E : modules)
+		if (sameFile(E.first(), file)) matches.push_back(E.first());
+	if (matches.empty()) {
+		OS << "error: " << file << " is not loaded\n";
+		return false;
+	}
+	if (matches.size() > 1) {
+		OS << "error: " << file << " is ambiguous:";
+		for (StringRef M : matches) OS << ' ' << M;
+		OS << '\n';
+		return false;
+	}
+	modules.erase(matches.front());
+	return true;
+}
+
+void Server::stats(raw_ostream& OS) {
+	for (auto& E : modules) {
+		unsigned funcs = 0;
+		for (Function& F : *E.second->M) funcs += !F.isDeclaration();
+		OS << E.first() << ": " << funcs << " functions, " << E.second->P.getTxs().size() <<
+			" txs\n";
+	}
+}
+
+// a line from the client; false to shut down
+bool handle(Server& Srv, StringRef line, raw_ostream& OS) {
+	std::pair<StringRef, StringRef> cmd = line.trim().split(' ');
+	const StringRef arg = cmd.second.trim();
+	bool ok = true;
+	if (cmd.first == "load" && !arg.empty()) ok = Srv.load(arg, OS);
+	else if (cmd.first == "update" && !arg.empty()) ok = Srv.update(arg, OS);
+	else if (cmd.first == "query" && !arg.empty()) ok = Srv.query(arg, OS);
+	else if (cmd.first == "unload" && !arg.empty()) ok = Srv.unload(arg, OS);
+	else if (cmd.first == "stats") Srv.stats(OS);
+	else if (cmd.first == "shutdown") {
+		OS << "ok\n";
+		return false;
+	} else {
+		OS << "error: unknown request: " << line << '\n';
+		ok = false;
+	}
+	if (ok) OS << "ok\n";
+	return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	InitLLVM X(argc, argv);
+	InitializeAllTargetInfos();
+	InitializeAllTargetMCs();
+	InitializeAllAsmParsers();
+	cl::ParseCommandLineOptions(argc, argv, "PrimeBort analysis server\n");
+
+	Server Srv;
+	for (const std::string& path : InitialModules) {
+		if (!Srv.load(path, errs())) return 1;
+	}
+
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (SocketPath.size() >= sizeof(addr.sun_path)) {
+		errs() << SocketPath << ": socket path too long\n";
+		return 1;
+	}
+	std::strcpy(addr.sun_path, SocketPath.c_str());
+	// a socket left by a server that didn't shut down is removed; one still listening
+	// answers, and anything that isn't a socket isn't ours to remove
+	struct stat st;
+	if (lstat(SocketPath.c_str(), &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			errs() << SocketPath << ": exists and is not a socket\n";
+			return 1;
+		}
+		const int probeFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		const bool live = probeFd >= 0 &&
+			connect(probeFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+		const int err = errno;
+		if (probeFd >= 0) close(probeFd);
+		if (live) {
+			errs() << SocketPath << ": another server is listening\n";
+			return 1;
+		}
+		if (err != ECONNREFUSED) {
+			errs() << SocketPath << ": " << std::strerror(err) << "\n";
+			return 1;
+		}
+		// sys::fs::remove won't remove sockets
+		if (unlink(SocketPath.c_str()) != 0) {
+			errs() << SocketPath << ": " << std::strerror(errno) << "\n";
+			return 1;
+		}
+	}
+	const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	// only the user can connect
+	const mode_t oldMask = umask(0077);
+	const bool bound = listenFd >= 0 &&
+		bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+	umask(oldMask);
+	if (!bound || listen(listenFd, 8) != 0) {
+		errs() << SocketPath << ": " << std::strerror(errno) << "\n";
+		return 1;
+	}
+	// a client going away mid-response isn't fatal
+	signal(SIGPIPE, SIG_IGN);
+
+	// one client at a time, requests in order
+	bool running = true;
+	int status = 0;
+	while (running) {
+		const int fd = accept(listenFd, NULL, NULL);
+		if (fd < 0) {
+			const int err = errno;
+			if (err == EINTR || err == ECONNABORTED) continue;
+			errs() << SocketPath << ": " << std::strerror(err) << "\n";
+			// out of descriptors or memory for now: give the clients time to go away
+			if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+				sleep(1);
+				continue;
+			}
+			status = 1;
+			break;
+		}
+		raw_fd_ostream OS(fd, false);
+		std::string buf;
+		char chunk[4096];
+		ssize_t n;
+		while (running && (n = read(fd, chunk, sizeof(chunk))) > 0) {
+			buf.append(chunk, n);
+			size_t eol;
+			while (running && (eol = buf.find('\n')) != std::string::npos) {
+				const std::string line = buf.substr(0, eol);
+				buf.erase(0, eol + 1);
+				if (StringRef(line).trim().empty()) continue;
+				running = handle(Srv, line, OS);
+				OS.flush();
+			}
+		}
+		OS.clear_error();
+		close(fd);
+	}
+	close(listenFd);
+	unlink(SocketPath.c_str());
+	return status;
+}